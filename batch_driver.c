@@ -0,0 +1,562 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/*
+ * Batch driver - generates or validates codes for many users at once,
+ * reading requests from a file or stdin and writing one result per
+ * request to stdout. Usage:
+ *
+ *   libotpbatch [-b] [-a sha1|sha256|sha512] [-d digits] [-p period]
+ *               [-w windows] [file]
+ *
+ * Text requests are one per line, the secret in Base32:
+ *
+ *   hotp|totp <secret> <counter or unix time> [code]
+ *
+ * With a code the line is validated over the window and answered "ok" or
+ * "fail", without one the code is printed. Malformed lines get "error".
+ *
+ * With -b requests are batch_record structures and results are native
+ * endian uint32_t: the code, an OTP_VALIDATE_RESULT, or UINT32_MAX for a
+ * malformed record. Input ending part way through a record gets a
+ * UINT32_MAX for it and a failed exit.
+ *
+ * Input is read and output written on their own threads, each through a
+ * pair of buffers, while the main thread hashes whole chunks through
+ * hotp_many().
+ */
+
+#include "libotp.h"
+#include "otp_uri.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_RECORDS 8192
+#define BUFFER_BYTES (BUFFER_RECORDS * sizeof(batch_record))
+#define MAX_LINE 512
+#define MAX_WINDOWS 64
+#define MAX_SECRET_BYTES 64
+#define BATCH_ERROR UINT32_MAX
+
+/* "error\n" or a ten digit code for a two byte line, plus a carried line */
+#define OUTPUT_BYTES ((BUFFER_BYTES / 2 + 2) * 11)
+
+typedef enum BATCH_FLAG {
+  BATCH_TOTP = 1, BATCH_VALIDATE = 2
+} BATCH_FLAG;
+
+/* the binary request, 80 bytes */
+typedef struct batch_record {
+  uint64_t value;
+  uint32_t guess;
+  uint8_t flags;
+  uint8_t digits;
+  uint8_t secretLength;
+  uint8_t reserved;
+  uint8_t secret[MAX_SECRET_BYTES];
+} batch_record;
+
+/* a request once parsed, whichever format it came in */
+typedef struct batch_job {
+  otp_key key;
+  uint64_t counter;
+  uint32_t guess;
+  unsigned int digits;
+  unsigned int slots;
+  int flags;
+  int valid;
+} batch_job;
+
+/* two buffers passed back and forth between a producer and a consumer */
+typedef struct batch_pipe {
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  char *data[2];
+  size_t length[2];
+  int full[2];
+  int last[2];
+  FILE *file;
+  int failed;
+} batch_pipe;
+
+typedef struct batch_options {
+  int binary;
+  OTP_ALGORITHM algorithm;
+  unsigned int digits;
+  unsigned int period;
+  unsigned int windows;
+} batch_options;
+
+static batch_options options = { 0, OTP_SHA1, 6, 30, 1 };
+static batch_job jobs[BUFFER_RECORDS];
+static hotp_request requests[BUFFER_RECORDS];
+static uint32_t codes[BUFFER_RECORDS];
+static uint32_t results[BUFFER_RECORDS];
+
+static int pipe_init(batch_pipe *pipe, size_t bytes, FILE *file) {
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->changed, NULL);
+  pipe->data[0] = malloc(bytes);
+  pipe->data[1] = malloc(bytes);
+  pipe->full[0] = pipe->full[1] = 0;
+  pipe->last[0] = pipe->last[1] = 0;
+  pipe->file = file;
+  pipe->failed = 0;
+
+  return pipe->data[0] && pipe->data[1] ? 0 : -1;
+}
+
+static void pipe_destroy(batch_pipe *pipe) {
+  free(pipe->data[0]);
+  free(pipe->data[1]);
+  pthread_cond_destroy(&pipe->changed);
+  pthread_mutex_destroy(&pipe->lock);
+}
+
+/* block until buffer index is in the wanted state */
+static void pipe_wait(batch_pipe *pipe, int index, int full) {
+  pthread_mutex_lock(&pipe->lock);
+  while (pipe->full[index] != full) {
+    pthread_cond_wait(&pipe->changed, &pipe->lock);
+  }
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+static void pipe_set(batch_pipe *pipe, int index, int full) {
+  pthread_mutex_lock(&pipe->lock);
+  pipe->full[index] = full;
+  pthread_cond_broadcast(&pipe->changed);
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+/* fill buffers until end of file. buffers are only short at the end, so
+ * binary records never straddle two of them */
+static void *read_input(void *arg) {
+  batch_pipe *pipe = arg;
+  size_t got;
+  int index = 0;
+
+  do {
+    pipe_wait(pipe, index, 0);
+    pipe->length[index] = 0;
+    while (pipe->length[index] < BUFFER_BYTES
+           && (got = fread(pipe->data[index] + pipe->length[index], 1,
+                           BUFFER_BYTES - pipe->length[index],
+                           pipe->file)) > 0) {
+      pipe->length[index] += got;
+    }
+    pipe->failed = ferror(pipe->file);
+    pipe->last[index] = pipe->length[index] < BUFFER_BYTES;
+    pipe_set(pipe, index, 1);
+    index ^= 1;
+  } while (!pipe->last[index ^ 1]);
+
+  return NULL;
+}
+
+static void *write_output(void *arg) {
+  batch_pipe *pipe = arg;
+  int index = 0;
+  int last;
+
+  do {
+    pipe_wait(pipe, index, 1);
+    if (!pipe->failed
+        && fwrite(pipe->data[index], 1, pipe->length[index], pipe->file)
+           != pipe->length[index]) {
+      pipe->failed = 1;
+    }
+    last = pipe->last[index];
+    pipe_set(pipe, index, 0);
+    index ^= 1;
+  } while (!last);
+
+  if (fflush(pipe->file) != 0) {
+    pipe->failed = 1;
+  }
+
+  return NULL;
+}
+
+static int parse_u64(const char *text, uint64_t *value) {
+  char *end;
+
+  if (*text < '0' || *text > '9') {
+    return -1;
+  }
+  errno = 0;
+  *value = strtoull(text, &end, 10);
+
+  return errno || *end ? -1 : 0;
+}
+
+/* prepare a job from its secret, counter or time and flags */
+static void job_init(batch_job *job, const uint8_t *secret,
+                     size_t secretLength, uint64_t value, int flags,
+                     unsigned int digits) {
+  job->flags = flags;
+  job->digits = digits ? digits : options.digits;
+  job->counter = flags & BATCH_TOTP ? value / options.period : value;
+  job->valid = secretLength > 0 && job->digits <= 10
+               && otp_key_init_algorithm(&job->key, options.algorithm,
+                                         secret, secretLength) == 0;
+}
+
+static void parse_line(batch_job *job, char *line) {
+  uint8_t secret[MAX_SECRET_BYTES];
+  size_t secretLength = sizeof(secret);
+  char *fields[5];
+  char *save;
+  uint64_t value;
+  uint64_t guess = 0;
+  int count = 0;
+  int flags = 0;
+
+  job->valid = 0;
+
+  /* one field past the most allowed, so that a line with too many has a
+   * count over 4 */
+  for (count = 0; count < 5; count++) {
+    fields[count] = strtok_r(count ? NULL : line, " \t\r", &save);
+    if (fields[count] == NULL) {
+      break;
+    }
+  }
+
+  if (count < 3 || count > 4 || parse_u64(fields[2], &value)
+      || (count == 4 && (parse_u64(fields[3], &guess) || guess > UINT32_MAX))) {
+    return;
+  }
+
+  if (strcmp(fields[0], "totp") == 0) {
+    flags |= BATCH_TOTP;
+  } else if (strcmp(fields[0], "hotp") != 0) {
+    return;
+  }
+  if (count == 4) {
+    flags |= BATCH_VALIDATE;
+    job->guess = (uint32_t)guess;
+  }
+
+  if (otp_base32_decode(secret, &secretLength, fields[1], strlen(fields[1]),
+                        OTP_BASE32) == 0) {
+    job_init(job, secret, secretLength, value, flags, 0);
+  }
+
+  memset(secret, 0, sizeof(secret));
+}
+
+static void parse_record(batch_job *job, const batch_record *record) {
+  job->valid = 0;
+  job->guess = record->guess;
+
+  if (record->secretLength <= MAX_SECRET_BYTES) {
+    job_init(job, record->secret, record->secretLength, record->value,
+             record->flags, record->digits);
+  }
+}
+
+/* hash every window slot of count jobs through hotp_many, chunk by chunk.
+ * results[i] is the code or OTP_VALIDATE_RESULT of job i */
+static void run_jobs(size_t count) {
+  int64_t lowest = -(int64_t)((options.windows - 1) / 2);
+  int64_t highest = options.windows / 2;
+  size_t queued = 0;
+  size_t first = 0;
+  size_t job;
+  size_t slot = 0;
+  unsigned int taken;
+  int64_t offset;
+
+  for (job = 0; job < count; job++) {
+    results[job] = jobs[job].valid ? OTP_VALIDATE_FAILURE : BATCH_ERROR;
+  }
+
+  for (job = 0; job <= count; job++) {
+    /* flush before a job's slots could overflow the request array */
+    if (job == count || queued + options.windows > BUFFER_RECORDS) {
+      hotp_many(requests, codes, queued);
+
+      for (slot = 0; first < job; first++) {
+        if (!jobs[first].valid) {
+          continue;
+        }
+        if (!(jobs[first].flags & BATCH_VALIDATE)) {
+          results[first] = otp_truncate_digits(codes[slot++],
+                                               jobs[first].digits);
+          continue;
+        }
+        for (taken = 0; taken < jobs[first].slots; taken++) {
+          if (otp_truncate_digits(codes[slot++], jobs[first].digits)
+              == jobs[first].guess) {
+            results[first] = OTP_VALIDATE_SUCCESS;
+          }
+        }
+      }
+      queued = 0;
+      if (job == count) {
+        break;
+      }
+    }
+
+    if (!jobs[job].valid) {
+      continue;
+    }
+    if (!(jobs[job].flags & BATCH_VALIDATE)) {
+      requests[queued].key = &jobs[job].key;
+      requests[queued++].counter = jobs[job].counter;
+      continue;
+    }
+    /* the same span as hotp_validate_windows, counters below zero skipped */
+    jobs[job].slots = 0;
+    for (offset = lowest; offset <= highest; offset++) {
+      if (offset < 0 && jobs[job].counter < (uint64_t)-offset) {
+        continue;
+      }
+      requests[queued].key = &jobs[job].key;
+      requests[queued++].counter = jobs[job].counter + offset;
+      jobs[job].slots++;
+    }
+  }
+
+  for (job = 0; job < count; job++) {
+    otp_key_clear(&jobs[job].key);
+  }
+}
+
+static size_t format_results(char *out, size_t count) {
+  size_t length = 0;
+  size_t job;
+
+  for (job = 0; job < count; job++) {
+    if (results[job] == BATCH_ERROR) {
+      length += sprintf(out + length, "error\n");
+    } else if (jobs[job].flags & BATCH_VALIDATE) {
+      length += sprintf(out + length, results[job] == OTP_VALIDATE_SUCCESS
+                                      ? "ok\n" : "fail\n");
+    } else {
+      length += otp_format_codes(&results[job], 1, jobs[job].digits, '\n',
+                                 out + length);
+    }
+  }
+
+  return length;
+}
+
+/* text lines can straddle buffers, the unfinished tail is carried over */
+static size_t process_text(char *out, const char *in, size_t inLength,
+                           char *carry, size_t *carryLength, int last) {
+  char line[MAX_LINE];
+  size_t outLength = 0;
+  size_t count = 0;
+  size_t position = 0;
+  size_t lineLength;
+  const char *newline;
+
+  while (position < inLength || (last && *carryLength)) {
+    newline = memchr(in + position, '\n', inLength - position);
+    if (newline == NULL && !last) {
+      lineLength = inLength - position;
+      if (*carryLength + lineLength >= MAX_LINE) {
+        lineLength = MAX_LINE - 1 - *carryLength;
+      }
+      memcpy(carry + *carryLength, in + position, lineLength);
+      *carryLength += lineLength;
+      break;
+    }
+
+    lineLength = newline ? (size_t)(newline - in) - position
+                         : inLength - position;
+    if (*carryLength + lineLength >= MAX_LINE) {
+      lineLength = MAX_LINE - 1 - *carryLength;
+    }
+    memcpy(line, carry, *carryLength);
+    memcpy(line + *carryLength, in + position, lineLength);
+    line[*carryLength + lineLength] = '\0';
+    position = newline ? (size_t)(newline - in) + 1 : inLength;
+    *carryLength = 0;
+
+    if (line[0] == '\0') {
+      continue;
+    }
+    parse_line(&jobs[count++], line);
+
+    if (count == BUFFER_RECORDS) {
+      run_jobs(count);
+      outLength += format_results(out + outLength, count);
+      count = 0;
+    }
+  }
+
+  run_jobs(count);
+  outLength += format_results(out + outLength, count);
+  memset(line, 0, sizeof(line));
+
+  return outLength;
+}
+
+/* a record cut short by the end of the input is answered as malformed,
+ * and noted in truncated */
+static size_t process_binary(char *out, const char *in, size_t inLength,
+                             int *truncated) {
+  size_t count = inLength / sizeof(batch_record);
+  uint32_t error = BATCH_ERROR;
+  batch_record record;
+  size_t job;
+
+  for (job = 0; job < count; job++) {
+    memcpy(&record, in + job * sizeof(record), sizeof(record));
+    parse_record(&jobs[job], &record);
+  }
+  memset(&record, 0, sizeof(record));
+
+  run_jobs(count);
+  memcpy(out, results, count * sizeof(results[0]));
+
+  if (inLength % sizeof(batch_record)) {
+    memcpy(out + count * sizeof(results[0]), &error, sizeof(error));
+    *truncated = 1;
+    count++;
+  }
+
+  return count * sizeof(results[0]);
+}
+
+static int usage(const char *name) {
+  fprintf(stderr, "usage: %s [-b] [-a sha1|sha256|sha512] [-d digits] "
+          "[-p period] [-w windows] [file]\n", name);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  batch_pipe input;
+  batch_pipe output;
+  pthread_t reader;
+  pthread_t writer;
+  char carry[MAX_LINE];
+  size_t carryLength = 0;
+  unsigned long number;
+  char *end;
+  int truncated = 0;
+  int index = 0;
+  int last;
+  int option;
+  FILE *file = stdin;
+
+  while ((option = getopt(argc, argv, "ba:d:p:w:")) != -1) {
+    switch (option) {
+      case 'b':
+        options.binary = 1;
+        break;
+      case 'a':
+        if (strcmp(optarg, "sha1") == 0) {
+          options.algorithm = OTP_SHA1;
+        } else if (strcmp(optarg, "sha256") == 0) {
+          options.algorithm = OTP_SHA256;
+        } else if (strcmp(optarg, "sha512") == 0) {
+          options.algorithm = OTP_SHA512;
+        } else {
+          return usage(argv[0]);
+        }
+        break;
+      case 'd':
+      case 'p':
+      case 'w':
+        number = strtoul(optarg, &end, 10);
+        if (*end != '\0' || optarg[0] == '-'
+            || number == 0 || (option == 'd' && number > 10)
+            || (option == 'w' && number > MAX_WINDOWS)
+            || number > UINT32_MAX) {
+          return usage(argv[0]);
+        }
+        if (option == 'd') {
+          options.digits = (unsigned int)number;
+        } else if (option == 'p') {
+          options.period = (unsigned int)number;
+        } else {
+          options.windows = (unsigned int)number;
+        }
+        break;
+      default:
+        return usage(argv[0]);
+    }
+  }
+
+  if (optind + 1 < argc) {
+    return usage(argv[0]);
+  }
+  if (optind < argc && (file = fopen(argv[optind], "rb")) == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (pipe_init(&input, BUFFER_BYTES, file)
+      || pipe_init(&output, OUTPUT_BYTES, stdout)) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+
+  pthread_create(&reader, NULL, read_input, &input);
+  pthread_create(&writer, NULL, write_output, &output);
+
+  do {
+    pipe_wait(&input, index, 1);
+    pipe_wait(&output, index, 0);
+
+    last = input.last[index];
+    output.length[index] = options.binary
+        ? process_binary(output.data[index], input.data[index],
+                         input.length[index], &truncated)
+        : process_text(output.data[index], input.data[index],
+                       input.length[index], carry, &carryLength, last);
+    output.last[index] = last;
+
+    pipe_set(&input, index, 0);
+    pipe_set(&output, index, 1);
+    index ^= 1;
+  } while (!last);
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+
+  if (input.failed || output.failed) {
+    fprintf(stderr, "%s: %s error\n", argv[0], input.failed ? "read" : "write");
+  }
+  if (truncated) {
+    fprintf(stderr, "%s: input ends in a partial record\n", argv[0]);
+  }
+  last = input.failed || output.failed || truncated;
+
+  memset(carry, 0, sizeof(carry));
+  pipe_destroy(&input);
+  pipe_destroy(&output);
+  if (file != stdin) {
+    fclose(file);
+  }
+
+  return last;
+}
@@ -0,0 +1,494 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/*
+ * Benchmark driver - prints one JSON document describing throughput and
+ * latency percentiles of the main entry points. Usage:
+ *
+ *   libotpbench [operations per case]
+ */
+
+#include "libotp.h"
+#include "otp_cache.h"
+#include "hmac_sha1.h"
+#include "hmac_sha1_mb.h"
+#include "otp_executor.h"
+#include "otp_uri.h"
+#include "sha1_backend.h"
+#include "sha256_backend.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_OPERATIONS 200000
+#define LATENCY_SAMPLES 20000
+#define BATCH_USERS 8192
+#define RESYNC_RANGE 10000
+#define SCHEDULE_STEPS 1024
+
+typedef void (*bench_fn)(void *context, size_t iteration);
+
+typedef struct bench_state {
+  otp_key key;
+  uint8_t secret[128];
+  size_t secretLength;
+  unsigned int digits;
+  unsigned int windows;
+  hotp_request requests[HMAC_SHA1_MB_MAX_LANES];
+  uint32_t codes[HMAC_SHA1_MB_MAX_LANES];
+  uint32_t schedule[SCHEDULE_STEPS];
+  char rendered[SCHEDULE_STEPS * 11];
+  totp_cache *cache;
+  char text[256];
+  size_t textLength;
+  volatile uint32_t sink;
+} bench_state;
+
+/* everything needed for the threaded batch cases */
+typedef struct bench_batch {
+  otp_executor *executor;
+  totp_batch batch;
+  OTP_VALIDATE_RESULT *results;
+} bench_batch;
+
+static size_t operations = DEFAULT_OPERATIONS;
+static uint64_t latencies[LATENCY_SAMPLES];
+static int firstResult = 1;
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static int compare_u64(const void *left, const void *right) {
+  uint64_t a = *(const uint64_t *)left;
+  uint64_t b = *(const uint64_t *)right;
+
+  return (a > b) - (a < b);
+}
+
+/* 0 when nothing was sampled */
+static uint64_t percentile(const uint64_t *sorted, size_t count, double fraction) {
+  size_t index;
+
+  if (count == 0) {
+    return 0;
+  }
+
+  index = (size_t)(fraction * (count - 1) + 0.5);
+  return sorted[index < count ? index : count - 1];
+}
+
+/* run fn for throughput without timers, then again timing every call for
+ * the latency distribution. ns_per_code and codes_per_sec are per code,
+ * ns_per_call and the percentiles per call of fn */
+static void run_case(const char *name, const char *params, bench_fn fn,
+                     void *context, size_t calls, size_t codesPerCall) {
+  size_t samples = calls < LATENCY_SAMPLES ? calls : LATENCY_SAMPLES;
+  uint64_t start;
+  uint64_t elapsed;
+  double nsPerCode;
+  size_t iteration;
+
+  /* a case with no calls has no figures worth printing, and would divide
+   * by zero below */
+  if (calls == 0 || codesPerCall == 0) {
+    return;
+  }
+
+  /* warm up caches and branch predictors */
+  for (iteration = 0; iteration < samples / 10 + 1; iteration++) {
+    fn(context, iteration);
+  }
+
+  start = now_ns();
+  for (iteration = 0; iteration < calls; iteration++) {
+    fn(context, iteration);
+  }
+  elapsed = now_ns() - start;
+  nsPerCode = (double)elapsed / ((double)calls * codesPerCall);
+
+  for (iteration = 0; iteration < samples; iteration++) {
+    start = now_ns();
+    fn(context, iteration);
+    latencies[iteration] = now_ns() - start;
+  }
+  qsort(latencies, samples, sizeof(latencies[0]), compare_u64);
+
+  printf("%s    {\"benchmark\": \"%s\", \"params\": {%s}, \"codes\": %zu, "
+         "\"ns_per_code\": %.2f, \"codes_per_sec\": %.0f, "
+         "\"ns_per_call\": %.2f, "
+         "\"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", "
+         "\"p999_ns\": %" PRIu64 "}",
+         firstResult ? "" : ",\n", name, params, calls * codesPerCall,
+         nsPerCode, 1e9 / nsPerCode, nsPerCode * codesPerCall,
+         percentile(latencies, samples, 0.50),
+         percentile(latencies, samples, 0.99),
+         percentile(latencies, samples, 0.999));
+  firstResult = 0;
+  fflush(stdout);
+}
+
+static void bench_hmac(void *context, size_t iteration) {
+  bench_state *state = context;
+  uint8_t message[8] = { 0 };
+  uint8_t result[HMAC_SHA1_MAC_BYTES];
+
+  message[7] = (uint8_t)iteration;
+  HMAC_SHA_1(result, state->secret, state->secretLength, message,
+             sizeof(message));
+  state->sink += result[0];
+}
+
+static void bench_hotp(void *context, size_t iteration) {
+  bench_state *state = context;
+  hotp_state counterState = { state->secret, state->secretLength, iteration };
+
+  state->sink += hotp(&counterState);
+}
+
+static void bench_hotp_ctx(void *context, size_t iteration) {
+  bench_state *state = context;
+
+  state->sink += hotp_ctx(&state->key, iteration);
+}
+
+static void bench_hotp_many(void *context, size_t iteration) {
+  bench_state *state = context;
+  size_t lane;
+
+  for (lane = 0; lane < HMAC_SHA1_MB_MAX_LANES; lane++) {
+    state->requests[lane].counter = iteration * HMAC_SHA1_MB_MAX_LANES + lane;
+  }
+  hotp_many(state->requests, state->codes, HMAC_SHA1_MB_MAX_LANES);
+  state->sink += state->codes[0];
+}
+
+static void bench_hotp_range(void *context, size_t iteration) {
+  bench_state *state = context;
+
+  hotp_range_ctx(&state->key, iteration * SCHEDULE_STEPS, SCHEDULE_STEPS,
+                 state->digits, state->schedule);
+  state->sink += state->schedule[0];
+}
+
+static void bench_format_codes(void *context, size_t iteration) {
+  bench_state *state = context;
+
+  state->schedule[iteration % SCHEDULE_STEPS] += (uint32_t)iteration;
+  otp_format_codes(state->schedule, SCHEDULE_STEPS, state->digits, '\n',
+                   state->rendered);
+  state->sink += (uint32_t)state->rendered[0];
+}
+
+static void bench_totp_validate(void *context, size_t iteration) {
+  bench_state *state = context;
+  totp_state timeState = { state->secret, state->secretLength,
+                           (time_t)(1500000000 + 30 * iteration) };
+
+  state->sink += totp_validate(&timeState, 30, 123456, state->digits);
+}
+
+/* guesses that never match, so every slot of the window is computed */
+static void bench_hotp_windows(void *context, size_t iteration) {
+  bench_state *state = context;
+  hotp_state counterState = { state->secret, state->secretLength,
+                              1000 + iteration };
+
+  state->sink += hotp_validate_windows(&counterState, 1234567890,
+                                       state->digits, state->windows);
+}
+
+static void bench_totp_windows_ctx(void *context, size_t iteration) {
+  bench_state *state = context;
+
+  state->sink += totp_validate_windows_ctx(&state->key,
+                                           (time_t)(1500000000 + 30 * iteration),
+                                           30, 1234567890, state->digits,
+                                           state->windows);
+}
+
+/* a pair of codes that is never found, so the whole range is scanned */
+static void bench_hotp_resync(void *context, size_t iteration) {
+  bench_state *state = context;
+  uint32_t guesses[2] = { 1000000, 1000000 };
+  uint64_t next;
+
+  state->sink += hotp_resync_ctx(&state->key, iteration * RESYNC_RANGE,
+                                 RESYNC_RANGE, guesses, 2, state->digits,
+                                 &next);
+}
+
+/* a retry storm - every step is validated many times over */
+static void bench_totp_cache(void *context, size_t iteration) {
+  bench_state *state = context;
+
+  state->sink += totp_cache_validate(state->cache,
+                                     (time_t)(1500000000 + iteration / 8),
+                                     1234567890, state->digits, state->windows);
+}
+
+static void bench_base32(void *context, size_t iteration) {
+  bench_state *state = context;
+  uint8_t secret[sizeof(state->secret)];
+  size_t secretLength = sizeof(secret);
+
+  (void)iteration;
+  state->sink += otp_base32_decode(secret, &secretLength, state->text,
+                                   state->textLength, OTP_BASE32);
+  state->sink += secret[0];
+}
+
+static void bench_uri_parse(void *context, size_t iteration) {
+  bench_state *state = context;
+  otp_uri uri;
+
+  (void)iteration;
+  state->sink += otp_uri_parse(&uri, &state->key, state->text,
+                               state->textLength);
+}
+
+static void bench_threaded_batch(void *context, size_t iteration) {
+  bench_batch *batch = context;
+
+  (void)iteration;
+  otp_job_wait(otp_executor_totp_validate(batch->executor, &batch->batch, 30,
+                                          batch->results, NULL, NULL));
+}
+
+static void prepare_state(bench_state *state, size_t secretLength,
+                          unsigned int digits, unsigned int windows) {
+  size_t lane;
+
+  memset(state->secret, 0x5a, sizeof(state->secret));
+  state->secretLength = secretLength;
+  state->digits = digits;
+  state->windows = windows;
+  otp_key_init(&state->key, state->secret, secretLength);
+  for (lane = 0; lane < HMAC_SHA1_MB_MAX_LANES; lane++) {
+    state->requests[lane].key = &state->key;
+  }
+}
+
+static void run_single_cases(void) {
+  static const size_t secretLengths[] = { 10, 20, 64, 100 };
+  static const unsigned int digitCounts[] = { 6, 8 };
+  static const unsigned int windowSizes[] = { 1, 3, 5, 11, 21, 51 };
+  bench_state state;
+  char params[128];
+  size_t index;
+  size_t inner;
+
+  for (index = 0; index < sizeof(secretLengths) / sizeof(secretLengths[0]); index++) {
+    prepare_state(&state, secretLengths[index], 6, 1);
+    snprintf(params, sizeof(params), "\"secret_bytes\": %zu", secretLengths[index]);
+    run_case("HMAC_SHA_1", params, bench_hmac, &state, operations, 1);
+    run_case("hotp", params, bench_hotp, &state, operations, 1);
+    run_case("hotp_ctx", params, bench_hotp_ctx, &state, operations, 1);
+  }
+
+  prepare_state(&state, 20, 6, 1);
+  snprintf(params, sizeof(params), "\"secret_bytes\": 20, \"lanes\": %zu",
+           hmac_sha1_mb_lanes());
+  run_case("hotp_many", params, bench_hotp_many, &state,
+           operations / HMAC_SHA1_MB_MAX_LANES + 1, HMAC_SHA1_MB_MAX_LANES);
+
+  snprintf(params, sizeof(params), "\"secret_bytes\": 20, \"steps\": %d",
+           SCHEDULE_STEPS);
+  run_case("hotp_range_ctx", params, bench_hotp_range, &state,
+           operations / SCHEDULE_STEPS + 1, SCHEDULE_STEPS);
+  run_case("otp_format_codes", params, bench_format_codes, &state,
+           operations / SCHEDULE_STEPS + 1, SCHEDULE_STEPS);
+
+  snprintf(params, sizeof(params), "\"secret_bytes\": 20, \"range\": %d",
+           RESYNC_RANGE);
+  run_case("hotp_resync_ctx", params, bench_hotp_resync, &state,
+           operations / RESYNC_RANGE + 1, RESYNC_RANGE);
+
+  for (index = 0; index < sizeof(digitCounts) / sizeof(digitCounts[0]); index++) {
+    prepare_state(&state, 20, digitCounts[index], 1);
+    snprintf(params, sizeof(params), "\"secret_bytes\": 20, \"digits\": %u",
+             digitCounts[index]);
+    run_case("totp_validate", params, bench_totp_validate, &state, operations, 1);
+
+    for (inner = 0; inner < sizeof(windowSizes) / sizeof(windowSizes[0]); inner++) {
+      prepare_state(&state, 20, digitCounts[index], windowSizes[inner]);
+      snprintf(params, sizeof(params),
+               "\"secret_bytes\": 20, \"digits\": %u, \"windows\": %u",
+               digitCounts[index], windowSizes[inner]);
+      run_case("hotp_validate_windows", params, bench_hotp_windows, &state,
+               operations / windowSizes[inner] + 1, windowSizes[inner]);
+      run_case("totp_validate_windows_ctx", params, bench_totp_windows_ctx,
+               &state, operations / windowSizes[inner] + 1, windowSizes[inner]);
+
+      state.cache = totp_cache_create(&state.key, 30, windowSizes[inner] / 2);
+      if (state.cache) {
+        run_case("totp_cache_validate", params, bench_totp_cache, &state,
+                 operations / windowSizes[inner] + 1, windowSizes[inner]);
+        totp_cache_destroy(state.cache);
+      }
+    }
+  }
+
+  otp_key_clear(&state.key);
+}
+
+/* the ctx entry points for each hash, with the RFC 6238 seed lengths */
+static void run_algorithm_cases(void) {
+  static const OTP_ALGORITHM algorithms[] = { OTP_SHA1, OTP_SHA256, OTP_SHA512 };
+  static const char *names[] = { "sha1", "sha256", "sha512" };
+  static const size_t secretLengths[] = { 20, 32, 64 };
+  bench_state state;
+  char params[128];
+  size_t index;
+
+  for (index = 0; index < sizeof(algorithms) / sizeof(algorithms[0]); index++) {
+    prepare_state(&state, secretLengths[index], 6, 3);
+    otp_key_init_algorithm(&state.key, algorithms[index], state.secret,
+                           state.secretLength);
+    snprintf(params, sizeof(params),
+             "\"algorithm\": \"%s\", \"secret_bytes\": %zu",
+             names[index], secretLengths[index]);
+    run_case("hotp_ctx", params, bench_hotp_ctx, &state, operations, 1);
+    run_case("hotp_many", params, bench_hotp_many, &state,
+             operations / HMAC_SHA1_MB_MAX_LANES + 1, HMAC_SHA1_MB_MAX_LANES);
+    run_case("totp_validate_windows_ctx", params, bench_totp_windows_ctx,
+             &state, operations / 3 + 1, 3);
+  }
+
+  otp_key_clear(&state.key);
+}
+
+/* decoding enrollment secrets, bare and inside an otpauth URI */
+static void run_provisioning_cases(void) {
+  static const size_t secretLengths[] = { 20, 64 };
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+  bench_state state;
+  char params[128];
+  size_t index;
+  size_t iterator;
+  size_t chars;
+  int prefix;
+
+  for (index = 0; index < sizeof(secretLengths) / sizeof(secretLengths[0]); index++) {
+    prepare_state(&state, secretLengths[index], 6, 1);
+    chars = (secretLengths[index] * 8 + 4) / 5;
+    for (iterator = 0; iterator < chars; iterator++) {
+      state.text[iterator] = alphabet[(iterator * 11) % 32];
+    }
+    state.textLength = chars;
+    snprintf(params, sizeof(params), "\"secret_bytes\": %zu", secretLengths[index]);
+    run_case("otp_base32_decode", params, bench_base32, &state, operations, 1);
+
+    prefix = snprintf(state.text, sizeof(state.text),
+                      "otpauth://totp/ACME:user?issuer=ACME&digits=6&secret=");
+    for (iterator = 0; iterator < chars; iterator++) {
+      state.text[prefix + iterator] = alphabet[(iterator * 11) % 32];
+    }
+    state.textLength = prefix + chars;
+    run_case("otp_uri_parse", params, bench_uri_parse, &state, operations, 1);
+  }
+
+  otp_key_clear(&state.key);
+}
+
+static void run_threaded_cases(void) {
+  unsigned int threadCounts[] = { 1, 2, 4, 0 };
+  uint8_t *secrets = malloc(BATCH_USERS * 20);
+  size_t *secretOffsets = malloc((BATCH_USERS + 1) * sizeof(size_t));
+  time_t *times = malloc(BATCH_USERS * sizeof(time_t));
+  uint32_t *guesses = malloc(BATCH_USERS * sizeof(uint32_t));
+  uint8_t *guessDigits = malloc(BATCH_USERS);
+  bench_batch batch;
+  char params[128];
+  size_t index;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+  threadCounts[3] = online > 0 ? (unsigned int)online : 1;
+
+  for (index = 0; index < BATCH_USERS; index++) {
+    memset(secrets + 20 * index, (int)index, 20);
+    secretOffsets[index] = 20 * index;
+    times[index] = 1500000000 + (time_t)index;
+    guesses[index] = (uint32_t)index % 1000000;
+    guessDigits[index] = 6;
+  }
+  secretOffsets[BATCH_USERS] = 20 * BATCH_USERS;
+
+  batch.batch.secrets = secrets;
+  batch.batch.secretOffsets = secretOffsets;
+  batch.batch.times = times;
+  batch.batch.guesses = guesses;
+  batch.batch.guessDigits = guessDigits;
+  batch.batch.count = BATCH_USERS;
+  batch.results = malloc(BATCH_USERS * sizeof(OTP_VALIDATE_RESULT));
+
+  for (index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+    batch.executor = otp_executor_create(threadCounts[index], 0);
+    if (batch.executor == NULL) {
+      continue;
+    }
+    snprintf(params, sizeof(params), "\"threads\": %u, \"batch\": %d",
+             threadCounts[index], BATCH_USERS);
+    run_case("totp_validate_batch", params, bench_threaded_batch, &batch,
+             operations / BATCH_USERS + 16, BATCH_USERS);
+    otp_executor_destroy(batch.executor);
+  }
+
+  free(secrets);
+  free(secretOffsets);
+  free(times);
+  free(guesses);
+  free(guessDigits);
+  free(batch.results);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    operations = strtoul(argv[1], NULL, 10);
+    if (operations == 0) {
+      fprintf(stderr, "usage: %s [operations per case]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("{\n  \"sha1_backend\": \"%s\",\n  \"sha256_backend\": \"%s\",\n"
+         "  \"mb_lanes\": %zu,\n  \"operations\": %zu,\n  \"results\": [\n",
+         sha1_backend_name(sha1_backend_current()),
+         sha256_backend_name(sha256_backend_current()), hmac_sha1_mb_lanes(),
+         operations);
+
+  run_single_cases();
+  run_algorithm_cases();
+  run_provisioning_cases();
+  run_threaded_cases();
+
+  printf("\n  ]\n}\n");
+
+  return 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/*
+ * Daemon driver - serves validation requests for the users in a key file
+ * over a Unix socket, keeping their counter and replay state in one
+ * place for every local client. Usage:
+ *
+ *   libotpd [-s socket] [-m mode] [-b batch] [-t delay ns] [-w windows]
+ *           [-f seconds] keyfile
+ *   libotpd -q [-s socket]
+ *
+ * The wire format is in otp_server.h. SIGINT or SIGTERM stops the server,
+ * which prints its stats as JSON on the way out. -q asks a running server
+ * for the same stats.
+ *
+ * Each user is checked with the digits and period from their key file
+ * record (period 0 for hotp), whatever a request asks for, and records
+ * without digits are refused. -w is the window used when a request names
+ * none and the widest one may name.
+ *
+ * Counters and last used steps are written back to the key file every -f
+ * seconds (60 by default, 0 for only on exit) and when the server stops,
+ * so a restart doesn't reopen codes that were already accepted. A crash
+ * loses at most what changed since the last write; TOTP drift is not
+ * kept.
+ *
+ * Any client that can connect can make guesses for every user, so the
+ * socket is 0600 (or -m, in octal) and by default lives in a libotpd
+ * directory only its owner can enter, under $XDG_RUNTIME_DIR or /run.
+ */
+
+#include "otp_arena.h"
+#include "otp_keyfile.h"
+#include "otp_server.h"
+#include "otp_store.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOCKET_DIRECTORY "libotpd"
+#define SOCKET_NAME "libotpd.sock"
+#define STORE_SHARDS 16
+#define STATS_JSON_BYTES 512
+#define DEFAULT_SAVE_INTERVAL 60
+
+/* writes the store back to the key file now and then */
+typedef struct daemon_saver {
+  otp_store *store;
+  const char *path;
+  unsigned int interval;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stopping;
+} daemon_saver;
+
+static otp_server *running;
+
+static void handle_signal(int signal) {
+  (void)signal;
+  otp_server_stop(running);
+}
+
+/* $XDG_RUNTIME_DIR/libotpd/libotpd.sock, or under /run without one.
+ * serving creates the directory 0700 and refuses one others can use */
+static const char *default_socket(char *path, size_t length, int create) {
+  const char *runtime = getenv("XDG_RUNTIME_DIR");
+  struct stat status;
+  int written;
+
+  written = snprintf(path, length, "%s/" SOCKET_DIRECTORY,
+                     runtime && runtime[0] == '/' ? runtime : "/run");
+  if (written < 0 || (size_t)written + sizeof(SOCKET_NAME) + 1 > length) {
+    fprintf(stderr, "socket directory name too long\n");
+    return NULL;
+  }
+
+  if (create) {
+    if (mkdir(path, 0700) && errno != EEXIST) {
+      perror(path);
+      return NULL;
+    }
+    if (lstat(path, &status) || !S_ISDIR(status.st_mode)
+        || status.st_uid != geteuid() || (status.st_mode & 077)) {
+      fprintf(stderr, "%s: not a private directory\n", path);
+      return NULL;
+    }
+  }
+
+  strcat(path, "/" SOCKET_NAME);
+  return path;
+}
+
+static otp_store *load_store(const char *path) {
+  otp_keyfile *keyfile = otp_keyfile_open(path);
+  otp_store *store;
+  size_t count;
+  size_t index;
+
+  if (keyfile == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  count = otp_keyfile_count(keyfile);
+  store = otp_store_create(count ? count : 1, STORE_SHARDS);
+  if (store == NULL) {
+    perror("store");
+    otp_keyfile_close(keyfile);
+    return NULL;
+  }
+
+  for (index = 0; index < count; index++) {
+    const otp_keyfile_record *record = otp_keyfile_record_at(keyfile, index);
+
+    if (record->digits == 0
+        || otp_store_add_user(store, record->userId, &record->key,
+                              record->counter, record->digits,
+                              record->period) != OTP_STORE_SUCCESS) {
+      fprintf(stderr, "%s: can't add user %llu\n", path,
+              (unsigned long long)record->userId);
+    }
+  }
+
+  /* the store holds its own copy of every key */
+  otp_keyfile_close(keyfile);
+  return store;
+}
+
+/* the key file with each user's counter replaced by the store's. the
+ * file is read again so records added to it meanwhile are kept, and left
+ * alone when nothing changed */
+static int save_store(const char *path, otp_store *store) {
+  otp_keyfile *keyfile = otp_keyfile_open(path);
+  otp_keyfile_record *records;
+  size_t count;
+  size_t index;
+  uint64_t step;
+  int changed = 0;
+  int result;
+
+  if (keyfile == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  count = otp_keyfile_count(keyfile);
+  records = aligned_alloc(alignof(otp_keyfile_record),
+                          (count ? count : 1) * sizeof(*records));
+  if (records == NULL) {
+    perror("save");
+    otp_keyfile_close(keyfile);
+    return -1;
+  }
+
+  for (index = 0; index < count; index++) {
+    records[index] = *otp_keyfile_record_at(keyfile, index);
+    if (otp_store_lookup(store, records[index].userId, &step, NULL)
+          == OTP_STORE_SUCCESS
+        && step != records[index].counter) {
+      records[index].counter = step;
+      changed = 1;
+    }
+  }
+  otp_keyfile_close(keyfile);
+
+  result = changed ? otp_keyfile_write(path, records, count) : 0;
+  if (result) {
+    perror(path);
+  }
+
+  otp_secure_wipe(records, count * sizeof(*records));
+  free(records);
+  return result;
+}
+
+static void *run_saver(void *argument) {
+  daemon_saver *saver = argument;
+  struct timespec wake;
+
+  pthread_mutex_lock(&saver->lock);
+  while (!saver->stopping) {
+    clock_gettime(CLOCK_REALTIME, &wake);
+    wake.tv_sec += saver->interval;
+    if (pthread_cond_timedwait(&saver->wake, &saver->lock, &wake) == ETIMEDOUT
+        && !saver->stopping) {
+      pthread_mutex_unlock(&saver->lock);
+      save_store(saver->path, saver->store);
+      pthread_mutex_lock(&saver->lock);
+    }
+  }
+  pthread_mutex_unlock(&saver->lock);
+
+  return NULL;
+}
+
+static int query_stats(const char *path) {
+  struct sockaddr_un address;
+  otp_server_request request;
+  otp_server_response response;
+  otp_server_stats stats;
+  char json[STATS_JSON_BYTES];
+  int fd;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+    perror(path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return 1;
+  }
+
+  memset(&request, 0, sizeof(request));
+  request.version = OTP_SERVER_VERSION;
+  request.type = OTP_SERVER_STATS;
+
+  if (write(fd, &request, sizeof(request)) != sizeof(request)
+      || recv(fd, &response, sizeof(response), MSG_WAITALL) != sizeof(response)
+      || response.status != OTP_STORE_SUCCESS
+      || recv(fd, &stats, sizeof(stats), MSG_WAITALL) != sizeof(stats)) {
+    fprintf(stderr, "%s: no stats from server\n", path);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  otp_server_format(json, sizeof(json), &stats);
+  printf("%s\n", json);
+  return 0;
+}
+
+static int usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s socket] [-m mode] [-b batch] "
+          "[-t delay ns] [-w windows] [-f seconds] keyfile\n"
+          "       %s -q [-s socket]\n", name, name);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  otp_server_config config;
+  otp_server_stats stats;
+  struct sigaction action;
+  char json[STATS_JSON_BYTES];
+  char defaultPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  const char *path = NULL;
+  char *end;
+  daemon_saver saver;
+  pthread_t saverThread;
+  int saving = 0;
+  unsigned int interval = DEFAULT_SAVE_INTERVAL;
+  otp_store *store;
+  unsigned long long number;
+  int query = 0;
+  int option;
+  int result;
+
+  memset(&config, 0, sizeof(config));
+
+  while ((option = getopt(argc, argv, "qs:m:b:t:w:f:")) != -1) {
+    switch (option) {
+      case 'q':
+        query = 1;
+        break;
+      case 's':
+        path = optarg;
+        break;
+      case 'm':
+        number = strtoull(optarg, &end, 8);
+        if (*end != '\0' || number == 0 || number > 0777) {
+          return usage(argv[0]);
+        }
+        config.mode = (unsigned int)number;
+        break;
+      case 'f':
+        number = strtoull(optarg, &end, 10);
+        if (*end != '\0' || end == optarg || number > UINT32_MAX) {
+          return usage(argv[0]);
+        }
+        interval = (unsigned int)number;
+        break;
+      case 'b':
+      case 't':
+      case 'w':
+        /* strtoull takes a sign, and would turn -1 into a huge delay */
+        number = strtoull(optarg, &end, 10);
+        if (*end != '\0' || end == optarg || optarg[0] == '-'
+            || (number == 0 && option != 't')
+            || (option == 'w' && number > UINT8_MAX)) {
+          return usage(argv[0]);
+        }
+        if (option == 'b') {
+          config.maxBatch = (size_t)number;
+        } else if (option == 't') {
+          config.batchDelay = number;
+        } else {
+          config.windows = (unsigned int)number;
+        }
+        break;
+      default:
+        return usage(argv[0]);
+    }
+  }
+
+  if (query ? optind != argc : optind + 1 != argc) {
+    return usage(argv[0]);
+  }
+  if (path == NULL) {
+    path = default_socket(defaultPath, sizeof(defaultPath), !query);
+    if (path == NULL) {
+      return 1;
+    }
+  }
+  if (query) {
+    return query_stats(path);
+  }
+
+  store = load_store(argv[optind]);
+  if (store == NULL) {
+    return 1;
+  }
+
+  running = otp_server_create(store, path, &config);
+  if (running == NULL) {
+    perror(path);
+    otp_store_destroy(store);
+    return 1;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  saver.store = store;
+  saver.path = argv[optind];
+  saver.interval = interval;
+  saver.stopping = 0;
+  pthread_mutex_init(&saver.lock, NULL);
+  pthread_cond_init(&saver.wake, NULL);
+  if (interval) {
+    saving = pthread_create(&saverThread, NULL, run_saver, &saver) == 0;
+    if (!saving) {
+      fprintf(stderr, "no periodic saves, state is written on exit only\n");
+    }
+  }
+
+  result = otp_server_run(running);
+  if (result) {
+    perror("epoll");
+  }
+
+  if (saving) {
+    pthread_mutex_lock(&saver.lock);
+    saver.stopping = 1;
+    pthread_cond_signal(&saver.wake);
+    pthread_mutex_unlock(&saver.lock);
+    pthread_join(saverThread, NULL);
+  }
+  pthread_cond_destroy(&saver.wake);
+  pthread_mutex_destroy(&saver.lock);
+
+  /* no more requests are taken once run returns */
+  if (save_store(argv[optind], store)) {
+    result = -1;
+  }
+
+  otp_server_read_stats(running, &stats);
+  otp_server_format(json, sizeof(json), &stats);
+  fprintf(stderr, "%s\n", json);
+
+  otp_server_destroy(running);
+  otp_store_destroy(store);
+  return result != 0;
+}
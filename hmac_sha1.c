@@ -21,59 +21,224 @@
 
 /* local includes */
 #include "hmac_sha1.h"
+#include "sha1_backend.h"
 
 /* external includes; */
-#include "sha1/sha1.h"
 #include <string.h>
 
 /* local SHA1 defines - See RFC 3174 */
-#define INNER_PAD_BYTE 0x36
-#define OUTER_PAD_BYTE 0x5c
-#define KEY_PAD_BYTE = 0x00
+#define INNER_PAD_WORD 0x36363636
+#define OUTER_PAD_WORD 0x5c5c5c5c
 #define SHA1_DIGEST_BYTES 20
 #define SHA1_KEY_BYTES 64
+#define SHA1_BLOCK_WORDS 16
+#define SHA1_PAD_WORD 0x80000000
+
+static const uint32_t sha1InitialState[5] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+/* internal helper function definitions */
+static void sha1_stream_begin(sha1_stream * stream, const uint32_t state[5],
+    uint64_t length);
+static void sha1_stream_update(sha1_stream * stream, const uint8_t * data,
+    size_t length);
+static void sha1_stream_final(sha1_stream * stream, uint32_t * digest);
+static void sha1_compress_bytes(uint32_t state[5], const uint8_t * bytes);
 
 /* implement HMAC (https://tools.ietf.org/html/rfc2104) for sha1 */
 void HMAC_SHA_1(uint8_t * outerResult, const uint8_t * key,
     size_t keyLength, const uint8_t * message, size_t messageLength) {
+  hmac_sha1_key keyCtx;
+
+  hmac_sha1_init_key(&keyCtx, key, keyLength);
+  hmac_sha1_mac(outerResult, &keyCtx, message, messageLength);
+
+  memset(&keyCtx, 0, sizeof(keyCtx));
+}
+
+/* hash the padded key blocks once so they can be reused for every message */
+void hmac_sha1_init_key(hmac_sha1_key * keyCtx, const uint8_t * key,
+    size_t keyLength) {
   /* declare local variables */
-  uint8_t innerResult[SHA1_DIGEST_BYTES];
-  uint8_t truncatedKey[SHA1_DIGEST_BYTES];
-  uint8_t innerPadBuffer[SHA1_KEY_BYTES];
-  uint8_t outerPadBuffer[SHA1_KEY_BYTES];
+  uint32_t keyBlock[SHA1_BLOCK_WORDS] = { 0 };
+  uint32_t padBlock[SHA1_BLOCK_WORDS];
   size_t iterator;
 
-  memset(innerPadBuffer, INNER_PAD_BYTE, SHA1_KEY_BYTES);
-  memset(outerPadBuffer, OUTER_PAD_BYTE, SHA1_KEY_BYTES);
-
   /* the key can't be longer than the block length */
   if (keyLength > SHA1_KEY_BYTES) {
-    SHA1_CTX keyCtx;
-    SHA1Init(&keyCtx);
-    SHA1Update(&keyCtx, key, keyLength);
-    SHA1Final(truncatedKey, &keyCtx);
+    sha1_stream keyStream;
+    sha1_stream_begin(&keyStream, sha1InitialState, 0);
+    sha1_stream_update(&keyStream, key, keyLength);
+    sha1_stream_final(&keyStream, keyBlock);
+    memset(&keyStream, 0, sizeof(keyStream));
+  } else {
+    for (iterator = 0; iterator < keyLength; iterator++) {
+      keyBlock[iterator / 4] |= (uint32_t)key[iterator] << (24 - 8 * (iterator % 4));
+    }
+  }
 
-    key = truncatedKey;
-    keyLength = SHA1_DIGEST_BYTES;
+  /* XOR key with the pad words and keep the chaining value of each block */
+  for (iterator = 0; iterator < SHA1_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ INNER_PAD_WORD;
   }
+  memcpy(keyCtx->innerState, sha1InitialState, sizeof(keyCtx->innerState));
+  sha1_compress(keyCtx->innerState, padBlock);
 
-  /* XOR key with pre-padded buffers */
-  for (iterator = 0; iterator < keyLength; iterator++) {
-    innerPadBuffer[iterator] ^= key[iterator];
-    outerPadBuffer[iterator] ^= key[iterator];
+  for (iterator = 0; iterator < SHA1_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ OUTER_PAD_WORD;
   }
+  memcpy(keyCtx->outerState, sha1InitialState, sizeof(keyCtx->outerState));
+  sha1_compress(keyCtx->outerState, padBlock);
+
+  /* don't leave key material on the stack */
+  memset(keyBlock, 0, sizeof(keyBlock));
+  memset(padBlock, 0, sizeof(padBlock));
+}
+
+/* HMAC over a precomputed key - costs only the message and final blocks */
+void hmac_sha1_mac(uint8_t * outerResult, const hmac_sha1_key * keyCtx,
+    const uint8_t * message, size_t messageLength) {
+  hmac_sha1_ctx ctx;
+
+  hmac_sha1_begin(&ctx, keyCtx);
+  hmac_sha1_update(&ctx, message, messageLength);
+  hmac_sha1_final(&ctx, outerResult);
+}
+
+void hmac_sha1_begin(hmac_sha1_ctx * ctx, const hmac_sha1_key * keyCtx) {
+  sha1_stream_begin(&ctx->inner, keyCtx->innerState, SHA1_KEY_BYTES);
+  memcpy(ctx->outerState, keyCtx->outerState, sizeof(ctx->outerState));
+}
+
+void hmac_sha1_update(hmac_sha1_ctx * ctx, const uint8_t * data,
+    size_t length) {
+  sha1_stream_update(&ctx->inner, data, length);
+}
+
+void hmac_sha1_final(hmac_sha1_ctx * ctx, uint8_t * outerResult) {
+  uint32_t block[SHA1_BLOCK_WORDS] = { 0 };
+  size_t iterator;
+
+  /* finish the inner hash, its digest becomes the start of the outer block */
+  sha1_stream_final(&ctx->inner, block);
+
+  /* perform outer hash */
+  block[5] = SHA1_PAD_WORD;
+  block[15] = (SHA1_KEY_BYTES + SHA1_DIGEST_BYTES) * 8;
+  sha1_compress(ctx->outerState, block);
+
+  for (iterator = 0; iterator < HMAC_SHA1_MAC_BYTES; iterator++) {
+    outerResult[iterator] = (uint8_t)(ctx->outerState[iterator / 4] >> (24 - 8 * (iterator % 4)));
+  }
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+/* the counter message is always a single block after the inner pad, so both
+ * padded blocks can be laid out directly as words */
+void hmac_sha1_counter(uint32_t * digest, const hmac_sha1_key * keyCtx,
+    uint64_t counter) {
+  uint32_t block[SHA1_BLOCK_WORDS] = {
+    (uint32_t)(counter >> 32), (uint32_t)counter, SHA1_PAD_WORD
+  };
 
   /* perform inner hash */
-  SHA1_CTX innerHashCtx;
-  SHA1Init(&innerHashCtx);
-  SHA1Update(&innerHashCtx, innerPadBuffer, SHA1_KEY_BYTES);
-  SHA1Update(&innerHashCtx, message, messageLength);
-  SHA1Final(innerResult, &innerHashCtx);
+  block[15] = (SHA1_KEY_BYTES + sizeof(counter)) * 8;
+  digest[0] = keyCtx->innerState[0];
+  digest[1] = keyCtx->innerState[1];
+  digest[2] = keyCtx->innerState[2];
+  digest[3] = keyCtx->innerState[3];
+  digest[4] = keyCtx->innerState[4];
+  sha1_compress(digest, block);
 
   /* perform outer hash */
-  SHA1_CTX outerHashCtx;
-  SHA1Init(&outerHashCtx);
-  SHA1Update(&outerHashCtx, outerPadBuffer, SHA1_KEY_BYTES);
-  SHA1Update(&outerHashCtx, innerResult, SHA1_DIGEST_BYTES);
-  SHA1Final(outerResult, &outerHashCtx);
+  block[0] = digest[0];
+  block[1] = digest[1];
+  block[2] = digest[2];
+  block[3] = digest[3];
+  block[4] = digest[4];
+  block[5] = SHA1_PAD_WORD;
+  block[15] = (SHA1_KEY_BYTES + SHA1_DIGEST_BYTES) * 8;
+  digest[0] = keyCtx->outerState[0];
+  digest[1] = keyCtx->outerState[1];
+  digest[2] = keyCtx->outerState[2];
+  digest[3] = keyCtx->outerState[3];
+  digest[4] = keyCtx->outerState[4];
+  sha1_compress(digest, block);
+}
+
+static void sha1_stream_begin(sha1_stream * stream, const uint32_t state[5],
+    uint64_t length) {
+  memcpy(stream->state, state, sizeof(stream->state));
+  stream->length = length;
+}
+
+static void sha1_stream_update(sha1_stream * stream, const uint8_t * data,
+    size_t length) {
+  size_t used = stream->length % SHA1_KEY_BYTES;
+
+  stream->length += length;
+
+  /* top up a partially filled buffer first */
+  if (used) {
+    size_t fill = SHA1_KEY_BYTES - used;
+
+    if (length < fill) {
+      memcpy(stream->buffer + used, data, length);
+      return;
+    }
+
+    memcpy(stream->buffer + used, data, fill);
+    sha1_compress_bytes(stream->state, stream->buffer);
+    data += fill;
+    length -= fill;
+  }
+
+  /* whole blocks are hashed straight from the input */
+  while (length >= SHA1_KEY_BYTES) {
+    sha1_compress_bytes(stream->state, data);
+    data += SHA1_KEY_BYTES;
+    length -= SHA1_KEY_BYTES;
+  }
+
+  memcpy(stream->buffer, data, length);
+}
+
+/* pad the remaining bytes (RFC 3174 section 4) and write the digest words */
+static void sha1_stream_final(sha1_stream * stream, uint32_t * digest) {
+  uint32_t block[SHA1_BLOCK_WORDS] = { 0 };
+  size_t used = stream->length % SHA1_KEY_BYTES;
+  uint64_t bits = stream->length * 8;
+  size_t iterator;
+
+  for (iterator = 0; iterator < used; iterator++) {
+    block[iterator / 4] |= (uint32_t)stream->buffer[iterator] << (24 - 8 * (iterator % 4));
+  }
+  block[used / 4] |= (uint32_t)0x80 << (24 - 8 * (used % 4));
+
+  /* no room left for the length, it goes in a block of its own */
+  if (used >= SHA1_KEY_BYTES - 8) {
+    sha1_compress(stream->state, block);
+    memset(block, 0, sizeof(block));
+  }
+
+  block[14] = (uint32_t)(bits >> 32);
+  block[15] = (uint32_t)bits;
+  sha1_compress(stream->state, block);
+
+  memcpy(digest, stream->state, sizeof(stream->state));
+  memset(block, 0, sizeof(block));
+}
+
+static void sha1_compress_bytes(uint32_t state[5], const uint8_t * bytes) {
+  uint32_t block[SHA1_BLOCK_WORDS];
+  size_t iterator;
+
+  for (iterator = 0; iterator < SHA1_BLOCK_WORDS; iterator++, bytes += 4) {
+    block[iterator] = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16
+                    | (uint32_t)bytes[2] << 8 | bytes[3];
+  }
+
+  sha1_compress(state, block);
 }
@@ -27,8 +27,51 @@
 #include <stdint.h>
 
 #define HMAC_SHA1_MAC_BYTES 20
+#define HMAC_SHA1_MAC_WORDS 5
+
+/* precomputed HMAC key - the SHA1 chaining values after hashing the
+ * inner (key ^ ipad) and outer (key ^ opad) blocks */
+typedef struct hmac_sha1_key {
+  uint32_t innerState[5];
+  uint32_t outerState[5];
+} hmac_sha1_key;
+
+#define HMAC_SHA1_BLOCK_BYTES 64
+
+/* running SHA1 over byte input, resumable from any block boundary */
+typedef struct sha1_stream {
+  uint32_t state[5];
+  uint64_t length;
+  uint8_t buffer[HMAC_SHA1_BLOCK_BYTES];
+} sha1_stream;
+
+/* an HMAC in progress, started from a precomputed key so the pad blocks
+ * are never hashed again */
+typedef struct hmac_sha1_ctx {
+  sha1_stream inner;
+  uint32_t outerState[5];
+} hmac_sha1_ctx;
 
 void HMAC_SHA_1(uint8_t * outerResult, const uint8_t * key,
     size_t keyLength, const uint8_t * message, size_t messageLength);
 
+void hmac_sha1_init_key(hmac_sha1_key * keyCtx, const uint8_t * key,
+    size_t keyLength);
+
+void hmac_sha1_mac(uint8_t * outerResult, const hmac_sha1_key * keyCtx,
+    const uint8_t * message, size_t messageLength);
+
+/* incremental HMAC - begin copies the key, update may be called any number
+ * of times with any chunk sizes, final writes the MAC and wipes ctx */
+void hmac_sha1_begin(hmac_sha1_ctx * ctx, const hmac_sha1_key * keyCtx);
+
+void hmac_sha1_update(hmac_sha1_ctx * ctx, const uint8_t * data,
+    size_t length);
+
+void hmac_sha1_final(hmac_sha1_ctx * ctx, uint8_t * outerResult);
+
+/* HMAC of an 8 byte big endian counter, returned as big endian words */
+void hmac_sha1_counter(uint32_t * digest, const hmac_sha1_key * keyCtx,
+    uint64_t counter);
+
 #endif /* HMAC_SHA1_H_ */
@@ -0,0 +1,205 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "hmac_sha1_mb.h"
+
+/* external includes */
+#include <stddef.h>
+
+/* local SHA1 defines - See RFC 3174 */
+#define MB_PAD_WORD 0x80000000u
+#define MB_INNER_BITS ((64 + 8) * 8)
+#define MB_OUTER_BITS ((64 + 20) * 8)
+
+typedef void (*mb_kernel_fn)(uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+    const hmac_sha1_key * const * keys, const uint64_t * counters);
+
+typedef struct mb_engine {
+  size_t lanes;
+  mb_kernel_fn kernel;
+  int (*supported)(void);
+} mb_engine;
+
+#if defined(__GNUC__)
+
+/* helper macros shared by every kernel instance */
+#define MB_CONCAT_(a, b) a##b
+#define MB_CONCAT(a, b) MB_CONCAT_(a, b)
+#define MB_ROTL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+#define MB_SCHEDULE(w, t) \
+  (w[(t) & 15] = MB_ROTL(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] \
+                       ^ w[((t) + 2) & 15] ^ w[(t) & 15], 1))
+
+#define MB_STEP(f, k, wt) do { \
+    __typeof__(a) temp = MB_ROTL(a, 5) + (f) + e + (k) + (wt); \
+    e = d; d = c; c = MB_ROTL(b, 30); b = a; a = temp; \
+  } while (0)
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define MB_KERNEL sha1_mb_x16_avx512
+#define MB_LANES 16
+#define MB_TARGET __attribute__((target("avx512f")))
+#include "hmac_sha1_mb_kernel.h"
+#undef MB_KERNEL
+#undef MB_LANES
+#undef MB_TARGET
+
+#define MB_KERNEL sha1_mb_x8_avx2
+#define MB_LANES 8
+#define MB_TARGET __attribute__((target("avx2")))
+#include "hmac_sha1_mb_kernel.h"
+#undef MB_KERNEL
+#undef MB_LANES
+#undef MB_TARGET
+
+#define MB_KERNEL sha1_mb_x4_sse2
+#define MB_LANES 4
+#define MB_TARGET __attribute__((target("sse2")))
+#include "hmac_sha1_mb_kernel.h"
+#undef MB_KERNEL
+#undef MB_LANES
+#undef MB_TARGET
+
+static int cpu_has_avx512f(void) {
+  return __builtin_cpu_supports("avx512f");
+}
+
+static int cpu_has_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+static int cpu_has_sse2(void) {
+  return __builtin_cpu_supports("sse2");
+}
+
+/* widest first */
+static const mb_engine engines[] = {
+  { 16, sha1_mb_x16_avx512, cpu_has_avx512f },
+  { 8, sha1_mb_x8_avx2, cpu_has_avx2 },
+  { 4, sha1_mb_x4_sse2, cpu_has_sse2 }
+};
+
+#else /* other GCC targets - let the compiler map the vectors */
+
+#define MB_KERNEL sha1_mb_x4_generic
+#define MB_LANES 4
+#define MB_TARGET
+#include "hmac_sha1_mb_kernel.h"
+#undef MB_KERNEL
+#undef MB_LANES
+#undef MB_TARGET
+
+static int cpu_always(void) {
+  return 1;
+}
+
+static const mb_engine engines[] = {
+  { 4, sha1_mb_x4_generic, cpu_always }
+};
+
+#endif /* __x86_64__ || __i386__ */
+
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+#else /* no vector extensions, everything goes through the scalar kernel */
+
+static const mb_engine engines[1] = { { 0, NULL, NULL } };
+#define ENGINE_COUNT 0
+
+#endif /* __GNUC__ */
+
+/* bit n set when engines[n] may be used */
+static unsigned int usableEngines;
+
+static void select_engines(size_t maxLanes) {
+  unsigned int mask = 0;
+  size_t index;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+#endif
+
+  for (index = 0; index < ENGINE_COUNT; index++) {
+    if (engines[index].lanes <= maxLanes && engines[index].supported()) {
+      mask |= 1u << index;
+    }
+  }
+
+  usableEngines = mask;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+static void init_engines(void) {
+  select_engines(HMAC_SHA1_MB_MAX_LANES);
+}
+
+void hmac_sha1_counter_mb(uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+    const hmac_sha1_key * const * keys, const uint64_t * counters,
+    size_t count) {
+  size_t index;
+
+  /* feed full groups to the widest engine, then let narrower ones take
+   * what is left */
+  for (index = 0; index < ENGINE_COUNT; index++) {
+    const mb_engine *engine = &engines[index];
+
+    if (!(usableEngines & (1u << index))) {
+      continue;
+    }
+
+    while (count >= engine->lanes) {
+      engine->kernel(digests, keys, counters);
+      digests += engine->lanes;
+      keys += engine->lanes;
+      counters += engine->lanes;
+      count -= engine->lanes;
+    }
+  }
+
+  /* the tail is too short for any vector engine */
+  while (count--) {
+    hmac_sha1_counter(*digests++, *keys++, *counters++);
+  }
+}
+
+size_t hmac_sha1_mb_lanes(void) {
+  size_t index;
+
+  for (index = 0; index < ENGINE_COUNT; index++) {
+    if (usableEngines & (1u << index)) {
+      return engines[index].lanes;
+    }
+  }
+
+  return 1;
+}
+
+size_t hmac_sha1_mb_limit_lanes(size_t maxLanes) {
+  select_engines(maxLanes);
+
+  return hmac_sha1_mb_lanes();
+}
@@ -0,0 +1,48 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef HMAC_SHA1_MB_H_
+#define HMAC_SHA1_MB_H_
+
+/* local includes */
+#include "hmac_sha1.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+#define HMAC_SHA1_MB_MAX_LANES 16
+
+/* multi-buffer version of hmac_sha1_counter - computes count independent
+ * (key, counter) MACs, running as many as the CPU allows side by side */
+void hmac_sha1_counter_mb(uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+    const hmac_sha1_key * const * keys, const uint64_t * counters,
+    size_t count);
+
+/* widest lane count in use (1 when no vector engine is available) */
+size_t hmac_sha1_mb_lanes(void);
+
+/* restrict the engine to at most maxLanes lanes, returns the width that is
+ * now in use - mainly for testing each engine on capable hardware */
+size_t hmac_sha1_mb_limit_lanes(size_t maxLanes);
+
+#endif /* HMAC_SHA1_MB_H_ */
@@ -0,0 +1,111 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/*
+ * Lane-parallel HMAC-SHA1 counter kernel. This file has no include guard -
+ * hmac_sha1_mb.c includes it once per lane width with MB_KERNEL, MB_LANES
+ * and MB_TARGET defined, and each lane of a GCC vector holds one message.
+ */
+
+#define MB_VEC MB_CONCAT(MB_KERNEL, _vec)
+#define MB_COMPRESS MB_CONCAT(MB_KERNEL, _compress)
+
+typedef uint32_t MB_VEC __attribute__((vector_size(MB_LANES * 4)));
+
+static inline MB_TARGET void MB_COMPRESS(MB_VEC *state, MB_VEC *w) {
+  MB_VEC a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  int t;
+
+  for (t = 0; t < 16; t++) {
+    MB_STEP((b & c) | (~b & d), 0x5a827999, w[t]);
+  }
+  for (; t < 20; t++) {
+    MB_STEP((b & c) | (~b & d), 0x5a827999, MB_SCHEDULE(w, t));
+  }
+  for (; t < 40; t++) {
+    MB_STEP(b ^ c ^ d, 0x6ed9eba1, MB_SCHEDULE(w, t));
+  }
+  for (; t < 60; t++) {
+    MB_STEP((b & c) | (d & (b | c)), 0x8f1bbcdc, MB_SCHEDULE(w, t));
+  }
+  for (; t < 80; t++) {
+    MB_STEP(b ^ c ^ d, 0xca62c1d6, MB_SCHEDULE(w, t));
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+static MB_TARGET void MB_KERNEL(uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+    const hmac_sha1_key * const * keys, const uint64_t * counters) {
+  const MB_VEC zero = { 0 };
+  MB_VEC state[HMAC_SHA1_MAC_WORDS];
+  MB_VEC w[16];
+  int lane;
+  int word;
+
+  /* transpose the inner midstates and counters into lanes */
+  for (word = 0; word < 16; word++) {
+    w[word] = zero;
+  }
+  for (lane = 0; lane < MB_LANES; lane++) {
+    for (word = 0; word < HMAC_SHA1_MAC_WORDS; word++) {
+      state[word][lane] = keys[lane]->innerState[word];
+    }
+    w[0][lane] = (uint32_t)(counters[lane] >> 32);
+    w[1][lane] = (uint32_t)counters[lane];
+  }
+
+  /* perform inner hash */
+  w[2] = zero + MB_PAD_WORD;
+  w[15] = zero + MB_INNER_BITS;
+  MB_COMPRESS(state, w);
+
+  /* perform outer hash */
+  for (word = 0; word < HMAC_SHA1_MAC_WORDS; word++) {
+    w[word] = state[word];
+  }
+  w[5] = zero + MB_PAD_WORD;
+  for (word = 6; word < 15; word++) {
+    w[word] = zero;
+  }
+  w[15] = zero + MB_OUTER_BITS;
+  for (lane = 0; lane < MB_LANES; lane++) {
+    for (word = 0; word < HMAC_SHA1_MAC_WORDS; word++) {
+      state[word][lane] = keys[lane]->outerState[word];
+    }
+  }
+  MB_COMPRESS(state, w);
+
+  /* transpose the lanes back out */
+  for (lane = 0; lane < MB_LANES; lane++) {
+    for (word = 0; word < HMAC_SHA1_MAC_WORDS; word++) {
+      digests[lane][word] = state[word][lane];
+    }
+  }
+}
+
+#undef MB_COMPRESS
+#undef MB_VEC
@@ -0,0 +1,233 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "hmac_sha256.h"
+#include "sha256_backend.h"
+
+/* external includes; */
+#include <string.h>
+
+/* local SHA256 defines - See RFC 6234 */
+#define INNER_PAD_WORD 0x36363636
+#define OUTER_PAD_WORD 0x5c5c5c5c
+#define SHA256_DIGEST_BYTES 32
+#define SHA256_KEY_BYTES 64
+#define SHA256_BLOCK_WORDS 16
+#define SHA256_PAD_WORD 0x80000000
+
+static const uint32_t sha256InitialState[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* internal helper function definitions */
+static void sha256_stream_begin(sha256_stream * stream,
+    const uint32_t state[8], uint64_t length);
+static void sha256_stream_update(sha256_stream * stream, const uint8_t * data,
+    size_t length);
+static void sha256_stream_final(sha256_stream * stream, uint32_t * digest);
+static void sha256_compress_bytes(uint32_t state[8], const uint8_t * bytes);
+
+/* implement HMAC (https://tools.ietf.org/html/rfc2104) for sha256 */
+void HMAC_SHA_256(uint8_t * outerResult, const uint8_t * key,
+    size_t keyLength, const uint8_t * message, size_t messageLength) {
+  hmac_sha256_key keyCtx;
+
+  hmac_sha256_init_key(&keyCtx, key, keyLength);
+  hmac_sha256_mac(outerResult, &keyCtx, message, messageLength);
+
+  memset(&keyCtx, 0, sizeof(keyCtx));
+}
+
+/* hash the padded key blocks once so they can be reused for every message */
+void hmac_sha256_init_key(hmac_sha256_key * keyCtx, const uint8_t * key,
+    size_t keyLength) {
+  uint32_t keyBlock[SHA256_BLOCK_WORDS] = { 0 };
+  uint32_t padBlock[SHA256_BLOCK_WORDS];
+  size_t iterator;
+
+  /* the key can't be longer than the block length */
+  if (keyLength > SHA256_KEY_BYTES) {
+    sha256_stream keyStream;
+    sha256_stream_begin(&keyStream, sha256InitialState, 0);
+    sha256_stream_update(&keyStream, key, keyLength);
+    sha256_stream_final(&keyStream, keyBlock);
+    memset(&keyStream, 0, sizeof(keyStream));
+  } else {
+    for (iterator = 0; iterator < keyLength; iterator++) {
+      keyBlock[iterator / 4] |= (uint32_t)key[iterator] << (24 - 8 * (iterator % 4));
+    }
+  }
+
+  /* XOR key with the pad words and keep the chaining value of each block */
+  for (iterator = 0; iterator < SHA256_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ INNER_PAD_WORD;
+  }
+  memcpy(keyCtx->innerState, sha256InitialState, sizeof(keyCtx->innerState));
+  sha256_compress(keyCtx->innerState, padBlock);
+
+  for (iterator = 0; iterator < SHA256_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ OUTER_PAD_WORD;
+  }
+  memcpy(keyCtx->outerState, sha256InitialState, sizeof(keyCtx->outerState));
+  sha256_compress(keyCtx->outerState, padBlock);
+
+  /* don't leave key material on the stack */
+  memset(keyBlock, 0, sizeof(keyBlock));
+  memset(padBlock, 0, sizeof(padBlock));
+}
+
+/* HMAC over a precomputed key - costs only the message and final blocks */
+void hmac_sha256_mac(uint8_t * outerResult, const hmac_sha256_key * keyCtx,
+    const uint8_t * message, size_t messageLength) {
+  hmac_sha256_ctx ctx;
+
+  hmac_sha256_begin(&ctx, keyCtx);
+  hmac_sha256_update(&ctx, message, messageLength);
+  hmac_sha256_final(&ctx, outerResult);
+}
+
+void hmac_sha256_begin(hmac_sha256_ctx * ctx, const hmac_sha256_key * keyCtx) {
+  sha256_stream_begin(&ctx->inner, keyCtx->innerState, SHA256_KEY_BYTES);
+  memcpy(ctx->outerState, keyCtx->outerState, sizeof(ctx->outerState));
+}
+
+void hmac_sha256_update(hmac_sha256_ctx * ctx, const uint8_t * data,
+    size_t length) {
+  sha256_stream_update(&ctx->inner, data, length);
+}
+
+void hmac_sha256_final(hmac_sha256_ctx * ctx, uint8_t * outerResult) {
+  uint32_t block[SHA256_BLOCK_WORDS] = { 0 };
+  size_t iterator;
+
+  /* finish the inner hash, its digest becomes the start of the outer block */
+  sha256_stream_final(&ctx->inner, block);
+
+  /* perform outer hash */
+  block[8] = SHA256_PAD_WORD;
+  block[15] = (SHA256_KEY_BYTES + SHA256_DIGEST_BYTES) * 8;
+  sha256_compress(ctx->outerState, block);
+
+  for (iterator = 0; iterator < HMAC_SHA256_MAC_BYTES; iterator++) {
+    outerResult[iterator] = (uint8_t)(ctx->outerState[iterator / 4] >> (24 - 8 * (iterator % 4)));
+  }
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+/* the counter message is always a single block after the inner pad, so both
+ * padded blocks can be laid out directly as words */
+void hmac_sha256_counter(uint32_t * digest, const hmac_sha256_key * keyCtx,
+    uint64_t counter) {
+  uint32_t block[SHA256_BLOCK_WORDS] = {
+    (uint32_t)(counter >> 32), (uint32_t)counter, SHA256_PAD_WORD
+  };
+
+  /* perform inner hash */
+  block[15] = (SHA256_KEY_BYTES + sizeof(counter)) * 8;
+  memcpy(digest, keyCtx->innerState, sizeof(keyCtx->innerState));
+  sha256_compress(digest, block);
+
+  /* perform outer hash */
+  memcpy(block, digest, HMAC_SHA256_MAC_BYTES);
+  block[8] = SHA256_PAD_WORD;
+  block[15] = (SHA256_KEY_BYTES + SHA256_DIGEST_BYTES) * 8;
+  memcpy(digest, keyCtx->outerState, sizeof(keyCtx->outerState));
+  sha256_compress(digest, block);
+}
+
+static void sha256_stream_begin(sha256_stream * stream,
+    const uint32_t state[8], uint64_t length) {
+  memcpy(stream->state, state, sizeof(stream->state));
+  stream->length = length;
+}
+
+static void sha256_stream_update(sha256_stream * stream, const uint8_t * data,
+    size_t length) {
+  size_t used = stream->length % SHA256_KEY_BYTES;
+
+  stream->length += length;
+
+  /* top up a partially filled buffer first */
+  if (used) {
+    size_t fill = SHA256_KEY_BYTES - used;
+
+    if (length < fill) {
+      memcpy(stream->buffer + used, data, length);
+      return;
+    }
+
+    memcpy(stream->buffer + used, data, fill);
+    sha256_compress_bytes(stream->state, stream->buffer);
+    data += fill;
+    length -= fill;
+  }
+
+  /* whole blocks are hashed straight from the input */
+  while (length >= SHA256_KEY_BYTES) {
+    sha256_compress_bytes(stream->state, data);
+    data += SHA256_KEY_BYTES;
+    length -= SHA256_KEY_BYTES;
+  }
+
+  memcpy(stream->buffer, data, length);
+}
+
+/* pad the remaining bytes (RFC 6234 section 4.1) and write the digest words */
+static void sha256_stream_final(sha256_stream * stream, uint32_t * digest) {
+  uint32_t block[SHA256_BLOCK_WORDS] = { 0 };
+  size_t used = stream->length % SHA256_KEY_BYTES;
+  uint64_t bits = stream->length * 8;
+  size_t iterator;
+
+  for (iterator = 0; iterator < used; iterator++) {
+    block[iterator / 4] |= (uint32_t)stream->buffer[iterator] << (24 - 8 * (iterator % 4));
+  }
+  block[used / 4] |= (uint32_t)0x80 << (24 - 8 * (used % 4));
+
+  /* no room left for the length, it goes in a block of its own */
+  if (used >= SHA256_KEY_BYTES - 8) {
+    sha256_compress(stream->state, block);
+    memset(block, 0, sizeof(block));
+  }
+
+  block[14] = (uint32_t)(bits >> 32);
+  block[15] = (uint32_t)bits;
+  sha256_compress(stream->state, block);
+
+  memcpy(digest, stream->state, sizeof(stream->state));
+  memset(block, 0, sizeof(block));
+}
+
+static void sha256_compress_bytes(uint32_t state[8], const uint8_t * bytes) {
+  uint32_t block[SHA256_BLOCK_WORDS];
+  size_t iterator;
+
+  for (iterator = 0; iterator < SHA256_BLOCK_WORDS; iterator++, bytes += 4) {
+    block[iterator] = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16
+                    | (uint32_t)bytes[2] << 8 | bytes[3];
+  }
+
+  sha256_compress(state, block);
+}
@@ -0,0 +1,78 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef HMAC_SHA256_H_
+#define HMAC_SHA256_H_
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+#define HMAC_SHA256_MAC_BYTES 32
+#define HMAC_SHA256_MAC_WORDS 8
+
+/* precomputed HMAC key - the SHA256 chaining values after hashing the
+ * inner (key ^ ipad) and outer (key ^ opad) blocks */
+typedef struct hmac_sha256_key {
+  uint32_t innerState[8];
+  uint32_t outerState[8];
+} hmac_sha256_key;
+
+#define HMAC_SHA256_BLOCK_BYTES 64
+
+/* running SHA256 over byte input, resumable from any block boundary */
+typedef struct sha256_stream {
+  uint32_t state[8];
+  uint64_t length;
+  uint8_t buffer[HMAC_SHA256_BLOCK_BYTES];
+} sha256_stream;
+
+/* an HMAC in progress, started from a precomputed key so the pad blocks
+ * are never hashed again */
+typedef struct hmac_sha256_ctx {
+  sha256_stream inner;
+  uint32_t outerState[8];
+} hmac_sha256_ctx;
+
+void HMAC_SHA_256(uint8_t * outerResult, const uint8_t * key,
+    size_t keyLength, const uint8_t * message, size_t messageLength);
+
+void hmac_sha256_init_key(hmac_sha256_key * keyCtx, const uint8_t * key,
+    size_t keyLength);
+
+void hmac_sha256_mac(uint8_t * outerResult, const hmac_sha256_key * keyCtx,
+    const uint8_t * message, size_t messageLength);
+
+/* incremental HMAC - begin copies the key, update may be called any number
+ * of times with any chunk sizes, final writes the MAC and wipes ctx */
+void hmac_sha256_begin(hmac_sha256_ctx * ctx, const hmac_sha256_key * keyCtx);
+
+void hmac_sha256_update(hmac_sha256_ctx * ctx, const uint8_t * data,
+    size_t length);
+
+void hmac_sha256_final(hmac_sha256_ctx * ctx, uint8_t * outerResult);
+
+/* HMAC of an 8 byte big endian counter, returned as big endian words */
+void hmac_sha256_counter(uint32_t * digest, const hmac_sha256_key * keyCtx,
+    uint64_t counter);
+
+#endif /* HMAC_SHA256_H_ */
@@ -0,0 +1,328 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "hmac_sha512.h"
+
+/* external includes; */
+#include <string.h>
+
+/* local SHA512 defines - See RFC 6234 */
+#define INNER_PAD_WORD UINT64_C(0x3636363636363636)
+#define OUTER_PAD_WORD UINT64_C(0x5c5c5c5c5c5c5c5c)
+#define SHA512_DIGEST_BYTES 64
+#define SHA512_KEY_BYTES 128
+#define SHA512_BLOCK_WORDS 16
+#define SHA512_PAD_WORD UINT64_C(0x8000000000000000)
+
+/* local helper macros */
+#define ROTR64(value, bits) (((value) >> (bits)) | ((value) << (64 - (bits))))
+
+/* SHA512 functions (https://tools.ietf.org/html/rfc6234#section-5.2) */
+#define SHA512_CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define SHA512_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA512_BSIG0(x) (ROTR64(x, 28) ^ ROTR64(x, 34) ^ ROTR64(x, 39))
+#define SHA512_BSIG1(x) (ROTR64(x, 14) ^ ROTR64(x, 18) ^ ROTR64(x, 41))
+#define SHA512_SSIG0(x) (ROTR64(x, 1) ^ ROTR64(x, 8) ^ ((x) >> 7))
+#define SHA512_SSIG1(x) (ROTR64(x, 19) ^ ROTR64(x, 61) ^ ((x) >> 6))
+
+#define SHA512_SCHEDULE(w, t) \
+  (w[(t) & 15] += SHA512_SSIG1(w[((t) + 14) & 15]) + w[((t) + 9) & 15] \
+                + SHA512_SSIG0(w[((t) + 1) & 15]))
+
+static const uint64_t sha512InitialState[8] = {
+  UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+  UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+  UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+  UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)
+};
+
+static const uint64_t sha512K[80] = {
+  UINT64_C(0x428a2f98d728ae22), UINT64_C(0x7137449123ef65cd),
+  UINT64_C(0xb5c0fbcfec4d3b2f), UINT64_C(0xe9b5dba58189dbbc),
+  UINT64_C(0x3956c25bf348b538), UINT64_C(0x59f111f1b605d019),
+  UINT64_C(0x923f82a4af194f9b), UINT64_C(0xab1c5ed5da6d8118),
+  UINT64_C(0xd807aa98a3030242), UINT64_C(0x12835b0145706fbe),
+  UINT64_C(0x243185be4ee4b28c), UINT64_C(0x550c7dc3d5ffb4e2),
+  UINT64_C(0x72be5d74f27b896f), UINT64_C(0x80deb1fe3b1696b1),
+  UINT64_C(0x9bdc06a725c71235), UINT64_C(0xc19bf174cf692694),
+  UINT64_C(0xe49b69c19ef14ad2), UINT64_C(0xefbe4786384f25e3),
+  UINT64_C(0x0fc19dc68b8cd5b5), UINT64_C(0x240ca1cc77ac9c65),
+  UINT64_C(0x2de92c6f592b0275), UINT64_C(0x4a7484aa6ea6e483),
+  UINT64_C(0x5cb0a9dcbd41fbd4), UINT64_C(0x76f988da831153b5),
+  UINT64_C(0x983e5152ee66dfab), UINT64_C(0xa831c66d2db43210),
+  UINT64_C(0xb00327c898fb213f), UINT64_C(0xbf597fc7beef0ee4),
+  UINT64_C(0xc6e00bf33da88fc2), UINT64_C(0xd5a79147930aa725),
+  UINT64_C(0x06ca6351e003826f), UINT64_C(0x142929670a0e6e70),
+  UINT64_C(0x27b70a8546d22ffc), UINT64_C(0x2e1b21385c26c926),
+  UINT64_C(0x4d2c6dfc5ac42aed), UINT64_C(0x53380d139d95b3df),
+  UINT64_C(0x650a73548baf63de), UINT64_C(0x766a0abb3c77b2a8),
+  UINT64_C(0x81c2c92e47edaee6), UINT64_C(0x92722c851482353b),
+  UINT64_C(0xa2bfe8a14cf10364), UINT64_C(0xa81a664bbc423001),
+  UINT64_C(0xc24b8b70d0f89791), UINT64_C(0xc76c51a30654be30),
+  UINT64_C(0xd192e819d6ef5218), UINT64_C(0xd69906245565a910),
+  UINT64_C(0xf40e35855771202a), UINT64_C(0x106aa07032bbd1b8),
+  UINT64_C(0x19a4c116b8d2d0c8), UINT64_C(0x1e376c085141ab53),
+  UINT64_C(0x2748774cdf8eeb99), UINT64_C(0x34b0bcb5e19b48a8),
+  UINT64_C(0x391c0cb3c5c95a63), UINT64_C(0x4ed8aa4ae3418acb),
+  UINT64_C(0x5b9cca4f7763e373), UINT64_C(0x682e6ff3d6b2b8a3),
+  UINT64_C(0x748f82ee5defb2fc), UINT64_C(0x78a5636f43172f60),
+  UINT64_C(0x84c87814a1f0ab72), UINT64_C(0x8cc702081a6439ec),
+  UINT64_C(0x90befffa23631e28), UINT64_C(0xa4506cebde82bde9),
+  UINT64_C(0xbef9a3f7b2c67915), UINT64_C(0xc67178f2e372532b),
+  UINT64_C(0xca273eceea26619c), UINT64_C(0xd186b8c721c0c207),
+  UINT64_C(0xeada7dd6cde0eb1e), UINT64_C(0xf57d4f7fee6ed178),
+  UINT64_C(0x06f067aa72176fba), UINT64_C(0x0a637dc5a2c898a6),
+  UINT64_C(0x113f9804bef90dae), UINT64_C(0x1b710b35131c471b),
+  UINT64_C(0x28db77f523047d84), UINT64_C(0x32caab7b40c72493),
+  UINT64_C(0x3c9ebe0a15c9bebc), UINT64_C(0x431d67c49c100d4c),
+  UINT64_C(0x4cc5d4becb3e42b6), UINT64_C(0x597f299cfc657e2a),
+  UINT64_C(0x5fcb6fab3ad6faec), UINT64_C(0x6c44198c4a475817)
+};
+
+/* internal helper function definitions */
+static void sha512_compress(uint64_t state[8], const uint64_t block[16]);
+static void sha512_stream_begin(sha512_stream * stream,
+    const uint64_t state[8], uint64_t length);
+static void sha512_stream_update(sha512_stream * stream, const uint8_t * data,
+    size_t length);
+static void sha512_stream_final(sha512_stream * stream, uint64_t * digest);
+static void sha512_compress_bytes(uint64_t state[8], const uint8_t * bytes);
+
+/* implement HMAC (https://tools.ietf.org/html/rfc2104) for sha512 */
+void HMAC_SHA_512(uint8_t * outerResult, const uint8_t * key,
+    size_t keyLength, const uint8_t * message, size_t messageLength) {
+  hmac_sha512_key keyCtx;
+
+  hmac_sha512_init_key(&keyCtx, key, keyLength);
+  hmac_sha512_mac(outerResult, &keyCtx, message, messageLength);
+
+  memset(&keyCtx, 0, sizeof(keyCtx));
+}
+
+/* hash the padded key blocks once so they can be reused for every message */
+void hmac_sha512_init_key(hmac_sha512_key * keyCtx, const uint8_t * key,
+    size_t keyLength) {
+  uint64_t keyBlock[SHA512_BLOCK_WORDS] = { 0 };
+  uint64_t padBlock[SHA512_BLOCK_WORDS];
+  size_t iterator;
+
+  /* the key can't be longer than the block length */
+  if (keyLength > SHA512_KEY_BYTES) {
+    sha512_stream keyStream;
+    sha512_stream_begin(&keyStream, sha512InitialState, 0);
+    sha512_stream_update(&keyStream, key, keyLength);
+    sha512_stream_final(&keyStream, keyBlock);
+    memset(&keyStream, 0, sizeof(keyStream));
+  } else {
+    for (iterator = 0; iterator < keyLength; iterator++) {
+      keyBlock[iterator / 8] |= (uint64_t)key[iterator] << (56 - 8 * (iterator % 8));
+    }
+  }
+
+  /* XOR key with the pad words and keep the chaining value of each block */
+  for (iterator = 0; iterator < SHA512_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ INNER_PAD_WORD;
+  }
+  memcpy(keyCtx->innerState, sha512InitialState, sizeof(keyCtx->innerState));
+  sha512_compress(keyCtx->innerState, padBlock);
+
+  for (iterator = 0; iterator < SHA512_BLOCK_WORDS; iterator++) {
+    padBlock[iterator] = keyBlock[iterator] ^ OUTER_PAD_WORD;
+  }
+  memcpy(keyCtx->outerState, sha512InitialState, sizeof(keyCtx->outerState));
+  sha512_compress(keyCtx->outerState, padBlock);
+
+  /* don't leave key material on the stack */
+  memset(keyBlock, 0, sizeof(keyBlock));
+  memset(padBlock, 0, sizeof(padBlock));
+}
+
+/* HMAC over a precomputed key - costs only the message and final blocks */
+void hmac_sha512_mac(uint8_t * outerResult, const hmac_sha512_key * keyCtx,
+    const uint8_t * message, size_t messageLength) {
+  hmac_sha512_ctx ctx;
+
+  hmac_sha512_begin(&ctx, keyCtx);
+  hmac_sha512_update(&ctx, message, messageLength);
+  hmac_sha512_final(&ctx, outerResult);
+}
+
+void hmac_sha512_begin(hmac_sha512_ctx * ctx, const hmac_sha512_key * keyCtx) {
+  sha512_stream_begin(&ctx->inner, keyCtx->innerState, SHA512_KEY_BYTES);
+  memcpy(ctx->outerState, keyCtx->outerState, sizeof(ctx->outerState));
+}
+
+void hmac_sha512_update(hmac_sha512_ctx * ctx, const uint8_t * data,
+    size_t length) {
+  sha512_stream_update(&ctx->inner, data, length);
+}
+
+void hmac_sha512_final(hmac_sha512_ctx * ctx, uint8_t * outerResult) {
+  uint64_t block[SHA512_BLOCK_WORDS] = { 0 };
+  size_t iterator;
+
+  /* finish the inner hash, its digest becomes the start of the outer block */
+  sha512_stream_final(&ctx->inner, block);
+
+  /* perform outer hash */
+  block[8] = SHA512_PAD_WORD;
+  block[15] = (SHA512_KEY_BYTES + SHA512_DIGEST_BYTES) * 8;
+  sha512_compress(ctx->outerState, block);
+
+  for (iterator = 0; iterator < HMAC_SHA512_MAC_BYTES; iterator++) {
+    outerResult[iterator] = (uint8_t)(ctx->outerState[iterator / 8] >> (56 - 8 * (iterator % 8)));
+  }
+
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+/* the counter message is always a single block after the inner pad, so both
+ * padded blocks can be laid out directly as words */
+void hmac_sha512_counter(uint64_t * digest, const hmac_sha512_key * keyCtx,
+    uint64_t counter) {
+  uint64_t block[SHA512_BLOCK_WORDS] = { counter, SHA512_PAD_WORD };
+
+  /* perform inner hash */
+  block[15] = (SHA512_KEY_BYTES + sizeof(counter)) * 8;
+  memcpy(digest, keyCtx->innerState, sizeof(keyCtx->innerState));
+  sha512_compress(digest, block);
+
+  /* perform outer hash */
+  memcpy(block, digest, HMAC_SHA512_MAC_BYTES);
+  block[8] = SHA512_PAD_WORD;
+  block[15] = (SHA512_KEY_BYTES + SHA512_DIGEST_BYTES) * 8;
+  memcpy(digest, keyCtx->outerState, sizeof(keyCtx->outerState));
+  sha512_compress(digest, block);
+}
+
+/* SHA512 compression (https://tools.ietf.org/html/rfc6234#section-6.4).
+ * the 64 bit rounds are already quick on 64 bit cores, there is no
+ * instruction set backend */
+static void sha512_compress(uint64_t state[8], const uint64_t block[16]) {
+  uint64_t w[16];
+  uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+  uint64_t temp1;
+  uint64_t temp2;
+  int t;
+
+  for (t = 0; t < 80; t++) {
+    if (t < 16) {
+      w[t] = block[t];
+    } else {
+      SHA512_SCHEDULE(w, t);
+    }
+
+    temp1 = h + SHA512_BSIG1(e) + SHA512_CH(e, f, g) + sha512K[t] + w[t & 15];
+    temp2 = SHA512_BSIG0(a) + SHA512_MAJ(a, b, c);
+    h = g; g = f; f = e; e = d + temp1;
+    d = c; c = b; b = a; a = temp1 + temp2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+static void sha512_stream_begin(sha512_stream * stream,
+    const uint64_t state[8], uint64_t length) {
+  memcpy(stream->state, state, sizeof(stream->state));
+  stream->length = length;
+}
+
+static void sha512_stream_update(sha512_stream * stream, const uint8_t * data,
+    size_t length) {
+  size_t used = stream->length % SHA512_KEY_BYTES;
+
+  stream->length += length;
+
+  /* top up a partially filled buffer first */
+  if (used) {
+    size_t fill = SHA512_KEY_BYTES - used;
+
+    if (length < fill) {
+      memcpy(stream->buffer + used, data, length);
+      return;
+    }
+
+    memcpy(stream->buffer + used, data, fill);
+    sha512_compress_bytes(stream->state, stream->buffer);
+    data += fill;
+    length -= fill;
+  }
+
+  /* whole blocks are hashed straight from the input */
+  while (length >= SHA512_KEY_BYTES) {
+    sha512_compress_bytes(stream->state, data);
+    data += SHA512_KEY_BYTES;
+    length -= SHA512_KEY_BYTES;
+  }
+
+  memcpy(stream->buffer, data, length);
+}
+
+/* pad the remaining bytes (RFC 6234 section 4.2) and write the digest
+ * words. lengths stay below 2^64 bits so the top length word is zero */
+static void sha512_stream_final(sha512_stream * stream, uint64_t * digest) {
+  uint64_t block[SHA512_BLOCK_WORDS] = { 0 };
+  size_t used = stream->length % SHA512_KEY_BYTES;
+  uint64_t bits = stream->length * 8;
+  size_t iterator;
+
+  for (iterator = 0; iterator < used; iterator++) {
+    block[iterator / 8] |= (uint64_t)stream->buffer[iterator] << (56 - 8 * (iterator % 8));
+  }
+  block[used / 8] |= (uint64_t)0x80 << (56 - 8 * (used % 8));
+
+  /* no room left for the length, it goes in a block of its own */
+  if (used >= SHA512_KEY_BYTES - 16) {
+    sha512_compress(stream->state, block);
+    memset(block, 0, sizeof(block));
+  }
+
+  block[15] = bits;
+  sha512_compress(stream->state, block);
+
+  memcpy(digest, stream->state, sizeof(stream->state));
+  memset(block, 0, sizeof(block));
+}
+
+static void sha512_compress_bytes(uint64_t state[8], const uint8_t * bytes) {
+  uint64_t block[SHA512_BLOCK_WORDS];
+  size_t iterator;
+  size_t byte;
+
+  for (iterator = 0; iterator < SHA512_BLOCK_WORDS; iterator++) {
+    block[iterator] = 0;
+    for (byte = 0; byte < 8; byte++) {
+      block[iterator] = block[iterator] << 8 | *bytes++;
+    }
+  }
+
+  sha512_compress(state, block);
+}
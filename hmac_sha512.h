@@ -0,0 +1,79 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef HMAC_SHA512_H_
+#define HMAC_SHA512_H_
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+#define HMAC_SHA512_MAC_BYTES 64
+#define HMAC_SHA512_MAC_WORDS 8
+
+/* precomputed HMAC key - the SHA512 chaining values after hashing the
+ * inner (key ^ ipad) and outer (key ^ opad) blocks */
+typedef struct hmac_sha512_key {
+  uint64_t innerState[8];
+  uint64_t outerState[8];
+} hmac_sha512_key;
+
+#define HMAC_SHA512_BLOCK_BYTES 128
+
+/* running SHA512 over byte input, resumable from any block boundary */
+typedef struct sha512_stream {
+  uint64_t state[8];
+  uint64_t length;
+  uint8_t buffer[HMAC_SHA512_BLOCK_BYTES];
+} sha512_stream;
+
+/* an HMAC in progress, started from a precomputed key so the pad blocks
+ * are never hashed again */
+typedef struct hmac_sha512_ctx {
+  sha512_stream inner;
+  uint64_t outerState[8];
+} hmac_sha512_ctx;
+
+void HMAC_SHA_512(uint8_t * outerResult, const uint8_t * key,
+    size_t keyLength, const uint8_t * message, size_t messageLength);
+
+void hmac_sha512_init_key(hmac_sha512_key * keyCtx, const uint8_t * key,
+    size_t keyLength);
+
+void hmac_sha512_mac(uint8_t * outerResult, const hmac_sha512_key * keyCtx,
+    const uint8_t * message, size_t messageLength);
+
+/* incremental HMAC - begin copies the key, update may be called any number
+ * of times with any chunk sizes, final writes the MAC and wipes ctx */
+void hmac_sha512_begin(hmac_sha512_ctx * ctx, const hmac_sha512_key * keyCtx);
+
+void hmac_sha512_update(hmac_sha512_ctx * ctx, const uint8_t * data,
+    size_t length);
+
+void hmac_sha512_final(hmac_sha512_ctx * ctx, uint8_t * outerResult);
+
+/* HMAC of an 8 byte big endian counter, returned as big endian 64 bit
+ * words */
+void hmac_sha512_counter(uint64_t * digest, const hmac_sha512_key * keyCtx,
+    uint64_t counter);
+
+#endif /* HMAC_SHA512_H_ */
@@ -24,56 +24,149 @@
 
 /* local includes */
 #include "hmac_sha1.h"
+#include "hmac_sha1_mb.h"
+#include "hmac_sha256.h"
+#include "hmac_sha512.h"
+#include "otp_arena.h"
+#include "otp_metrics.h"
+
+/* external includes */
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TRUNCATE_HAVE_SSSE3
+#endif
+
+/* window slots hashed per batch, one bit each in the match mask */
+#define WINDOW_CHUNK 64
+
+/* prefetch the next group's secrets while the current one hashes */
+#if defined(__GNUC__)
+#define OTP_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define OTP_PREFETCH(address) ((void)(address))
+#endif
+
+/* keys and steps of one hotp_matrix_ctx tile. a tile's key schedules and
+ * output rows (16 keys by 256 codes, 16KiB) stay in L1/L2 while it is
+ * hashed */
+#define MATRIX_KEYS HMAC_SHA1_MB_MAX_LANES
+#define MATRIX_STEPS 256
+
+/* code % 10^digits is code - (code * reciprocal >> shift) * 10^digits,
+ * exact for every 31 bit code. ten digits keep the whole code */
+static const uint32_t digitModulus[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+  0
+};
+
+static const uint32_t digitReciprocal[] = {
+  0x80000000, 0xcccccccd, 0xa3d70a3e, 0x83126e98, 0xd1b71759, 0xa7c5ac48,
+  0x8637bd06, 0xd6bf94d6, 0xabcc7712, 0x89705f42, 0
+};
+
+static const uint8_t digitShift[] = {
+  31, 35, 38, 41, 45, 48, 51, 55, 58, 61, 0
+};
+
+/* "00" to "99" for rendering two digits at a time */
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+#ifdef TRUNCATE_HAVE_SSSE3
+/* pshufb controls gathering the four big endian bytes at a digest offset
+ * into one lane. digests at offsets 4 and up are loaded from their second
+ * word so the bytes always fall inside the sixteen loaded */
+static uint8_t truncateShuffles[4][16][16] __attribute__((aligned(16)));
+static int truncateSimd;
+#endif
 
 /* internal helper function definitions */
-static int pow10(unsigned int power);
-static void *memset(void *ptr, int value, size_t length);
+static uint32_t hotp_truncate(const uint32_t *digest, size_t words);
+static uint32_t hotp_truncate_wide(const uint64_t *digest);
+static uint32_t truncate_digits(uint32_t code, unsigned int digits);
+static void hash_codes(uint32_t *codes, const otp_key *const *keys,
+                       const uint64_t *counters, size_t count,
+                       unsigned int digits);
+static void render_code(char *text, uint32_t code);
+#ifdef TRUNCATE_HAVE_SSSE3
+static size_t truncate_many_ssse3(
+    const uint32_t (*digests)[HMAC_SHA1_MAC_WORDS], size_t count,
+    unsigned int digits, uint32_t *codes);
+#endif
+static void validate_group(const uint8_t *secrets, const size_t *secretOffsets,
+                           const uint64_t *counters, const uint32_t *guesses,
+                           const uint8_t *guessDigits, size_t count,
+                           OTP_VALIDATE_RESULT *results);
+static int64_t next_window_offset(uint64_t *sequence, int64_t lowest,
+                                  int64_t highest);
 
-uint32_t hotp(const hotp_state * state) {
-  uint8_t hmacKey[8];
-  uint8_t hmacResult[HMAC_SHA1_MAC_BYTES];
-  size_t iterator;
-  uint64_t counter = state->counter;
+void otp_key_init(otp_key *key, const uint8_t *secret, size_t secretLength) {
+  otp_key_init_algorithm(key, OTP_SHA1, secret, secretLength);
+}
 
-  for (iterator = 8; iterator--; counter >>= 8) {
-    hmacKey[iterator] = counter;
+int otp_key_init_algorithm(otp_key *key, OTP_ALGORITHM algorithm,
+                           const uint8_t *secret, size_t secretLength) {
+  switch (algorithm) {
+    case OTP_SHA1:
+      hmac_sha1_init_key(&key->hmac.sha1, secret, secretLength);
+      break;
+    case OTP_SHA256:
+      hmac_sha256_init_key(&key->hmac.sha256, secret, secretLength);
+      break;
+    case OTP_SHA512:
+      hmac_sha512_init_key(&key->hmac.sha512, secret, secretLength);
+      break;
+    default:
+      return -1;
   }
+  key->algorithm = algorithm;
 
-  HMAC_SHA_1( hmacResult, state->secret, state->secretLength,
-              hmacKey, sizeof(hmacKey));
+  return 0;
+}
 
-  size_t offset = hmacResult[HMAC_SHA1_MAC_BYTES-1] & 0xf;
-  uint32_t bin_code = (hmacResult[offset] & 0x7f) << 24
-                    | (hmacResult[offset + 1] & 0xff) << 16
-                    | (hmacResult[offset + 2] & 0xff) << 8
-                    | (hmacResult[offset + 3] & 0xff);
+void otp_key_clear(otp_key *key) {
+  otp_secure_wipe(key, sizeof(*key));
+}
+
+uint32_t hotp(const hotp_state * state) {
+  otp_key key;
+  uint32_t bin_code;
 
-    memset(hmacKey, 0, sizeof(hmacKey));
-    memset(hmacResult, 0, sizeof(hmacResult));
+  otp_key_init(&key, state->secret, state->secretLength);
+  bin_code = hotp_ctx(&key, state->counter);
+  otp_key_clear(&key);
 
-    return bin_code;
+  return bin_code;
 }
 
 OTP_VALIDATE_RESULT hotp_validate(const hotp_state * state, uint32_t guess, unsigned int guessDigits)
 {
-  uint32_t truncatedCode = hotp(state) % pow10(guessDigits);
+  otp_key key;
+  OTP_VALIDATE_RESULT result;
+
+  otp_key_init(&key, state->secret, state->secretLength);
+  result = hotp_validate_ctx(&key, state->counter, guess, guessDigits);
+  otp_key_clear(&key);
 
-  return guess == truncatedCode ? OTP_VALIDATE_SUCCESS : OTP_VALIDATE_FAILURE;
+  return result;
 }
 
 OTP_VALIDATE_RESULT hotp_validate_windows(  const hotp_state * state,uint32_t guess,
                                             unsigned int guessDigits, unsigned int windows) {
-  int64_t iterator;
+  otp_key key;
+  OTP_VALIDATE_RESULT result;
 
-  /* check each counter in the window and return validation success if found */
-  for (iterator = -( (windows-1)/2 ); iterator <= windows/2; iterator++) {
-    if( hotp_validate( state, guess+iterator, guessDigits) == OTP_VALIDATE_SUCCESS) {
-      return OTP_VALIDATE_SUCCESS;
-    }
-  }
+  otp_key_init(&key, state->secret, state->secretLength);
+  result = hotp_validate_windows_ctx(&key, state->counter, guess, guessDigits, windows);
+  otp_key_clear(&key);
 
-  /* the guess wasn't found in the window, return validation failure */
-  return OTP_VALIDATE_FAILURE;
+  return result;
 }
 
 uint32_t totp( const totp_state *timeState, unsigned int windowLength) {
@@ -106,24 +199,643 @@ OTP_VALIDATE_RESULT totp_validate_windows(const totp_state *timeState,
                              };
   return hotp_validate_windows(&counter_state, guess, guessDigits, windows);
 }
-static int pow10(unsigned int power)
-{
-  int result = 1;
-  while(power > 0) {
-    result *=10;
+
+uint32_t hotp_ctx(const otp_key *key, uint64_t counter) {
+  uint32_t digest[HMAC_SHA256_MAC_WORDS];
+  uint64_t wideDigest[HMAC_SHA512_MAC_WORDS];
+
+  OTP_METRICS_ADD(OTP_METRIC_HASHES, 1);
+
+  switch (key->algorithm) {
+    case OTP_SHA256:
+      hmac_sha256_counter(digest, &key->hmac.sha256, counter);
+      return hotp_truncate(digest, HMAC_SHA256_MAC_WORDS);
+    case OTP_SHA512:
+      hmac_sha512_counter(wideDigest, &key->hmac.sha512, counter);
+      return hotp_truncate_wide(wideDigest);
+    default:
+      hmac_sha1_counter(digest, &key->hmac.sha1, counter);
+      return hotp_truncate(digest, HMAC_SHA1_MAC_WORDS);
   }
+}
+
+OTP_VALIDATE_RESULT hotp_validate_ctx(const otp_key *key, uint64_t counter,
+                                      uint32_t guess,
+                                      unsigned int guessDigits) {
+  OTP_METRICS_START(start);
+  uint32_t truncatedCode = truncate_digits(hotp_ctx(key, counter), guessDigits);
+  OTP_VALIDATE_RESULT result = guess == truncatedCode ? OTP_VALIDATE_SUCCESS
+                                                      : OTP_VALIDATE_FAILURE;
+
+  OTP_METRICS_VALIDATED(result, 0, start);
+
   return result;
 }
 
-static void *memset( void *ptr, int value, size_t length)
+OTP_VALIDATE_RESULT hotp_validate_windows_ctx(const otp_key *key,
+                                              uint64_t counter,
+                                              uint32_t guess,
+                                              unsigned int guessDigits,
+                                              unsigned int windows) {
+  return hotp_find_window_ctx(key, counter, guess, guessDigits, windows, NULL);
+}
+
+OTP_VALIDATE_RESULT hotp_find_window_ctx(const otp_key *key, uint64_t counter,
+                                         uint32_t guess,
+                                         unsigned int guessDigits,
+                                         unsigned int windows,
+                                         int64_t *matchOffset) {
+  const otp_key *keys[WINDOW_CHUNK];
+  uint64_t counters[WINDOW_CHUNK];
+  int64_t offsets[WINDOW_CHUNK];
+  uint32_t codes[WINDOW_CHUNK];
+  int64_t lowest;
+  int64_t highest;
+  uint64_t sequence = 0;
+  uint64_t remaining;
+  uint64_t hits;
+  size_t chunk;
+  size_t iterator;
+  OTP_METRICS_START(start);
+
+  if (windows == 0) {
+    OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+    return OTP_VALIDATE_FAILURE;
+  }
+
+  /* same span as before: the extra slot of an even window goes forward,
+   * and counters below zero don't exist */
+  lowest = -(int64_t)((windows - 1) / 2);
+  highest = windows / 2;
+  if (counter < (uint64_t)-lowest) {
+    lowest = -(int64_t)counter;
+  }
+  remaining = highest - lowest + 1;
+
+  for (iterator = 0; iterator < WINDOW_CHUNK; iterator++) {
+    keys[iterator] = key;
+  }
+
+  while (remaining) {
+    /* queue the next slots nearest first, all under the same key */
+    for (chunk = 0; chunk < WINDOW_CHUNK && remaining; chunk++, remaining--) {
+      offsets[chunk] = next_window_offset(&sequence, lowest, highest);
+      counters[chunk] = counter + offsets[chunk];
+    }
+
+    hash_codes(codes, keys, counters, chunk, guessDigits);
+
+    /* compare the whole chunk without branching on the codes */
+    hits = 0;
+    for (iterator = 0; iterator < chunk; iterator++) {
+      hits |= (uint64_t)(codes[iterator] == guess) << iterator;
+    }
+
+    if (hits) {
+      for (iterator = 0; !(hits & 1); iterator++) {
+        hits >>= 1;
+      }
+      if (matchOffset) {
+        *matchOffset = offsets[iterator];
+      }
+      OTP_METRICS_VALIDATED(OTP_VALIDATE_SUCCESS, offsets[iterator], start);
+      return OTP_VALIDATE_SUCCESS;
+    }
+  }
+
+  /* the guess wasn't found in the window, return validation failure */
+  OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+  return OTP_VALIDATE_FAILURE;
+}
+
+uint32_t totp_ctx(const otp_key *key, time_t time, unsigned int windowLength) {
+  return hotp_ctx(key, time/windowLength);
+}
+
+OTP_VALIDATE_RESULT totp_validate_ctx(const otp_key *key, time_t time,
+                                      unsigned int windowLength,
+                                      uint32_t guess,
+                                      unsigned int guessDigits) {
+  return hotp_validate_ctx(key, time/windowLength, guess, guessDigits);
+}
+
+OTP_VALIDATE_RESULT totp_validate_windows_ctx(const otp_key *key, time_t time,
+                                              unsigned int windowLength,
+                                              uint32_t guess,
+                                              unsigned int guessDigits,
+                                              unsigned int windows) {
+  return hotp_validate_windows_ctx(key, time/windowLength, guess,
+                                   guessDigits, windows);
+}
+
+OTP_VALIDATE_RESULT totp_find_window_ctx(const otp_key *key, time_t time,
+                                         unsigned int windowLength,
+                                         uint32_t guess,
+                                         unsigned int guessDigits,
+                                         unsigned int windows,
+                                         int64_t *matchOffset) {
+  return hotp_find_window_ctx(key, time/windowLength, guess, guessDigits,
+                              windows, matchOffset);
+}
+
+OTP_VALIDATE_RESULT hotp_resync_ctx(const otp_key *key, uint64_t counter,
+                                    uint64_t range, const uint32_t *guesses,
+                                    size_t guessCount,
+                                    unsigned int guessDigits,
+                                    uint64_t *nextCounter) {
+  const otp_key *keys[WINDOW_CHUNK];
+  uint64_t counters[WINDOW_CHUNK];
+  uint32_t codes[WINDOW_CHUNK];
+  uint64_t firstHits;
+  uint64_t secondHits;
+  uint64_t candidates;
+  size_t chunk;
+  size_t iterator;
+  uint32_t code;
+  uint64_t first = counter;
+  uint64_t last;
+  OTP_METRICS_START(start);
+
+  if (guessCount < 1 || guessCount > 2 || range == 0
+      || counter > UINT64_MAX - (guessCount - 1)) {
+    OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+    return OTP_VALIDATE_FAILURE;
+  }
+
+  /* the second code has to fit after the last candidate, which can be as
+   * far as this past counter. range - 1 keeps UINT64_MAX - counter + 1
+   * from overflowing when counter is 0 */
+  last = UINT64_MAX - counter - (guessCount - 1);
+  if (range - 1 > last) {
+    range = last + 1;
+  }
+
+  for (iterator = 0; iterator < WINDOW_CHUNK; iterator++) {
+    keys[iterator] = key;
+  }
+
+  /* chunks of a pair search overlap by one, so that the last counter of
+   * one chunk is checked again as a first code in the next */
+  while (range) {
+    chunk = range < WINDOW_CHUNK - (guessCount - 1) ? range + guessCount - 1
+                                                    : WINDOW_CHUNK;
+
+    for (iterator = 0; iterator < chunk; iterator++) {
+      counters[iterator] = counter + iterator;
+    }
+
+    hash_codes(codes, keys, counters, chunk, guessDigits);
+
+    firstHits = 0;
+    secondHits = 0;
+    for (iterator = 0; iterator < chunk; iterator++) {
+      code = codes[iterator];
+      firstHits |= (uint64_t)(code == guesses[0]) << iterator;
+      secondHits |= (uint64_t)(guessCount == 2 && code == guesses[1]) << iterator;
+    }
+
+    /* a first code only counts where its successor is in this chunk */
+    candidates = guessCount == 2 ? firstHits & (secondHits >> 1) : firstHits;
+    candidates &= chunk - (guessCount - 1) < WINDOW_CHUNK
+                ? (UINT64_C(1) << (chunk - (guessCount - 1))) - 1 : UINT64_MAX;
+
+    if (candidates) {
+      for (iterator = 0; !(candidates & 1); iterator++) {
+        candidates >>= 1;
+      }
+      if (nextCounter) {
+        *nextCounter = counter + iterator + guessCount;
+      }
+      OTP_METRICS_VALIDATED(OTP_VALIDATE_SUCCESS,
+                            (int64_t)(counter + iterator - first), start);
+      return OTP_VALIDATE_SUCCESS;
+    }
+
+    counter += chunk - (guessCount - 1);
+    range -= chunk - (guessCount - 1);
+  }
+
+  OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+  return OTP_VALIDATE_FAILURE;
+}
+
+uint32_t otp_truncate_digits(uint32_t code, unsigned int guessDigits) {
+  return truncate_digits(code, guessDigits);
+}
+
+void hotp_many(const hotp_request *requests, uint32_t *codes, size_t count) {
+  const otp_key *keys[WINDOW_CHUNK];
+  uint64_t counters[WINDOW_CHUNK];
+  size_t chunk;
+  size_t iterator;
+
+  /* gather the requests into groups for the hash engine */
+  while (count) {
+    chunk = count < WINDOW_CHUNK ? count : WINDOW_CHUNK;
+
+    for (iterator = 0; iterator < chunk; iterator++) {
+      keys[iterator] = requests[iterator].key;
+      counters[iterator] = requests[iterator].counter;
+    }
+
+    hash_codes(codes, keys, counters, chunk, 10);
+
+    requests += chunk;
+    codes += chunk;
+    count -= chunk;
+  }
+}
+
+void hotp_range_ctx(const otp_key *key, uint64_t counter, size_t count,
+                    unsigned int digits, uint32_t *codes) {
+  const otp_key *keys[WINDOW_CHUNK];
+  uint64_t counters[WINDOW_CHUNK];
+  size_t chunk;
+  size_t iterator;
+
+  for (iterator = 0; iterator < WINDOW_CHUNK; iterator++) {
+    keys[iterator] = key;
+  }
+
+  /* one key in every lane, consecutive counters across them */
+  while (count) {
+    chunk = count < WINDOW_CHUNK ? count : WINDOW_CHUNK;
+
+    for (iterator = 0; iterator < chunk; iterator++) {
+      counters[iterator] = counter + iterator;
+    }
+
+    hash_codes(codes, keys, counters, chunk, digits);
+
+    counter += chunk;
+    codes += chunk;
+    count -= chunk;
+  }
+}
+
+void totp_range_ctx(const otp_key *key, time_t time, unsigned int windowLength,
+                    size_t count, unsigned int digits, uint32_t *codes) {
+  hotp_range_ctx(key, time/windowLength, count, digits, codes);
+}
+
+void hotp_matrix_ctx(const otp_key *const *keys, size_t keyCount,
+                     uint64_t counter, size_t count, unsigned int digits,
+                     uint32_t *codes) {
+  const otp_key *laneKeys[WINDOW_CHUNK];
+  uint64_t counters[WINDOW_CHUNK];
+  uint32_t laneCodes[WINDOW_CHUNK];
+  size_t firstKey;
+  size_t tileKeys;
+  size_t firstStep;
+  size_t tileSteps;
+  size_t step;
+  size_t steps;
+  size_t lanes;
+  size_t iterator;
+
+  for (firstKey = 0; firstKey < keyCount; firstKey += tileKeys) {
+    tileKeys = keyCount - firstKey;
+    tileKeys = tileKeys < MATRIX_KEYS ? tileKeys : MATRIX_KEYS;
+
+    for (firstStep = 0; firstStep < count; firstStep += tileSteps) {
+      tileSteps = count - firstStep;
+      tileSteps = tileSteps < MATRIX_STEPS ? tileSteps : MATRIX_STEPS;
+
+      /* each chunk is every key of the tile at a few neighbouring steps,
+       * so the lanes hold different keys and the same schedules are
+       * reused chunk after chunk */
+      for (step = 0; step < tileSteps; step += steps) {
+        steps = tileSteps - step;
+        steps = steps < WINDOW_CHUNK / tileKeys ? steps
+                                                : WINDOW_CHUNK / tileKeys;
+        lanes = steps * tileKeys;
+
+        for (iterator = 0; iterator < lanes; iterator++) {
+          laneKeys[iterator] = keys[firstKey + iterator % tileKeys];
+          counters[iterator] = counter + firstStep + step
+                             + iterator / tileKeys;
+        }
+
+        hash_codes(laneCodes, laneKeys, counters, lanes, digits);
+
+        for (iterator = 0; iterator < lanes; iterator++) {
+          codes[(firstKey + iterator % tileKeys) * count + firstStep + step
+                + iterator / tileKeys] = laneCodes[iterator];
+        }
+      }
+    }
+  }
+}
+
+void otp_truncate_many(const uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+                       size_t count, unsigned int digits, uint32_t *codes) {
+  size_t iterator = 0;
+
+  digits = digits < 10 ? digits : 10;
+
+#ifdef TRUNCATE_HAVE_SSSE3
+  if (truncateSimd) {
+    iterator = truncate_many_ssse3(digests, count, digits, codes);
+  }
+#endif
+
+  for (; iterator < count; iterator++) {
+    codes[iterator] = truncate_digits(hotp_truncate(digests[iterator],
+                                                    HMAC_SHA1_MAC_WORDS),
+                                      digits);
+  }
+}
+
+size_t otp_format_codes(const uint32_t *codes, size_t count,
+                        unsigned int digits, char separator, char *out) {
+  char text[10];
+  size_t width;
+  size_t iterator;
+  unsigned int position;
+
+  digits = digits < 10 ? digits : 10;
+  width = digits + (separator != '\0');
+
+  for (iterator = 0; iterator < count; iterator++) {
+    render_code(text, truncate_digits(codes[iterator], digits));
+    for (position = 0; position < digits; position++) {
+      out[position] = text[10 - digits + position];
+    }
+    if (separator != '\0') {
+      out[digits] = separator;
+    }
+    out += width;
+  }
+
+  return count * width;
+}
+
+void hotp_validate_batch(const hotp_batch *batch, OTP_VALIDATE_RESULT *results) {
+  size_t start;
+  size_t chunk;
+
+  for (start = 0; start < batch->count; start += chunk) {
+    chunk = batch->count - start;
+    chunk = chunk < HMAC_SHA1_MB_MAX_LANES ? chunk : HMAC_SHA1_MB_MAX_LANES;
+
+    validate_group(batch->secrets, batch->secretOffsets + start,
+                   batch->counters + start, batch->guesses + start,
+                   batch->guessDigits + start, chunk, results + start);
+  }
+}
+
+void totp_validate_batch(const totp_batch *batch, unsigned int windowLength,
+                         OTP_VALIDATE_RESULT *results) {
+  uint64_t counters[HMAC_SHA1_MB_MAX_LANES];
+  size_t start;
+  size_t chunk;
+  size_t iterator;
+
+  for (start = 0; start < batch->count; start += chunk) {
+    chunk = batch->count - start;
+    chunk = chunk < HMAC_SHA1_MB_MAX_LANES ? chunk : HMAC_SHA1_MB_MAX_LANES;
+
+    for (iterator = 0; iterator < chunk; iterator++) {
+      counters[iterator] = batch->times[start + iterator] / windowLength;
+    }
+
+    validate_group(batch->secrets, batch->secretOffsets + start, counters,
+                   batch->guesses + start, batch->guessDigits + start, chunk,
+                   results + start);
+  }
+}
+
+/* dynamic truncation (https://tools.ietf.org/html/rfc4226#section-5.3)
+ * straight from the digest words - the four bytes at the offset straddle at
+ * most two adjacent words. the offset comes from the last of words */
+static uint32_t hotp_truncate(const uint32_t *digest, size_t words)
+{
+  unsigned int offset = digest[words - 1] & 0xf;
+  uint64_t window = (uint64_t)digest[offset >> 2] << 32
+                  | digest[(offset >> 2) + 1];
+
+  return (uint32_t)(window >> (32 - 8 * (offset & 3))) & 0x7fffffff;
+}
+
+/* the same over 64 bit words, where the bytes can straddle two words */
+static uint32_t hotp_truncate_wide(const uint64_t *digest)
+{
+  unsigned int offset = digest[HMAC_SHA512_MAC_WORDS - 1] & 0xf;
+  unsigned int shift = 8 * (offset & 7);
+  uint64_t window = digest[offset >> 3] << shift;
+
+  if (shift > 32) {
+    window |= digest[(offset >> 3) + 1] >> (64 - shift);
+  }
+
+  return (uint32_t)(window >> 32) & 0x7fffffff;
+}
+
+/* digits digit codes for count key and counter pairs. SHA1 keys are
+ * gathered into the multi-buffer engine and truncated together, the others
+ * are hashed one at a time */
+static void hash_codes(uint32_t *codes, const otp_key *const *keys,
+                       const uint64_t *counters, size_t count,
+                       unsigned int digits)
 {
-  uint8_t *byte_pointer = (uint8_t *)ptr;
-  uint8_t byte = (uint8_t)(value & 0xff);
+  const hmac_sha1_key *laneKeys[WINDOW_CHUNK];
+  uint64_t laneCounters[WINDOW_CHUNK];
+  uint32_t digests[WINDOW_CHUNK][HMAC_SHA1_MAC_WORDS];
+  uint32_t laneCodes[WINDOW_CHUNK];
+  size_t positions[WINDOW_CHUNK];
+  size_t lanes = 0;
+  size_t iterator;
+
+  for (iterator = 0; iterator < count; iterator++) {
+    if (keys[iterator]->algorithm == OTP_SHA1) {
+      laneKeys[lanes] = &keys[iterator]->hmac.sha1;
+      laneCounters[lanes] = counters[iterator];
+      positions[lanes++] = iterator;
+    } else {
+      codes[iterator] = truncate_digits(hotp_ctx(keys[iterator],
+                                                 counters[iterator]),
+                                        digits);
+    }
+  }
+
+  if (lanes == 0) {
+    return;
+  }
 
-  while (length) {
-    *byte_pointer = byte;
-    length--;
+  OTP_METRICS_ADD(OTP_METRIC_HASHES, lanes);
+  hmac_sha1_counter_mb(digests, laneKeys, laneCounters, lanes);
+
+  /* all SHA1, the usual case, needs no scatter */
+  if (lanes == count) {
+    otp_truncate_many(digests, lanes, digits, codes);
+    return;
+  }
+
+  otp_truncate_many(digests, lanes, digits, laneCodes);
+  for (iterator = 0; iterator < lanes; iterator++) {
+    codes[positions[iterator]] = laneCodes[iterator];
+  }
+}
+
+#ifdef TRUNCATE_HAVE_SSSE3
+/* four digests at a time: one shuffle per digest gathers its code into a
+ * lane, then the modulus is two widening multiplies. returns how many
+ * digests it handled, the rest are left for the scalar path */
+__attribute__((target("ssse3,sse4.1")))
+static size_t truncate_many_ssse3(
+    const uint32_t (*digests)[HMAC_SHA1_MAC_WORDS], size_t count,
+    unsigned int digits, uint32_t *codes)
+{
+  const __m128i mask = _mm_set1_epi32(0x7fffffff);
+  const __m128i reciprocal = _mm_set1_epi32((int)digitReciprocal[digits]);
+  const __m128i modulus = _mm_set1_epi32((int)digitModulus[digits]);
+  const __m128i shift = _mm_cvtsi32_si128(digitShift[digits]);
+  __m128i gathered;
+  __m128i words;
+  __m128i even;
+  __m128i odd;
+  const uint32_t *digest;
+  unsigned int offset;
+  size_t iterator;
+  int lane;
+
+  for (iterator = 0; iterator + 4 <= count; iterator += 4) {
+    gathered = _mm_setzero_si128();
+    for (lane = 0; lane < 4; lane++) {
+      digest = digests[iterator + lane];
+      offset = digest[HMAC_SHA1_MAC_WORDS - 1] & 0xf;
+      words = _mm_loadu_si128((const __m128i *)(digest + ((offset + 12) >> 4)));
+      gathered = _mm_or_si128(gathered, _mm_shuffle_epi8(words,
+                   _mm_load_si128((const __m128i *)
+                                  truncateShuffles[lane][offset])));
+    }
+    gathered = _mm_and_si128(gathered, mask);
+
+    /* quotients fit 32 bits, so odd lanes can be shifted over the even */
+    even = _mm_srl_epi64(_mm_mul_epu32(gathered, reciprocal), shift);
+    odd = _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(gathered, 32),
+                                      reciprocal), shift);
+    even = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+
+    _mm_storeu_si128((__m128i *)(codes + iterator),
+                     _mm_sub_epi32(gathered, _mm_mullo_epi32(even, modulus)));
+  }
+
+  return iterator;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+static void init_truncate(void)
+{
+  unsigned int lane;
+  unsigned int offset;
+  unsigned int byte;
+  unsigned int position;
+
+  for (lane = 0; lane < 4; lane++) {
+    for (offset = 0; offset < 16; offset++) {
+      memset(truncateShuffles[lane][offset], 0x80, 16);
+
+      /* lowest byte of the lane is the last big endian byte */
+      for (byte = 0; byte < 4; byte++) {
+        position = offset + 3 - byte;
+        truncateShuffles[lane][offset][4 * lane + byte] =
+          (uint8_t)(4 * (position >> 2) + 3 - (position & 3)
+                    - (offset >= 4 ? 4 : 0));
+      }
+    }
   }
 
-  return ptr;
+  __builtin_cpu_init();
+  truncateSimd = __builtin_cpu_supports("ssse3")
+              && __builtin_cpu_supports("sse4.1");
+}
+#endif /* TRUNCATE_HAVE_SSSE3 */
+
+/* ten zero padded digits of a 31 bit code. the divisors are constants, so
+ * each split is a multiply and a shift */
+static void render_code(char *text, uint32_t code)
+{
+  uint32_t halves[2] = { code / 100000, code % 100000 };
+  uint32_t pair;
+  int half;
+
+  for (half = 0; half < 2; half++) {
+    text[5 * half] = (char)('0' + halves[half] / 10000);
+    pair = halves[half] % 10000 / 100;
+    text[5 * half + 1] = digitPairs[2 * pair];
+    text[5 * half + 2] = digitPairs[2 * pair + 1];
+    pair = halves[half] % 100;
+    text[5 * half + 3] = digitPairs[2 * pair];
+    text[5 * half + 4] = digitPairs[2 * pair + 1];
+  }
+}
+
+/* codes are at most 31 bits, so ten or more digits keep the whole code */
+static uint32_t truncate_digits(uint32_t code, unsigned int digits)
+{
+  digits = digits < 10 ? digits : 10;
+  code &= 0x7fffffff;
+
+  return code - (uint32_t)(((uint64_t)code * digitReciprocal[digits])
+                           >> digitShift[digits]) * digitModulus[digits];
+}
+
+/* one lane group of a bulk validation: derive the keys, hash every counter
+ * side by side, then compare */
+static void validate_group(const uint8_t *secrets, const size_t *secretOffsets,
+                           const uint64_t *counters, const uint32_t *guesses,
+                           const uint8_t *guessDigits, size_t count,
+                           OTP_VALIDATE_RESULT *results)
+{
+  hmac_sha1_key keys[HMAC_SHA1_MB_MAX_LANES];
+  const hmac_sha1_key *keyPointers[HMAC_SHA1_MB_MAX_LANES];
+  uint32_t digests[HMAC_SHA1_MB_MAX_LANES][HMAC_SHA1_MAC_WORDS];
+  uint32_t code;
+  size_t iterator;
+  size_t successes = 0;
+
+  /* the following group's secrets start where this group's end */
+  OTP_PREFETCH(secrets + secretOffsets[count]);
+
+  for (iterator = 0; iterator < count; iterator++) {
+    hmac_sha1_init_key(&keys[iterator], secrets + secretOffsets[iterator],
+                       secretOffsets[iterator + 1] - secretOffsets[iterator]);
+    keyPointers[iterator] = &keys[iterator];
+  }
+
+  OTP_METRICS_ADD(OTP_METRIC_HASHES, count);
+  hmac_sha1_counter_mb(digests, keyPointers, counters, count);
+
+  for (iterator = 0; iterator < count; iterator++) {
+    code = truncate_digits(hotp_truncate(digests[iterator],
+                                         HMAC_SHA1_MAC_WORDS),
+                           guessDigits[iterator]);
+    results[iterator] = code == guesses[iterator] ? OTP_VALIDATE_SUCCESS
+                                                  : OTP_VALIDATE_FAILURE;
+    successes += code == guesses[iterator];
+  }
+
+  OTP_METRICS_ADD(OTP_METRIC_VALIDATIONS, count);
+  OTP_METRICS_ADD(OTP_METRIC_SUCCESSES, successes);
+  OTP_METRICS_ADD(OTP_METRIC_FAILURES, count - successes);
+
+  otp_secure_wipe(keys, sizeof(keys));
+}
+
+/* walk 0, +1, -1, +2, -2 ... skipping anything outside [lowest, highest] */
+static int64_t next_window_offset(uint64_t *sequence, int64_t lowest,
+                                  int64_t highest)
+{
+  int64_t offset;
+
+  do {
+    offset = *sequence & 1 ? (int64_t)(*sequence / 2 + 1)
+                           : -(int64_t)(*sequence / 2);
+    (*sequence)++;
+  } while (offset < lowest || offset > highest);
+
+  return offset;
 }
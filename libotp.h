@@ -22,7 +22,13 @@
 #ifndef LIBOTP_H_
 #define LIBOTP_H_
 
+/* local includes */
+#include "hmac_sha1.h"
+#include "hmac_sha256.h"
+#include "hmac_sha512.h"
+
 /* external includes */
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -35,6 +41,11 @@ typedef enum OTP_TYPE {
   OTP_HASH, OTP_TIME
 } OTP_TYPE;
 
+/* HMAC hash functions of RFC 6238 */
+typedef enum OTP_ALGORITHM {
+  OTP_SHA1, OTP_SHA256, OTP_SHA512
+} OTP_ALGORITHM;
+
 typedef struct otp_state {
   uint8_t *secret;
   size_t secretLength;
@@ -47,6 +58,53 @@ typedef struct totp_state {
   time_t time;
 } totp_state;
 
+/* a secret prepared once for repeated hotp/totp calls. the *_ctx entry
+ * points use the key's algorithm, the secret based ones are SHA1 only */
+typedef struct otp_key {
+  OTP_ALGORITHM algorithm;
+  union {
+    hmac_sha1_key sha1;
+    hmac_sha256_key sha256;
+    hmac_sha512_key sha512;
+  } hmac;
+} otp_key;
+
+/* prepare a SHA1 key */
+void otp_key_init(otp_key *key, const uint8_t *secret, size_t secretLength);
+
+/* prepare a key for any algorithm, 0 on success or -1 if it is unknown */
+int otp_key_init_algorithm(otp_key *key, OTP_ALGORITHM algorithm,
+                           const uint8_t *secret, size_t secretLength);
+
+void otp_key_clear(otp_key *key);
+
+/* one (key, counter) pair for the multi-buffer entry points */
+typedef struct hotp_request {
+  const otp_key *key;
+  uint64_t counter;
+} hotp_request;
+
+/* struct-of-arrays input for bulk validation. request i uses the secret
+ * secrets[secretOffsets[i]] up to secrets[secretOffsets[i+1]], so
+ * secretOffsets holds count + 1 entries */
+typedef struct hotp_batch {
+  const uint8_t *secrets;
+  const size_t *secretOffsets;
+  const uint64_t *counters;
+  const uint32_t *guesses;
+  const uint8_t *guessDigits;
+  size_t count;
+} hotp_batch;
+
+typedef struct totp_batch {
+  const uint8_t *secrets;
+  const size_t *secretOffsets;
+  const time_t *times;
+  const uint32_t *guesses;
+  const uint8_t *guessDigits;
+  size_t count;
+} totp_batch;
+
 uint32_t hotp(const hotp_state *state);
 
 OTP_VALIDATE_RESULT hotp_validate(const hotp_state * state, uint32_t guess,
@@ -70,4 +128,96 @@ OTP_VALIDATE_RESULT totp_validate_windows(const totp_state * timeState,
                                           unsigned int guessDigits,
                                           unsigned int windows);
 
+/* variants of the above taking a precomputed key */
+uint32_t hotp_ctx(const otp_key *key, uint64_t counter);
+
+OTP_VALIDATE_RESULT hotp_validate_ctx(const otp_key *key, uint64_t counter,
+                                      uint32_t guess,
+                                      unsigned int guessDigits);
+
+OTP_VALIDATE_RESULT hotp_validate_windows_ctx(const otp_key *key,
+                                              uint64_t counter,
+                                              uint32_t guess,
+                                              unsigned int guessDigits,
+                                              unsigned int windows);
+
+uint32_t totp_ctx(const otp_key *key, time_t time, unsigned int windowLength);
+
+OTP_VALIDATE_RESULT totp_validate_ctx(const otp_key *key, time_t time,
+                                      unsigned int windowLength,
+                                      uint32_t guess,
+                                      unsigned int guessDigits);
+
+OTP_VALIDATE_RESULT totp_validate_windows_ctx(const otp_key *key, time_t time,
+                                              unsigned int windowLength,
+                                              uint32_t guess,
+                                              unsigned int guessDigits,
+                                              unsigned int windows);
+
+/* window checks that also report where the guess matched: *matchOffset
+ * (if not NULL) receives the step offset from counter/time that produced
+ * the guess, nearer offsets win when several match */
+OTP_VALIDATE_RESULT hotp_find_window_ctx(const otp_key *key, uint64_t counter,
+                                         uint32_t guess,
+                                         unsigned int guessDigits,
+                                         unsigned int windows,
+                                         int64_t *matchOffset);
+
+OTP_VALIDATE_RESULT totp_find_window_ctx(const otp_key *key, time_t time,
+                                         unsigned int windowLength,
+                                         uint32_t guess,
+                                         unsigned int guessDigits,
+                                         unsigned int windows,
+                                         int64_t *matchOffset);
+
+/* resynchronise a token pressed many times offline: find the lowest
+ * counter in counter .. counter + range - 1 that produced guesses[0],
+ * followed by guesses[1] at the next counter when guessCount is 2. the
+ * range stops where the last code would pass UINT64_MAX. on success
+ * *nextCounter is the counter after the last code matched, 0 when that
+ * was UINT64_MAX */
+OTP_VALIDATE_RESULT hotp_resync_ctx(const otp_key *key, uint64_t counter,
+                                    uint64_t range, const uint32_t *guesses,
+                                    size_t guessCount,
+                                    unsigned int guessDigits,
+                                    uint64_t *nextCounter);
+
+/* reduce a code from hotp_ctx, totp_ctx or hotp_many to guessDigits digits */
+uint32_t otp_truncate_digits(uint32_t code, unsigned int guessDigits);
+
+/* dynamic truncation of count hmac_sha1_counter_mb digests straight to
+ * digits digit codes, a batch at a time */
+void otp_truncate_many(const uint32_t (*digests)[HMAC_SHA1_MAC_WORDS],
+                       size_t count, unsigned int digits, uint32_t *codes);
+
+/* render codes as zero padded decimal, digits (at most 10) characters each
+ * followed by separator unless it is '\0'. nothing is NUL terminated.
+ * returns the bytes written, count * (digits + 1) at most */
+size_t otp_format_codes(const uint32_t *codes, size_t count,
+                        unsigned int digits, char separator, char *out);
+
+/* hotp_ctx over many requests at once, codes[i] answers requests[i] */
+void hotp_many(const hotp_request *requests, uint32_t *codes, size_t count);
+
+/* code schedules for provisioning. codes[i] is the code for counter + i,
+ * truncated to digits, streamed through the multi-buffer engine */
+void hotp_range_ctx(const otp_key *key, uint64_t counter, size_t count,
+                    unsigned int digits, uint32_t *codes);
+
+/* codes[i] is the code for the step i windows after the one containing time */
+void totp_range_ctx(const otp_key *key, time_t time, unsigned int windowLength,
+                    size_t count, unsigned int digits, uint32_t *codes);
+
+/* every key over the same counter range, row by row: codes[k * count + i]
+ * is keys[k] at counter + i. keys are worked through in cache sized tiles */
+void hotp_matrix_ctx(const otp_key *const *keys, size_t keyCount,
+                     uint64_t counter, size_t count, unsigned int digits,
+                     uint32_t *codes);
+
+/* validate every request in a batch, results[i] answers request i */
+void hotp_validate_batch(const hotp_batch *batch, OTP_VALIDATE_RESULT *results);
+
+void totp_validate_batch(const totp_batch *batch, unsigned int windowLength,
+                         OTP_VALIDATE_RESULT *results);
+
 #endif /* LIBOTP_H_ */
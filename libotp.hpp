@@ -0,0 +1,275 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/*
+ * Header only C++ layer over libotp. Digits, period, window and algorithm
+ * are template parameters, so the modulus is a constant, the window is a
+ * fixed size loop over a constexpr offset table, and each algorithm's
+ * counter kernel is called directly instead of through hotp_ctx()'s
+ * switch on the key. The kernels themselves still come from the library,
+ * which picks their SHA-NI or vector backend when it is loaded.
+ */
+
+#ifndef LIBOTP_HPP_
+#define LIBOTP_HPP_
+
+/* local includes */
+extern "C" {
+#include "hmac_sha1_mb.h"
+#include "libotp.h"
+}
+
+/* external includes */
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+namespace otp {
+
+enum class algorithm {
+  sha1 = OTP_SHA1, sha256 = OTP_SHA256, sha512 = OTP_SHA512
+};
+
+/* a prepared secret, wiped when it is moved from or destroyed */
+template <algorithm Algo = algorithm::sha1>
+class key {
+ public:
+  key(const uint8_t *secret, std::size_t secretLength) {
+    otp_key_init_algorithm(&key_, static_cast<OTP_ALGORITHM>(Algo), secret,
+                           secretLength);
+  }
+
+  key(const key &) = delete;
+  key &operator=(const key &) = delete;
+
+  key(key &&other) noexcept : key_(other.key_) {
+    otp_key_clear(&other.key_);
+  }
+
+  key &operator=(key &&other) noexcept {
+    if (this != &other) {
+      key_ = other.key_;
+      otp_key_clear(&other.key_);
+    }
+    return *this;
+  }
+
+  ~key() {
+    otp_key_clear(&key_);
+  }
+
+  /* for the C entry points, e.g. otp_store_add() */
+  const otp_key *get() const {
+    return &key_;
+  }
+
+ private:
+  otp_key key_;
+};
+
+namespace detail {
+
+constexpr uint64_t pow10(unsigned int digits) {
+  return digits == 0 ? 1 : 10 * pow10(digits - 1);
+}
+
+/* codes are 31 bits, so 10 digits need no reduction at all */
+template <unsigned int Digits>
+constexpr uint32_t reduce(uint32_t code) {
+  if constexpr (Digits >= 10) {
+    return code;
+  } else {
+    return code % static_cast<uint32_t>(pow10(Digits));
+  }
+}
+
+/* RFC 4226 dynamic truncation over big endian words, as in libotp.c */
+inline uint32_t truncate(const uint32_t *digest, std::size_t words) {
+  unsigned int offset = digest[words - 1] & 0xf;
+  uint64_t window = static_cast<uint64_t>(digest[offset >> 2]) << 32
+                  | digest[(offset >> 2) + 1];
+
+  return static_cast<uint32_t>(window >> (32 - 8 * (offset & 3))) & 0x7fffffff;
+}
+
+inline uint32_t truncate_wide(const uint64_t *digest) {
+  unsigned int offset = digest[HMAC_SHA512_MAC_WORDS - 1] & 0xf;
+  unsigned int shift = 8 * (offset & 7);
+  uint64_t window = digest[offset >> 3] << shift;
+
+  if (shift > 32) {
+    window |= digest[(offset >> 3) + 1] >> (64 - shift);
+  }
+
+  return static_cast<uint32_t>(window >> 32) & 0x7fffffff;
+}
+
+template <algorithm Algo>
+struct hash;
+
+template <>
+struct hash<algorithm::sha1> {
+  static uint32_t code(const otp_key &key, uint64_t counter) {
+    uint32_t digest[HMAC_SHA1_MAC_WORDS];
+
+    hmac_sha1_counter(digest, &key.hmac.sha1, counter);
+    return truncate(digest, HMAC_SHA1_MAC_WORDS);
+  }
+
+  /* the whole window through the multi-buffer engine at once */
+  template <std::size_t Count>
+  static void codes(const otp_key &key, const uint64_t *counters,
+                    uint32_t *codes) {
+    const hmac_sha1_key *keys[Count];
+    uint32_t digests[Count][HMAC_SHA1_MAC_WORDS];
+
+    for (std::size_t slot = 0; slot < Count; slot++) {
+      keys[slot] = &key.hmac.sha1;
+    }
+    hmac_sha1_counter_mb(digests, keys, counters, Count);
+    for (std::size_t slot = 0; slot < Count; slot++) {
+      codes[slot] = truncate(digests[slot], HMAC_SHA1_MAC_WORDS);
+    }
+  }
+};
+
+template <>
+struct hash<algorithm::sha256> {
+  static uint32_t code(const otp_key &key, uint64_t counter) {
+    uint32_t digest[HMAC_SHA256_MAC_WORDS];
+
+    hmac_sha256_counter(digest, &key.hmac.sha256, counter);
+    return truncate(digest, HMAC_SHA256_MAC_WORDS);
+  }
+
+  template <std::size_t Count>
+  static void codes(const otp_key &key, const uint64_t *counters,
+                    uint32_t *codes) {
+    for (std::size_t slot = 0; slot < Count; slot++) {
+      codes[slot] = code(key, counters[slot]);
+    }
+  }
+};
+
+template <>
+struct hash<algorithm::sha512> {
+  static uint32_t code(const otp_key &key, uint64_t counter) {
+    uint64_t digest[HMAC_SHA512_MAC_WORDS];
+
+    hmac_sha512_counter(digest, &key.hmac.sha512, counter);
+    return truncate_wide(digest);
+  }
+
+  template <std::size_t Count>
+  static void codes(const otp_key &key, const uint64_t *counters,
+                    uint32_t *codes) {
+    for (std::size_t slot = 0; slot < Count; slot++) {
+      codes[slot] = code(key, counters[slot]);
+    }
+  }
+};
+
+/* slot i of a window is this far from its centre: nearest first, the
+ * later of a tied pair first, the same order hotp_find_window_ctx uses */
+template <unsigned int Window>
+constexpr std::array<int64_t, Window> window_offsets() {
+  std::array<int64_t, Window> offsets{};
+
+  for (unsigned int slot = 0; slot < Window; slot++) {
+    offsets[slot] = slot & 1 ? static_cast<int64_t>(slot / 2 + 1)
+                             : -static_cast<int64_t>(slot / 2);
+  }
+
+  return offsets;
+}
+
+} /* namespace detail */
+
+template <unsigned int Digits, unsigned int Window = 1,
+          algorithm Algo = algorithm::sha1>
+struct hotp_validator {
+  static_assert(Digits >= 1 && Digits <= 10, "1 to 10 digit codes");
+  static_assert(Window >= 1 && Window <= 64, "1 to 64 slot windows");
+
+  static uint32_t code(const key<Algo> &key, uint64_t counter) {
+    return detail::reduce<Digits>(detail::hash<Algo>::code(*key.get(),
+                                                           counter));
+  }
+
+  /* hotp_find_window_ctx with everything but the counter and guess fixed */
+  static bool validate(const key<Algo> &key, uint64_t counter, uint32_t guess,
+                       int64_t *matchOffset = nullptr) {
+    static constexpr std::array<int64_t, Window> offsets =
+        detail::window_offsets<Window>();
+    uint64_t counters[Window];
+    uint32_t codes[Window];
+    uint64_t hits = 0;
+    unsigned int slot;
+
+    for (slot = 0; slot < Window; slot++) {
+      counters[slot] = counter + offsets[slot];
+    }
+    detail::hash<Algo>::template codes<Window>(*key.get(), counters, codes);
+
+    /* counters below zero don't exist, their slots never match */
+    for (slot = 0; slot < Window; slot++) {
+      hits |= static_cast<uint64_t>(
+                  (detail::reduce<Digits>(codes[slot]) == guess)
+                  & (offsets[slot] >= 0
+                     || counter >= static_cast<uint64_t>(-offsets[slot])))
+              << slot;
+    }
+    if (hits == 0) {
+      return false;
+    }
+
+    if (matchOffset) {
+      for (slot = 0; !(hits & 1); slot++) {
+        hits >>= 1;
+      }
+      *matchOffset = offsets[slot];
+    }
+    return true;
+  }
+};
+
+template <unsigned int Digits, unsigned int Period = 30,
+          unsigned int Window = 1, algorithm Algo = algorithm::sha1>
+struct totp_validator {
+  static_assert(Period >= 1, "a period of at least a second");
+
+  static uint32_t code(const key<Algo> &key, std::time_t time) {
+    return hotp_validator<Digits, Window, Algo>::code(
+        key, static_cast<uint64_t>(time) / Period);
+  }
+
+  static bool validate(const key<Algo> &key, std::time_t time, uint32_t guess,
+                       int64_t *matchOffset = nullptr) {
+    return hotp_validator<Digits, Window, Algo>::validate(
+        key, static_cast<uint64_t>(time) / Period, guess, matchOffset);
+  }
+};
+
+} /* namespace otp */
+
+#endif /* LIBOTP_HPP_ */
@@ -0,0 +1,274 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_arena.h"
+
+/* external includes */
+#include <errno.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define ARENA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ARENA_ALIGNMENT 64
+#define DEFAULT_SLAB_BYTES (1u << 20)
+
+/* a key, or the link to the next free slot once it is released */
+typedef struct arena_slot {
+  alignas(ARENA_ALIGNMENT) union {
+    otp_key key;
+    struct arena_slot *next;
+  };
+} arena_slot;
+
+/* the header takes the first slot of every slab */
+typedef struct arena_slab {
+  struct arena_slab *next;
+  size_t bytes;
+  int locked;
+} arena_slab;
+
+struct otp_arena {
+  size_t slabBytes;
+  unsigned int flags;
+  arena_slab *slabs;
+  arena_slab *lastSlab;
+  /* slots are carved from current until it runs out, then its successor */
+  arena_slab *current;
+  arena_slot *bump;
+  arena_slot *bumpEnd;
+  arena_slot *freeSlots;
+  size_t keys;
+  size_t slabCount;
+  size_t lockedBytes;
+};
+
+/* internal helper function definitions */
+static arena_slot *slab_slots(arena_slab *slab);
+static arena_slot *slab_end(arena_slab *slab);
+static int next_slab(otp_arena *arena);
+static arena_slab *map_slab(otp_arena *arena);
+
+otp_arena *otp_arena_create(size_t slabBytes, unsigned int flags) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  otp_arena *arena;
+
+  if (slabBytes == 0) {
+    slabBytes = DEFAULT_SLAB_BYTES;
+  }
+  /* whole pages, with room for the header and at least one key */
+  if (slabBytes < 2 * sizeof(arena_slot)) {
+    slabBytes = 2 * sizeof(arena_slot);
+  }
+  slabBytes = (slabBytes + page - 1) & ~(page - 1);
+
+  arena = calloc(1, sizeof(*arena));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->slabBytes = slabBytes;
+  arena->flags = flags;
+
+  return arena;
+}
+
+void otp_arena_destroy(otp_arena *arena) {
+  arena_slab *slab = arena->slabs;
+
+  while (slab) {
+    arena_slab *next = slab->next;
+    size_t bytes = slab->bytes;
+
+    /* munmap unlocks the pages */
+    otp_secure_wipe(slab, bytes);
+    munmap(slab, bytes);
+    slab = next;
+  }
+
+  otp_secure_wipe(arena, sizeof(*arena));
+  free(arena);
+}
+
+otp_key *otp_arena_alloc(otp_arena *arena) {
+  arena_slot *slot = arena->freeSlots;
+
+  if (slot) {
+    arena->freeSlots = slot->next;
+    slot->next = NULL;
+  } else {
+    if (arena->bump == arena->bumpEnd && next_slab(arena)) {
+      return NULL;
+    }
+    slot = arena->bump++;
+  }
+
+  arena->keys++;
+  return &slot->key;
+}
+
+otp_key *otp_arena_key(otp_arena *arena, OTP_ALGORITHM algorithm,
+                       const uint8_t *secret, size_t secretLength) {
+  otp_key *key = otp_arena_alloc(arena);
+
+  if (key && otp_key_init_algorithm(key, algorithm, secret, secretLength)) {
+    otp_arena_free(arena, key);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return key;
+}
+
+void otp_arena_free(otp_arena *arena, otp_key *key) {
+  arena_slot *slot = (arena_slot *)key;
+
+  otp_secure_wipe(key, sizeof(*key));
+  slot->next = arena->freeSlots;
+  arena->freeSlots = slot;
+  arena->keys--;
+}
+
+void otp_arena_reset(otp_arena *arena) {
+  arena_slab *slab;
+
+  /* one long run of wide stores per slab rather than a key at a time */
+  for (slab = arena->slabs; slab; slab = slab->next) {
+    otp_secure_wipe(slab_slots(slab),
+                    (uint8_t *)slab_end(slab) - (uint8_t *)slab_slots(slab));
+  }
+
+  arena->freeSlots = NULL;
+  arena->keys = 0;
+  arena->current = arena->slabs;
+  arena->bump = arena->slabs ? slab_slots(arena->slabs) : NULL;
+  arena->bumpEnd = arena->slabs ? slab_end(arena->slabs) : NULL;
+}
+
+void otp_arena_read_stats(const otp_arena *arena, otp_arena_stats *stats) {
+  stats->slabs = arena->slabCount;
+  stats->keys = arena->keys;
+  stats->capacity = arena->slabCount
+                    * (arena->slabBytes / sizeof(arena_slot) - 1);
+  stats->lockedBytes = arena->lockedBytes;
+}
+
+void otp_secure_wipe(void *pointer, size_t length) {
+  uint8_t *bytes = pointer;
+  size_t index = 0;
+
+#ifdef ARENA_HAVE_SSE2
+  __m128i zero = _mm_setzero_si128();
+
+  for (; index + 64 <= length; index += 64) {
+    _mm_storeu_si128((__m128i *)(bytes + index), zero);
+    _mm_storeu_si128((__m128i *)(bytes + index + 16), zero);
+    _mm_storeu_si128((__m128i *)(bytes + index + 32), zero);
+    _mm_storeu_si128((__m128i *)(bytes + index + 48), zero);
+  }
+  for (; index + 16 <= length; index += 16) {
+    _mm_storeu_si128((__m128i *)(bytes + index), zero);
+  }
+#endif
+  for (; index < length; index++) {
+    bytes[index] = 0;
+  }
+
+  /* the stores are dead as far as the compiler knows, so claim the memory
+   * is read afterwards */
+#if defined(__GNUC__)
+  __asm__ __volatile__("" : : "r"(pointer) : "memory");
+#else
+  {
+    volatile uint8_t *check = pointer;
+
+    for (index = 0; index < length; index++) {
+      (void)check[index];
+    }
+  }
+#endif
+}
+
+static arena_slot *slab_slots(arena_slab *slab) {
+  return (arena_slot *)slab + 1;
+}
+
+static arena_slot *slab_end(arena_slab *slab) {
+  return (arena_slot *)slab + slab->bytes / sizeof(arena_slot);
+}
+
+/* move the bump pointer on to the next slab, mapping one if needed */
+static int next_slab(otp_arena *arena) {
+  arena_slab *slab = arena->current ? arena->current->next : arena->slabs;
+
+  if (slab == NULL) {
+    slab = map_slab(arena);
+    if (slab == NULL) {
+      return -1;
+    }
+  }
+
+  arena->current = slab;
+  arena->bump = slab_slots(slab);
+  arena->bumpEnd = slab_end(slab);
+  return 0;
+}
+
+static arena_slab *map_slab(otp_arena *arena) {
+  arena_slab *slab = mmap(NULL, arena->slabBytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (slab == MAP_FAILED) {
+    return NULL;
+  }
+
+  slab->bytes = arena->slabBytes;
+  slab->locked = mlock(slab, arena->slabBytes) == 0;
+  if (!slab->locked && (arena->flags & OTP_ARENA_REQUIRE_LOCK)) {
+    int error = errno;
+
+    munmap(slab, arena->slabBytes);
+    errno = error;
+    return NULL;
+  }
+#ifdef MADV_DONTDUMP
+  madvise(slab, arena->slabBytes, MADV_DONTDUMP);
+#endif
+
+  if (arena->lastSlab) {
+    arena->lastSlab->next = slab;
+  } else {
+    arena->slabs = slab;
+  }
+  arena->lastSlab = slab;
+  arena->slabCount++;
+  if (slab->locked) {
+    arena->lockedBytes += arena->slabBytes;
+  }
+
+  return slab;
+}
@@ -0,0 +1,80 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_ARENA_H_
+#define OTP_ARENA_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Key context arena. Keys are handed out from large mmap'd slabs, each
+ * one in its own cache line aligned slot, and kept on a free list when
+ * released, so creating and destroying a key is O(1) and millions of
+ * them don't fragment the heap. Slabs are mlock'd so secrets stay out of
+ * swap, and left out of core dumps. Not thread safe - callers serialise
+ * allocation and release, using the keys is fine from any thread.
+ */
+
+/* fail (ENOMEM/EPERM) rather than hand out memory that couldn't be locked */
+#define OTP_ARENA_REQUIRE_LOCK 1
+
+typedef struct otp_arena otp_arena;
+
+typedef struct otp_arena_stats {
+  size_t slabs;
+  size_t keys;
+  size_t capacity;
+  size_t lockedBytes;
+} otp_arena_stats;
+
+/* slabBytes is rounded up to whole pages, 0 for 1MiB. NULL with errno
+ * set on failure */
+otp_arena *otp_arena_create(size_t slabBytes, unsigned int flags);
+
+/* wipes every key and unmaps the slabs */
+void otp_arena_destroy(otp_arena *arena);
+
+/* a zeroed key, NULL with errno set when no slab can be added */
+otp_key *otp_arena_alloc(otp_arena *arena);
+
+/* otp_arena_alloc and otp_key_init_algorithm together, NULL (EINVAL) for
+ * an unknown algorithm */
+otp_key *otp_arena_key(otp_arena *arena, OTP_ALGORITHM algorithm,
+                       const uint8_t *secret, size_t secretLength);
+
+/* wipe a key and return its slot to the arena */
+void otp_arena_free(otp_arena *arena, otp_key *key);
+
+/* release every key at once, keeping the slabs for reuse */
+void otp_arena_reset(otp_arena *arena);
+
+void otp_arena_read_stats(const otp_arena *arena, otp_arena_stats *stats);
+
+/* zero memory with wide stores the compiler is not allowed to drop */
+void otp_secure_wipe(void *pointer, size_t length);
+
+#endif /* OTP_ARENA_H_ */
@@ -0,0 +1,219 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+/* local includes */
+#include "otp_arena.h"
+#include "otp_cache.h"
+#include "otp_metrics.h"
+
+/* external includes */
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* a slot holds the low 32 bits of its step, a valid flag and the 31 bit
+ * code, so it is written and read with one atomic access. only steps up
+ * to SLOT_LAST_STEP are cached, later ones are hashed every time: that
+ * is the year 2106 with a 1 second window, never with 30 */
+#define SLOT_LAST_STEP UINT32_MAX
+#define SLOT_VALID 0x80000000u
+#define SLOT_PACK(step, code) ((uint64_t)(uint32_t)(step) << 32 | SLOT_VALID | (code))
+#define SLOT_HOLDS(slot, step) (((slot) & SLOT_VALID) \
+                                && (uint32_t)((slot) >> 32) == (uint32_t)(step))
+#define SLOT_CODE(slot) ((uint32_t)(slot) & 0x7fffffff)
+
+struct totp_cache {
+  otp_key key;
+  unsigned int windowLength;
+  unsigned int radius;
+  size_t mask;
+  _Atomic uint64_t slots[];
+};
+
+/* internal helper function definitions */
+static void fill_steps(totp_cache *cache, uint64_t first, uint64_t last);
+static uint32_t step_code(totp_cache *cache, uint64_t step);
+
+totp_cache *totp_cache_create(const otp_key *key, unsigned int windowLength,
+                              unsigned int radius) {
+  totp_cache *cache;
+  size_t slots = 1;
+  size_t index;
+
+  if (windowLength == 0 || radius > TOTP_CACHE_MAX_RADIUS) {
+    return NULL;
+  }
+
+  /* a ring big enough for the whole range and the step after it,
+   * indexed by step, so advancing ahead of a boundary keeps the oldest
+   * step still in use */
+  while (slots < 2 * radius + 2) {
+    slots <<= 1;
+  }
+
+  cache = malloc(sizeof(*cache) + slots * sizeof(cache->slots[0]));
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  cache->key = *key;
+  cache->windowLength = windowLength;
+  cache->radius = radius;
+  cache->mask = slots - 1;
+  for (index = 0; index < slots; index++) {
+    atomic_init(&cache->slots[index], 0);
+  }
+
+  return cache;
+}
+
+void totp_cache_destroy(totp_cache *cache) {
+  otp_secure_wipe(cache,
+                  sizeof(*cache) + (cache->mask + 1) * sizeof(cache->slots[0]));
+  free(cache);
+}
+
+void totp_cache_advance(totp_cache *cache, time_t time) {
+  uint64_t step = time / cache->windowLength;
+  uint64_t first = step < cache->radius ? 0 : step - cache->radius;
+
+  fill_steps(cache, first, step + cache->radius);
+}
+
+uint32_t totp_cache_code(totp_cache *cache, time_t time) {
+  uint64_t step = time / cache->windowLength;
+  uint64_t slot = atomic_load_explicit(&cache->slots[step & cache->mask],
+                                       memory_order_relaxed);
+
+  if (step <= SLOT_LAST_STEP && SLOT_HOLDS(slot, step)) {
+    return SLOT_CODE(slot);
+  }
+
+  totp_cache_advance(cache, time);
+
+  return step_code(cache, step);
+}
+
+OTP_VALIDATE_RESULT totp_cache_validate(totp_cache *cache, time_t time,
+                                        uint32_t guess,
+                                        unsigned int guessDigits,
+                                        unsigned int windows) {
+  return totp_cache_find_window(cache, time, guess, guessDigits, windows, NULL);
+}
+
+OTP_VALIDATE_RESULT totp_cache_find_window(totp_cache *cache, time_t time,
+                                           uint32_t guess,
+                                           unsigned int guessDigits,
+                                           unsigned int windows,
+                                           int64_t *matchOffset) {
+  uint64_t step = time / cache->windowLength;
+  int64_t lowest;
+  int64_t highest;
+  int64_t distance;
+  OTP_METRICS_START(start);
+
+  if (windows == 0) {
+    OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+    return OTP_VALIDATE_FAILURE;
+  }
+
+  /* the same span and search order as totp_find_window_ctx */
+  lowest = -(int64_t)((windows - 1) / 2);
+  highest = windows / 2;
+  if (step < (uint64_t)-lowest) {
+    lowest = -(int64_t)step;
+  }
+
+  if (highest > cache->radius || -lowest > cache->radius) {
+    return totp_find_window_ctx(&cache->key, time, cache->windowLength, guess,
+                                guessDigits, windows, matchOffset);
+  }
+
+  totp_cache_advance(cache, time);
+
+  for (distance = 0; distance <= highest || -distance >= lowest; distance++) {
+    if (distance <= highest
+        && otp_truncate_digits(step_code(cache, step + distance),
+                               guessDigits) == guess) {
+      if (matchOffset) {
+        *matchOffset = distance;
+      }
+      OTP_METRICS_VALIDATED(OTP_VALIDATE_SUCCESS, distance, start);
+      return OTP_VALIDATE_SUCCESS;
+    }
+    if (distance && -distance >= lowest
+        && otp_truncate_digits(step_code(cache, step - distance),
+                               guessDigits) == guess) {
+      if (matchOffset) {
+        *matchOffset = -distance;
+      }
+      OTP_METRICS_VALIDATED(OTP_VALIDATE_SUCCESS, -distance, start);
+      return OTP_VALIDATE_SUCCESS;
+    }
+  }
+
+  OTP_METRICS_VALIDATED(OTP_VALIDATE_FAILURE, 0, start);
+  return OTP_VALIDATE_FAILURE;
+}
+
+/* hash the steps in first .. last that aren't cached yet, side by side */
+static void fill_steps(totp_cache *cache, uint64_t first, uint64_t last) {
+  hotp_request requests[2 * TOTP_CACHE_MAX_RADIUS + 1];
+  uint32_t codes[2 * TOTP_CACHE_MAX_RADIUS + 1];
+  size_t missing = 0;
+  size_t index;
+  uint64_t step;
+
+  for (step = first; step <= last && step <= SLOT_LAST_STEP; step++) {
+    uint64_t slot = atomic_load_explicit(&cache->slots[step & cache->mask],
+                                         memory_order_relaxed);
+
+    if (!SLOT_HOLDS(slot, step)) {
+      requests[missing].key = &cache->key;
+      requests[missing].counter = step;
+      missing++;
+    }
+  }
+
+  if (missing == 0) {
+    return;
+  }
+
+  hotp_many(requests, codes, missing);
+
+  /* racing fillers store identical values, and a slot taken over by a far
+   * away time is caught by the step check on the way out */
+  for (index = 0; index < missing; index++) {
+    step = requests[index].counter;
+    atomic_store_explicit(&cache->slots[step & cache->mask],
+                          SLOT_PACK(step, codes[index]), memory_order_relaxed);
+  }
+}
+
+/* a cached code, hashed directly if another time has since taken the slot */
+static uint32_t step_code(totp_cache *cache, uint64_t step) {
+  uint64_t slot = atomic_load_explicit(&cache->slots[step & cache->mask],
+                                       memory_order_relaxed);
+
+  return step <= SLOT_LAST_STEP && SLOT_HOLDS(slot, step)
+         ? SLOT_CODE(slot) : hotp_ctx(&cache->key, step);
+}
@@ -0,0 +1,71 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef OTP_CACHE_H_
+#define OTP_CACHE_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stdint.h>
+#include <time.h>
+
+/* steps kept either side of the current one */
+#define TOTP_CACHE_MAX_RADIUS 15
+
+/*
+ * Truncated codes of one key for the steps around the clock. Crossing a
+ * step boundary hashes only the step that came into range, older steps are
+ * overwritten in place. Safe to share between threads.
+ */
+typedef struct totp_cache totp_cache;
+
+/* cache steps time/windowLength - radius .. + radius. the key is copied.
+ * NULL on failure or a radius above TOTP_CACHE_MAX_RADIUS */
+totp_cache *totp_cache_create(const otp_key *key, unsigned int windowLength,
+                              unsigned int radius);
+
+void totp_cache_destroy(totp_cache *cache);
+
+/* hash whichever steps around time are missing, at most one per step
+ * boundary crossed */
+void totp_cache_advance(totp_cache *cache, time_t time);
+
+/* same result as totp_ctx */
+uint32_t totp_cache_code(totp_cache *cache, time_t time);
+
+/* same results as totp_validate_windows_ctx and totp_find_window_ctx.
+ * windows reaching past the cached radius are hashed directly */
+OTP_VALIDATE_RESULT totp_cache_validate(totp_cache *cache, time_t time,
+                                        uint32_t guess,
+                                        unsigned int guessDigits,
+                                        unsigned int windows);
+
+OTP_VALIDATE_RESULT totp_cache_find_window(totp_cache *cache, time_t time,
+                                           uint32_t guess,
+                                           unsigned int guessDigits,
+                                           unsigned int windows,
+                                           int64_t *matchOffset);
+
+#endif /* OTP_CACHE_H_ */
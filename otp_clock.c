@@ -0,0 +1,265 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_cache.h"
+#include "otp_clock.h"
+#include "otp_index.h"
+
+/* external includes */
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE CLOCK_REALTIME
+#endif
+
+#define NO_STEP UINT64_MAX
+
+typedef struct clock_watch {
+  unsigned int period;
+  unsigned int lead;
+  otp_clock_callback callback;
+  void *context;
+  _Atomic uint64_t step;
+  /* the step last announced to the callback */
+  uint64_t announced;
+} clock_watch;
+
+struct otp_clock {
+  otp_clock_source source;
+  void *context;
+  _Atomic int64_t now;
+  clock_watch watches[OTP_CLOCK_MAX_WATCHES];
+  atomic_uint watchCount;
+  /* one tick at a time, callbacks included */
+  pthread_mutex_t tickLock;
+  pthread_mutex_t threadLock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  int running;
+  int stopping;
+};
+
+/* internal helper function definitions */
+static void *clock_thread(void *argument);
+
+otp_clock *otp_clock_create(otp_clock_source source, void *context) {
+  otp_clock *clock = calloc(1, sizeof(*clock));
+
+  if (clock == NULL) {
+    return NULL;
+  }
+
+  clock->source = source ? source : otp_clock_coarse;
+  clock->context = context;
+  pthread_mutex_init(&clock->tickLock, NULL);
+  pthread_mutex_init(&clock->threadLock, NULL);
+  pthread_cond_init(&clock->wake, NULL);
+  atomic_init(&clock->now, (int64_t)clock->source(clock->context));
+  atomic_init(&clock->watchCount, 0);
+
+  return clock;
+}
+
+void otp_clock_destroy(otp_clock *clock) {
+  otp_clock_stop(clock);
+
+  pthread_cond_destroy(&clock->wake);
+  pthread_mutex_destroy(&clock->threadLock);
+  pthread_mutex_destroy(&clock->tickLock);
+  free(clock);
+}
+
+int otp_clock_watch(otp_clock *clock, unsigned int period, unsigned int lead,
+                    otp_clock_callback callback, void *context) {
+  unsigned int count = atomic_load(&clock->watchCount);
+  clock_watch *watch;
+
+  if (count == OTP_CLOCK_MAX_WATCHES || period == 0 || lead >= period) {
+    return -1;
+  }
+
+  watch = &clock->watches[count];
+  watch->period = period;
+  watch->lead = lead;
+  watch->callback = callback;
+  watch->context = context;
+  watch->announced = NO_STEP;
+  atomic_init(&watch->step, (uint64_t)otp_clock_now(clock) / period);
+
+  /* published last, readers only look at watches below the count */
+  atomic_store(&clock->watchCount, count + 1);
+  return 0;
+}
+
+time_t otp_clock_now(const otp_clock *clock) {
+  return (time_t)atomic_load_explicit(&clock->now, memory_order_relaxed);
+}
+
+uint64_t otp_clock_step(const otp_clock *clock, unsigned int period) {
+  unsigned int count = atomic_load_explicit(&clock->watchCount,
+                                            memory_order_acquire);
+  unsigned int iterator;
+
+  for (iterator = 0; iterator < count; iterator++) {
+    if (clock->watches[iterator].period == period) {
+      return atomic_load_explicit(&clock->watches[iterator].step,
+                                  memory_order_relaxed);
+    }
+  }
+
+  return (uint64_t)otp_clock_now(clock) / period;
+}
+
+time_t otp_clock_tick(otp_clock *clock) {
+  unsigned int count;
+  unsigned int iterator;
+  time_t now;
+
+  pthread_mutex_lock(&clock->tickLock);
+
+  now = clock->source(clock->context);
+  atomic_store_explicit(&clock->now, (int64_t)now, memory_order_relaxed);
+
+  count = atomic_load(&clock->watchCount);
+  for (iterator = 0; iterator < count; iterator++) {
+    clock_watch *watch = &clock->watches[iterator];
+    uint64_t upcoming = ((uint64_t)now + watch->lead) / watch->period;
+
+    atomic_store_explicit(&watch->step, (uint64_t)now / watch->period,
+                          memory_order_relaxed);
+
+    /* once per change, however many boundaries went by, and again if the
+     * clock is set back */
+    if (upcoming != watch->announced) {
+      watch->announced = upcoming;
+      if (watch->callback) {
+        watch->callback(watch->context, upcoming,
+                        (time_t)(upcoming * watch->period));
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&clock->tickLock);
+  return now;
+}
+
+int otp_clock_start(otp_clock *clock) {
+  int result;
+
+  pthread_mutex_lock(&clock->threadLock);
+  if (clock->running) {
+    pthread_mutex_unlock(&clock->threadLock);
+    errno = EALREADY;
+    return -1;
+  }
+
+  clock->stopping = 0;
+  result = pthread_create(&clock->thread, NULL, clock_thread, clock);
+  if (result) {
+    pthread_mutex_unlock(&clock->threadLock);
+    errno = result;
+    return -1;
+  }
+  clock->running = 1;
+  pthread_mutex_unlock(&clock->threadLock);
+
+  return 0;
+}
+
+void otp_clock_stop(otp_clock *clock) {
+  pthread_mutex_lock(&clock->threadLock);
+  if (!clock->running) {
+    pthread_mutex_unlock(&clock->threadLock);
+    return;
+  }
+  clock->stopping = 1;
+  pthread_cond_signal(&clock->wake);
+  pthread_mutex_unlock(&clock->threadLock);
+
+  pthread_join(clock->thread, NULL);
+  clock->running = 0;
+}
+
+time_t otp_clock_coarse(void *context) {
+  struct timespec now;
+
+  (void)context;
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  return now.tv_sec;
+}
+
+void otp_clock_advance_cache(void *cache, uint64_t step, time_t stepStart) {
+  (void)step;
+  totp_cache_advance(cache, stepStart);
+}
+
+void otp_clock_advance_index(void *index, uint64_t step, time_t stepStart) {
+  (void)step;
+  otp_index_advance(index, stepStart);
+}
+
+static void *clock_thread(void *argument) {
+  otp_clock *clock = argument;
+  struct timespec resolution;
+  struct timespec wake;
+  time_t now;
+
+  /* how far past a second the coarse clock usually shows it */
+  if (clock_getres(CLOCK_REALTIME_COARSE, &resolution)
+      || resolution.tv_sec || resolution.tv_nsec > 100000000) {
+    resolution.tv_nsec = 10000000;
+  }
+
+  pthread_mutex_lock(&clock->threadLock);
+  while (!clock->stopping) {
+    pthread_mutex_unlock(&clock->threadLock);
+
+    now = otp_clock_tick(clock);
+
+    /* sleep until just past the next whole second, where any boundary
+     * falls. a source still showing the last second is polled again
+     * shortly rather than a second late */
+    clock_gettime(CLOCK_REALTIME, &wake);
+    if (now == wake.tv_sec - 1) {
+      wake.tv_nsec += resolution.tv_nsec;
+      if (wake.tv_nsec >= 1000000000) {
+        wake.tv_sec++;
+        wake.tv_nsec -= 1000000000;
+      }
+    } else {
+      wake.tv_sec++;
+      wake.tv_nsec = resolution.tv_nsec;
+    }
+
+    pthread_mutex_lock(&clock->threadLock);
+    if (!clock->stopping) {
+      pthread_cond_timedwait(&clock->wake, &clock->threadLock, &wake);
+    }
+  }
+  pthread_mutex_unlock(&clock->threadLock);
+
+  return NULL;
+}
@@ -0,0 +1,89 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_CLOCK_H_
+#define OTP_CLOCK_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Shared time source for totp. The clock keeps the last second it read
+ * and the current step of every period being watched in atomics, so the
+ * hot path reads a cached step instead of calling time() and dividing.
+ * Each watch can also fire a callback when its step changes, optionally
+ * lead seconds ahead of the boundary so caches can hash the next step
+ * before anyone asks for it. The source is injectable for tests.
+ */
+#define OTP_CLOCK_MAX_WATCHES 16
+
+/* unix seconds */
+typedef time_t (*otp_clock_source)(void *context);
+
+/* step is the one starting at stepStart, which is up to lead seconds away */
+typedef void (*otp_clock_callback)(void *context, uint64_t step,
+                                   time_t stepStart);
+
+typedef struct otp_clock otp_clock;
+
+/* a NULL source reads CLOCK_REALTIME_COARSE. NULL on failure */
+otp_clock *otp_clock_create(otp_clock_source source, void *context);
+
+/* stops the clock thread if it is running */
+void otp_clock_destroy(otp_clock *clock);
+
+/* track period, calling callback (if not NULL) from otp_clock_tick when
+ * the step lead seconds from now changes. add watches before the clock
+ * is started. 0 on success, -1 when full or lead is not below period */
+int otp_clock_watch(otp_clock *clock, unsigned int period, unsigned int lead,
+                    otp_clock_callback callback, void *context);
+
+/* the time as of the last tick */
+time_t otp_clock_now(const otp_clock *clock);
+
+/* the step of a watched period as of the last tick, otherwise computed
+ * from otp_clock_now */
+uint64_t otp_clock_step(const otp_clock *clock, unsigned int period);
+
+/* read the source, update the steps and fire the callbacks that are due.
+ * returns the time read */
+time_t otp_clock_tick(otp_clock *clock);
+
+/* tick on a thread of its own at every second of the system clock.
+ * 0 on success, -1 with errno set */
+int otp_clock_start(otp_clock *clock);
+
+void otp_clock_stop(otp_clock *clock);
+
+/* the default source */
+time_t otp_clock_coarse(void *context);
+
+/* callbacks that advance a totp_cache or otp_index passed as context */
+void otp_clock_advance_cache(void *cache, uint64_t step, time_t stepStart);
+
+void otp_clock_advance_index(void *index, uint64_t step, time_t stepStart);
+
+#endif /* OTP_CLOCK_H_ */
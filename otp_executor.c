@@ -0,0 +1,619 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_executor.h"
+#include "hmac_sha1_mb.h"
+
+/* external includes */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* items a worker takes per step for the built in jobs - a few lane groups */
+#define BUILTIN_GRAIN (4 * HMAC_SHA1_MB_MAX_LANES)
+#define SCRATCH_ALIGNMENT 64
+
+/* counters a worker scans between checks for a match found elsewhere */
+#define RESYNC_BLOCK 1024
+#define RESYNC_NONE UINT64_MAX
+
+/* a range [begin, end) packed as begin << 32 | end so that the owner and
+ * thieves can both claim from it with a single CAS */
+#define RANGE_PACK(begin, end) ((uint64_t)(begin) << 32 | (uint32_t)(end))
+#define RANGE_BEGIN(range) ((uint32_t)((range) >> 32))
+#define RANGE_END(range) ((uint32_t)(range))
+
+typedef struct otp_worker {
+  otp_executor *executor;
+  unsigned int index;
+  pthread_t thread;
+  void *scratch;
+} otp_worker;
+
+struct otp_job {
+  otp_job *next;
+  otp_task_fn task;
+  void *arg;
+  size_t grain;
+  otp_job_callback callback;
+  void *callbackArg;
+  /* lets a built in job publish its result before it is marked done */
+  void (*complete)(otp_job *job);
+  atomic_size_t remaining;
+  atomic_uint references;
+  int done;
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+
+  /* arguments of the built in jobs */
+  union {
+    struct {
+      const hotp_request *requests;
+      uint32_t *codes;
+    } hotp;
+    struct {
+      hotp_batch batch;
+      OTP_VALIDATE_RESULT *results;
+    } hotpValidate;
+    struct {
+      totp_batch batch;
+      unsigned int windowLength;
+      OTP_VALIDATE_RESULT *results;
+    } totpValidate;
+    struct {
+      const otp_key *key;
+      uint64_t counter;
+      uint64_t range;
+      uint32_t guesses[2];
+      size_t guessCount;
+      unsigned int guessDigits;
+      _Atomic uint64_t match;
+      OTP_VALIDATE_RESULT *result;
+      uint64_t *nextCounter;
+    } resync;
+  } builtin;
+
+  /* the part of the job each worker owns, one per worker */
+  _Atomic uint64_t ranges[];
+};
+
+struct otp_executor {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  otp_job *head;
+  otp_job *tail;
+  int stopping;
+  unsigned int threads;
+  unsigned int started;
+  otp_worker workers[];
+};
+
+/* internal helper function definitions */
+static otp_job *create_job(otp_executor *executor, otp_task_fn task,
+                           void *arg, size_t count, size_t grain,
+                           otp_job_callback callback, void *callbackArg);
+static void queue_job(otp_executor *executor, otp_job *job);
+static void *worker_main(void *argument);
+static void run_job(otp_worker *worker, otp_job *job);
+static int take_front(_Atomic uint64_t *range, size_t grain, uint32_t *begin,
+                      uint32_t *end);
+static int steal(otp_job *job, unsigned int thief, unsigned int threads,
+                 uint32_t *begin, uint32_t *end);
+static void finish_job(otp_job *job);
+static void release_job(otp_job *job);
+static void hotp_many_task(void *arg, size_t begin, size_t end, void *scratch);
+static void hotp_validate_task(void *arg, size_t begin, size_t end,
+                               void *scratch);
+static void totp_validate_task(void *arg, size_t begin, size_t end,
+                               void *scratch);
+static void resync_task(void *arg, size_t begin, size_t end, void *scratch);
+static void resync_complete(otp_job *job);
+
+otp_executor *otp_executor_create(unsigned int threads, size_t scratchBytes) {
+  otp_executor *executor;
+  unsigned int index;
+
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (unsigned int)online : 1;
+  }
+
+  executor = calloc(1, sizeof(*executor) + threads * sizeof(otp_worker));
+  if (executor == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_init(&executor->lock, NULL);
+  pthread_cond_init(&executor->wake, NULL);
+  executor->threads = threads;
+
+  /* round scratch up so every worker's buffer starts on its own line */
+  scratchBytes = (scratchBytes + SCRATCH_ALIGNMENT - 1)
+               & ~(size_t)(SCRATCH_ALIGNMENT - 1);
+
+  for (index = 0; index < threads; index++) {
+    otp_worker *worker = &executor->workers[index];
+
+    worker->executor = executor;
+    worker->index = index;
+    if (scratchBytes) {
+      worker->scratch = aligned_alloc(SCRATCH_ALIGNMENT, scratchBytes);
+      if (worker->scratch == NULL) {
+        break;
+      }
+    }
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+      free(worker->scratch);
+      worker->scratch = NULL;
+      break;
+    }
+    executor->started++;
+  }
+
+  if (executor->started != threads) {
+    otp_executor_destroy(executor);
+    return NULL;
+  }
+
+  return executor;
+}
+
+void otp_executor_destroy(otp_executor *executor) {
+  unsigned int index;
+
+  pthread_mutex_lock(&executor->lock);
+  executor->stopping = 1;
+  pthread_cond_broadcast(&executor->wake);
+  pthread_mutex_unlock(&executor->lock);
+
+  for (index = 0; index < executor->started; index++) {
+    pthread_join(executor->workers[index].thread, NULL);
+    free(executor->workers[index].scratch);
+  }
+
+  pthread_cond_destroy(&executor->wake);
+  pthread_mutex_destroy(&executor->lock);
+  free(executor);
+}
+
+unsigned int otp_executor_threads(const otp_executor *executor) {
+  return executor->threads;
+}
+
+otp_job *otp_executor_submit(otp_executor *executor, otp_task_fn task,
+                             void *arg, size_t count, size_t grain,
+                             otp_job_callback callback, void *callbackArg) {
+  otp_job *job = create_job(executor, task, arg, count, grain, callback,
+                            callbackArg);
+
+  if (job) {
+    queue_job(executor, job);
+  }
+
+  return job;
+}
+
+/* the built in jobs carry their arguments inside the job itself, filled in
+ * before the job becomes visible to the workers */
+otp_job *otp_executor_hotp_many(otp_executor *executor,
+                                const hotp_request *requests, uint32_t *codes,
+                                size_t count, otp_job_callback callback,
+                                void *callbackArg) {
+  otp_job *job = create_job(executor, hotp_many_task, NULL, count,
+                            BUILTIN_GRAIN, callback, callbackArg);
+
+  if (job) {
+    job->arg = job;
+    job->builtin.hotp.requests = requests;
+    job->builtin.hotp.codes = codes;
+    queue_job(executor, job);
+  }
+
+  return job;
+}
+
+otp_job *otp_executor_hotp_validate(otp_executor *executor,
+                                    const hotp_batch *batch,
+                                    OTP_VALIDATE_RESULT *results,
+                                    otp_job_callback callback,
+                                    void *callbackArg) {
+  otp_job *job = create_job(executor, hotp_validate_task, NULL, batch->count,
+                            BUILTIN_GRAIN, callback, callbackArg);
+
+  if (job) {
+    job->arg = job;
+    job->builtin.hotpValidate.batch = *batch;
+    job->builtin.hotpValidate.results = results;
+    queue_job(executor, job);
+  }
+
+  return job;
+}
+
+otp_job *otp_executor_totp_validate(otp_executor *executor,
+                                    const totp_batch *batch,
+                                    unsigned int windowLength,
+                                    OTP_VALIDATE_RESULT *results,
+                                    otp_job_callback callback,
+                                    void *callbackArg) {
+  otp_job *job = create_job(executor, totp_validate_task, NULL, batch->count,
+                            BUILTIN_GRAIN, callback, callbackArg);
+
+  if (job) {
+    job->arg = job;
+    job->builtin.totpValidate.batch = *batch;
+    job->builtin.totpValidate.windowLength = windowLength;
+    job->builtin.totpValidate.results = results;
+    queue_job(executor, job);
+  }
+
+  return job;
+}
+
+otp_job *otp_executor_hotp_resync(otp_executor *executor, const otp_key *key,
+                                  uint64_t counter, uint64_t range,
+                                  const uint32_t *guesses, size_t guessCount,
+                                  unsigned int guessDigits,
+                                  OTP_VALIDATE_RESULT *result,
+                                  uint64_t *nextCounter,
+                                  otp_job_callback callback,
+                                  void *callbackArg) {
+  otp_job *job;
+
+  if (guessCount < 1 || guessCount > 2) {
+    return NULL;
+  }
+  if (range > UINT64_MAX - counter) {
+    range = UINT64_MAX - counter;
+  }
+
+  job = create_job(executor, resync_task, NULL,
+                   range / RESYNC_BLOCK + (range % RESYNC_BLOCK != 0), 1,
+                   callback, callbackArg);
+  if (job) {
+    job->arg = job;
+    job->complete = resync_complete;
+    job->builtin.resync.key = key;
+    job->builtin.resync.counter = counter;
+    job->builtin.resync.range = range;
+    memcpy(job->builtin.resync.guesses, guesses, guessCount * sizeof(uint32_t));
+    job->builtin.resync.guessCount = guessCount;
+    job->builtin.resync.guessDigits = guessDigits;
+    atomic_init(&job->builtin.resync.match, RESYNC_NONE);
+    job->builtin.resync.result = result;
+    job->builtin.resync.nextCounter = nextCounter;
+    queue_job(executor, job);
+  }
+
+  return job;
+}
+
+int otp_job_done(otp_job *job) {
+  int done;
+
+  pthread_mutex_lock(&job->lock);
+  done = job->done;
+  pthread_mutex_unlock(&job->lock);
+
+  return done;
+}
+
+void otp_job_wait(otp_job *job) {
+  pthread_mutex_lock(&job->lock);
+  while (!job->done) {
+    pthread_cond_wait(&job->finished, &job->lock);
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  release_job(job);
+}
+
+void otp_job_detach(otp_job *job) {
+  release_job(job);
+}
+
+static otp_job *create_job(otp_executor *executor, otp_task_fn task,
+                           void *arg, size_t count, size_t grain,
+                           otp_job_callback callback, void *callbackArg) {
+  otp_job *job;
+  unsigned int index;
+
+  if (count > UINT32_MAX) {
+    return NULL;
+  }
+
+  job = calloc(1, sizeof(*job) + executor->threads * sizeof(job->ranges[0]));
+  if (job == NULL) {
+    return NULL;
+  }
+
+  job->task = task;
+  job->arg = arg;
+  job->grain = grain ? grain : 1;
+  job->callback = callback;
+  job->callbackArg = callbackArg;
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->finished, NULL);
+  atomic_init(&job->remaining, count);
+
+  /* start every worker on an equal contiguous share */
+  for (index = 0; index < executor->threads; index++) {
+    atomic_init(&job->ranges[index],
+                RANGE_PACK(count * index / executor->threads,
+                           count * (index + 1) / executor->threads));
+  }
+
+  /* one reference for the caller's handle, one for the queue */
+  atomic_init(&job->references, 2);
+
+  return job;
+}
+
+static void queue_job(otp_executor *executor, otp_job *job) {
+  /* nothing to hand out, complete on the spot */
+  if (atomic_load(&job->remaining) == 0) {
+    finish_job(job);
+    release_job(job);
+    return;
+  }
+
+  pthread_mutex_lock(&executor->lock);
+  if (executor->tail) {
+    executor->tail->next = job;
+  } else {
+    executor->head = job;
+  }
+  executor->tail = job;
+  pthread_cond_broadcast(&executor->wake);
+  pthread_mutex_unlock(&executor->lock);
+}
+
+static void *worker_main(void *argument) {
+  otp_worker *worker = argument;
+  otp_executor *executor = worker->executor;
+  otp_job *job;
+
+  for (;;) {
+    pthread_mutex_lock(&executor->lock);
+    while (executor->head == NULL && !executor->stopping) {
+      pthread_cond_wait(&executor->wake, &executor->lock);
+    }
+
+    /* only stop once the queue has drained */
+    job = executor->head;
+    if (job == NULL) {
+      pthread_mutex_unlock(&executor->lock);
+      return NULL;
+    }
+    atomic_fetch_add(&job->references, 1);
+    pthread_mutex_unlock(&executor->lock);
+
+    run_job(worker, job);
+
+    /* nothing left to claim, let the queue move on to the next job */
+    pthread_mutex_lock(&executor->lock);
+    if (executor->head == job) {
+      executor->head = job->next;
+      if (executor->head == NULL) {
+        executor->tail = NULL;
+      }
+      release_job(job);
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    release_job(job);
+  }
+}
+
+/* work through our own range, then steal until every range is empty */
+static void run_job(otp_worker *worker, otp_job *job) {
+  unsigned int threads = worker->executor->threads;
+  _Atomic uint64_t *own = &job->ranges[worker->index];
+  uint32_t begin;
+  uint32_t end;
+
+  for (;;) {
+    while (take_front(own, job->grain, &begin, &end)) {
+      job->task(job->arg, begin, end, worker->scratch);
+
+      if (atomic_fetch_sub(&job->remaining, end - begin) == end - begin) {
+        finish_job(job);
+      }
+    }
+
+    if (!steal(job, worker->index, threads, &begin, &end)) {
+      return;
+    }
+
+    /* our range is empty, so no thief can be racing this store */
+    atomic_store(own, RANGE_PACK(begin, end));
+  }
+}
+
+/* the owner claims up to grain items from the front of its range */
+static int take_front(_Atomic uint64_t *range, size_t grain, uint32_t *begin,
+                      uint32_t *end) {
+  uint64_t current = atomic_load(range);
+  uint32_t first;
+  uint32_t last;
+
+  do {
+    first = RANGE_BEGIN(current);
+    last = RANGE_END(current);
+    if (first >= last) {
+      return 0;
+    }
+    if (last - first > grain) {
+      last = first + (uint32_t)grain;
+    }
+  } while (!atomic_compare_exchange_weak(range, &current,
+                                         RANGE_PACK(last, RANGE_END(current))));
+
+  *begin = first;
+  *end = last;
+
+  return 1;
+}
+
+/* thieves take the back half of another worker's range, or all of it once
+ * it is down to a single grain */
+static int steal(otp_job *job, unsigned int thief, unsigned int threads,
+                 uint32_t *begin, uint32_t *end) {
+  unsigned int step;
+
+  for (step = 1; step < threads; step++) {
+    _Atomic uint64_t *victim = &job->ranges[(thief + step) % threads];
+    uint64_t current = atomic_load(victim);
+    uint32_t first;
+    uint32_t last;
+    uint32_t middle;
+
+    for (;;) {
+      first = RANGE_BEGIN(current);
+      last = RANGE_END(current);
+      if (first >= last) {
+        break;
+      }
+
+      middle = last - first > job->grain ? first + (last - first) / 2 : first;
+      if (atomic_compare_exchange_weak(victim, &current,
+                                       RANGE_PACK(first, middle))) {
+        *begin = middle;
+        *end = last;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static void finish_job(otp_job *job) {
+  if (job->complete) {
+    job->complete(job);
+  }
+  if (job->callback) {
+    job->callback(job->callbackArg);
+  }
+
+  pthread_mutex_lock(&job->lock);
+  job->done = 1;
+  pthread_cond_broadcast(&job->finished);
+  pthread_mutex_unlock(&job->lock);
+}
+
+static void release_job(otp_job *job) {
+  if (atomic_fetch_sub(&job->references, 1) == 1) {
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+  }
+}
+
+static void hotp_many_task(void *arg, size_t begin, size_t end, void *scratch) {
+  otp_job *job = arg;
+
+  (void)scratch;
+  hotp_many(job->builtin.hotp.requests + begin,
+            job->builtin.hotp.codes + begin, end - begin);
+}
+
+static void hotp_validate_task(void *arg, size_t begin, size_t end,
+                               void *scratch) {
+  otp_job *job = arg;
+  hotp_batch part = job->builtin.hotpValidate.batch;
+
+  /* secret offsets are absolute, so a slice only needs its arrays moved */
+  (void)scratch;
+  part.secretOffsets += begin;
+  part.counters += begin;
+  part.guesses += begin;
+  part.guessDigits += begin;
+  part.count = end - begin;
+  hotp_validate_batch(&part, job->builtin.hotpValidate.results + begin);
+}
+
+static void totp_validate_task(void *arg, size_t begin, size_t end,
+                               void *scratch) {
+  otp_job *job = arg;
+  totp_batch part = job->builtin.totpValidate.batch;
+
+  (void)scratch;
+  part.secretOffsets += begin;
+  part.times += begin;
+  part.guesses += begin;
+  part.guessDigits += begin;
+  part.count = end - begin;
+  totp_validate_batch(&part, job->builtin.totpValidate.windowLength,
+                      job->builtin.totpValidate.results + begin);
+}
+
+static void resync_task(void *arg, size_t begin, size_t end, void *scratch) {
+  otp_job *job = arg;
+  uint64_t start;
+  uint64_t range;
+  uint64_t next;
+  uint64_t match;
+  size_t block;
+
+  (void)scratch;
+  for (block = begin; block < end; block++) {
+    start = job->builtin.resync.counter + (uint64_t)block * RESYNC_BLOCK;
+
+    /* only a lower match can still change the answer */
+    match = atomic_load_explicit(&job->builtin.resync.match,
+                                 memory_order_relaxed);
+    if (match <= start) {
+      return;
+    }
+
+    range = job->builtin.resync.range - (uint64_t)block * RESYNC_BLOCK;
+    range = range < RESYNC_BLOCK ? range : RESYNC_BLOCK;
+    if (hotp_resync_ctx(job->builtin.resync.key, start, range,
+                        job->builtin.resync.guesses,
+                        job->builtin.resync.guessCount,
+                        job->builtin.resync.guessDigits,
+                        &next) != OTP_VALIDATE_SUCCESS) {
+      continue;
+    }
+
+    next -= job->builtin.resync.guessCount;
+    while (next < match
+           && !atomic_compare_exchange_weak(&job->builtin.resync.match, &match,
+                                            next)) {
+    }
+    return;
+  }
+}
+
+static void resync_complete(otp_job *job) {
+  uint64_t match = atomic_load(&job->builtin.resync.match);
+
+  *job->builtin.resync.result = match == RESYNC_NONE ? OTP_VALIDATE_FAILURE
+                                                     : OTP_VALIDATE_SUCCESS;
+  if (match != RESYNC_NONE && job->builtin.resync.nextCounter) {
+    *job->builtin.resync.nextCounter = match + job->builtin.resync.guessCount;
+  }
+}
@@ -0,0 +1,101 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_EXECUTOR_H_
+#define OTP_EXECUTOR_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct otp_executor otp_executor;
+typedef struct otp_job otp_job;
+
+/* processes items [begin, end) of a job. scratch is the calling worker's
+ * private buffer, scratchBytes long as configured at create time */
+typedef void (*otp_task_fn)(void *arg, size_t begin, size_t end,
+                            void *scratch);
+
+/* runs on the worker that finishes the last item of a job */
+typedef void (*otp_job_callback)(void *callbackArg);
+
+/* start a pool of threads (0 = one per online CPU), NULL on failure */
+otp_executor *otp_executor_create(unsigned int threads, size_t scratchBytes);
+
+/* waits for queued jobs to drain, then stops and frees the pool */
+void otp_executor_destroy(otp_executor *executor);
+
+unsigned int otp_executor_threads(const otp_executor *executor);
+
+/* split count items into ranges that workers take grain items at a time
+ * and steal from each other when they run dry. jobs are limited to
+ * UINT32_MAX items. returns NULL if the job couldn't be allocated.
+ * the handle must be given back with otp_job_wait or otp_job_detach */
+otp_job *otp_executor_submit(otp_executor *executor, otp_task_fn task,
+                             void *arg, size_t count, size_t grain,
+                             otp_job_callback callback, void *callbackArg);
+
+/* built in jobs over the batch entry points of libotp.h */
+otp_job *otp_executor_hotp_many(otp_executor *executor,
+                                const hotp_request *requests, uint32_t *codes,
+                                size_t count, otp_job_callback callback,
+                                void *callbackArg);
+
+otp_job *otp_executor_hotp_validate(otp_executor *executor,
+                                    const hotp_batch *batch,
+                                    OTP_VALIDATE_RESULT *results,
+                                    otp_job_callback callback,
+                                    void *callbackArg);
+
+otp_job *otp_executor_totp_validate(otp_executor *executor,
+                                    const totp_batch *batch,
+                                    unsigned int windowLength,
+                                    OTP_VALIDATE_RESULT *results,
+                                    otp_job_callback callback,
+                                    void *callbackArg);
+
+/* hotp_resync_ctx split over the workers. blocks above a match already
+ * found are skipped, and the lowest match wins as it would inline. unlike
+ * inline, UINT64_MAX is never taken as the first code, it marks no match.
+ * result and nextCounter are written before the job completes */
+otp_job *otp_executor_hotp_resync(otp_executor *executor, const otp_key *key,
+                                  uint64_t counter, uint64_t range,
+                                  const uint32_t *guesses, size_t guessCount,
+                                  unsigned int guessDigits,
+                                  OTP_VALIDATE_RESULT *result,
+                                  uint64_t *nextCounter,
+                                  otp_job_callback callback,
+                                  void *callbackArg);
+
+/* non-zero once every item of the job has been processed */
+int otp_job_done(otp_job *job);
+
+/* block until the job completes, then release the handle */
+void otp_job_wait(otp_job *job);
+
+/* release the handle without waiting, the job still runs to completion */
+void otp_job_detach(otp_job *job);
+
+#endif /* OTP_EXECUTOR_H_ */
@@ -0,0 +1,429 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+/* local includes */
+#include "otp_arena.h"
+#include "otp_index.h"
+
+/* external includes */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_NO_STEP UINT64_MAX
+
+/* Fibonacci hashing of a code onto bucketBits bits */
+#define INDEX_BUCKET(code, bits) \
+  ((size_t)(((uint64_t)(code) * UINT64_C(0x9e3779b97f4a7c15)) >> (64 - (bits))))
+
+typedef struct index_entry {
+  uint32_t code;
+  uint32_t user;
+} index_entry;
+
+/* the codes of every user at one step, grouped by bucket. step reads
+ * INDEX_NO_STEP while the table is rebuilt, which only starts once the
+ * readers already inside have left */
+typedef struct index_table {
+  _Atomic uint64_t step;
+  atomic_uint readers;
+  uint32_t *bucketStart;
+  index_entry *entries;
+} index_table;
+
+struct otp_index {
+  size_t count;
+  unsigned int windowLength;
+  unsigned int digits;
+  unsigned int radius;
+  unsigned int bucketBits;
+  uint64_t *userIds;
+  otp_key *keys;
+  otp_executor *executor;
+  /* builder scratch, only touched under buildLock */
+  pthread_mutex_t buildLock;
+  hotp_request *requests;
+  uint32_t *codes;
+  uint32_t *cursor;
+  /* the background rebuild */
+  pthread_mutex_t threadLock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  int running;
+  int stopping;
+  size_t tableCount;
+  index_table tables[];
+};
+
+/* internal helper function definitions */
+static void build_step(otp_index *index, index_table *table, uint64_t step);
+static index_table *find_table(otp_index *index, uint64_t step);
+static index_table *spare_table(otp_index *index, uint64_t first,
+                                uint64_t last);
+static index_table *acquire_table(otp_index *index, uint64_t step);
+static size_t lookup_table(otp_index *index, const index_table *table,
+                           uint32_t code, int64_t offset,
+                           otp_index_match *matches, size_t maxMatches,
+                           size_t found);
+static void *index_thread(void *argument);
+
+otp_index *otp_index_create(const uint64_t *userIds, const otp_key *keys,
+                            size_t count, unsigned int windowLength,
+                            unsigned int digits, unsigned int radius,
+                            otp_executor *executor) {
+  otp_index *index;
+  size_t tableCount = 2 * (size_t)radius + 3;
+  size_t buckets;
+  size_t iterator;
+
+  if (count > UINT32_MAX || windowLength == 0 || digits == 0
+      || radius > OTP_INDEX_MAX_RADIUS) {
+    return NULL;
+  }
+
+  index = calloc(1, sizeof(*index) + tableCount * sizeof(index_table));
+  if (index == NULL) {
+    return NULL;
+  }
+
+  pthread_mutex_init(&index->buildLock, NULL);
+  pthread_mutex_init(&index->threadLock, NULL);
+  pthread_cond_init(&index->wake, NULL);
+  index->count = count;
+  index->windowLength = windowLength;
+  index->digits = digits;
+  index->radius = radius;
+  index->executor = executor;
+  index->tableCount = tableCount;
+
+  /* about one user per bucket */
+  index->bucketBits = 1;
+  while (((size_t)1 << index->bucketBits) < count) {
+    index->bucketBits++;
+  }
+  buckets = (size_t)1 << index->bucketBits;
+
+  index->userIds = malloc(count * sizeof(uint64_t) + 1);
+  index->keys = malloc(count * sizeof(otp_key) + 1);
+  index->requests = malloc(count * sizeof(hotp_request) + 1);
+  index->codes = malloc(count * sizeof(uint32_t) + 1);
+  index->cursor = malloc(buckets * sizeof(uint32_t));
+  if (!index->userIds || !index->keys || !index->requests || !index->codes
+      || !index->cursor) {
+    otp_index_destroy(index);
+    return NULL;
+  }
+
+  for (iterator = 0; iterator < tableCount; iterator++) {
+    index_table *table = &index->tables[iterator];
+
+    atomic_init(&table->step, INDEX_NO_STEP);
+    atomic_init(&table->readers, 0);
+    table->bucketStart = malloc((buckets + 1) * sizeof(uint32_t));
+    table->entries = malloc(count * sizeof(index_entry) + 1);
+    if (!table->bucketStart || !table->entries) {
+      otp_index_destroy(index);
+      return NULL;
+    }
+  }
+
+  memcpy(index->userIds, userIds, count * sizeof(uint64_t));
+  memcpy(index->keys, keys, count * sizeof(otp_key));
+  for (iterator = 0; iterator < count; iterator++) {
+    index->requests[iterator].key = &index->keys[iterator];
+  }
+
+  return index;
+}
+
+void otp_index_destroy(otp_index *index) {
+  size_t iterator;
+
+  otp_index_stop(index);
+
+  for (iterator = 0; iterator < index->tableCount; iterator++) {
+    free(index->tables[iterator].bucketStart);
+    free(index->tables[iterator].entries);
+  }
+  if (index->keys) {
+    otp_secure_wipe(index->keys, index->count * sizeof(otp_key));
+  }
+  free(index->userIds);
+  free(index->keys);
+  free(index->requests);
+  free(index->codes);
+  free(index->cursor);
+
+  pthread_cond_destroy(&index->wake);
+  pthread_mutex_destroy(&index->threadLock);
+  pthread_mutex_destroy(&index->buildLock);
+  free(index);
+}
+
+void otp_index_advance(otp_index *index, time_t time) {
+  uint64_t step = time / index->windowLength;
+  uint64_t first = step < index->radius ? 0 : step - index->radius;
+  uint64_t last = step + index->radius + 1;
+  uint64_t current;
+
+  pthread_mutex_lock(&index->buildLock);
+
+  for (current = first; current <= last; current++) {
+    if (find_table(index, current) == NULL) {
+      build_step(index, spare_table(index, first, last), current);
+    }
+  }
+
+  pthread_mutex_unlock(&index->buildLock);
+}
+
+int otp_index_start(otp_index *index) {
+  int result;
+
+  pthread_mutex_lock(&index->threadLock);
+  if (index->running) {
+    pthread_mutex_unlock(&index->threadLock);
+    errno = EALREADY;
+    return -1;
+  }
+
+  index->stopping = 0;
+  result = pthread_create(&index->thread, NULL, index_thread, index);
+  if (result) {
+    pthread_mutex_unlock(&index->threadLock);
+    errno = result;
+    return -1;
+  }
+  index->running = 1;
+  pthread_mutex_unlock(&index->threadLock);
+
+  return 0;
+}
+
+void otp_index_stop(otp_index *index) {
+  pthread_mutex_lock(&index->threadLock);
+  if (!index->running) {
+    pthread_mutex_unlock(&index->threadLock);
+    return;
+  }
+  index->stopping = 1;
+  pthread_cond_signal(&index->wake);
+  pthread_mutex_unlock(&index->threadLock);
+
+  pthread_join(index->thread, NULL);
+  index->running = 0;
+}
+
+size_t otp_index_lookup(otp_index *index, time_t time, uint32_t code,
+                        otp_index_match *matches, size_t maxMatches) {
+  uint64_t step = time / index->windowLength;
+  index_table *table;
+  int64_t distance;
+  int64_t offset;
+  int side;
+  size_t found = 0;
+
+  for (distance = 0; distance <= index->radius; distance++) {
+    for (side = 0; side < (distance ? 2 : 1); side++) {
+      offset = side ? -distance : distance;
+      if (offset < 0 && (uint64_t)distance > step) {
+        continue;
+      }
+
+      /* a step the background rebuild hasn't reached is built here */
+      table = acquire_table(index, step + offset);
+      if (table == NULL) {
+        otp_index_advance(index, time);
+        table = acquire_table(index, step + offset);
+      }
+      if (table == NULL) {
+        continue;
+      }
+
+      found = lookup_table(index, table, code, offset, matches, maxMatches,
+                           found);
+      atomic_fetch_sub(&table->readers, 1);
+    }
+  }
+
+  return found;
+}
+
+/* hash every user at step and counting sort the codes into buckets */
+static void build_step(otp_index *index, index_table *table, uint64_t step) {
+  size_t buckets = (size_t)1 << index->bucketBits;
+  otp_job *job = NULL;
+  size_t bucket;
+  size_t iterator;
+
+  /* retire the table and let readers still inside it finish */
+  atomic_store(&table->step, INDEX_NO_STEP);
+  while (atomic_load(&table->readers)) {
+    sched_yield();
+  }
+
+  for (iterator = 0; iterator < index->count; iterator++) {
+    index->requests[iterator].counter = step;
+  }
+  if (index->executor) {
+    job = otp_executor_hotp_many(index->executor, index->requests,
+                                 index->codes, index->count, NULL, NULL);
+  }
+  if (job) {
+    otp_job_wait(job);
+  } else {
+    hotp_many(index->requests, index->codes, index->count);
+  }
+
+  memset(table->bucketStart, 0, (buckets + 1) * sizeof(uint32_t));
+  for (iterator = 0; iterator < index->count; iterator++) {
+    index->codes[iterator] = otp_truncate_digits(index->codes[iterator],
+                                                 index->digits);
+    table->bucketStart[INDEX_BUCKET(index->codes[iterator],
+                                    index->bucketBits) + 1]++;
+  }
+  for (bucket = 0; bucket < buckets; bucket++) {
+    table->bucketStart[bucket + 1] += table->bucketStart[bucket];
+  }
+
+  memcpy(index->cursor, table->bucketStart, buckets * sizeof(uint32_t));
+  for (iterator = 0; iterator < index->count; iterator++) {
+    bucket = INDEX_BUCKET(index->codes[iterator], index->bucketBits);
+    table->entries[index->cursor[bucket]].code = index->codes[iterator];
+    table->entries[index->cursor[bucket]].user = (uint32_t)iterator;
+    index->cursor[bucket]++;
+  }
+
+  atomic_store(&table->step, step);
+}
+
+static index_table *find_table(otp_index *index, uint64_t step) {
+  size_t iterator;
+
+  for (iterator = 0; iterator < index->tableCount; iterator++) {
+    if (atomic_load(&index->tables[iterator].step) == step) {
+      return &index->tables[iterator];
+    }
+  }
+
+  return NULL;
+}
+
+/* the range needs one table less than there are. the spare is kept for
+ * advancing ahead of a boundary: time is then a step on from the one
+ * lookups still use, whose lowest step lies just below first, so the
+ * table taken is the one furthest from the range */
+static index_table *spare_table(otp_index *index, uint64_t first,
+                                uint64_t last) {
+  index_table *spare = NULL;
+  uint64_t spareDistance = 0;
+  uint64_t tableStep;
+  uint64_t distance;
+  size_t iterator;
+
+  for (iterator = 0; iterator < index->tableCount; iterator++) {
+    tableStep = atomic_load(&index->tables[iterator].step);
+    if (tableStep == INDEX_NO_STEP) {
+      return &index->tables[iterator];
+    }
+    if (tableStep >= first && tableStep <= last) {
+      continue;
+    }
+    distance = tableStep < first ? first - tableStep : tableStep - last;
+    if (distance > spareDistance) {
+      spare = &index->tables[iterator];
+      spareDistance = distance;
+    }
+  }
+
+  return spare;
+}
+
+/* find the table of step and register as its reader. the step is checked
+ * again once registered in case a rebuild started in between */
+static index_table *acquire_table(otp_index *index, uint64_t step) {
+  index_table *table = find_table(index, step);
+
+  if (table == NULL) {
+    return NULL;
+  }
+
+  atomic_fetch_add(&table->readers, 1);
+  if (atomic_load(&table->step) != step) {
+    atomic_fetch_sub(&table->readers, 1);
+    return NULL;
+  }
+
+  return table;
+}
+
+static size_t lookup_table(otp_index *index, const index_table *table,
+                           uint32_t code, int64_t offset,
+                           otp_index_match *matches, size_t maxMatches,
+                           size_t found) {
+  size_t bucket = INDEX_BUCKET(code, index->bucketBits);
+  uint32_t entry;
+
+  for (entry = table->bucketStart[bucket];
+       entry < table->bucketStart[bucket + 1]; entry++) {
+    if (table->entries[entry].code != code) {
+      continue;
+    }
+    if (found < maxMatches) {
+      matches[found].userId = index->userIds[table->entries[entry].user];
+      matches[found].offset = offset;
+    }
+    found++;
+  }
+
+  return found;
+}
+
+static void *index_thread(void *argument) {
+  otp_index *index = argument;
+  struct timespec boundary;
+  time_t now;
+
+  pthread_mutex_lock(&index->threadLock);
+  while (!index->stopping) {
+    pthread_mutex_unlock(&index->threadLock);
+
+    now = time(NULL);
+    otp_index_advance(index, now);
+
+    /* sleep until the clock reaches the next step */
+    boundary.tv_sec = (now / index->windowLength + 1) * index->windowLength;
+    boundary.tv_nsec = 0;
+
+    pthread_mutex_lock(&index->threadLock);
+    if (!index->stopping) {
+      pthread_cond_timedwait(&index->wake, &index->threadLock, &boundary);
+    }
+  }
+  pthread_mutex_unlock(&index->threadLock);
+
+  return NULL;
+}
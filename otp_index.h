@@ -0,0 +1,78 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef OTP_INDEX_H_
+#define OTP_INDEX_H_
+
+/* local includes */
+#include "libotp.h"
+#include "otp_executor.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Code to user lookup over a population of keys, for flows where only the
+ * code is entered. The codes of every user are precomputed for the steps
+ * time/windowLength - radius .. + radius (and the one after, ahead of the
+ * boundary) and bucketed by code. One table more is kept, so advancing to
+ * a time just ahead of the next boundary doesn't drop a step lookups are
+ * still using. Lookups don't take locks.
+ */
+typedef struct otp_index otp_index;
+
+#define OTP_INDEX_MAX_RADIUS 16
+
+typedef struct otp_index_match {
+  uint64_t userId;
+  int64_t offset;
+} otp_index_match;
+
+/* index count users, userIds[i] holding keys[i]. the keys are copied.
+ * steps are hashed on executor when one is given. NULL on failure */
+otp_index *otp_index_create(const uint64_t *userIds, const otp_key *keys,
+                            size_t count, unsigned int windowLength,
+                            unsigned int digits, unsigned int radius,
+                            otp_executor *executor);
+
+/* stops the background rebuild if it is running */
+void otp_index_destroy(otp_index *index);
+
+/* build whichever steps around time are missing */
+void otp_index_advance(otp_index *index, time_t time);
+
+/* keep the index current on a thread of its own, rebuilding at each step
+ * boundary of the system clock. 0 on success, -1 with errno set */
+int otp_index_start(otp_index *index);
+
+void otp_index_stop(otp_index *index);
+
+/* every user whose code at an offset within the radius of time's step is
+ * code, nearest offsets first. the first maxMatches are written to
+ * matches, and the total is returned - more than one is a collision */
+size_t otp_index_lookup(otp_index *index, time_t time, uint32_t code,
+                        otp_index_match *matches, size_t maxMatches);
+
+#endif /* OTP_INDEX_H_ */
@@ -0,0 +1,313 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_keyfile.h"
+
+/* external includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define KEYFILE_ALIGNMENT 64
+#define ALIGN_UP(value) (((value) + KEYFILE_ALIGNMENT - 1) \
+                         & ~(uint64_t)(KEYFILE_ALIGNMENT - 1))
+
+struct otp_keyfile {
+  void *map;
+  size_t length;
+  size_t count;
+  const uint64_t *index;
+  const otp_keyfile_record *records;
+};
+
+/* internal helper function definitions */
+static int compare_records(const void *left, const void *right);
+static int write_records(int fd, const otp_keyfile_header *header,
+                         const otp_keyfile_record *records, size_t count);
+static int sync_directory(const char *path);
+static uint32_t algorithm_bit(OTP_ALGORITHM algorithm);
+
+int otp_keyfile_write(const char *path, otp_keyfile_record *records,
+                      size_t count) {
+  otp_keyfile_header header;
+  uint64_t indexBytes = count * sizeof(uint64_t);
+  char *temporary;
+  size_t iterator;
+  int fd;
+
+  memset(&header, 0, sizeof(header));
+
+  qsort(records, count, sizeof(*records), compare_records);
+  for (iterator = 0; iterator < count; iterator++) {
+    uint32_t algorithm = algorithm_bit(records[iterator].key.algorithm);
+
+    if (algorithm == 0 || (iterator > 0 && records[iterator].userId
+                                           == records[iterator - 1].userId)) {
+      errno = EINVAL;
+      return -1;
+    }
+    header.algorithm |= algorithm;
+  }
+
+  memcpy(header.magic, OTP_KEYFILE_MAGIC, sizeof(OTP_KEYFILE_MAGIC));
+  header.version = OTP_KEYFILE_VERSION;
+  header.byteOrder = OTP_KEYFILE_BYTE_ORDER;
+  header.recordSize = sizeof(otp_keyfile_record);
+  header.recordCount = count;
+  header.indexOffset = sizeof(header);
+  header.recordsOffset = ALIGN_UP(header.indexOffset + indexBytes);
+
+  /* written beside the file and renamed over it, so processes mapping the
+   * old file keep reading it and a failed write leaves it as it was */
+  temporary = malloc(strlen(path) + sizeof(".tmp"));
+  if (temporary == NULL) {
+    return -1;
+  }
+  strcpy(temporary, path);
+  strcat(temporary, ".tmp");
+
+  /* key material, keep it private to the owner */
+  fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+            0600);
+  if (fd < 0) {
+    free(temporary);
+    return -1;
+  }
+
+  if (write_records(fd, &header, records, count)
+      || rename(temporary, path) || sync_directory(path)) {
+    int error = errno;
+
+    unlink(temporary);
+    free(temporary);
+    errno = error;
+    return -1;
+  }
+
+  free(temporary);
+  return 0;
+}
+
+otp_keyfile *otp_keyfile_open(const char *path) {
+  const otp_keyfile_header *header;
+  otp_keyfile *keyfile;
+  struct stat status;
+  size_t iterator;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    return NULL;
+  }
+  if ((uint64_t)status.st_size < sizeof(otp_keyfile_header)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  keyfile = calloc(1, sizeof(*keyfile));
+  if (keyfile == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  /* shared so every process using the file reads the same page cache */
+  keyfile->length = status.st_size;
+  keyfile->map = mmap(NULL, keyfile->length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (keyfile->map == MAP_FAILED) {
+    free(keyfile);
+    return NULL;
+  }
+
+  /* check the header and that every section fits the file */
+  header = keyfile->map;
+  if (memcmp(header->magic, OTP_KEYFILE_MAGIC, sizeof(OTP_KEYFILE_MAGIC)) != 0
+      || header->version != OTP_KEYFILE_VERSION
+      || header->byteOrder != OTP_KEYFILE_BYTE_ORDER
+      || (header->algorithm & ~(uint32_t)OTP_KEYFILE_ALGORITHM_ALL)
+      || header->recordSize != sizeof(otp_keyfile_record)
+      || header->indexOffset % sizeof(uint64_t) != 0
+      || header->recordsOffset % KEYFILE_ALIGNMENT != 0
+      || header->recordCount > keyfile->length / sizeof(otp_keyfile_record)
+      || header->indexOffset > keyfile->length
+      || header->recordCount * sizeof(uint64_t)
+           > keyfile->length - header->indexOffset
+      || header->recordsOffset > keyfile->length
+      || header->recordCount * sizeof(otp_keyfile_record)
+           > keyfile->length - header->recordsOffset) {
+    otp_keyfile_close(keyfile);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  keyfile->count = header->recordCount;
+  keyfile->index = (const uint64_t *)((const uint8_t *)keyfile->map
+                                      + header->indexOffset);
+  keyfile->records = (const otp_keyfile_record *)((const uint8_t *)keyfile->map
+                                                  + header->recordsOffset);
+
+  /* a damaged algorithm would otherwise hash as SHA1 */
+  for (iterator = 0; iterator < keyfile->count; iterator++) {
+    if (!(algorithm_bit(keyfile->records[iterator].key.algorithm)
+          & header->algorithm)) {
+      otp_keyfile_close(keyfile);
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+
+  /* lookups land anywhere, don't read ahead */
+  madvise(keyfile->map, keyfile->length, MADV_RANDOM);
+
+  return keyfile;
+}
+
+void otp_keyfile_close(otp_keyfile *keyfile) {
+  munmap(keyfile->map, keyfile->length);
+  free(keyfile);
+}
+
+size_t otp_keyfile_count(const otp_keyfile *keyfile) {
+  return keyfile->count;
+}
+
+/* binary search over the dense ID index, only the hit touches a record */
+const otp_keyfile_record *otp_keyfile_find(const otp_keyfile *keyfile,
+                                           uint64_t userId) {
+  size_t low = 0;
+  size_t high = keyfile->count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+
+    if (keyfile->index[middle] < userId) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  if (low < keyfile->count && keyfile->index[low] == userId) {
+    return &keyfile->records[low];
+  }
+
+  return NULL;
+}
+
+const otp_keyfile_record *otp_keyfile_record_at(const otp_keyfile *keyfile,
+                                                size_t index) {
+  return index < keyfile->count ? &keyfile->records[index] : NULL;
+}
+
+static int compare_records(const void *left, const void *right) {
+  uint64_t leftId = ((const otp_keyfile_record *)left)->userId;
+  uint64_t rightId = ((const otp_keyfile_record *)right)->userId;
+
+  return (leftId > rightId) - (leftId < rightId);
+}
+
+/* header, index and records through stdio, synced and closed. fd is
+ * closed either way */
+static int write_records(int fd, const otp_keyfile_header *header,
+                         const otp_keyfile_record *records, size_t count) {
+  static const uint8_t padding[KEYFILE_ALIGNMENT];
+  uint64_t padBytes = header->recordsOffset - header->indexOffset
+                    - count * sizeof(uint64_t);
+  size_t iterator;
+  FILE *file;
+  int written;
+
+  file = fdopen(fd, "wb");
+  if (file == NULL) {
+    close(fd);
+    return -1;
+  }
+
+  written = fwrite(header, sizeof(*header), 1, file) == 1;
+  for (iterator = 0; iterator < count && written; iterator++) {
+    written = fwrite(&records[iterator].userId, sizeof(uint64_t), 1, file) == 1;
+  }
+  written = written && fwrite(padding, 1, padBytes, file) == padBytes;
+  written = written
+         && fwrite(records, sizeof(otp_keyfile_record), count, file) == count;
+
+  if (!written || fflush(file) != 0 || fsync(fd) != 0) {
+    int error = errno;
+
+    fclose(file);
+    errno = error;
+    return -1;
+  }
+
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+/* make a rename in path's directory durable */
+static int sync_directory(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *directory;
+  int result;
+  int fd;
+
+  if (slash == NULL) {
+    fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  } else {
+    directory = strndup(path, slash == path ? 1 : (size_t)(slash - path));
+    if (directory == NULL) {
+      return -1;
+    }
+    fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(directory);
+  }
+  if (fd < 0) {
+    return -1;
+  }
+
+  result = fsync(fd);
+  close(fd);
+  return result;
+}
+
+/* the header bit for algorithm, 0 if it isn't one */
+static uint32_t algorithm_bit(OTP_ALGORITHM algorithm) {
+  switch (algorithm) {
+    case OTP_SHA1:
+      return OTP_KEYFILE_ALGORITHM_SHA1;
+    case OTP_SHA256:
+      return OTP_KEYFILE_ALGORITHM_SHA256;
+    case OTP_SHA512:
+      return OTP_KEYFILE_ALGORITHM_SHA512;
+    default:
+      return 0;
+  }
+}
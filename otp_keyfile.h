@@ -0,0 +1,98 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_KEYFILE_H_
+#define OTP_KEYFILE_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary secret store. All fields are native endian, the header records
+ * the byte order so a file from another architecture is refused.
+ *
+ *   header     64 bytes
+ *   index      recordCount sorted user IDs, padded to 64 bytes
+ *   records    recordCount otp_keyfile_record, same order as the index
+ */
+#define OTP_KEYFILE_MAGIC "OTPKEYS"
+#define OTP_KEYFILE_VERSION 1
+#define OTP_KEYFILE_BYTE_ORDER 0x01020304
+
+/* header algorithm bits, one for each algorithm used by some record. a
+ * file of SHA1 keys alone reads the same as before the others existed */
+#define OTP_KEYFILE_ALGORITHM_SHA1 1
+#define OTP_KEYFILE_ALGORITHM_SHA256 2
+#define OTP_KEYFILE_ALGORITHM_SHA512 4
+#define OTP_KEYFILE_ALGORITHM_ALL 7
+
+typedef struct otp_keyfile_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t algorithm;
+  uint32_t recordSize;
+  uint64_t recordCount;
+  uint64_t indexOffset;
+  uint64_t recordsOffset;
+  uint8_t reserved[16];
+} otp_keyfile_header;
+
+/* one user, a precomputed key plus the parameters it is used with */
+typedef struct otp_keyfile_record {
+  alignas(64) uint64_t userId;
+  uint64_t counter;
+  uint32_t digits;
+  uint32_t period;
+  otp_key key;
+} otp_keyfile_record;
+
+typedef struct otp_keyfile otp_keyfile;
+
+/* write records to path, sorting them by user ID in place first. the file
+ * is written as path.tmp and renamed into place, so open mappings of the
+ * old one stay valid. returns 0 on success, -1 with errno set on failure
+ * (EINVAL for duplicate user IDs or an unknown algorithm) */
+int otp_keyfile_write(const char *path, otp_keyfile_record *records,
+                      size_t count);
+
+/* map a key file read only, NULL with errno set if it can't be used.
+ * every record must have an algorithm the header lists */
+otp_keyfile *otp_keyfile_open(const char *path);
+
+void otp_keyfile_close(otp_keyfile *keyfile);
+
+size_t otp_keyfile_count(const otp_keyfile *keyfile);
+
+/* records live in the mapping and stay valid until the file is closed */
+const otp_keyfile_record *otp_keyfile_find(const otp_keyfile *keyfile,
+                                           uint64_t userId);
+
+const otp_keyfile_record *otp_keyfile_record_at(const otp_keyfile *keyfile,
+                                                size_t index);
+
+#endif /* OTP_KEYFILE_H_ */
@@ -0,0 +1,275 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_metrics.h"
+
+/* external includes */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* one per thread, reused once the thread exits. only the owner writes */
+typedef struct metrics_slot {
+  _Atomic uint64_t counters[OTP_METRIC_COUNT];
+  _Atomic uint64_t matchOffsets[OTP_METRICS_OFFSET_BUCKETS];
+  _Atomic uint64_t latency[OTP_METRICS_LATENCY_BUCKETS];
+  atomic_int owned;
+  struct metrics_slot *next;
+} metrics_slot;
+
+static _Atomic(metrics_slot *) slots;
+static _Thread_local metrics_slot *threadSlot;
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+/* subtracted from every read, replaced by otp_metrics_reset */
+static otp_metrics_snapshot baseline;
+static pthread_mutex_t baselineLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* internal helper function definitions */
+static metrics_slot *claim_slot(void);
+static void release_slot(void *slot);
+static void create_slot_key(void);
+static void read_slots(otp_metrics_snapshot *snapshot);
+static void bump(_Atomic uint64_t *counter, uint64_t count);
+
+int otp_metrics_enabled(void) {
+#ifdef OTP_METRICS
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void otp_metrics_read(otp_metrics_snapshot *snapshot) {
+  uint64_t *totals = (uint64_t *)snapshot;
+  const uint64_t *base = (const uint64_t *)&baseline;
+  size_t iterator;
+
+  read_slots(snapshot);
+
+  pthread_mutex_lock(&baselineLock);
+  for (iterator = 0; iterator < sizeof(*snapshot) / sizeof(uint64_t); iterator++) {
+    totals[iterator] -= base[iterator];
+  }
+  pthread_mutex_unlock(&baselineLock);
+}
+
+void otp_metrics_reset(void) {
+  otp_metrics_snapshot current;
+
+  read_slots(&current);
+
+  pthread_mutex_lock(&baselineLock);
+  baseline = current;
+  pthread_mutex_unlock(&baselineLock);
+}
+
+uint64_t otp_metrics_latency_percentile(const otp_metrics_snapshot *snapshot,
+                                        double fraction) {
+  uint64_t total = 0;
+  uint64_t seen = 0;
+  size_t bucket;
+
+  for (bucket = 0; bucket < OTP_METRICS_LATENCY_BUCKETS; bucket++) {
+    total += snapshot->latency[bucket];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  for (bucket = 0; bucket < OTP_METRICS_LATENCY_BUCKETS - 1; bucket++) {
+    seen += snapshot->latency[bucket];
+    if (seen >= fraction * total) {
+      break;
+    }
+  }
+
+  return ((uint64_t)1 << bucket) - 1;
+}
+
+int otp_metrics_format(char *buffer, size_t size,
+                       const otp_metrics_snapshot *snapshot) {
+  static const char *names[OTP_METRIC_COUNT] = {
+    "hashes", "validations", "successes", "failures"
+  };
+  const char *separator = "";
+  size_t used = 0;
+  size_t iterator;
+  int length;
+
+/* append to buffer while it has room, always counting the full length */
+#define APPEND(...) do { \
+    length = snprintf(buffer + (used < size ? used : size), \
+                      used < size ? size - used : 0, __VA_ARGS__); \
+    if (length < 0) { \
+      return length; \
+    } \
+    used += (size_t)length; \
+  } while (0)
+
+  APPEND("{");
+  for (iterator = 0; iterator < OTP_METRIC_COUNT; iterator++) {
+    APPEND("\"%s\": %llu, ", names[iterator],
+           (unsigned long long)snapshot->counters[iterator]);
+  }
+
+  APPEND("\"match_offsets\": {");
+  for (iterator = 0; iterator < OTP_METRICS_OFFSET_BUCKETS; iterator++) {
+    if (snapshot->matchOffsets[iterator]) {
+      APPEND("%s\"%d\": %llu", separator,
+             (int)iterator - OTP_METRICS_OFFSET_LIMIT,
+             (unsigned long long)snapshot->matchOffsets[iterator]);
+      separator = ", ";
+    }
+  }
+
+  APPEND("}, \"latency_p50_ns\": %llu, \"latency_p99_ns\": %llu, "
+         "\"latency_p999_ns\": %llu}",
+         (unsigned long long)otp_metrics_latency_percentile(snapshot, 0.50),
+         (unsigned long long)otp_metrics_latency_percentile(snapshot, 0.99),
+         (unsigned long long)otp_metrics_latency_percentile(snapshot, 0.999));
+
+#undef APPEND
+
+  return (int)used;
+}
+
+void otp_metrics_add(OTP_METRIC metric, uint64_t count) {
+  metrics_slot *slot = threadSlot ? threadSlot : claim_slot();
+
+  if (slot) {
+    bump(&slot->counters[metric], count);
+  }
+}
+
+uint64_t otp_metrics_clock(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void otp_metrics_validated(OTP_VALIDATE_RESULT result, int64_t offset,
+                           uint64_t start) {
+  metrics_slot *slot = threadSlot ? threadSlot : claim_slot();
+  uint64_t elapsed = otp_metrics_clock() - start;
+  size_t bucket = 0;
+
+  if (slot == NULL) {
+    return;
+  }
+
+  bump(&slot->counters[OTP_METRIC_VALIDATIONS], 1);
+
+  if (result == OTP_VALIDATE_SUCCESS) {
+    bump(&slot->counters[OTP_METRIC_SUCCESSES], 1);
+
+    if (offset < -OTP_METRICS_OFFSET_LIMIT) {
+      offset = -OTP_METRICS_OFFSET_LIMIT;
+    } else if (offset > OTP_METRICS_OFFSET_LIMIT) {
+      offset = OTP_METRICS_OFFSET_LIMIT;
+    }
+    bump(&slot->matchOffsets[offset + OTP_METRICS_OFFSET_LIMIT], 1);
+  } else {
+    bump(&slot->counters[OTP_METRIC_FAILURES], 1);
+  }
+
+  /* log2 bucket - the bit length of the elapsed time */
+  while (elapsed && bucket < OTP_METRICS_LATENCY_BUCKETS - 1) {
+    elapsed >>= 1;
+    bucket++;
+  }
+  bump(&slot->latency[bucket], 1);
+}
+
+/* take over the slot of an exited thread, or add a new one */
+static metrics_slot *claim_slot(void) {
+  metrics_slot *slot;
+  int unowned;
+
+  pthread_once(&slotKeyOnce, create_slot_key);
+
+  for (slot = atomic_load(&slots); slot; slot = slot->next) {
+    unowned = 0;
+    if (atomic_compare_exchange_strong(&slot->owned, &unowned, 1)) {
+      break;
+    }
+  }
+
+  if (slot == NULL) {
+    slot = calloc(1, sizeof(*slot));
+    if (slot == NULL) {
+      return NULL;
+    }
+    atomic_init(&slot->owned, 1);
+    slot->next = atomic_load(&slots);
+    while (!atomic_compare_exchange_weak(&slots, &slot->next, slot)) {
+    }
+  }
+
+  pthread_setspecific(slotKey, slot);
+  threadSlot = slot;
+
+  return slot;
+}
+
+static void release_slot(void *slot) {
+  atomic_store(&((metrics_slot *)slot)->owned, 0);
+}
+
+static void create_slot_key(void) {
+  pthread_key_create(&slotKey, release_slot);
+}
+
+static void read_slots(otp_metrics_snapshot *snapshot) {
+  const metrics_slot *slot;
+  size_t iterator;
+
+  memset(snapshot, 0, sizeof(*snapshot));
+
+  for (slot = atomic_load(&slots); slot; slot = slot->next) {
+    for (iterator = 0; iterator < OTP_METRIC_COUNT; iterator++) {
+      snapshot->counters[iterator] += atomic_load_explicit(
+          &slot->counters[iterator], memory_order_relaxed);
+    }
+    for (iterator = 0; iterator < OTP_METRICS_OFFSET_BUCKETS; iterator++) {
+      snapshot->matchOffsets[iterator] += atomic_load_explicit(
+          &slot->matchOffsets[iterator], memory_order_relaxed);
+    }
+    for (iterator = 0; iterator < OTP_METRICS_LATENCY_BUCKETS; iterator++) {
+      snapshot->latency[iterator] += atomic_load_explicit(
+          &slot->latency[iterator], memory_order_relaxed);
+    }
+  }
+}
+
+/* single writer, so a relaxed load and store is enough - no locked add */
+static void bump(_Atomic uint64_t *counter, uint64_t count) {
+  atomic_store_explicit(counter,
+                        atomic_load_explicit(counter, memory_order_relaxed)
+                        + count, memory_order_relaxed);
+}
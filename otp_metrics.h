@@ -0,0 +1,98 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_METRICS_H_
+#define OTP_METRICS_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Opt-in instrumentation. Building the library with -DOTP_METRICS turns
+ * the hooks in the hot paths on; without it they expand to nothing and
+ * snapshots read all zero. Each thread counts into its own slot with
+ * plain relaxed stores, readers add the slots up.
+ */
+
+typedef enum OTP_METRIC {
+  OTP_METRIC_HASHES, OTP_METRIC_VALIDATIONS, OTP_METRIC_SUCCESSES,
+  OTP_METRIC_FAILURES, OTP_METRIC_COUNT
+} OTP_METRIC;
+
+/* matched offsets -LIMIT .. LIMIT, further ones land in the end buckets */
+#define OTP_METRICS_OFFSET_LIMIT 32
+#define OTP_METRICS_OFFSET_BUCKETS (2 * OTP_METRICS_OFFSET_LIMIT + 1)
+
+/* bucket 0 holds calls under 1ns, bucket b those of 2^(b-1) to 2^b - 1ns */
+#define OTP_METRICS_LATENCY_BUCKETS 40
+
+typedef struct otp_metrics_snapshot {
+  uint64_t counters[OTP_METRIC_COUNT];
+  /* successful window validations by offset + OTP_METRICS_OFFSET_LIMIT */
+  uint64_t matchOffsets[OTP_METRICS_OFFSET_BUCKETS];
+  /* latency of single (not batched) validation calls */
+  uint64_t latency[OTP_METRICS_LATENCY_BUCKETS];
+} otp_metrics_snapshot;
+
+/* 1 if the library was built with OTP_METRICS */
+int otp_metrics_enabled(void);
+
+/* totals since start or the last reset. calls still running on other
+ * threads may or may not be included */
+void otp_metrics_read(otp_metrics_snapshot *snapshot);
+
+void otp_metrics_reset(void);
+
+/* upper bound in ns of the latency bucket holding the given fraction */
+uint64_t otp_metrics_latency_percentile(const otp_metrics_snapshot *snapshot,
+                                        double fraction);
+
+/* write a snapshot as JSON. returns the length it needs like snprintf,
+ * output is truncated when that is not less than size */
+int otp_metrics_format(char *buffer, size_t size,
+                       const otp_metrics_snapshot *snapshot);
+
+/* hooks for the library itself */
+void otp_metrics_add(OTP_METRIC metric, uint64_t count);
+
+uint64_t otp_metrics_clock(void);
+
+void otp_metrics_validated(OTP_VALIDATE_RESULT result, int64_t offset,
+                           uint64_t start);
+
+#ifdef OTP_METRICS
+#define OTP_METRICS_ADD(metric, count) otp_metrics_add(metric, count)
+#define OTP_METRICS_START(name) uint64_t name = otp_metrics_clock()
+#define OTP_METRICS_VALIDATED(result, offset, start) \
+  otp_metrics_validated(result, offset, start)
+#else
+/* arguments are left unevaluated, sizeof only keeps them "used" */
+#define OTP_METRICS_ADD(metric, count) ((void)sizeof(count))
+#define OTP_METRICS_START(name) ((void)0)
+#define OTP_METRICS_VALIDATED(result, offset, start) ((void)sizeof(offset))
+#endif
+
+#endif /* OTP_METRICS_H_ */
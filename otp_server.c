@@ -0,0 +1,843 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* accept4 */
+#define _GNU_SOURCE
+
+/* local includes */
+#include "otp_server.h"
+
+/* external includes */
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BATCH 256
+#define MAX_BATCH 65536
+#define DEFAULT_WINDOWS 3
+#define DEFAULT_PERIOD 30
+#define DEFAULT_MODE 0600
+#define MAX_EVENTS 64
+#define MAX_DIGITS 10
+
+/* bytes read from one connection at a time */
+#define INPUT_BYTES (64 * sizeof(otp_server_request))
+
+/* stop reading from a client that isn't taking its responses */
+#define OUTPUT_HIGH 65536
+
+#define STATS_RESPONSE_BYTES (sizeof(otp_server_response) \
+                              + sizeof(otp_server_stats))
+
+typedef struct server_connection {
+  int fd;
+  uint32_t events;
+  /* the client stopped sending, close once everything is answered */
+  int finished;
+  /* the socket is gone, free once no batch refers to it */
+  int dead;
+  size_t pending;
+  size_t inputLength;
+  uint8_t input[INPUT_BYTES];
+  uint8_t *output;
+  size_t outputStart;
+  size_t outputLength;
+  size_t outputCapacity;
+  struct server_connection *previous;
+  struct server_connection *next;
+} server_connection;
+
+/* a decoded request waiting for the batch to be validated */
+typedef struct batch_entry {
+  server_connection *connection;
+  uint64_t start;
+  uint32_t tag;
+  uint32_t type;
+  uint32_t status;
+  size_t storeIndex;
+} batch_entry;
+
+/* only the server thread writes these */
+typedef struct server_counters {
+  _Atomic uint64_t connections;
+  _Atomic uint64_t requests;
+  _Atomic uint64_t malformed;
+  _Atomic uint64_t batches;
+  _Atomic uint64_t latency[OTP_SERVER_LATENCY_BUCKETS];
+  _Atomic uint64_t batchSizes[OTP_SERVER_BATCH_BUCKETS];
+} server_counters;
+
+struct otp_server {
+  otp_store *store;
+  int listenFd;
+  int epollFd;
+  int stopFd;
+  int timerFd;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  size_t maxBatch;
+  uint64_t batchDelay;
+  unsigned int windows;
+  unsigned int period;
+  batch_entry *entries;
+  otp_store_request *requests;
+  OTP_STORE_RESULT *results;
+  size_t count;
+  size_t storeCount;
+  server_connection *connections;
+  server_counters counters;
+};
+
+/* internal helper function definitions */
+static int watch(otp_server *server, int fd, void *data, uint32_t events);
+static int remove_stale_socket(const struct sockaddr_un *address);
+static void accept_connections(otp_server *server);
+static void read_requests(otp_server *server, server_connection *connection);
+static void decode_request(otp_server *server, server_connection *connection,
+                           const otp_server_request *request, uint64_t start);
+static void validate_batch(otp_server *server);
+static int queue_output(server_connection *connection, const void *data,
+                        size_t length);
+static void write_responses(otp_server *server, server_connection *connection);
+static void update_events(otp_server *server, server_connection *connection);
+static void release_connection(otp_server *server,
+                               server_connection *connection);
+static void free_connection(otp_server *server, server_connection *connection);
+static int arm_timer(otp_server *server, uint64_t deadline);
+static uint64_t clock_ns(void);
+static size_t bit_length(uint64_t value);
+static size_t bucket_percentile(const uint64_t *buckets, size_t count,
+                                double fraction);
+static void bump(_Atomic uint64_t *counter, uint64_t count);
+
+otp_server *otp_server_create(otp_store *store, const char *path,
+                              const otp_server_config *config) {
+  struct sockaddr_un address;
+  otp_server *server;
+  size_t maxBatch = config && config->maxBatch ? config->maxBatch
+                                                : DEFAULT_BATCH;
+  mode_t mode = config && config->mode ? (mode_t)config->mode : DEFAULT_MODE;
+
+  if (strlen(path) >= sizeof(address.sun_path) || maxBatch > MAX_BATCH
+      || (mode & ~(mode_t)0777)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  server = calloc(1, sizeof(*server));
+  if (server == NULL) {
+    return NULL;
+  }
+  server->store = store;
+  server->listenFd = -1;
+  server->epollFd = -1;
+  server->stopFd = -1;
+  server->timerFd = -1;
+  server->maxBatch = maxBatch;
+  server->batchDelay = config ? config->batchDelay : 0;
+  server->windows = config && config->windows ? config->windows
+                                               : DEFAULT_WINDOWS;
+  server->period = config && config->period ? config->period
+                                             : DEFAULT_PERIOD;
+
+  server->entries = calloc(maxBatch, sizeof(*server->entries));
+  server->requests = calloc(maxBatch, sizeof(*server->requests));
+  server->results = calloc(maxBatch, sizeof(*server->results));
+  if (server->entries == NULL || server->requests == NULL
+      || server->results == NULL) {
+    goto fail;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  server->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            0);
+  if (server->listenFd < 0) {
+    goto fail;
+  }
+
+  /* the file is created with the socket's mode less the umask, so it is
+   * never more open than asked for, then set to exactly that */
+  if (fchmod(server->listenFd, mode)) {
+    goto fail;
+  }
+
+  /* a socket file left by a server that is gone */
+  if (bind(server->listenFd, (struct sockaddr *)&address, sizeof(address))) {
+    if (errno != EADDRINUSE || remove_stale_socket(&address)
+        || bind(server->listenFd, (struct sockaddr *)&address,
+                sizeof(address))) {
+      goto fail;
+    }
+  }
+  strcpy(server->path, path);
+  if (chmod(path, mode)) {
+    goto fail;
+  }
+
+  server->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  server->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  server->timerFd = timerfd_create(CLOCK_MONOTONIC,
+                                   TFD_NONBLOCK | TFD_CLOEXEC);
+  if (listen(server->listenFd, SOMAXCONN) || server->epollFd < 0
+      || server->stopFd < 0 || server->timerFd < 0
+      || watch(server, server->listenFd, &server->listenFd, EPOLLIN)
+      || watch(server, server->stopFd, &server->stopFd, EPOLLIN)
+      || watch(server, server->timerFd, &server->timerFd, EPOLLIN)) {
+    goto fail;
+  }
+
+  return server;
+
+fail:
+  {
+    int error = errno;
+
+    otp_server_destroy(server);
+    errno = error;
+  }
+  return NULL;
+}
+
+int otp_server_run(otp_server *server) {
+  struct epoll_event events[MAX_EVENTS];
+  uint64_t deadline = 0;
+  uint64_t stops;
+  uint64_t expirations;
+  int stopping = 0;
+  int ready;
+  int index;
+
+  for (;;) {
+    /* an open batch is closed by the timer, so this can always sleep */
+    ready = epoll_wait(server->epollFd, events, MAX_EVENTS, -1);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    for (index = 0; index < ready; index++) {
+      void *data = events[index].data.ptr;
+      server_connection *connection = data;
+
+      if (data == &server->listenFd) {
+        accept_connections(server);
+      } else if (data == &server->stopFd) {
+        stopping = 1;
+      } else if (data == &server->timerFd) {
+        while (read(server->timerFd, &expirations, sizeof(expirations)) < 0
+               && errno == EINTR) {
+        }
+      } else if (events[index].events & EPOLLIN) {
+        read_requests(server, connection);
+      } else if (events[index].events & (EPOLLERR | EPOLLHUP)) {
+        release_connection(server, connection);
+      } else if (events[index].events & EPOLLOUT) {
+        write_responses(server, connection);
+      }
+    }
+
+    if (stopping) {
+      validate_batch(server);
+      while (read(server->stopFd, &stops, sizeof(stops)) < 0
+             && errno == EINTR) {
+      }
+      return 0;
+    }
+    if (server->count == 0) {
+      continue;
+    }
+
+    /* give a batch that isn't full until its oldest request is
+     * batchDelay old, waking then for it */
+    if (server->count < server->maxBatch && server->batchDelay) {
+      if (deadline == 0) {
+        deadline = server->entries[0].start + server->batchDelay;
+        if (arm_timer(server, deadline)) {
+          return -1;
+        }
+      }
+      if (clock_ns() < deadline) {
+        continue;
+      }
+    }
+
+    validate_batch(server);
+    deadline = 0;
+  }
+}
+
+void otp_server_stop(otp_server *server) {
+  uint64_t one = 1;
+
+  /* an eventfd write is async signal safe */
+  while (write(server->stopFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+void otp_server_destroy(otp_server *server) {
+  while (server->connections) {
+    free_connection(server, server->connections);
+  }
+
+  if (server->listenFd >= 0) {
+    close(server->listenFd);
+  }
+  if (server->epollFd >= 0) {
+    close(server->epollFd);
+  }
+  if (server->stopFd >= 0) {
+    close(server->stopFd);
+  }
+  if (server->timerFd >= 0) {
+    close(server->timerFd);
+  }
+  if (server->path[0]) {
+    unlink(server->path);
+  }
+
+  free(server->entries);
+  free(server->requests);
+  free(server->results);
+  free(server);
+}
+
+void otp_server_read_stats(otp_server *server, otp_server_stats *stats) {
+  server_counters *counters = &server->counters;
+  size_t bucket;
+
+  stats->connections = atomic_load_explicit(&counters->connections,
+                                            memory_order_relaxed);
+  stats->requests = atomic_load_explicit(&counters->requests,
+                                         memory_order_relaxed);
+  stats->malformed = atomic_load_explicit(&counters->malformed,
+                                          memory_order_relaxed);
+  stats->batches = atomic_load_explicit(&counters->batches,
+                                        memory_order_relaxed);
+  for (bucket = 0; bucket < OTP_SERVER_LATENCY_BUCKETS; bucket++) {
+    stats->latency[bucket] = atomic_load_explicit(&counters->latency[bucket],
+                                                  memory_order_relaxed);
+  }
+  for (bucket = 0; bucket < OTP_SERVER_BATCH_BUCKETS; bucket++) {
+    stats->batchSizes[bucket] =
+      atomic_load_explicit(&counters->batchSizes[bucket], memory_order_relaxed);
+  }
+}
+
+uint64_t otp_server_latency_percentile(const otp_server_stats *stats,
+                                       double fraction) {
+  size_t bucket = bucket_percentile(stats->latency, OTP_SERVER_LATENCY_BUCKETS,
+                                    fraction);
+
+  return bucket == SIZE_MAX ? 0 : ((uint64_t)1 << bucket) - 1;
+}
+
+uint64_t otp_server_batch_percentile(const otp_server_stats *stats,
+                                     double fraction) {
+  size_t bucket = bucket_percentile(stats->batchSizes,
+                                    OTP_SERVER_BATCH_BUCKETS, fraction);
+
+  return bucket == SIZE_MAX ? 0 : ((uint64_t)2 << bucket) - 1;
+}
+
+int otp_server_format(char *buffer, size_t size,
+                      const otp_server_stats *stats) {
+  return snprintf(buffer, size,
+                  "{\"connections\": %llu, \"requests\": %llu, "
+                  "\"malformed\": %llu, \"batches\": %llu, "
+                  "\"batch_mean\": %.2f, \"batch_p50\": %llu, "
+                  "\"batch_p99\": %llu, \"latency_p50_ns\": %llu, "
+                  "\"latency_p99_ns\": %llu, \"latency_p999_ns\": %llu}",
+                  (unsigned long long)stats->connections,
+                  (unsigned long long)stats->requests,
+                  (unsigned long long)stats->malformed,
+                  (unsigned long long)stats->batches,
+                  stats->batches ? (double)stats->requests / stats->batches
+                                 : 0.0,
+                  (unsigned long long)otp_server_batch_percentile(stats, 0.50),
+                  (unsigned long long)otp_server_batch_percentile(stats, 0.99),
+                  (unsigned long long)otp_server_latency_percentile(stats, 0.50),
+                  (unsigned long long)otp_server_latency_percentile(stats, 0.99),
+                  (unsigned long long)otp_server_latency_percentile(stats, 0.999));
+}
+
+/* unlink the socket at address only if nothing is listening on it, so
+ * neither other files nor a live server's socket are taken over. -1 with
+ * errno EADDRINUSE otherwise */
+static int remove_stale_socket(const struct sockaddr_un *address) {
+  struct stat status;
+  int probe;
+  int refused;
+
+  if (lstat(address->sun_path, &status) || !S_ISSOCK(status.st_mode)) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe < 0) {
+    return -1;
+  }
+  refused = connect(probe, (const struct sockaddr *)address,
+                    sizeof(*address)) && errno == ECONNREFUSED;
+  close(probe);
+
+  if (!refused) {
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  return unlink(address->sun_path);
+}
+
+static int watch(otp_server *server, int fd, void *data, uint32_t events) {
+  struct epoll_event event;
+
+  event.events = events;
+  event.data.ptr = data;
+  return epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void accept_connections(otp_server *server) {
+  server_connection *connection;
+  int fd;
+
+  for (;;) {
+    fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      /* EAGAIN, or out of descriptors - the rest wait in the backlog */
+      return;
+    }
+
+    connection = calloc(1, sizeof(*connection));
+    if (connection == NULL) {
+      close(fd);
+      return;
+    }
+    connection->fd = fd;
+    connection->events = EPOLLIN;
+    if (watch(server, fd, connection, EPOLLIN)) {
+      close(fd);
+      free(connection);
+      return;
+    }
+
+    connection->next = server->connections;
+    if (server->connections) {
+      server->connections->previous = connection;
+    }
+    server->connections = connection;
+    bump(&server->counters.connections, 1);
+  }
+}
+
+/* read whole requests into the batch while it has room */
+static void read_requests(otp_server *server, server_connection *connection) {
+  otp_server_request request;
+  size_t room;
+  size_t used;
+  ssize_t length;
+  uint64_t start;
+
+  if (connection->dead || connection->finished) {
+    return;
+  }
+
+  while ((room = server->maxBatch - server->count) != 0) {
+    room = room * sizeof(request) - connection->inputLength;
+    if (room > INPUT_BYTES - connection->inputLength) {
+      room = INPUT_BYTES - connection->inputLength;
+    }
+
+    length = read(connection->fd, connection->input + connection->inputLength,
+                  room);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        release_connection(server, connection);
+      }
+      return;
+    }
+    if (length == 0) {
+      /* answer what was sent, then close */
+      connection->finished = 1;
+      if (connection->pending == 0 && connection->outputLength == 0) {
+        release_connection(server, connection);
+      } else {
+        update_events(server, connection);
+      }
+      return;
+    }
+
+    start = clock_ns();
+    connection->inputLength += length;
+    for (used = 0; connection->inputLength - used >= sizeof(request);
+         used += sizeof(request)) {
+      memcpy(&request, connection->input + used, sizeof(request));
+      decode_request(server, connection, &request, start);
+    }
+    memmove(connection->input, connection->input + used,
+            connection->inputLength - used);
+    connection->inputLength -= used;
+
+    if ((size_t)length < room) {
+      return;
+    }
+  }
+}
+
+static void decode_request(otp_server *server, server_connection *connection,
+                           const otp_server_request *request, uint64_t start) {
+  batch_entry *entry = &server->entries[server->count++];
+  otp_store_request *storeRequest;
+  unsigned int digits;
+  unsigned int period;
+
+  entry->connection = connection;
+  entry->start = start;
+  entry->tag = request->tag;
+  entry->type = request->type;
+  entry->status = OTP_SERVER_MALFORMED;
+  entry->storeIndex = SIZE_MAX;
+  connection->pending++;
+
+  if (request->version != OTP_SERVER_VERSION) {
+    return;
+  }
+  if (request->type == OTP_SERVER_STATS) {
+    entry->status = OTP_STORE_SUCCESS;
+    return;
+  }
+  if ((request->type != OTP_SERVER_HOTP && request->type != OTP_SERVER_TOTP)
+      || request->digits > MAX_DIGITS || request->time < 0) {
+    return;
+  }
+
+  /* a user's own settings win, the request may only repeat them */
+  if (otp_store_settings(server->store, request->userId, &digits, &period)
+        == OTP_STORE_SUCCESS
+      && digits) {
+    if ((request->digits && request->digits != digits)
+        || (request->period && request->period != period)
+        || (request->type == OTP_SERVER_TOTP) != (period != 0)) {
+      entry->status = OTP_STORE_FAILURE;
+      return;
+    }
+  } else {
+    digits = request->digits;
+    period = request->period ? request->period : server->period;
+    if (digits == 0) {
+      return;
+    }
+  }
+
+  entry->storeIndex = server->storeCount;
+  storeRequest = &server->requests[server->storeCount++];
+  storeRequest->userId = request->userId;
+  storeRequest->guess = request->guess;
+  storeRequest->guessDigits = digits;
+  storeRequest->windows = request->windows
+                          && request->windows < server->windows
+                          ? request->windows : server->windows;
+  if (request->type == OTP_SERVER_TOTP) {
+    storeRequest->time = request->time;
+    storeRequest->windowLength = period;
+  } else {
+    storeRequest->time = 0;
+    storeRequest->windowLength = 0;
+  }
+}
+
+/* validate everything decoded so far and queue the responses in order */
+static void validate_batch(otp_server *server) {
+  otp_server_response response;
+  otp_server_stats stats;
+  time_t now;
+  uint64_t finished;
+  size_t bucket;
+  size_t index;
+
+  if (server->count == 0) {
+    return;
+  }
+
+  /* totp requests without a time use the time the batch ran */
+  now = time(NULL);
+  for (index = 0; index < server->storeCount; index++) {
+    if (server->requests[index].windowLength
+        && server->requests[index].time == 0) {
+      server->requests[index].time = now;
+    }
+  }
+  otp_store_validate_many(server->store, server->requests, server->results,
+                          server->storeCount);
+
+  bump(&server->counters.requests, server->count);
+  bump(&server->counters.batches, 1);
+  bucket = bit_length(server->count) - 1;
+  bump(&server->counters.batchSizes[bucket < OTP_SERVER_BATCH_BUCKETS
+                                    ? bucket : OTP_SERVER_BATCH_BUCKETS - 1],
+       1);
+
+  finished = clock_ns();
+  for (index = 0; index < server->count; index++) {
+    batch_entry *entry = &server->entries[index];
+    server_connection *connection = entry->connection;
+
+    bucket = bit_length(finished - entry->start);
+
+    if (entry->storeIndex != SIZE_MAX) {
+      entry->status = server->results[entry->storeIndex];
+    } else if (entry->status == OTP_SERVER_MALFORMED) {
+      bump(&server->counters.malformed, 1);
+    }
+    bump(&server->counters.latency[bucket < OTP_SERVER_LATENCY_BUCKETS
+                                   ? bucket : OTP_SERVER_LATENCY_BUCKETS - 1],
+         1);
+
+    if (!connection->dead) {
+      response.tag = entry->tag;
+      response.status = entry->status;
+      if (queue_output(connection, &response, sizeof(response))) {
+        release_connection(server, connection);
+      } else if (entry->type == OTP_SERVER_STATS
+                 && entry->status == OTP_STORE_SUCCESS) {
+        otp_server_read_stats(server, &stats);
+        if (queue_output(connection, &stats, sizeof(stats))) {
+          release_connection(server, connection);
+        }
+      }
+    }
+
+    /* the last response for this connection in the batch sends them all */
+    if (--connection->pending == 0) {
+      if (connection->dead) {
+        free_connection(server, connection);
+      } else {
+        write_responses(server, connection);
+      }
+    }
+  }
+
+  server->count = 0;
+  server->storeCount = 0;
+}
+
+static int queue_output(server_connection *connection, const void *data,
+                        size_t length) {
+  if (connection->outputStart + connection->outputLength + length
+      > connection->outputCapacity) {
+    /* slide what's left to the front, growing only when that isn't enough */
+    memmove(connection->output, connection->output + connection->outputStart,
+            connection->outputLength);
+    connection->outputStart = 0;
+
+    if (connection->outputLength + length > connection->outputCapacity) {
+      size_t capacity = connection->outputCapacity ? connection->outputCapacity
+                                                   : STATS_RESPONSE_BYTES * 16;
+      uint8_t *output;
+
+      while (capacity < connection->outputLength + length) {
+        capacity *= 2;
+      }
+      output = realloc(connection->output, capacity);
+      if (output == NULL) {
+        return -1;
+      }
+      connection->output = output;
+      connection->outputCapacity = capacity;
+    }
+  }
+
+  memcpy(connection->output + connection->outputStart
+         + connection->outputLength, data, length);
+  connection->outputLength += length;
+  return 0;
+}
+
+static void write_responses(otp_server *server, server_connection *connection) {
+  ssize_t length;
+
+  while (connection->outputLength) {
+    length = send(connection->fd, connection->output + connection->outputStart,
+                  connection->outputLength, MSG_NOSIGNAL);
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        release_connection(server, connection);
+        return;
+      }
+      break;
+    }
+    connection->outputStart += length;
+    connection->outputLength -= length;
+  }
+  if (connection->outputLength == 0) {
+    connection->outputStart = 0;
+  }
+
+  if (connection->finished && connection->pending == 0
+      && connection->outputLength == 0) {
+    release_connection(server, connection);
+  } else {
+    update_events(server, connection);
+  }
+}
+
+/* read while the client keeps up with its responses, write while any wait */
+static void update_events(otp_server *server, server_connection *connection) {
+  struct epoll_event event;
+  uint32_t events = 0;
+
+  if (!connection->finished && connection->outputLength < OUTPUT_HIGH) {
+    events |= EPOLLIN;
+  }
+  if (connection->outputLength) {
+    events |= EPOLLOUT;
+  }
+  if (events == connection->events) {
+    return;
+  }
+
+  event.events = events;
+  event.data.ptr = connection;
+  if (epoll_ctl(server->epollFd, EPOLL_CTL_MOD, connection->fd, &event)) {
+    release_connection(server, connection);
+    return;
+  }
+  connection->events = events;
+}
+
+/* close the socket now, keep the memory while the batch points at it */
+static void release_connection(otp_server *server,
+                               server_connection *connection) {
+  if (connection->dead) {
+    return;
+  }
+  if (connection->pending == 0) {
+    free_connection(server, connection);
+    return;
+  }
+
+  connection->dead = 1;
+  epoll_ctl(server->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+  close(connection->fd);
+  connection->fd = -1;
+}
+
+static void free_connection(otp_server *server, server_connection *connection) {
+  if (connection->fd >= 0) {
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+  }
+
+  if (connection->previous) {
+    connection->previous->next = connection->next;
+  } else {
+    server->connections = connection->next;
+  }
+  if (connection->next) {
+    connection->next->previous = connection->previous;
+  }
+
+  free(connection->output);
+  free(connection);
+}
+
+/* a timer left armed by a batch that filled up early only costs a wakeup */
+static int arm_timer(otp_server *server, uint64_t deadline) {
+  struct itimerspec timer;
+
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = deadline / 1000000000u;
+  timer.it_value.tv_nsec = deadline % 1000000000u;
+  return timerfd_settime(server->timerFd, TFD_TIMER_ABSTIME, &timer, NULL);
+}
+
+static uint64_t clock_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+static size_t bit_length(uint64_t value) {
+  size_t length = 0;
+
+  while (value) {
+    value >>= 1;
+    length++;
+  }
+
+  return length;
+}
+
+/* index of the bucket holding the given fraction, SIZE_MAX when empty */
+static size_t bucket_percentile(const uint64_t *buckets, size_t count,
+                                double fraction) {
+  uint64_t total = 0;
+  uint64_t seen = 0;
+  size_t bucket;
+
+  for (bucket = 0; bucket < count; bucket++) {
+    total += buckets[bucket];
+  }
+  if (total == 0) {
+    return SIZE_MAX;
+  }
+
+  for (bucket = 0; bucket < count - 1; bucket++) {
+    seen += buckets[bucket];
+    if (seen >= fraction * total) {
+      break;
+    }
+  }
+
+  return bucket;
+}
+
+/* single writer, so a plain relaxed store is enough */
+static void bump(_Atomic uint64_t *counter, uint64_t count) {
+  atomic_store_explicit(counter,
+                        atomic_load_explicit(counter, memory_order_relaxed)
+                        + count, memory_order_relaxed);
+}
@@ -0,0 +1,142 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_SERVER_H_
+#define OTP_SERVER_H_
+
+/* local includes */
+#include "otp_store.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Validation server. Clients connect to a Unix stream socket and write
+ * otp_server_request structures, each answered in order with an
+ * otp_server_response. Everything is native endian, the socket never
+ * leaves the machine. Requests that arrive together, from one client or
+ * many, are validated as one batch with otp_store_validate_many(), and
+ * the store keeps the counter and replay state for all of them.
+ */
+#define OTP_SERVER_VERSION 1
+
+typedef enum OTP_SERVER_TYPE {
+  OTP_SERVER_HOTP, OTP_SERVER_TOTP, OTP_SERVER_STATS
+} OTP_SERVER_TYPE;
+
+/* status of a request that could not be decoded */
+#define OTP_SERVER_MALFORMED 0xff
+
+/* 32 bytes */
+typedef struct otp_server_request {
+  uint8_t version;
+  uint8_t type;
+  /* 0 for the user's. a user added with settings fails requests that
+   * name other digits, another period or the wrong type */
+  uint8_t digits;
+  /* 0 for the server default, which is also the most allowed */
+  uint8_t windows;
+  uint32_t guess;
+  uint64_t userId;
+  /* totp only, unix time or 0 for the server clock */
+  int64_t time;
+  /* totp only, 0 for the user's or else the server default */
+  uint32_t period;
+  /* echoed in the response */
+  uint32_t tag;
+} otp_server_request;
+
+/* 8 bytes, status is an OTP_STORE_RESULT or OTP_SERVER_MALFORMED. the
+ * response to OTP_SERVER_STATS is followed by an otp_server_stats */
+typedef struct otp_server_response {
+  uint32_t tag;
+  uint32_t status;
+} otp_server_response;
+
+/* bucket 0 holds requests under 1ns, bucket b those of 2^(b-1) to
+ * 2^b - 1ns, as in otp_metrics */
+#define OTP_SERVER_LATENCY_BUCKETS 40
+
+/* bucket b holds batches of 2^b to 2^(b+1) - 1 requests */
+#define OTP_SERVER_BATCH_BUCKETS 16
+
+typedef struct otp_server_stats {
+  uint64_t connections;
+  uint64_t requests;
+  uint64_t malformed;
+  uint64_t batches;
+  /* from the request being read to its response being queued */
+  uint64_t latency[OTP_SERVER_LATENCY_BUCKETS];
+  uint64_t batchSizes[OTP_SERVER_BATCH_BUCKETS];
+} otp_server_stats;
+
+typedef struct otp_server_config {
+  /* requests validated together at most, 0 for 256 */
+  size_t maxBatch;
+  /* ns to wait for more requests before a batch that isn't full
+   * is validated, 0 to validate whatever each wakeup brought */
+  uint64_t batchDelay;
+  /* used when a request leaves them 0, windows is also the most a
+   * request may ask for. a user's own period comes before this one */
+  unsigned int windows;
+  unsigned int period;
+  /* permissions of the socket file, 0 for 0600. anyone who can connect
+   * can make guesses for every user */
+  unsigned int mode;
+} otp_server_config;
+
+typedef struct otp_server otp_server;
+
+/* bind and listen on path, replacing a stale socket there. anything else
+ * at path, including a socket a server is still listening on, fails with
+ * EADDRINUSE. config may be NULL for the defaults. the store must outlive
+ * the server. NULL with errno set on failure */
+otp_server *otp_server_create(otp_store *store, const char *path,
+                              const otp_server_config *config);
+
+/* serve until otp_server_stop(), 0 when stopped, -1 with errno set if
+ * the event loop fails */
+int otp_server_run(otp_server *server);
+
+/* safe from any thread and from signal handlers */
+void otp_server_stop(otp_server *server);
+
+/* closes every connection and removes the socket */
+void otp_server_destroy(otp_server *server);
+
+/* counts since the server was created, safe while it runs */
+void otp_server_read_stats(otp_server *server, otp_server_stats *stats);
+
+/* upper bound of the bucket holding the given fraction of samples, in
+ * ns for latency and requests for batch sizes */
+uint64_t otp_server_latency_percentile(const otp_server_stats *stats,
+                                       double fraction);
+
+uint64_t otp_server_batch_percentile(const otp_server_stats *stats,
+                                     double fraction);
+
+/* write stats as JSON. returns the length it needs like snprintf, output
+ * is truncated when that is not less than size */
+int otp_server_format(char *buffer, size_t size, const otp_server_stats *stats);
+
+#endif /* OTP_SERVER_H_ */
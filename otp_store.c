@@ -0,0 +1,681 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_arena.h"
+#include "otp_metrics.h"
+#include "otp_store.h"
+
+/* external includes */
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STORE_ALIGNMENT 64
+
+/* per user state, packed so that it can be replaced with one CAS: the
+ * step, 12 bits of drift and a 4 bit count of totp codes in a row that
+ * matched exactly where the drift predicted */
+#define STATE_PACK(step, drift, streak) ((uint64_t)(step) << 16 \
+  | (uint16_t)((uint16_t)(int16_t)(drift) << 4 | (streak)))
+#define STATE_STEP(state) ((state) >> 16)
+#define STATE_DRIFT(state) ((int64_t)((int16_t)(uint16_t)(state) >> 4))
+#define STATE_STREAK(state) ((unsigned int)(state) & 0xf)
+#define DRIFT_LIMIT 2047
+#define STREAK_LIMIT 15
+
+/* a device this many codes on the prediction has a narrow window searched
+ * before the rest of its window */
+#define STABLE_STREAK 4
+#define STABLE_WINDOWS 3
+
+/* window slots hashed together by otp_store_validate_many, and the
+ * requests staged through it at a time */
+#define BATCH_SLOTS 256
+#define BATCH_GROUP 64
+
+/* one user per cache line (or more once the key outgrows it) */
+typedef struct otp_store_entry {
+  alignas(STORE_ALIGNMENT) _Atomic uint64_t userId;
+  _Atomic uint64_t state;
+  atomic_int ready;
+  /* 0 when the caller's are used */
+  unsigned int digits;
+  unsigned int period;
+  otp_key key;
+} otp_store_entry;
+
+typedef struct otp_store_shard {
+  otp_store_entry *entries;
+  size_t mask;
+} otp_store_shard;
+
+struct otp_store {
+  unsigned int shardBits;
+  otp_store_shard shards[];
+};
+
+/* a submission with its window queued in the current chunk. searched
+ * counts the slots queued so far in nearest first order, a totp window
+ * goes in stages: the predicted step, the narrow window, then the rest */
+typedef struct batch_pending {
+  otp_store_entry *entry;
+  uint64_t state;
+  uint64_t step;
+  uint64_t centre;
+  unsigned int windows;
+  unsigned int narrow;
+  size_t searched;
+  size_t request;
+  size_t first;
+  size_t slotCount;
+} batch_pending;
+
+typedef struct store_batch {
+  hotp_request slots[BATCH_SLOTS];
+  int64_t offsets[BATCH_SLOTS];
+  uint32_t codes[BATCH_SLOTS];
+  batch_pending pending[BATCH_SLOTS];
+  /* a totp submission can be retried twice per group */
+  batch_pending retries[2 * BATCH_GROUP];
+  size_t slotCount;
+  size_t pendingCount;
+  size_t retryCount;
+} store_batch;
+
+/* internal helper function definitions */
+static uint64_t hash_user(uint64_t userId);
+static otp_store_entry *find_entry(otp_store *store, uint64_t userId,
+                                   int insert, int *inserted);
+static otp_store_entry *ready_entry(otp_store *store, uint64_t userId);
+static int64_t clamp_drift(int64_t drift);
+static int wrong_settings(const otp_store_entry *entry,
+                          unsigned int guessDigits, unsigned int windowLength);
+static uint64_t hotp_centre(uint64_t state, unsigned int windows);
+static uint64_t totp_centre(uint64_t state, uint64_t step);
+static OTP_STORE_RESULT hotp_commit(otp_store_entry *entry, uint64_t current,
+                                    uint64_t matched);
+static unsigned int totp_windows(uint64_t state, unsigned int windows);
+static size_t next_stage(const batch_pending *pending);
+static OTP_STORE_RESULT totp_commit(otp_store_entry *entry, uint64_t current,
+                                    uint64_t step, uint64_t centre,
+                                    uint64_t matched);
+static OTP_STORE_RESULT totp_validate_wide(otp_store_entry *entry,
+                                           const otp_store_request *request);
+static void window_bounds(const batch_pending *pending, int64_t *lowest,
+                          int64_t *highest);
+static void queue_window(store_batch *batch, const otp_store_request *requests,
+                         OTP_STORE_RESULT *results,
+                         const batch_pending *pending, size_t from, size_t to);
+static void finish_chunk(store_batch *batch, const otp_store_request *requests,
+                         OTP_STORE_RESULT *results);
+static int64_t next_offset(uint64_t *sequence, int64_t lowest,
+                           int64_t highest);
+
+otp_store *otp_store_create(size_t capacity, unsigned int shards) {
+  otp_store *store;
+  unsigned int shardBits = 0;
+  size_t slots = 1;
+  size_t perShard;
+  size_t shard;
+  size_t index;
+
+  while ((1u << shardBits) < shards && shardBits < 16) {
+    shardBits++;
+  }
+
+  /* keep every shard at most half full */
+  perShard = (capacity + (1u << shardBits) - 1) >> shardBits;
+  while (slots < 2 * perShard) {
+    slots <<= 1;
+  }
+
+  store = calloc(1, sizeof(*store) + sizeof(otp_store_shard) * (1u << shardBits));
+  if (store == NULL) {
+    return NULL;
+  }
+  store->shardBits = shardBits;
+
+  for (shard = 0; shard < (1u << shardBits); shard++) {
+    otp_store_entry *entries = aligned_alloc(STORE_ALIGNMENT,
+                                             slots * sizeof(otp_store_entry));
+
+    if (entries == NULL) {
+      otp_store_destroy(store);
+      return NULL;
+    }
+
+    memset(entries, 0, slots * sizeof(otp_store_entry));
+    for (index = 0; index < slots; index++) {
+      atomic_init(&entries[index].userId, OTP_STORE_EMPTY_ID);
+    }
+    store->shards[shard].entries = entries;
+    store->shards[shard].mask = slots - 1;
+  }
+
+  return store;
+}
+
+void otp_store_destroy(otp_store *store) {
+  size_t shard;
+
+  for (shard = 0; shard < (1u << store->shardBits); shard++) {
+    otp_store_shard *current = &store->shards[shard];
+
+    if (current->entries) {
+      otp_secure_wipe(current->entries,
+                      (current->mask + 1) * sizeof(otp_store_entry));
+      free(current->entries);
+    }
+  }
+
+  free(store);
+}
+
+OTP_STORE_RESULT otp_store_add(otp_store *store, uint64_t userId,
+                               const otp_key *key, uint64_t step) {
+  return otp_store_add_user(store, userId, key, step, 0, 0);
+}
+
+OTP_STORE_RESULT otp_store_add_user(otp_store *store, uint64_t userId,
+                                    const otp_key *key, uint64_t step,
+                                    unsigned int digits, unsigned int period) {
+  otp_store_entry *entry;
+  int inserted;
+
+  if (userId == OTP_STORE_EMPTY_ID || step > OTP_STORE_MAX_STEP
+      || digits > 10 || (digits == 0 && period)) {
+    return OTP_STORE_FAILURE;
+  }
+
+  entry = find_entry(store, userId, 1, &inserted);
+  if (entry == NULL) {
+    return OTP_STORE_FULL;
+  }
+  if (!inserted) {
+    return OTP_STORE_EXISTS;
+  }
+
+  /* the slot is ours, publish the user once the key is in place */
+  entry->key = *key;
+  entry->digits = digits;
+  entry->period = period;
+  atomic_store_explicit(&entry->state, STATE_PACK(step, 0, 0),
+                        memory_order_relaxed);
+  atomic_store_explicit(&entry->ready, 1, memory_order_release);
+
+  return OTP_STORE_SUCCESS;
+}
+
+OTP_STORE_RESULT otp_store_lookup(otp_store *store, uint64_t userId,
+                                  uint64_t *step, int64_t *drift) {
+  otp_store_entry *entry = ready_entry(store, userId);
+  uint64_t state;
+
+  if (entry == NULL) {
+    return OTP_STORE_UNKNOWN_USER;
+  }
+
+  state = atomic_load(&entry->state);
+  if (step) {
+    *step = STATE_STEP(state);
+  }
+  if (drift) {
+    *drift = STATE_DRIFT(state);
+  }
+
+  return OTP_STORE_SUCCESS;
+}
+
+OTP_STORE_RESULT otp_store_settings(otp_store *store, uint64_t userId,
+                                    unsigned int *digits,
+                                    unsigned int *period) {
+  otp_store_entry *entry = ready_entry(store, userId);
+
+  if (entry == NULL) {
+    return OTP_STORE_UNKNOWN_USER;
+  }
+
+  *digits = entry->digits;
+  *period = entry->period;
+  return OTP_STORE_SUCCESS;
+}
+
+OTP_STORE_RESULT hotp_store_validate(otp_store *store, uint64_t userId,
+                                     uint32_t guess, unsigned int guessDigits,
+                                     unsigned int windows) {
+  otp_store_entry *entry = ready_entry(store, userId);
+  uint64_t current;
+  uint64_t centre;
+  int64_t offset;
+
+  if (entry == NULL) {
+    return OTP_STORE_UNKNOWN_USER;
+  }
+  if (windows == 0 || wrong_settings(entry, guessDigits, 0)) {
+    return OTP_STORE_FAILURE;
+  }
+
+  current = atomic_load(&entry->state);
+  centre = hotp_centre(current, windows);
+
+  if (hotp_find_window_ctx(&entry->key, centre, guess, guessDigits, windows,
+                           &offset) != OTP_VALIDATE_SUCCESS) {
+    return OTP_STORE_FAILURE;
+  }
+
+  return hotp_commit(entry, current, centre + offset);
+}
+
+OTP_STORE_RESULT totp_store_validate(otp_store *store, uint64_t userId,
+                                     time_t time, unsigned int windowLength,
+                                     uint32_t guess, unsigned int guessDigits,
+                                     unsigned int windows) {
+  otp_store_request request;
+  OTP_STORE_RESULT result;
+
+  if (windowLength == 0) {
+    return OTP_STORE_FAILURE;
+  }
+
+  /* the staged search lives in the batched path, this is a batch of one */
+  request.userId = userId;
+  request.time = time;
+  request.windowLength = windowLength;
+  request.guess = guess;
+  request.guessDigits = guessDigits;
+  request.windows = windows;
+  otp_store_validate_many(store, &request, &result, 1);
+
+  return result;
+}
+
+void otp_store_validate_many(otp_store *store,
+                             const otp_store_request *requests,
+                             OTP_STORE_RESULT *results, size_t count) {
+  store_batch batch;
+  size_t group;
+  size_t index;
+
+  batch.slotCount = 0;
+  batch.pendingCount = 0;
+
+  for (group = 0; group < count; group += BATCH_GROUP) {
+    size_t end = count - group < BATCH_GROUP ? count : group + BATCH_GROUP;
+
+    /* hotp windows whole, totp only the step the drift predicts */
+    batch.retryCount = 0;
+    for (index = group; index < end; index++) {
+      const otp_store_request *request = &requests[index];
+      otp_store_entry *entry = ready_entry(store, request->userId);
+      batch_pending pending;
+      int64_t lowest;
+      int64_t highest;
+
+      if (entry == NULL) {
+        results[index] = OTP_STORE_UNKNOWN_USER;
+        continue;
+      }
+      if (request->windows == 0
+          || wrong_settings(entry, request->guessDigits,
+                            request->windowLength)) {
+        results[index] = OTP_STORE_FAILURE;
+        continue;
+      }
+
+      /* windows too big for a chunk go on their own */
+      if (request->windows > BATCH_SLOTS) {
+        results[index] = request->windowLength
+          ? totp_validate_wide(entry, request)
+          : hotp_store_validate(store, request->userId, request->guess,
+                                request->guessDigits, request->windows);
+        continue;
+      }
+
+      pending.entry = entry;
+      pending.request = index;
+      pending.state = atomic_load(&entry->state);
+      pending.windows = request->windows;
+      pending.searched = 0;
+      if (request->windowLength) {
+        pending.step = request->time / request->windowLength;
+        pending.centre = totp_centre(pending.state, pending.step);
+        pending.narrow = totp_windows(pending.state, request->windows);
+      } else {
+        pending.step = 0;
+        pending.centre = hotp_centre(pending.state, request->windows);
+        pending.narrow = request->windows;
+      }
+      window_bounds(&pending, &lowest, &highest);
+
+      queue_window(&batch, requests, results, &pending, 0,
+                   request->windowLength ? 1
+                                         : (size_t)(highest - lowest + 1));
+    }
+    finish_chunk(&batch, requests, results);
+
+    /* then the next stage of the window, nearest first, for codes that
+     * weren't found yet. misses there queue another retry */
+    index = 0;
+    while (index < batch.retryCount) {
+      for (; index < batch.retryCount; index++) {
+        batch_pending *pending = &batch.retries[index];
+
+        queue_window(&batch, requests, results, pending, pending->searched,
+                     next_stage(pending));
+      }
+      finish_chunk(&batch, requests, results);
+    }
+  }
+}
+
+/* where the next search stage of a partly searched window ends */
+static size_t next_stage(const batch_pending *pending) {
+  int64_t lowest;
+  int64_t highest;
+  size_t total;
+  size_t narrow;
+
+  window_bounds(pending, &lowest, &highest);
+  total = (size_t)(highest - lowest + 1);
+  narrow = pending->narrow < total ? pending->narrow : total;
+
+  return pending->searched == 0 ? 1
+       : pending->searched < narrow ? narrow : total;
+}
+
+/* a user added with settings only takes codes made with them, a totp
+ * code for a hotp user or one shortened to be easier to guess is refused */
+static int wrong_settings(const otp_store_entry *entry,
+                          unsigned int guessDigits, unsigned int windowLength) {
+  return entry->digits
+         && (guessDigits != entry->digits || windowLength != entry->period);
+}
+
+/* the window starts at the next counter expected */
+static uint64_t hotp_centre(uint64_t state, unsigned int windows) {
+  /* a window centred (windows - 1) / 2 ahead covers exactly the counters
+   * expected .. expected + windows - 1 */
+  return STATE_STEP(state) + (windows - 1) / 2;
+}
+
+/* search around where this device's clock was last seen */
+static uint64_t totp_centre(uint64_t state, uint64_t step) {
+  int64_t centre = (int64_t)step + STATE_DRIFT(state);
+
+  return centre < 0 ? 0 : (uint64_t)centre;
+}
+
+/* how much of the window to search before the rest: devices that keep
+ * landing on the prediction are looked for a step either side first. the
+ * whole window is still searched before a code is refused */
+static unsigned int totp_windows(uint64_t state, unsigned int windows) {
+  return STATE_STREAK(state) >= STABLE_STREAK && windows > STABLE_WINDOWS
+         ? STABLE_WINDOWS : windows;
+}
+
+/* move past the match unless another submission got there first */
+static OTP_STORE_RESULT hotp_commit(otp_store_entry *entry, uint64_t current,
+                                    uint64_t matched) {
+  uint64_t expected = STATE_STEP(current);
+
+  if (matched >= OTP_STORE_MAX_STEP) {
+    return OTP_STORE_FAILURE;
+  }
+
+  while (!atomic_compare_exchange_weak(&entry->state, &current,
+                                       STATE_PACK(matched + 1,
+                                                  clamp_drift(matched - expected),
+                                                  0))) {
+    if (STATE_STEP(current) > matched) {
+      return OTP_STORE_REPLAY;
+    }
+  }
+
+  return OTP_STORE_SUCCESS;
+}
+
+/* each step is accepted once, later steps only. the streak grows while
+ * codes match at the predicted centre and restarts when they don't */
+static OTP_STORE_RESULT totp_commit(otp_store_entry *entry, uint64_t current,
+                                    uint64_t step, uint64_t centre,
+                                    uint64_t matched) {
+  unsigned int streak;
+
+  /* a stored 0 means no step was used yet, so step 0 itself can't be
+   * told apart from it and is never accepted */
+  if (matched == 0 || matched > OTP_STORE_MAX_STEP) {
+    return OTP_STORE_FAILURE;
+  }
+
+  do {
+    if (STATE_STEP(current) != 0 && matched <= STATE_STEP(current)) {
+      return OTP_STORE_REPLAY;
+    }
+    streak = STATE_STREAK(current);
+    streak = matched != centre ? 0 : streak < STREAK_LIMIT ? streak + 1
+                                                           : STREAK_LIMIT;
+  } while (!atomic_compare_exchange_weak(&entry->state, &current,
+                                         STATE_PACK(matched,
+                                                    clamp_drift((int64_t)matched
+                                                                - (int64_t)step),
+                                                    streak)));
+
+  return OTP_STORE_SUCCESS;
+}
+
+/* a totp window too wide for the batch, searched in one go */
+static OTP_STORE_RESULT totp_validate_wide(otp_store_entry *entry,
+                                           const otp_store_request *request) {
+  uint64_t step = request->time / request->windowLength;
+  uint64_t current = atomic_load(&entry->state);
+  uint64_t centre = totp_centre(current, step);
+  int64_t offset;
+
+  if (hotp_find_window_ctx(&entry->key, centre, request->guess,
+                           request->guessDigits, request->windows,
+                           &offset) != OTP_VALIDATE_SUCCESS) {
+    return OTP_STORE_FAILURE;
+  }
+
+  return totp_commit(entry, current, step, centre, centre + offset);
+}
+
+/* the same span as hotp_find_window_ctx: the extra slot of an even
+ * window goes forward, and steps below zero don't exist */
+static void window_bounds(const batch_pending *pending, int64_t *lowest,
+                          int64_t *highest) {
+  *lowest = -(int64_t)((pending->windows - 1) / 2);
+  *highest = pending->windows / 2;
+  if (pending->centre < (uint64_t)-*lowest) {
+    *lowest = -(int64_t)pending->centre;
+  }
+}
+
+/* queue slots from .. to - 1 of a window in nearest first order */
+static void queue_window(store_batch *batch, const otp_store_request *requests,
+                         OTP_STORE_RESULT *results,
+                         const batch_pending *pending, size_t from, size_t to) {
+  batch_pending *queued;
+  uint64_t sequence = 0;
+  int64_t lowest;
+  int64_t highest;
+  size_t position;
+
+  if (batch->slotCount + (to - from) > BATCH_SLOTS) {
+    finish_chunk(batch, requests, results);
+  }
+
+  window_bounds(pending, &lowest, &highest);
+  queued = &batch->pending[batch->pendingCount++];
+  *queued = *pending;
+  queued->first = batch->slotCount;
+  queued->searched = to;
+
+  for (position = 0; position < to; position++) {
+    int64_t offset = next_offset(&sequence, lowest, highest);
+
+    if (position < from) {
+      continue;
+    }
+    batch->offsets[batch->slotCount] = offset;
+    batch->slots[batch->slotCount].key = &pending->entry->key;
+    batch->slots[batch->slotCount].counter = pending->centre + offset;
+    batch->slotCount++;
+  }
+  queued->slotCount = batch->slotCount - queued->first;
+}
+
+/* hash every queued slot at once, then settle the submissions in order */
+static void finish_chunk(store_batch *batch, const otp_store_request *requests,
+                         OTP_STORE_RESULT *results) {
+  uint64_t settled = 0;
+  uint64_t matches = 0;
+  size_t index;
+  size_t slot;
+
+  if (batch->slotCount == 0) {
+    return;
+  }
+
+  hotp_many(batch->slots, batch->codes, batch->slotCount);
+
+  for (index = 0; index < batch->pendingCount; index++) {
+    batch_pending *pending = &batch->pending[index];
+    const otp_store_request *request = &requests[pending->request];
+    OTP_STORE_RESULT result = OTP_STORE_FAILURE;
+    int matched = 0;
+
+    for (slot = pending->first; slot < pending->first + pending->slotCount;
+         slot++) {
+      if (otp_truncate_digits(batch->codes[slot], request->guessDigits)
+          == request->guess) {
+        uint64_t step = pending->centre + batch->offsets[slot];
+
+        result = request->windowLength
+          ? totp_commit(pending->entry, pending->state, pending->step,
+                        pending->centre, step)
+          : hotp_commit(pending->entry, pending->state, step);
+        matched = 1;
+        break;
+      }
+    }
+
+    /* not in this stage, look over the next one */
+    if (!matched && pending->searched < next_stage(pending)) {
+      batch->retries[batch->retryCount++] = *pending;
+      continue;
+    }
+    results[pending->request] = result;
+    settled++;
+    matches += matched;
+  }
+
+  OTP_METRICS_ADD(OTP_METRIC_VALIDATIONS, settled);
+  OTP_METRICS_ADD(OTP_METRIC_SUCCESSES, matches);
+  OTP_METRICS_ADD(OTP_METRIC_FAILURES, settled - matches);
+
+  batch->slotCount = 0;
+  batch->pendingCount = 0;
+}
+
+/* nearest offset first, the later of a tied pair first as in libotp.c */
+static int64_t next_offset(uint64_t *sequence, int64_t lowest,
+                           int64_t highest) {
+  int64_t offset;
+
+  do {
+    offset = *sequence & 1 ? (int64_t)(*sequence / 2 + 1)
+                           : -(int64_t)(*sequence / 2);
+    (*sequence)++;
+  } while (offset < lowest || offset > highest);
+
+  return offset;
+}
+
+/* splitmix64 finaliser - the top bits pick the shard, the bottom the slot */
+static uint64_t hash_user(uint64_t userId) {
+  userId ^= userId >> 30;
+  userId *= UINT64_C(0xbf58476d1ce4e5b9);
+  userId ^= userId >> 27;
+  userId *= UINT64_C(0x94d049bb133111eb);
+  userId ^= userId >> 31;
+  return userId;
+}
+
+/* linear probe for userId, claiming an empty slot with a CAS if insert */
+static otp_store_entry *find_entry(otp_store *store, uint64_t userId,
+                                   int insert, int *inserted) {
+  uint64_t hash = hash_user(userId);
+  otp_store_shard *shard = &store->shards[store->shardBits
+                                          ? hash >> (64 - store->shardBits) : 0];
+  size_t probe;
+
+  if (inserted) {
+    *inserted = 0;
+  }
+
+  for (probe = 0; probe <= shard->mask; probe++) {
+    otp_store_entry *entry = &shard->entries[(hash + probe) & shard->mask];
+    uint64_t id = atomic_load_explicit(&entry->userId, memory_order_acquire);
+
+    if (id == OTP_STORE_EMPTY_ID) {
+      if (!insert) {
+        return NULL;
+      }
+      if (atomic_compare_exchange_strong(&entry->userId, &id, userId)) {
+        *inserted = 1;
+        return entry;
+      }
+      /* lost the slot, fall through to see who took it */
+    }
+
+    if (id == userId) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+/* users still being added are treated as unknown */
+static otp_store_entry *ready_entry(otp_store *store, uint64_t userId) {
+  otp_store_entry *entry;
+
+  if (userId == OTP_STORE_EMPTY_ID) {
+    return NULL;
+  }
+
+  entry = find_entry(store, userId, 0, NULL);
+  if (entry == NULL
+      || !atomic_load_explicit(&entry->ready, memory_order_acquire)) {
+    return NULL;
+  }
+
+  return entry;
+}
+
+static int64_t clamp_drift(int64_t drift) {
+  return drift > DRIFT_LIMIT ? DRIFT_LIMIT
+       : drift < -DRIFT_LIMIT ? -DRIFT_LIMIT : drift;
+}
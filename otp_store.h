@@ -0,0 +1,116 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_STORE_H_
+#define OTP_STORE_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum OTP_STORE_RESULT {
+  OTP_STORE_SUCCESS, OTP_STORE_FAILURE, OTP_STORE_REPLAY,
+  OTP_STORE_UNKNOWN_USER, OTP_STORE_EXISTS, OTP_STORE_FULL
+} OTP_STORE_RESULT;
+
+/* user IDs are any value except this one */
+#define OTP_STORE_EMPTY_ID UINT64_MAX
+
+/* steps are kept in 48 bits, drift and its history in 16 alongside them */
+#define OTP_STORE_MAX_STEP ((UINT64_C(1) << 48) - 2)
+
+typedef struct otp_store otp_store;
+
+/* a table with room for at least capacity users, split over shards
+ * separately allocated parts. shards is rounded up to a power of two, at
+ * most 65536, and 0 means 1. NULL on failure */
+otp_store *otp_store_create(size_t capacity, unsigned int shards);
+
+void otp_store_destroy(otp_store *store);
+
+/* add a user. for hotp step is the next counter expected, for totp it is
+ * the last step already used (0 when none, so step 0 itself is never
+ * accepted). users can't be removed */
+OTP_STORE_RESULT otp_store_add(otp_store *store, uint64_t userId,
+                               const otp_key *key, uint64_t step);
+
+/* otp_store_add for a user whose codes are digits long and, for totp,
+ * period seconds apart (0 for hotp). submissions for the user with any
+ * other digits or window length then fail, whatever the caller asks for.
+ * digits 0 leaves both up to the caller, as otp_store_add does */
+OTP_STORE_RESULT otp_store_add_user(otp_store *store, uint64_t userId,
+                                    const otp_key *key, uint64_t step,
+                                    unsigned int digits, unsigned int period);
+
+/* the digits and period a user was added with */
+OTP_STORE_RESULT otp_store_settings(otp_store *store, uint64_t userId,
+                                    unsigned int *digits,
+                                    unsigned int *period);
+
+/* current step and drift of a user */
+OTP_STORE_RESULT otp_store_lookup(otp_store *store, uint64_t userId,
+                                  uint64_t *step, int64_t *drift);
+
+/* validate-and-advance: look windows counters ahead of the expected one
+ * and on a match move the user past it, atomically with respect to other
+ * submissions for the same user */
+OTP_STORE_RESULT hotp_store_validate(otp_store *store, uint64_t userId,
+                                     uint32_t guess, unsigned int guessDigits,
+                                     unsigned int windows);
+
+/* validate around the user's drift corrected step, refusing steps at or
+ * before the last one accepted, and record the new step and drift. the
+ * window is searched in stages, each only when the last missed: the
+ * predicted step, then for a device whose last few codes all matched the
+ * prediction the steps either side of it, then the rest of the window.
+ * each step is hashed once, so the worst case is the whole window, as
+ * for a device that drifted recently. drift is kept to +-2047 steps */
+OTP_STORE_RESULT totp_store_validate(otp_store *store, uint64_t userId,
+                                     time_t time, unsigned int windowLength,
+                                     uint32_t guess, unsigned int guessDigits,
+                                     unsigned int windows);
+
+/* one submission for otp_store_validate_many, windowLength 0 for hotp */
+typedef struct otp_store_request {
+  uint64_t userId;
+  time_t time;
+  unsigned int windowLength;
+  uint32_t guess;
+  unsigned int guessDigits;
+  unsigned int windows;
+} otp_store_request;
+
+/* hotp_store_validate and totp_store_validate over many submissions,
+ * hashing their windows together through hotp_many() - totp predicted
+ * steps first, then the rest of the windows they missed. results[i] answers
+ * requests[i]. submissions within a call behave as if made concurrently,
+ * a second code for the same user is checked against the state from
+ * before the call and only committed if it is still later */
+void otp_store_validate_many(otp_store *store,
+                             const otp_store_request *requests,
+                             OTP_STORE_RESULT *results, size_t count);
+
+#endif /* OTP_STORE_H_ */
@@ -0,0 +1,434 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "otp_uri.h"
+
+/* external includes */
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE32_HAVE_SSSE3 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define BASE32_INVALID 0xff
+#define BASE32_PAD '='
+#define BASE32_BLOCK_CHARS 16
+#define BASE32_BLOCK_BYTES 10
+#define URI_SCHEME "otpauth://"
+
+/* decode BASE32_BLOCK_CHARS characters into BASE32_BLOCK_BYTES bytes,
+ * returns 0 if any of them is outside the alphabet */
+typedef int (*base32_block_fn)(uint8_t *out, const char *text,
+                               OTP_BASE32_ALPHABET alphabet);
+
+/* character to 5 bit value, indexed by OTP_BASE32_ALPHABET */
+static uint8_t decodeTables[2][256];
+
+/* internal helper function definitions */
+static int decode_block_portable(uint8_t *out, const char *text,
+                                 OTP_BASE32_ALPHABET alphabet);
+static int parse_number(uint64_t *value, const char *text, size_t length,
+                        uint64_t limit);
+static int equals_ignore_case(const char *text, size_t length,
+                              const char *expect);
+static int percent_decode(char *out, size_t *outLength, const char *text,
+                          size_t length);
+
+static base32_block_fn decode_block = decode_block_portable;
+
+int otp_base32_decode(uint8_t *out, size_t *outLength, const char *text,
+                      size_t textLength, OTP_BASE32_ALPHABET alphabet) {
+  const uint8_t *table;
+  uint64_t bits = 0;
+  size_t written = 0;
+  size_t decoded;
+  size_t iterator;
+  size_t byte;
+  size_t tail;
+  uint8_t value;
+
+  if ((unsigned int)alphabet > OTP_BASE32_HEX) {
+    return -1;
+  }
+  table = decodeTables[alphabet];
+
+  while (textLength && text[textLength - 1] == BASE32_PAD) {
+    textLength--;
+  }
+
+  /* 1, 3 and 6 characters leave a partial byte no encoder produces */
+  tail = textLength % 8;
+  decoded = textLength / 8 * 5 + tail * 5 / 8;
+  if (tail == 1 || tail == 3 || tail == 6 || decoded > *outLength) {
+    return -1;
+  }
+
+  for (; textLength >= BASE32_BLOCK_CHARS; textLength -= BASE32_BLOCK_CHARS) {
+    if (!decode_block(out + written, text, alphabet)) {
+      return -1;
+    }
+    text += BASE32_BLOCK_CHARS;
+    written += BASE32_BLOCK_BYTES;
+  }
+
+  /* the rest a character at a time, flushing every full group of eight */
+  for (iterator = 0; iterator < textLength; iterator++) {
+    value = table[(uint8_t)text[iterator]];
+    if (value == BASE32_INVALID) {
+      return -1;
+    }
+    bits = bits << 5 | value;
+
+    if (iterator % 8 == 7) {
+      for (byte = 0; byte < 5; byte++) {
+        out[written++] = (uint8_t)(bits >> (32 - 8 * byte));
+      }
+      bits = 0;
+    }
+  }
+
+  /* the partial group, left aligned with the unused low bits dropped */
+  tail = textLength % 8;
+  if (tail) {
+    bits <<= 40 - 5 * tail;
+    for (byte = 0; byte < tail * 5 / 8; byte++) {
+      out[written++] = (uint8_t)(bits >> (32 - 8 * byte));
+    }
+  }
+
+  *outLength = written;
+
+  return 0;
+}
+
+int otp_uri_parse(otp_uri *uri, otp_key *key, const char *text,
+                  size_t textLength) {
+  char secretText[OTP_URI_MAX_SECRET_BYTES * 8 / 5 + 8];
+  uint8_t secret[OTP_URI_MAX_SECRET_BYTES];
+  size_t secretTextLength = 0;
+  size_t secretLength = sizeof(secret);
+  const char *end = text + textLength;
+  const char *cursor;
+  const char *name;
+  const char *value;
+  size_t nameLength;
+  size_t valueLength;
+  uint64_t number;
+  int haveSecret = 0;
+  int result = -1;
+
+  memset(uri, 0, sizeof(*uri));
+  memset(key, 0, sizeof(*key));
+  uri->algorithm = OTP_SHA1;
+  uri->digits = 6;
+  uri->period = 30;
+
+  if (textLength < sizeof(URI_SCHEME) + 4
+      || !equals_ignore_case(text, sizeof(URI_SCHEME) - 1, URI_SCHEME)) {
+    return -1;
+  }
+  cursor = text + sizeof(URI_SCHEME) - 1;
+
+  if (equals_ignore_case(cursor, 4, "totp")) {
+    uri->type = OTP_TIME;
+  } else if (equals_ignore_case(cursor, 4, "hotp")) {
+    uri->type = OTP_HASH;
+  } else {
+    return -1;
+  }
+  cursor += 4;
+  if (cursor == end || *cursor != '/') {
+    return -1;
+  }
+
+  uri->label = ++cursor;
+  while (cursor < end && *cursor != '?') {
+    cursor++;
+  }
+  uri->labelLength = cursor - uri->label;
+
+  /* name=value pairs separated by '&' */
+  while (cursor < end) {
+    name = ++cursor;
+    while (cursor < end && *cursor != '=' && *cursor != '&') {
+      cursor++;
+    }
+    nameLength = cursor - name;
+    value = cursor < end && *cursor == '=' ? ++cursor : cursor;
+    while (cursor < end && *cursor != '&') {
+      cursor++;
+    }
+    valueLength = cursor - value;
+
+    if (equals_ignore_case(name, nameLength, "secret")) {
+      secretTextLength = sizeof(secretText);
+      if (percent_decode(secretText, &secretTextLength, value, valueLength)) {
+        goto cleanup;
+      }
+      haveSecret = 1;
+    } else if (equals_ignore_case(name, nameLength, "algorithm")) {
+      if (equals_ignore_case(value, valueLength, "sha1")) {
+        uri->algorithm = OTP_SHA1;
+      } else if (equals_ignore_case(value, valueLength, "sha256")) {
+        uri->algorithm = OTP_SHA256;
+      } else if (equals_ignore_case(value, valueLength, "sha512")) {
+        uri->algorithm = OTP_SHA512;
+      } else {
+        goto cleanup;
+      }
+    } else if (equals_ignore_case(name, nameLength, "digits")) {
+      if (parse_number(&number, value, valueLength, 10) || number == 0) {
+        goto cleanup;
+      }
+      uri->digits = (unsigned int)number;
+    } else if (equals_ignore_case(name, nameLength, "period")) {
+      if (parse_number(&number, value, valueLength, UINT32_MAX) || number == 0) {
+        goto cleanup;
+      }
+      uri->period = (unsigned int)number;
+    } else if (equals_ignore_case(name, nameLength, "counter")) {
+      if (parse_number(&number, value, valueLength, UINT64_MAX)) {
+        goto cleanup;
+      }
+      uri->counter = number;
+    } else if (equals_ignore_case(name, nameLength, "issuer")) {
+      uri->issuer = value;
+      uri->issuerLength = valueLength;
+    }
+  }
+
+  if (!haveSecret
+      || otp_base32_decode(secret, &secretLength, secretText, secretTextLength,
+                           OTP_BASE32) || secretLength == 0) {
+    goto cleanup;
+  }
+
+  result = otp_key_init_algorithm(key, uri->algorithm, secret, secretLength);
+
+cleanup:
+  /* don't leave the secret on the stack */
+  memset(secretText, 0, sizeof(secretText));
+  memset(secret, 0, sizeof(secret));
+
+  return result;
+}
+
+/* 16 characters make 80 bits, two big endian 40 bit groups */
+static int decode_block_portable(uint8_t *out, const char *text,
+                                 OTP_BASE32_ALPHABET alphabet) {
+  const uint8_t *table = decodeTables[alphabet];
+  uint8_t invalid = 0;
+  uint64_t bits;
+  uint8_t value;
+  int group;
+  int iterator;
+
+  for (group = 0; group < 2; group++, text += 8, out += 5) {
+    bits = 0;
+    for (iterator = 0; iterator < 8; iterator++) {
+      value = table[(uint8_t)text[iterator]];
+      invalid |= value;
+      bits = bits << 5 | (value & 0x1f);
+    }
+
+    out[0] = (uint8_t)(bits >> 32);
+    out[1] = (uint8_t)(bits >> 24);
+    out[2] = (uint8_t)(bits >> 16);
+    out[3] = (uint8_t)(bits >> 8);
+    out[4] = (uint8_t)bits;
+  }
+
+  /* valid values never reach the top bits, BASE32_INVALID sets them all */
+  return (invalid & 0xe0) == 0;
+}
+
+#ifdef BASE32_HAVE_SSSE3
+
+/* classify and map all 16 characters with range compares, then merge the
+ * 5 bit values pairwise into 10, 20 and 40 bit fields */
+__attribute__((target("ssse3")))
+static int decode_block_ssse3(uint8_t *out, const char *text,
+                              OTP_BASE32_ALPHABET alphabet) {
+  const __m128i chars = _mm_loadu_si128((const __m128i *)text);
+  const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+  __m128i isLetter;
+  __m128i isDigit;
+  __m128i values;
+  __m128i merged;
+  uint8_t bytes[16];
+
+  if (alphabet == OTP_BASE32) {
+    /* A-Z a-z -> 0..25, 2-7 -> 26..31 */
+    isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                             _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('2' - 1)),
+                            _mm_cmplt_epi8(chars, _mm_set1_epi8('7' + 1)));
+    values = _mm_or_si128(
+        _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a'))),
+        _mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('2' - 26))));
+  } else {
+    /* 0-9 -> 0..9, A-V a-v -> 10..31 */
+    isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                             _mm_cmplt_epi8(lower, _mm_set1_epi8('v' + 1)));
+    isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+                            _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+    values = _mm_or_si128(
+        _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))),
+        _mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))));
+  }
+
+  if (_mm_movemask_epi8(_mm_or_si128(isLetter, isDigit)) != 0xffff) {
+    return 0;
+  }
+
+  merged = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0120));
+  merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00010400));
+  merged = _mm_or_si128(
+      _mm_slli_epi64(_mm_and_si128(merged, _mm_set_epi32(0, -1, 0, -1)), 20),
+      _mm_srli_epi64(merged, 32));
+  merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9,
+                                                  8, -1, -1, -1, -1, -1, -1));
+
+  _mm_storeu_si128((__m128i *)bytes, merged);
+  memcpy(out, bytes, BASE32_BLOCK_BYTES);
+
+  return 1;
+}
+
+static int cpu_has_ssse3(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+
+  return (ecx & bit_SSSE3) != 0;
+}
+
+#endif /* BASE32_HAVE_SSSE3 */
+
+static int parse_number(uint64_t *value, const char *text, size_t length,
+                        uint64_t limit) {
+  uint64_t digit;
+  size_t iterator;
+
+  if (length == 0) {
+    return -1;
+  }
+
+  *value = 0;
+  for (iterator = 0; iterator < length; iterator++) {
+    if (text[iterator] < '0' || text[iterator] > '9') {
+      return -1;
+    }
+    digit = (uint64_t)(text[iterator] - '0');
+    if (*value > (limit - digit) / 10) {
+      return -1;
+    }
+    *value = *value * 10 + digit;
+  }
+
+  return 0;
+}
+
+/* compare against a lower case ASCII string */
+static int equals_ignore_case(const char *text, size_t length,
+                              const char *expect) {
+  size_t iterator;
+  char letter;
+
+  for (iterator = 0; iterator < length; iterator++) {
+    letter = text[iterator];
+    if (letter >= 'A' && letter <= 'Z') {
+      letter += 'a' - 'A';
+    }
+    if (expect[iterator] == '\0' || letter != expect[iterator]) {
+      return 0;
+    }
+  }
+
+  return expect[length] == '\0';
+}
+
+static int percent_decode(char *out, size_t *outLength, const char *text,
+                          size_t length) {
+  static const char hexDigits[] = "0123456789abcdef";
+  const char *high;
+  const char *low;
+  size_t written = 0;
+  size_t iterator;
+
+  for (iterator = 0; iterator < length; iterator++) {
+    if (written == *outLength) {
+      return -1;
+    }
+
+    if (text[iterator] != '%') {
+      out[written++] = text[iterator];
+      continue;
+    }
+
+    if (length - iterator < 3
+        || (high = memchr(hexDigits, text[iterator + 1] | 0x20, 16)) == NULL
+        || (low = memchr(hexDigits, text[iterator + 2] | 0x20, 16)) == NULL) {
+      return -1;
+    }
+    out[written++] = (char)((high - hexDigits) << 4 | (low - hexDigits));
+    iterator += 2;
+  }
+
+  *outLength = written;
+
+  return 0;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+static void init_base32(void) {
+  static const char *alphabets[2] = {
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567", "0123456789ABCDEFGHIJKLMNOPQRSTUV"
+  };
+  int alphabet;
+  int value;
+  char letter;
+
+  memset(decodeTables, BASE32_INVALID, sizeof(decodeTables));
+  for (alphabet = 0; alphabet < 2; alphabet++) {
+    for (value = 0; value < 32; value++) {
+      letter = alphabets[alphabet][value];
+      decodeTables[alphabet][(uint8_t)letter] = (uint8_t)value;
+      if (letter >= 'A' && letter <= 'Z') {
+        decodeTables[alphabet][(uint8_t)(letter + 'a' - 'A')] = (uint8_t)value;
+      }
+    }
+  }
+
+#ifdef BASE32_HAVE_SSSE3
+  if (cpu_has_ssse3()) {
+    decode_block = decode_block_ssse3;
+  }
+#endif
+}
@@ -0,0 +1,73 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef OTP_URI_H_
+#define OTP_URI_H_
+
+/* local includes */
+#include "libotp.h"
+
+/* external includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/* the longest secret otp_uri_parse accepts, in decoded bytes */
+#define OTP_URI_MAX_SECRET_BYTES 128
+
+/* upper bound on the bytes decoded from textLength Base32 characters */
+#define OTP_BASE32_DECODED_LENGTH(textLength) ((textLength) * 5 / 8)
+
+/* the two alphabets of RFC 4648 */
+typedef enum OTP_BASE32_ALPHABET {
+  OTP_BASE32, OTP_BASE32_HEX
+} OTP_BASE32_ALPHABET;
+
+/* decode Base32 text into out, ignoring case and any trailing '=' padding.
+ * *outLength holds the room in out on entry and the bytes written on
+ * return. returns 0 on success, -1 for a character outside the alphabet,
+ * a length no encoder produces, or too little room */
+int otp_base32_decode(uint8_t *out, size_t *outLength, const char *text,
+                      size_t textLength, OTP_BASE32_ALPHABET alphabet);
+
+/* the parameters of an otpauth:// URI besides the secret. label and issuer
+ * point into the parsed text and are still percent encoded */
+typedef struct otp_uri {
+  OTP_TYPE type;
+  OTP_ALGORITHM algorithm;
+  unsigned int digits;
+  unsigned int period;
+  uint64_t counter;
+  const char *label;
+  size_t labelLength;
+  const char *issuer;
+  size_t issuerLength;
+} otp_uri;
+
+/* parse otpauth://totp/label?secret=...&algorithm=...&digits=...&period=...
+ * (or hotp with counter=...) and prepare key from the secret. missing
+ * parameters default to SHA1, 6 digits, 30 seconds and counter 0, unknown
+ * ones are ignored. nothing is allocated. returns 0 on success, -1 if the
+ * URI is malformed, in which case key is left cleared */
+int otp_uri_parse(otp_uri *uri, otp_key *key, const char *text,
+                  size_t textLength);
+
+#endif /* OTP_URI_H_ */
@@ -0,0 +1,322 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+/* local includes */
+#include "sha1_backend.h"
+
+/* external includes */
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_HAVE_X86_SHA 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define SHA1_HAVE_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+
+/* local SHA1 defines - See RFC 3174 */
+#define SHA1_K0 0x5a827999
+#define SHA1_K1 0x6ed9eba1
+#define SHA1_K2 0x8f1bbcdc
+#define SHA1_K3 0xca62c1d6
+
+/* local helper macros */
+#define ROTL32(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+/* SHA1 compression (https://tools.ietf.org/html/rfc3174#section-6.2) */
+#define SHA1_SCHEDULE(w, t) \
+  (w[(t) & 15] = ROTL32(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] \
+                      ^ w[((t) + 2) & 15] ^ w[(t) & 15], 1))
+
+#define SHA1_STEP(f, k, w) do { \
+    uint32_t temp = ROTL32(a, 5) + (f) + e + (k) + (w); \
+    e = d; d = c; c = ROTL32(b, 30); b = a; a = temp; \
+  } while (0)
+
+static void sha1_compress_portable(uint32_t state[5], const uint32_t block[16]) {
+  uint32_t w[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  int t;
+
+  for (t = 0; t < 16; t++) {
+    w[t] = block[t];
+    SHA1_STEP((b & c) | (~b & d), SHA1_K0, w[t]);
+  }
+  for (; t < 20; t++) {
+    SHA1_STEP((b & c) | (~b & d), SHA1_K0, SHA1_SCHEDULE(w, t));
+  }
+  for (; t < 40; t++) {
+    SHA1_STEP(b ^ c ^ d, SHA1_K1, SHA1_SCHEDULE(w, t));
+  }
+  for (; t < 60; t++) {
+    SHA1_STEP((b & c) | (b & d) | (c & d), SHA1_K2, SHA1_SCHEDULE(w, t));
+  }
+  for (; t < 80; t++) {
+    SHA1_STEP(b ^ c ^ d, SHA1_K3, SHA1_SCHEDULE(w, t));
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+#ifdef SHA1_HAVE_X86_SHA
+
+/* four rounds of the steady state schedule: consume m0, finish m1, extend m3
+ * and fold m0 into m2 */
+#define SHANI_QUAD(eIn, eOut, m0, m1, m2, m3, func) \
+  eIn = _mm_sha1nexte_epu32(eIn, m0); \
+  eOut = abcd; \
+  m1 = _mm_sha1msg2_epu32(m1, m0); \
+  abcd = _mm_sha1rnds4_epu32(abcd, eIn, func); \
+  m3 = _mm_sha1msg1_epu32(m3, m0); \
+  m2 = _mm_xor_si128(m2, m0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha1_compress_x86_sha(uint32_t state[5], const uint32_t block[16]) {
+  __m128i abcd, abcdSave, e0, e1, eSave;
+  __m128i msg0, msg1, msg2, msg3;
+
+  /* the instructions want a in the top lane */
+  abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+  e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+  abcdSave = abcd;
+  eSave = e0;
+
+  /* rounds 0-11 while the first message words load */
+  msg0 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(block + 0)), 0x1b);
+  e0 = _mm_add_epi32(e0, msg0);
+  e1 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+  msg1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(block + 4)), 0x1b);
+  e1 = _mm_sha1nexte_epu32(e1, msg1);
+  e0 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+  msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+  msg2 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(block + 8)), 0x1b);
+  e0 = _mm_sha1nexte_epu32(e0, msg2);
+  e1 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+  msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+  msg0 = _mm_xor_si128(msg0, msg2);
+
+  msg3 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(block + 12)), 0x1b);
+
+  /* rounds 12-67 */
+  SHANI_QUAD(e1, e0, msg3, msg0, msg1, msg2, 0);
+  SHANI_QUAD(e0, e1, msg0, msg1, msg2, msg3, 0);
+  SHANI_QUAD(e1, e0, msg1, msg2, msg3, msg0, 1);
+  SHANI_QUAD(e0, e1, msg2, msg3, msg0, msg1, 1);
+  SHANI_QUAD(e1, e0, msg3, msg0, msg1, msg2, 1);
+  SHANI_QUAD(e0, e1, msg0, msg1, msg2, msg3, 1);
+  SHANI_QUAD(e1, e0, msg1, msg2, msg3, msg0, 1);
+  SHANI_QUAD(e0, e1, msg2, msg3, msg0, msg1, 2);
+  SHANI_QUAD(e1, e0, msg3, msg0, msg1, msg2, 2);
+  SHANI_QUAD(e0, e1, msg0, msg1, msg2, msg3, 2);
+  SHANI_QUAD(e1, e0, msg1, msg2, msg3, msg0, 2);
+  SHANI_QUAD(e0, e1, msg2, msg3, msg0, msg1, 2);
+  SHANI_QUAD(e1, e0, msg3, msg0, msg1, msg2, 3);
+  SHANI_QUAD(e0, e1, msg0, msg1, msg2, msg3, 3);
+
+  /* rounds 68-79 as the schedule runs out */
+  e1 = _mm_sha1nexte_epu32(e1, msg1);
+  e0 = abcd;
+  msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+  abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+  msg3 = _mm_xor_si128(msg3, msg1);
+
+  e0 = _mm_sha1nexte_epu32(e0, msg2);
+  e1 = abcd;
+  msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+  e1 = _mm_sha1nexte_epu32(e1, msg3);
+  e0 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+  /* add the saved state back in */
+  e0 = _mm_sha1nexte_epu32(e0, eSave);
+  abcd = _mm_add_epi32(abcd, abcdSave);
+
+  _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+  state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static int cpu_has_x86_sha(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+    return 0;
+  }
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+
+  return (ebx & bit_SHA) != 0;
+}
+
+#endif /* SHA1_HAVE_X86_SHA */
+
+#ifdef SHA1_HAVE_ARMV8
+
+__attribute__((target("+crypto")))
+static void sha1_compress_armv8(uint32_t state[5], const uint32_t block[16]) {
+  static const uint32_t constants[4] = { SHA1_K0, SHA1_K1, SHA1_K2, SHA1_K3 };
+  uint32x4_t abcd = vld1q_u32(state);
+  uint32x4_t abcdSave = abcd;
+  uint32x4_t msg[4];
+  uint32x4_t words;
+  uint32_t e = state[4];
+  uint32_t eNext;
+  int group;
+
+  /* words are already in host order, no byte reversal needed */
+  msg[0] = vld1q_u32(block + 0);
+  msg[1] = vld1q_u32(block + 4);
+  msg[2] = vld1q_u32(block + 8);
+  msg[3] = vld1q_u32(block + 12);
+
+  for (group = 0; group < 20; group++) {
+    words = vaddq_u32(msg[group & 3], vdupq_n_u32(constants[group / 5]));
+    eNext = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+    if (group < 5) {
+      abcd = vsha1cq_u32(abcd, e, words);
+    } else if (group < 10 || group >= 15) {
+      abcd = vsha1pq_u32(abcd, e, words);
+    } else {
+      abcd = vsha1mq_u32(abcd, e, words);
+    }
+    e = eNext;
+
+    /* extend the schedule by the four words sixteen steps ahead */
+    if (group < 16) {
+      msg[group & 3] = vsha1su1q_u32(vsha1su0q_u32(msg[group & 3],
+                                                   msg[(group + 1) & 3],
+                                                   msg[(group + 2) & 3]),
+                                     msg[(group + 3) & 3]);
+    }
+  }
+
+  vst1q_u32(state, vaddq_u32(abcd, abcdSave));
+  state[4] += e;
+}
+
+static int cpu_has_armv8_sha1(void) {
+  return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+#endif /* SHA1_HAVE_ARMV8 */
+
+static int cpu_always(void) {
+  return 1;
+}
+
+static int cpu_never(void) {
+  return 0;
+}
+
+typedef struct sha1_backend_entry {
+  const char *name;
+  sha1_compress_fn compress;
+  int (*supported)(void);
+} sha1_backend_entry;
+
+/* indexed by SHA1_BACKEND */
+static const sha1_backend_entry backends[SHA1_BACKEND_COUNT] = {
+  { "portable", sha1_compress_portable, cpu_always },
+#ifdef SHA1_HAVE_X86_SHA
+  { "x86-sha", sha1_compress_x86_sha, cpu_has_x86_sha },
+#else
+  { "x86-sha", NULL, cpu_never },
+#endif
+#ifdef SHA1_HAVE_ARMV8
+  { "armv8-sha1", sha1_compress_armv8, cpu_has_armv8_sha1 }
+#else
+  { "armv8-sha1", NULL, cpu_never }
+#endif
+};
+
+sha1_compress_fn sha1_compress = sha1_compress_portable;
+static SHA1_BACKEND currentBackend = SHA1_BACKEND_PORTABLE;
+
+int sha1_backend_supported(SHA1_BACKEND backend) {
+  if ((unsigned int)backend >= SHA1_BACKEND_COUNT) {
+    return 0;
+  }
+
+  return backends[backend].supported();
+}
+
+int sha1_backend_select(SHA1_BACKEND backend) {
+  if (!sha1_backend_supported(backend)) {
+    return -1;
+  }
+
+  sha1_compress = backends[backend].compress;
+  currentBackend = backend;
+
+  return 0;
+}
+
+SHA1_BACKEND sha1_backend_current(void) {
+  return currentBackend;
+}
+
+SHA1_BACKEND sha1_backend_best(void) {
+  int backend;
+
+  for (backend = SHA1_BACKEND_COUNT - 1; backend > SHA1_BACKEND_PORTABLE; backend--) {
+    if (sha1_backend_supported((SHA1_BACKEND)backend)) {
+      return (SHA1_BACKEND)backend;
+    }
+  }
+
+  return SHA1_BACKEND_PORTABLE;
+}
+
+const char *sha1_backend_name(SHA1_BACKEND backend) {
+  if ((unsigned int)backend >= SHA1_BACKEND_COUNT) {
+    return "unknown";
+  }
+
+  return backends[backend].name;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+static void init_sha1_backend(void) {
+  sha1_backend_select(sha1_backend_best());
+}
@@ -0,0 +1,243 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+/* local includes */
+#include "sha256_backend.h"
+
+/* external includes */
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_HAVE_X86_SHA 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* local helper macros */
+#define ROTR32(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+/* SHA256 functions (https://tools.ietf.org/html/rfc6234#section-5.1) */
+#define SHA256_CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA256_BSIG0(x) (ROTR32(x, 2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
+#define SHA256_BSIG1(x) (ROTR32(x, 6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
+#define SHA256_SSIG0(x) (ROTR32(x, 7) ^ ROTR32(x, 18) ^ ((x) >> 3))
+#define SHA256_SSIG1(x) (ROTR32(x, 17) ^ ROTR32(x, 19) ^ ((x) >> 10))
+
+#define SHA256_SCHEDULE(w, t) \
+  (w[(t) & 15] += SHA256_SSIG1(w[((t) + 14) & 15]) + w[((t) + 9) & 15] \
+                + SHA256_SSIG0(w[((t) + 1) & 15]))
+
+static const uint32_t sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_compress_portable(uint32_t state[8], const uint32_t block[16]) {
+  uint32_t w[16];
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  uint32_t temp1;
+  uint32_t temp2;
+  int t;
+
+  for (t = 0; t < 64; t++) {
+    if (t < 16) {
+      w[t] = block[t];
+    } else {
+      SHA256_SCHEDULE(w, t);
+    }
+
+    temp1 = h + SHA256_BSIG1(e) + SHA256_CH(e, f, g) + sha256K[t] + w[t & 15];
+    temp2 = SHA256_BSIG0(a) + SHA256_MAJ(a, b, c);
+    h = g; g = f; f = e; e = d + temp1;
+    d = c; c = b; b = a; a = temp1 + temp2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+#ifdef SHA256_HAVE_X86_SHA
+
+/* the instructions keep the state as ABEF and CDGH, and run two rounds at a
+ * time from the low then high half of four scheduled words */
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_x86_sha(uint32_t state[8], const uint32_t block[16]) {
+  __m128i state0, state1, save0, save1;
+  __m128i msg[4];
+  __m128i words;
+  __m128i temp;
+  int quad;
+
+  temp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1b);
+  state0 = _mm_alignr_epi8(temp, state1, 8);
+  state1 = _mm_blend_epi16(state1, temp, 0xf0);
+  save0 = state0;
+  save1 = state1;
+
+  for (quad = 0; quad < 16; quad++) {
+    /* words are already in host order, no byte reversal needed */
+    if (quad < 4) {
+      msg[quad] = _mm_loadu_si128((const __m128i *)(block + 4 * quad));
+    }
+
+    words = _mm_add_epi32(msg[quad & 3],
+                          _mm_loadu_si128((const __m128i *)(sha256K + 4 * quad)));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+
+    /* finish the words needed four rounds from now */
+    if (quad >= 3 && quad < 15) {
+      temp = _mm_alignr_epi8(msg[quad & 3], msg[(quad - 1) & 3], 4);
+      msg[(quad + 1) & 3] = _mm_sha256msg2_epu32(
+          _mm_add_epi32(msg[(quad + 1) & 3], temp), msg[quad & 3]);
+    }
+
+    state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                   _mm_shuffle_epi32(words, 0x0e));
+
+    /* and start on the ones needed after that */
+    if (quad >= 1 && quad < 13) {
+      msg[(quad - 1) & 3] = _mm_sha256msg1_epu32(msg[(quad - 1) & 3],
+                                                 msg[quad & 3]);
+    }
+  }
+
+  state0 = _mm_add_epi32(state0, save0);
+  state1 = _mm_add_epi32(state1, save1);
+
+  temp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128((__m128i *)state, _mm_blend_epi16(temp, state1, 0xf0));
+  _mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(state1, temp, 8));
+}
+
+static int cpu_has_x86_sha(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+    return 0;
+  }
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+
+  return (ebx & bit_SHA) != 0;
+}
+
+#endif /* SHA256_HAVE_X86_SHA */
+
+static int cpu_always(void) {
+  return 1;
+}
+
+#ifndef SHA256_HAVE_X86_SHA
+static int cpu_never(void) {
+  return 0;
+}
+#endif
+
+typedef struct sha256_backend_entry {
+  const char *name;
+  sha256_compress_fn compress;
+  int (*supported)(void);
+} sha256_backend_entry;
+
+/* indexed by SHA256_BACKEND */
+static const sha256_backend_entry backends[SHA256_BACKEND_COUNT] = {
+  { "portable", sha256_compress_portable, cpu_always },
+#ifdef SHA256_HAVE_X86_SHA
+  { "x86-sha", sha256_compress_x86_sha, cpu_has_x86_sha }
+#else
+  { "x86-sha", NULL, cpu_never }
+#endif
+};
+
+sha256_compress_fn sha256_compress = sha256_compress_portable;
+static SHA256_BACKEND currentBackend = SHA256_BACKEND_PORTABLE;
+
+int sha256_backend_supported(SHA256_BACKEND backend) {
+  if ((unsigned int)backend >= SHA256_BACKEND_COUNT) {
+    return 0;
+  }
+
+  return backends[backend].supported();
+}
+
+int sha256_backend_select(SHA256_BACKEND backend) {
+  if (!sha256_backend_supported(backend)) {
+    return -1;
+  }
+
+  sha256_compress = backends[backend].compress;
+  currentBackend = backend;
+
+  return 0;
+}
+
+SHA256_BACKEND sha256_backend_current(void) {
+  return currentBackend;
+}
+
+SHA256_BACKEND sha256_backend_best(void) {
+  int backend;
+
+  for (backend = SHA256_BACKEND_COUNT - 1; backend > SHA256_BACKEND_PORTABLE; backend--) {
+    if (sha256_backend_supported((SHA256_BACKEND)backend)) {
+      return (SHA256_BACKEND)backend;
+    }
+  }
+
+  return SHA256_BACKEND_PORTABLE;
+}
+
+const char *sha256_backend_name(SHA256_BACKEND backend) {
+  if ((unsigned int)backend >= SHA256_BACKEND_COUNT) {
+    return "unknown";
+  }
+
+  return backends[backend].name;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+#endif
+static void init_sha256_backend(void) {
+  sha256_backend_select(sha256_backend_best());
+}
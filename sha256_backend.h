@@ -0,0 +1,52 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef SHA256_BACKEND_H_
+#define SHA256_BACKEND_H_
+
+/* external includes */
+#include <stdint.h>
+
+/* SHA256 compression implementations, best one is chosen at load time */
+typedef enum SHA256_BACKEND {
+  SHA256_BACKEND_PORTABLE, SHA256_BACKEND_X86_SHA, SHA256_BACKEND_COUNT
+} SHA256_BACKEND;
+
+/* compress one block given as big endian words into state */
+typedef void (*sha256_compress_fn)(uint32_t state[8], const uint32_t block[16]);
+
+extern sha256_compress_fn sha256_compress;
+
+int sha256_backend_supported(SHA256_BACKEND backend);
+
+/* switch backends - returns 0 on success, -1 if the CPU lacks support.
+ * not safe while other threads are hashing, meant for startup and tests */
+int sha256_backend_select(SHA256_BACKEND backend);
+
+SHA256_BACKEND sha256_backend_current(void);
+
+SHA256_BACKEND sha256_backend_best(void);
+
+const char *sha256_backend_name(SHA256_BACKEND backend);
+
+#endif /* SHA256_BACKEND_H_ */
@@ -20,8 +20,19 @@
  */
 
 #include "tests/test_hmac_sha1.c"
+#include "tests/test_hmac_sha2.c"
 #include "tests/test_hotp.c"
 #include "tests/test_totp.c"
+#include "tests/test_executor.c"
+#include "tests/test_store.c"
+#include "tests/test_keyfile.c"
+#include "tests/test_cache.c"
+#include "tests/test_index.c"
+#include "tests/test_uri.c"
+#include "tests/test_metrics.c"
+#include "tests/test_server.c"
+#include "tests/test_arena.c"
+#include "tests/test_clock.c"
 
 #include <CUnit/Basic.h>
 
@@ -29,6 +40,17 @@ int main(void) {
   CU_pSuite pSuite1 = NULL;
   CU_pSuite pSuite2 = NULL;
   CU_pSuite pSuite3 = NULL;
+  CU_pSuite pSuite4 = NULL;
+  CU_pSuite pSuite5 = NULL;
+  CU_pSuite pSuite6 = NULL;
+  CU_pSuite pSuite7 = NULL;
+  CU_pSuite pSuite8 = NULL;
+  CU_pSuite pSuite9 = NULL;
+  CU_pSuite pSuite10 = NULL;
+  CU_pSuite pSuite11 = NULL;
+  CU_pSuite pSuite12 = NULL;
+  CU_pSuite pSuite13 = NULL;
+  CU_pSuite pSuite14 = NULL;
 
   /* initialize the CUnit test registry */
   if (CU_initialize_registry() != CUE_SUCCESS) {
@@ -50,6 +72,61 @@ int main(void) {
     return CU_get_error();
   }
 
+  if ( addExecutorTestSuite( pSuite4 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addStoreTestSuite( pSuite5 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addKeyfileTestSuite( pSuite6 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addCacheTestSuite( pSuite7 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addIndexTestSuite( pSuite8 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addHMACSHA2TestSuite( pSuite9 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addURITestSuite( pSuite10 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addMetricsTestSuite( pSuite11 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addServerTestSuite( pSuite12 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addArenaTestSuite( pSuite13 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if ( addClockTestSuite( pSuite14 ) != CUE_SUCCESS) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
   /* Run all tests using the CUnit Basic interface */
   CU_basic_set_mode(CU_BRM_VERBOSE);
   CU_basic_run_tests();
@@ -0,0 +1,199 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef ARENA_TEST_
+#define ARENA_TEST_
+
+/* local includes */
+#include "../otp_arena.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/* arena test function definitions */
+void arena_alloc_test(void);
+void arena_free_reuse_test(void);
+void arena_reset_test(void);
+void arena_wipe_test(void);
+
+CU_ErrorCode addArenaTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Key context arena", NULL, NULL);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "allocation across slabs", arena_alloc_test))
+      || (NULL == CU_add_test(pSuite, "free list reuse", arena_free_reuse_test))
+      || (NULL == CU_add_test(pSuite, "bulk reset", arena_reset_test))
+      || (NULL == CU_add_test(pSuite, "secure wipe", arena_wipe_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+void arena_alloc_test(void) {
+  otp_arena *arena = otp_arena_create(4096, 0);
+  otp_arena_stats stats;
+  otp_key *keys[100];
+  size_t iterator;
+
+  CU_ASSERT_PTR_NOT_NULL(arena);
+  if (arena == NULL) {
+    return;
+  }
+
+  for (iterator = 0; iterator < 100; iterator++) {
+    keys[iterator] = otp_arena_key(arena, OTP_SHA1,
+                                   (uint8_t *)"12345678901234567890", 20);
+    CU_ASSERT_PTR_NOT_NULL(keys[iterator]);
+    if (keys[iterator] == NULL) {
+      break;
+    }
+    CU_ASSERT_EQUAL((uintptr_t)keys[iterator] % 64, 0);
+    CU_ASSERT(iterator == 0 || keys[iterator] != keys[iterator - 1]);
+  }
+  CU_ASSERT_EQUAL(hotp_ctx(keys[0], 1) % 1000000, 287082);
+  CU_ASSERT_EQUAL(hotp_ctx(keys[99], 4) % 1000000, 338314);
+  CU_ASSERT_PTR_NULL(otp_arena_key(arena, (OTP_ALGORITHM)3,
+                                   (uint8_t *)"12345678901234567890", 20));
+
+  /* 4KiB slabs hold far fewer than 100 keys */
+  otp_arena_read_stats(arena, &stats);
+  CU_ASSERT_EQUAL(stats.keys, 100);
+  CU_ASSERT(stats.slabs > 1);
+  CU_ASSERT(stats.capacity >= 100);
+  CU_ASSERT(stats.lockedBytes <= stats.slabs * 4096);
+
+  otp_arena_destroy(arena);
+}
+
+void arena_free_reuse_test(void) {
+  otp_arena *arena = otp_arena_create(0, 0);
+  otp_arena_stats stats;
+  otp_key *first;
+  otp_key *second;
+  const uint8_t *bytes;
+  size_t iterator;
+  int wiped = 1;
+
+  CU_ASSERT_PTR_NOT_NULL(arena);
+  if (arena == NULL) {
+    return;
+  }
+
+  first = otp_arena_key(arena, OTP_SHA512, (uint8_t *)"secret", 6);
+  second = otp_arena_key(arena, OTP_SHA256, (uint8_t *)"secret", 6);
+  CU_ASSERT_PTR_NOT_NULL(first);
+  CU_ASSERT_PTR_NOT_NULL(second);
+  if (first == NULL || second == NULL) {
+    otp_arena_destroy(arena);
+    return;
+  }
+
+  /* a released slot is wiped past the free list link it now holds */
+  otp_arena_free(arena, first);
+  bytes = (const uint8_t *)first;
+  for (iterator = sizeof(void *); iterator < sizeof(otp_key); iterator++) {
+    wiped &= bytes[iterator] == 0;
+  }
+  CU_ASSERT(wiped);
+
+  /* and handed out again, zeroed, before any new slot */
+  CU_ASSERT_EQUAL(otp_arena_alloc(arena), first);
+  CU_ASSERT_EQUAL(first->algorithm, OTP_SHA1);
+  otp_arena_read_stats(arena, &stats);
+  CU_ASSERT_EQUAL(stats.keys, 2);
+  CU_ASSERT_EQUAL(stats.slabs, 1);
+
+  otp_arena_destroy(arena);
+}
+
+void arena_reset_test(void) {
+  otp_arena *arena = otp_arena_create(4096, 0);
+  otp_arena_stats stats;
+  otp_key *first;
+  otp_key *key = NULL;
+  size_t iterator;
+
+  CU_ASSERT_PTR_NOT_NULL(arena);
+  if (arena == NULL) {
+    return;
+  }
+
+  first = otp_arena_alloc(arena);
+  for (iterator = 0; iterator < 60; iterator++) {
+    key = otp_arena_key(arena, OTP_SHA1, (uint8_t *)"secret", 6);
+  }
+  CU_ASSERT_PTR_NOT_NULL(key);
+
+  otp_arena_reset(arena);
+
+  /* the same slabs come back in the same order, all of them zeroed */
+  CU_ASSERT_EQUAL(otp_arena_alloc(arena), first);
+  for (iterator = 0; iterator < 60; iterator++) {
+    otp_key *again = otp_arena_alloc(arena);
+
+    CU_ASSERT_EQUAL(again->algorithm, OTP_SHA1);
+    CU_ASSERT_EQUAL(again->hmac.sha1.innerState[0], 0);
+    key = again;
+  }
+  otp_arena_read_stats(arena, &stats);
+  CU_ASSERT_EQUAL(stats.keys, 61);
+  otp_arena_reset(arena);
+  otp_arena_read_stats(arena, &stats);
+  CU_ASSERT_EQUAL(stats.keys, 0);
+  CU_ASSERT(stats.slabs > 1);
+
+  otp_arena_destroy(arena);
+}
+
+void arena_wipe_test(void) {
+  uint8_t buffer[300];
+  size_t start;
+  size_t length;
+  size_t iterator;
+  int correct = 1;
+
+  /* every alignment and tail length around the wide stores */
+  for (start = 0; start < 17; start++) {
+    for (length = 0; length < 200; length += 13) {
+      memset(buffer, 0xa5, sizeof(buffer));
+      otp_secure_wipe(buffer + start, length);
+
+      for (iterator = 0; iterator < sizeof(buffer); iterator++) {
+        int inside = iterator >= start && iterator < start + length;
+
+        correct &= buffer[iterator] == (inside ? 0 : 0xa5);
+      }
+    }
+  }
+  CU_ASSERT(correct);
+}
+
+#endif /* ARENA_TEST_ */
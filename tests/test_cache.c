@@ -0,0 +1,190 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef CACHE_TEST_
+#define CACHE_TEST_
+
+/* local includes */
+#include "../otp_cache.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdint.h>
+#include <time.h>
+
+/* cache test function definitions */
+int init_cache_suite(void);
+int clean_cache_suite(void);
+void cache_create_test(void);
+void cache_code_test(void);
+void cache_window_test(void);
+void cache_late_step_test(void);
+
+otp_key cache_reference_key;
+
+CU_ErrorCode addCacheTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Rolling TOTP code cache", init_cache_suite,
+                        clean_cache_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "create", cache_create_test))
+      || (NULL == CU_add_test(pSuite, "codes across step boundaries", cache_code_test))
+      || (NULL == CU_add_test(pSuite, "window validation", cache_window_test))
+      || (NULL == CU_add_test(pSuite, "steps past 2^32", cache_late_step_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_cache_suite(void) {
+  otp_key_init(&cache_reference_key, (uint8_t *)"12345678901234567890", 20);
+  return CUE_SUCCESS;
+}
+
+int clean_cache_suite(void) {
+  otp_key_clear(&cache_reference_key);
+  return CUE_SUCCESS;
+}
+
+void cache_create_test(void) {
+  totp_cache *cache;
+
+  CU_ASSERT_PTR_NULL(totp_cache_create(&cache_reference_key, 0, 1));
+  CU_ASSERT_PTR_NULL(totp_cache_create(&cache_reference_key, 30,
+                                       TOTP_CACHE_MAX_RADIUS + 1));
+
+  cache = totp_cache_create(&cache_reference_key, 30, TOTP_CACHE_MAX_RADIUS);
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  if (cache) {
+    totp_cache_destroy(cache);
+  }
+}
+
+/* the cached codes follow the clock forwards, jump and go back */
+void cache_code_test(void) {
+  totp_cache *cache = totp_cache_create(&cache_reference_key, 30, 2);
+  time_t time;
+
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  if (cache == NULL) {
+    return;
+  }
+
+  /* RFC 6238 appendix B, 8 digits */
+  CU_ASSERT_EQUAL(totp_cache_code(cache, 59) % 100000000, 94287082);
+  CU_ASSERT_EQUAL(totp_cache_code(cache, 1111111109) % 100000000, 7081804);
+
+  for (time = 1111111000; time < 1111113000; time += 7) {
+    CU_ASSERT_EQUAL(totp_cache_code(cache, time),
+                    totp_ctx(&cache_reference_key, time, 30));
+  }
+  for (time = 1111113000; time > 1111111000; time -= 13) {
+    CU_ASSERT_EQUAL(totp_cache_code(cache, time),
+                    totp_ctx(&cache_reference_key, time, 30));
+  }
+
+  /* the first steps, where the range is clipped at step 0 */
+  for (time = 0; time < 200; time++) {
+    CU_ASSERT_EQUAL(totp_cache_code(cache, time),
+                    totp_ctx(&cache_reference_key, time, 30));
+  }
+
+  totp_cache_destroy(cache);
+}
+
+/* every guess gives the same answer and offset as the uncached search */
+void cache_window_test(void) {
+  totp_cache *cache = totp_cache_create(&cache_reference_key, 30, 3);
+  unsigned int windows;
+  int64_t step;
+  int64_t cachedOffset;
+  int64_t directOffset;
+  time_t time = 1234567890;
+  uint32_t guess;
+
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  if (cache == NULL) {
+    return;
+  }
+
+  for (windows = 0; windows <= 9; windows++) {
+    for (step = -5; step <= 5; step++) {
+      guess = totp_ctx(&cache_reference_key, time + 30 * step, 30) % 1000000;
+      cachedOffset = directOffset = 99;
+
+      CU_ASSERT_EQUAL(totp_cache_find_window(cache, time, guess, 6, windows,
+                                             &cachedOffset),
+                      totp_find_window_ctx(&cache_reference_key, time, 30,
+                                           guess, 6, windows, &directOffset));
+      CU_ASSERT_EQUAL(cachedOffset, directOffset);
+    }
+    time += 30;
+  }
+
+  /* near zero, and a guess that is never right */
+  for (windows = 1; windows <= 7; windows++) {
+    guess = totp_ctx(&cache_reference_key, 0, 30) % 1000000;
+    CU_ASSERT_EQUAL(totp_cache_validate(cache, 35, guess, 6, windows),
+                    totp_validate_windows_ctx(&cache_reference_key, 35, 30,
+                                              guess, 6, windows));
+    CU_ASSERT_EQUAL(totp_cache_validate(cache, 35, 1000000, 6, windows),
+                    OTP_VALIDATE_FAILURE);
+  }
+
+  totp_cache_destroy(cache);
+}
+
+/* with a 1 second window the steps pass 2^32 in 2106, where a step with
+ * the same low bits mustn't be taken for an earlier one */
+void cache_late_step_test(void) {
+  totp_cache *cache = totp_cache_create(&cache_reference_key, 1, 0);
+  time_t late = ((time_t)1 << 32) + 100;
+
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  if (cache == NULL) {
+    return;
+  }
+
+  CU_ASSERT_EQUAL(totp_cache_code(cache, 100),
+                  totp_ctx(&cache_reference_key, 100, 1));
+  CU_ASSERT_EQUAL(totp_cache_code(cache, late),
+                  totp_ctx(&cache_reference_key, late, 1));
+  CU_ASSERT_EQUAL(totp_cache_validate(cache, late,
+                                      totp_ctx(&cache_reference_key, late + 1,
+                                               1) % 1000000, 6, 3),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(totp_cache_code(cache, 100),
+                  totp_ctx(&cache_reference_key, 100, 1));
+
+  totp_cache_destroy(cache);
+}
+
+#endif /* CACHE_TEST_ */
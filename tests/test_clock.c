@@ -0,0 +1,410 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef CLOCK_TEST_
+#define CLOCK_TEST_
+
+/* local includes */
+#include "../otp_cache.h"
+#include "../otp_clock.h"
+#include "../otp_index.h"
+#include "../otp_metrics.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/* clock test function definitions */
+void clock_step_test(void);
+void clock_lead_test(void);
+void clock_jump_test(void);
+void clock_cache_test(void);
+void clock_lead_hashes_test(void);
+void clock_thread_test(void);
+
+CU_ErrorCode addClockTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Cached clock", NULL, NULL);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "cached steps", clock_step_test))
+      || (NULL == CU_add_test(pSuite, "boundary lead", clock_lead_test))
+      || (NULL == CU_add_test(pSuite, "clock jumps", clock_jump_test))
+      || (NULL == CU_add_test(pSuite, "cache precompute", clock_cache_test))
+      || (NULL == CU_add_test(pSuite, "lead keeps the current steps", clock_lead_hashes_test))
+      || (NULL == CU_add_test(pSuite, "clock thread", clock_thread_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+typedef struct clock_record {
+  unsigned int calls;
+  uint64_t step;
+  time_t stepStart;
+} clock_record;
+
+static time_t clock_fake(void *context) {
+  return *(time_t *)context;
+}
+
+static void clock_count(void *context, uint64_t step, time_t stepStart) {
+  clock_record *record = context;
+
+  record->calls++;
+  record->step = step;
+  record->stepStart = stepStart;
+}
+
+void clock_step_test(void) {
+  time_t now = 59;
+  clock_record record = {0, 0, 0};
+  otp_clock *clock = otp_clock_create(clock_fake, &now);
+
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (clock == NULL) {
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_clock_now(clock), 59);
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 0, clock_count, &record), 0);
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 60, 0, NULL, NULL), 0);
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 0, 0, NULL, NULL), -1);
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 30, NULL, NULL), -1);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 1);
+
+  /* the first tick announces the current step */
+  CU_ASSERT_EQUAL(otp_clock_tick(clock), 59);
+  CU_ASSERT_EQUAL(record.calls, 1);
+  CU_ASSERT_EQUAL(record.step, 1);
+  CU_ASSERT_EQUAL(record.stepStart, 30);
+
+  /* steps only move on a tick */
+  now = 60;
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 1);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 60), 0);
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 2);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 60), 1);
+  CU_ASSERT_EQUAL(record.calls, 2);
+  CU_ASSERT_EQUAL(record.step, 2);
+
+  now = 61;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 2);
+
+  /* unwatched periods are worked out from the cached time */
+  CU_ASSERT_EQUAL(otp_clock_now(clock), 61);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 20), 3);
+
+  otp_clock_destroy(clock);
+}
+
+void clock_lead_test(void) {
+  time_t now = 0;
+  clock_record record = {0, 0, 0};
+  otp_clock *clock = otp_clock_create(clock_fake, &now);
+
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (clock == NULL) {
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 5, clock_count, &record), 0);
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 1);
+  CU_ASSERT_EQUAL(record.step, 0);
+
+  now = 24;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 1);
+
+  /* five seconds early the next step is announced, but not yet current */
+  now = 25;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 2);
+  CU_ASSERT_EQUAL(record.step, 1);
+  CU_ASSERT_EQUAL(record.stepStart, 30);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 0);
+
+  now = 30;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 2);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 1);
+
+  otp_clock_destroy(clock);
+}
+
+void clock_jump_test(void) {
+  time_t now = 300;
+  clock_record record = {0, 0, 0};
+  otp_clock *clock = otp_clock_create(clock_fake, &now);
+
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (clock == NULL) {
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 0, clock_count, &record), 0);
+  otp_clock_tick(clock);
+
+  /* skipped steps are announced once, for the latest */
+  now = 3000;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 2);
+  CU_ASSERT_EQUAL(record.step, 100);
+
+  /* and a clock set back is announced too */
+  now = 900;
+  otp_clock_tick(clock);
+  CU_ASSERT_EQUAL(record.calls, 3);
+  CU_ASSERT_EQUAL(record.step, 30);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 30), 30);
+
+  otp_clock_destroy(clock);
+}
+
+static uint64_t clock_hashes(void) {
+  otp_metrics_snapshot snapshot;
+
+  otp_metrics_read(&snapshot);
+  return snapshot.counters[OTP_METRIC_HASHES];
+}
+
+/* a cache hooked to the clock has the next step ready before it starts */
+void clock_cache_test(void) {
+  time_t now = 1000 * 30;
+  otp_key key;
+  totp_cache *cache;
+  otp_clock *clock;
+  uint64_t before;
+  uint32_t code;
+
+  otp_key_init(&key, (uint8_t *)"12345678901234567890", 20);
+  cache = totp_cache_create(&key, 30, 1);
+  clock = otp_clock_create(clock_fake, &now);
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (cache == NULL || clock == NULL) {
+    if (cache) {
+      totp_cache_destroy(cache);
+    }
+    if (clock) {
+      otp_clock_destroy(clock);
+    }
+    otp_key_clear(&key);
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 5, otp_clock_advance_cache,
+                                  cache), 0);
+  otp_clock_tick(clock);
+
+  now = 1001 * 30 - 5;
+  otp_clock_tick(clock);
+
+  before = clock_hashes();
+  code = totp_cache_code(cache, 1002 * 30);
+  CU_ASSERT(!otp_metrics_enabled() || clock_hashes() == before);
+  CU_ASSERT_EQUAL(code, totp_ctx(&key, 1002 * 30, 30));
+
+  totp_cache_destroy(cache);
+  otp_clock_destroy(clock);
+  otp_key_clear(&key);
+}
+
+#define CLOCK_INDEX_USERS 64
+
+/* hashing the next step ahead of the boundary mustn't drop one still in
+ * use, not from the index nor from a cache holding only the current step */
+void clock_lead_hashes_test(void) {
+  time_t now = 1000 * 30;
+  uint64_t userIds[CLOCK_INDEX_USERS];
+  otp_key keys[CLOCK_INDEX_USERS];
+  uint8_t secret[20];
+  otp_index_match match;
+  otp_index *index;
+  totp_cache *cache;
+  otp_clock *clock;
+  uint64_t before;
+  uint32_t previous;
+  uint32_t next;
+  uint32_t current[2];
+  size_t user;
+
+  memset(secret, 0, sizeof(secret));
+  for (user = 0; user < CLOCK_INDEX_USERS; user++) {
+    userIds[user] = user + 1;
+    secret[0] = (uint8_t)user;
+    otp_key_init(&keys[user], secret, sizeof(secret));
+  }
+  /* worked out first, totp_ctx counts as hashing too */
+  previous = otp_truncate_digits(totp_ctx(&keys[7], 999 * 30, 30), 6);
+  next = otp_truncate_digits(totp_ctx(&keys[7], 1002 * 30, 30), 6);
+  current[0] = totp_ctx(&keys[0], 1000 * 30, 30);
+  current[1] = totp_ctx(&keys[0], 1001 * 30, 30);
+
+  index = otp_index_create(userIds, keys, CLOCK_INDEX_USERS, 30, 6, 1, NULL);
+  cache = totp_cache_create(&keys[0], 30, 0);
+  clock = otp_clock_create(clock_fake, &now);
+  CU_ASSERT_PTR_NOT_NULL(index);
+  CU_ASSERT_PTR_NOT_NULL(cache);
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (index && cache && clock) {
+    CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 5, otp_clock_advance_index,
+                                    index), 0);
+    CU_ASSERT_EQUAL(otp_clock_watch(clock, 30, 5, otp_clock_advance_cache,
+                                    cache), 0);
+    otp_clock_tick(clock);
+    now = 1001 * 30 - 5;
+    otp_clock_tick(clock);
+
+    /* step 999 is still in range, and step 1000 still current */
+    before = clock_hashes();
+    CU_ASSERT(otp_index_lookup(index, now, previous, &match, 1) >= 1);
+    CU_ASSERT_EQUAL(match.userId, 8);
+    CU_ASSERT_EQUAL(match.offset, -1);
+    CU_ASSERT_EQUAL(totp_cache_code(cache, now), current[0]);
+    CU_ASSERT(!otp_metrics_enabled() || clock_hashes() == before);
+
+    /* and past the boundary the step hashed early is there */
+    now = 1001 * 30;
+    otp_clock_tick(clock);
+    before = clock_hashes();
+    CU_ASSERT(otp_index_lookup(index, now, next, &match, 1) >= 1);
+    CU_ASSERT_EQUAL(match.userId, 8);
+    CU_ASSERT_EQUAL(match.offset, 1);
+    CU_ASSERT_EQUAL(totp_cache_code(cache, now), current[1]);
+    CU_ASSERT(!otp_metrics_enabled() || clock_hashes() == before);
+  }
+
+  if (clock) {
+    otp_clock_destroy(clock);
+  }
+  if (cache) {
+    totp_cache_destroy(cache);
+  }
+  if (index) {
+    otp_index_destroy(index);
+  }
+  for (user = 0; user < CLOCK_INDEX_USERS; user++) {
+    otp_key_clear(&keys[user]);
+  }
+}
+
+/* a source that moves a second on with every read, and a callback that
+ * wakes the test */
+typedef struct clock_waiter {
+  pthread_mutex_t lock;
+  pthread_cond_t called;
+  time_t now;
+  unsigned int calls;
+  uint64_t step;
+} clock_waiter;
+
+static time_t clock_advancing(void *context) {
+  clock_waiter *waiter = context;
+  time_t now;
+
+  pthread_mutex_lock(&waiter->lock);
+  now = waiter->now++;
+  pthread_mutex_unlock(&waiter->lock);
+  return now;
+}
+
+static void clock_signal(void *context, uint64_t step, time_t stepStart) {
+  clock_waiter *waiter = context;
+
+  (void)stepStart;
+  pthread_mutex_lock(&waiter->lock);
+  waiter->calls++;
+  waiter->step = step;
+  pthread_cond_signal(&waiter->called);
+  pthread_mutex_unlock(&waiter->lock);
+}
+
+void clock_thread_test(void) {
+  clock_waiter waiter;
+  struct timespec deadline;
+  otp_clock *clock = otp_clock_create(NULL, NULL);
+  time_t now = time(NULL);
+  int result = 0;
+
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (clock == NULL) {
+    return;
+  }
+
+  /* the coarse clock may trail time() by a tick */
+  CU_ASSERT(otp_clock_now(clock) >= now - 1 && otp_clock_now(clock) <= now);
+  otp_clock_destroy(clock);
+
+  pthread_mutex_init(&waiter.lock, NULL);
+  pthread_cond_init(&waiter.called, NULL);
+  waiter.now = 1000;
+  waiter.calls = 0;
+  waiter.step = 0;
+
+  clock = otp_clock_create(clock_advancing, &waiter);
+  CU_ASSERT_PTR_NOT_NULL(clock);
+  if (clock == NULL) {
+    pthread_cond_destroy(&waiter.called);
+    pthread_mutex_destroy(&waiter.lock);
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_clock_watch(clock, 1, 0, clock_signal, &waiter), 0);
+  CU_ASSERT_EQUAL(otp_clock_start(clock), 0);
+  CU_ASSERT_EQUAL(otp_clock_start(clock), -1);
+
+  /* the thread ticks at once and then at the next second, so this is
+   * only a bound for a badly stalled machine */
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 10;
+  pthread_mutex_lock(&waiter.lock);
+  while (waiter.calls < 2 && result != ETIMEDOUT) {
+    result = pthread_cond_timedwait(&waiter.called, &waiter.lock, &deadline);
+  }
+  pthread_mutex_unlock(&waiter.lock);
+  otp_clock_stop(clock);
+
+  /* the source was read once by create, then once per tick */
+  CU_ASSERT(waiter.calls >= 2);
+  CU_ASSERT(waiter.step >= 1002);
+  CU_ASSERT_EQUAL(otp_clock_step(clock, 1), waiter.step);
+  CU_ASSERT_EQUAL(otp_clock_now(clock), waiter.now - 1);
+
+  otp_clock_destroy(clock);
+  pthread_cond_destroy(&waiter.called);
+  pthread_mutex_destroy(&waiter.lock);
+}
+
+#endif /* CLOCK_TEST_ */
@@ -0,0 +1,237 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef EXECUTOR_TEST_
+#define EXECUTOR_TEST_
+
+/* local includes */
+#include "../otp_executor.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* executor test function definitions */
+int init_executor_suite(void);
+int clean_executor_suite(void);
+void executor_hotp_many_test(void);
+void executor_totp_validate_test(void);
+void executor_custom_task_test(void);
+void executor_resync_test(void);
+
+#define EXECUTOR_TEST_ITEMS 10007
+
+otp_executor *test_executor;
+
+CU_ErrorCode addExecutorTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Threaded executor", init_executor_suite,
+                        clean_executor_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "hotp_many job", executor_hotp_many_test))
+      || (NULL == CU_add_test(pSuite, "totp validate job", executor_totp_validate_test))
+      || (NULL == CU_add_test(pSuite, "custom task and callback", executor_custom_task_test))
+      || (NULL == CU_add_test(pSuite, "hotp resync job", executor_resync_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_executor_suite(void) {
+  /* more workers than cores so that stealing actually happens */
+  test_executor = otp_executor_create(4, 256);
+  return test_executor == NULL;
+}
+
+int clean_executor_suite(void) {
+  otp_executor_destroy(test_executor);
+  return CUE_SUCCESS;
+}
+
+void executor_hotp_many_test(void) {
+  hotp_request *requests = calloc(EXECUTOR_TEST_ITEMS, sizeof(*requests));
+  uint32_t *codes = calloc(EXECUTOR_TEST_ITEMS, sizeof(*codes));
+  otp_key key;
+  size_t iterator;
+
+  otp_key_init(&key, (uint8_t *)"12345678901234567890", 20);
+  for (iterator = 0; iterator < EXECUTOR_TEST_ITEMS; iterator++) {
+    requests[iterator].key = &key;
+    requests[iterator].counter = iterator;
+  }
+
+  otp_job_wait(otp_executor_hotp_many(test_executor, requests, codes,
+                                      EXECUTOR_TEST_ITEMS, NULL, NULL));
+
+  for (iterator = 0; iterator < EXECUTOR_TEST_ITEMS; iterator++) {
+    if (codes[iterator] != hotp_ctx(&key, iterator)) {
+      break;
+    }
+  }
+  CU_ASSERT_EQUAL(iterator, EXECUTOR_TEST_ITEMS);
+
+  otp_key_clear(&key);
+  free(requests);
+  free(codes);
+}
+
+void executor_totp_validate_test(void) {
+  const char secret[] = "12345678901234567890";
+  uint8_t *secrets = malloc(EXECUTOR_TEST_ITEMS * 20);
+  size_t *secretOffsets = malloc((EXECUTOR_TEST_ITEMS + 1) * sizeof(size_t));
+  time_t *times = malloc(EXECUTOR_TEST_ITEMS * sizeof(time_t));
+  uint32_t *guesses = malloc(EXECUTOR_TEST_ITEMS * sizeof(uint32_t));
+  uint8_t *guessDigits = malloc(EXECUTOR_TEST_ITEMS);
+  OTP_VALIDATE_RESULT *results = malloc(EXECUTOR_TEST_ITEMS * sizeof(OTP_VALIDATE_RESULT));
+  totp_batch batch;
+  otp_key key;
+  size_t failures = 0;
+  size_t iterator;
+
+  otp_key_init(&key, (uint8_t *)secret, 20);
+  for (iterator = 0; iterator < EXECUTOR_TEST_ITEMS; iterator++) {
+    memcpy(secrets + 20 * iterator, secret, 20);
+    secretOffsets[iterator] = 20 * iterator;
+    times[iterator] = 30 * iterator;
+    guessDigits[iterator] = 6;
+    guesses[iterator] = totp_ctx(&key, times[iterator], 30) % 1000000;
+    guesses[iterator] += iterator % 2;
+  }
+  secretOffsets[EXECUTOR_TEST_ITEMS] = 20 * EXECUTOR_TEST_ITEMS;
+
+  batch.secrets = secrets;
+  batch.secretOffsets = secretOffsets;
+  batch.times = times;
+  batch.guesses = guesses;
+  batch.guessDigits = guessDigits;
+  batch.count = EXECUTOR_TEST_ITEMS;
+  otp_job_wait(otp_executor_totp_validate(test_executor, &batch, 30, results,
+                                          NULL, NULL));
+
+  for (iterator = 0; iterator < EXECUTOR_TEST_ITEMS; iterator++) {
+    failures += results[iterator] != (iterator % 2 ? OTP_VALIDATE_FAILURE
+                                                   : OTP_VALIDATE_SUCCESS);
+  }
+  CU_ASSERT_EQUAL(failures, 0);
+
+  otp_key_clear(&key);
+  free(secrets);
+  free(secretOffsets);
+  free(times);
+  free(guesses);
+  free(guessDigits);
+  free(results);
+}
+
+/* every item is visited exactly once, and the callback fires once */
+static void count_items_task(void *arg, size_t begin, size_t end, void *scratch) {
+  atomic_uint *visits = arg;
+
+  memset(scratch, 0xa5, 256);
+  while (begin < end) {
+    atomic_fetch_add(&visits[begin++], 1);
+  }
+}
+
+static void count_callback(void *arg) {
+  atomic_fetch_add((atomic_uint *)arg, 1);
+}
+
+void executor_custom_task_test(void) {
+  atomic_uint *visits = calloc(EXECUTOR_TEST_ITEMS, sizeof(*visits));
+  atomic_uint callbacks = 0;
+  otp_job *jobs[8];
+  size_t wrong = 0;
+  size_t iterator;
+
+  for (iterator = 0; iterator < 8; iterator++) {
+    jobs[iterator] = otp_executor_submit(test_executor, count_items_task,
+                                         visits, EXECUTOR_TEST_ITEMS, 3,
+                                         count_callback, &callbacks);
+  }
+  for (iterator = 0; iterator < 8; iterator++) {
+    otp_job_wait(jobs[iterator]);
+  }
+
+  for (iterator = 0; iterator < EXECUTOR_TEST_ITEMS; iterator++) {
+    wrong += atomic_load(&visits[iterator]) != 8;
+  }
+  CU_ASSERT_EQUAL(wrong, 0);
+  CU_ASSERT_EQUAL(atomic_load(&callbacks), 8);
+
+  /* an empty job completes immediately */
+  jobs[0] = otp_executor_submit(test_executor, count_items_task, visits, 0, 1,
+                                count_callback, &callbacks);
+  CU_ASSERT(otp_job_done(jobs[0]));
+  otp_job_wait(jobs[0]);
+  CU_ASSERT_EQUAL(atomic_load(&callbacks), 9);
+
+  free(visits);
+}
+
+/* the threaded scan finds the same counter as the inline one */
+void executor_resync_test(void) {
+  otp_key key;
+  uint32_t guesses[2];
+  OTP_VALIDATE_RESULT result = OTP_VALIDATE_FAILURE;
+  OTP_VALIDATE_RESULT expectedResult;
+  uint64_t next = 0;
+  uint64_t expected = 0;
+  size_t count;
+
+  otp_key_init(&key, (uint8_t *)"12345678901234567890", 20);
+  guesses[0] = hotp_ctx(&key, 70000) % 1000000;
+  guesses[1] = hotp_ctx(&key, 70001) % 1000000;
+
+  for (count = 1; count <= 2; count++) {
+    expectedResult = hotp_resync_ctx(&key, 100, 100000, guesses, count, 6,
+                                     &expected);
+    CU_ASSERT_EQUAL(expectedResult, OTP_VALIDATE_SUCCESS);
+
+    otp_job_wait(otp_executor_hotp_resync(test_executor, &key, 100, 100000,
+                                          guesses, count, 6, &result, &next,
+                                          NULL, NULL));
+    CU_ASSERT_EQUAL(result, expectedResult);
+    CU_ASSERT_EQUAL(next, expected);
+  }
+
+  /* nothing to find below the token's counter */
+  otp_job_wait(otp_executor_hotp_resync(test_executor, &key, 100, 60000,
+                                        guesses, 2, 6, &result, &next,
+                                        NULL, NULL));
+  CU_ASSERT_EQUAL(result, OTP_VALIDATE_FAILURE);
+
+  otp_key_clear(&key);
+}
+
+#endif /* EXECUTOR_TEST_ */
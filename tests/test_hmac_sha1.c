@@ -24,6 +24,7 @@
 
 /* local includes */
 #include "../hmac_sha1.h"
+#include "../sha1_backend.h"
 
 /* external includes */
 #include <CUnit/Basic.h>
@@ -41,6 +42,9 @@ void hmac_sha1_testvec2(void);
 void hmac_sha1_testvec3(void);
 void hmac_sha1_testvec4(void);
 void hmac_sha1_testvec5(void);
+void hmac_sha1_counter_test(void);
+void hmac_sha1_stream_test(void);
+void hmac_sha1_backend_test(void);
 
 CU_ErrorCode addHMACTestSuite( CU_pSuite pSuite )
 {
@@ -56,7 +60,10 @@ CU_ErrorCode addHMACTestSuite( CU_pSuite pSuite )
         || (NULL == CU_add_test(pSuite, "HMAC Test Vector 2", hmac_sha1_testvec2))
         || (NULL == CU_add_test(pSuite, "HMAC Test Vector 3", hmac_sha1_testvec3))
         || (NULL == CU_add_test(pSuite, "HMAC Test Vector 4", hmac_sha1_testvec4))
-        || (NULL == CU_add_test(pSuite, "HMAC Test Vector 5", hmac_sha1_testvec5))) {
+        || (NULL == CU_add_test(pSuite, "HMAC Test Vector 5", hmac_sha1_testvec5))
+        || (NULL == CU_add_test(pSuite, "HMAC counter kernel", hmac_sha1_counter_test))
+        || (NULL == CU_add_test(pSuite, "HMAC incremental update", hmac_sha1_stream_test))
+        || (NULL == CU_add_test(pSuite, "HMAC on every SHA1 backend", hmac_sha1_backend_test))) {
       return CU_get_error();
     }
 
@@ -215,4 +222,90 @@ void hmac_sha1_testvec5(void) {
   CU_ASSERT(strncmp(hexresult, expect, 40) == CUE_SUCCESS);
 }
 
+/* the fixed length counter kernel must agree with the generic HMAC */
+void hmac_sha1_counter_test(void) {
+  const char key[] = "12345678901234567890";
+  const uint64_t counters[] = { 0, 1, 9, 0x0123456789abcdefULL, UINT64_MAX };
+  hmac_sha1_key keyCtx;
+  uint8_t message[8];
+  uint8_t expect[HMAC_SHA1_MAC_BYTES];
+  uint32_t digest[HMAC_SHA1_MAC_WORDS];
+  size_t iterator;
+  size_t offset;
+
+  hmac_sha1_init_key(&keyCtx, (uint8_t *)key, strlen(key));
+
+  for (iterator = 0; iterator < sizeof(counters)/sizeof(counters[0]); iterator++) {
+    for (offset = 0; offset < 8; offset++) {
+      message[offset] = (uint8_t)(counters[iterator] >> (56 - 8 * offset));
+    }
+
+    HMAC_SHA_1(expect, (uint8_t *)key, strlen(key), message, sizeof(message));
+    hmac_sha1_counter(digest, &keyCtx, counters[iterator]);
+
+    for (offset = 0; offset < HMAC_SHA1_MAC_BYTES; offset++) {
+      CU_ASSERT_EQUAL((uint8_t)(digest[offset / 4] >> (24 - 8 * (offset % 4))),
+                      expect[offset]);
+    }
+  }
+}
+
+/* any split of the message into chunks must give the one-shot HMAC, with
+ * chunk boundaries inside and across blocks */
+void hmac_sha1_stream_test(void) {
+  const char key[] = "Jefe";
+  uint8_t message[300];
+  uint8_t expect[HMAC_SHA1_MAC_BYTES];
+  uint8_t result[HMAC_SHA1_MAC_BYTES];
+  hmac_sha1_key keyCtx;
+  hmac_sha1_ctx ctx;
+  size_t chunk;
+  size_t offset;
+  size_t length;
+
+  for (offset = 0; offset < sizeof(message); offset++) {
+    message[offset] = (uint8_t)(offset * 7);
+  }
+
+  hmac_sha1_init_key(&keyCtx, (uint8_t *)key, strlen(key));
+
+  for (length = 0; length <= sizeof(message); length += 55) {
+    HMAC_SHA_1(expect, (uint8_t *)key, strlen(key), message, length);
+
+    for (chunk = 1; chunk <= 130; chunk += 3) {
+      hmac_sha1_begin(&ctx, &keyCtx);
+      for (offset = 0; offset < length; offset += chunk) {
+        hmac_sha1_update(&ctx, message + offset,
+                         length - offset < chunk ? length - offset : chunk);
+      }
+      hmac_sha1_final(&ctx, result);
+
+      CU_ASSERT(memcmp(result, expect, sizeof(expect)) == 0);
+    }
+  }
+}
+
+/* rerun the vectors on each compression backend this CPU supports */
+void hmac_sha1_backend_test(void) {
+  SHA1_BACKEND original = sha1_backend_current();
+  int backend;
+
+  for (backend = 0; backend < SHA1_BACKEND_COUNT; backend++) {
+    if (sha1_backend_select((SHA1_BACKEND)backend) != 0) {
+      continue;
+    }
+
+    printf("\n    backend: %s ", sha1_backend_name((SHA1_BACKEND)backend));
+    hmac_sha1_testvec1();
+    hmac_sha1_testvec2();
+    hmac_sha1_testvec3();
+    hmac_sha1_testvec4();
+    hmac_sha1_testvec5();
+    hmac_sha1_counter_test();
+    hmac_sha1_stream_test();
+  }
+
+  sha1_backend_select(original);
+}
+
 #endif /* HMAC_SHA1_test_ */
@@ -0,0 +1,279 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef HMAC_SHA2_test_
+#define HMAC_SHA2_test_
+
+/* local includes */
+#include "../hmac_sha256.h"
+#include "../hmac_sha512.h"
+#include "../sha256_backend.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* HMAC-SHA2 test function definitions */
+int init_hmac_sha2_suite(void);
+int clean_hmac_sha2_suite(void);
+void hmac_sha256_testvecs(void);
+void hmac_sha512_testvecs(void);
+void hmac_sha256_counter_test(void);
+void hmac_sha512_counter_test(void);
+void hmac_sha2_stream_test(void);
+void hmac_sha256_backend_test(void);
+
+/* RFC 4231 test cases 1, 2 and 6 - the last has a key longer than a block */
+typedef struct hmac_sha2_vector {
+  uint8_t keyByte;
+  size_t keyLength;
+  const char *data;
+  const char *expect256;
+  const char *expect512;
+} hmac_sha2_vector;
+
+static const hmac_sha2_vector hmac_sha2_vectors[] = {
+  { 0x0b, 20, "Hi There",
+    "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+    "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+    "daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854" },
+  { 0, 4, "what do ya want for nothing?",
+    "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+    "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd610270cd7ea250554"
+    "9758bf75c05a994a6d034f65f8f0e6fdcaeab1a34d4a6b4b636e070a38bce737" },
+  { 0xaa, 131, "Test Using Larger Than Block-Size Key - Hash Key First",
+    "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+    "80b24263c7c1a3ebb71493c1dd7be8b49b46d1f41b4aeec1121b013783f8f352"
+    "6b56d037e05f2598bd0fd2215d6a1e5295e64f73f63f0aec8b915a985d786598" }
+};
+
+CU_ErrorCode addHMACSHA2TestSuite( CU_pSuite pSuite )
+{
+  /* add the HMAC-SHA2 suite to the registry */
+    pSuite = CU_add_suite("HMAC-SHA-256/512 Test Vectors (RFC 4231)", init_hmac_sha2_suite, clean_hmac_sha2_suite);
+    if (pSuite == NULL) {
+      CU_cleanup_registry();
+      return CU_get_error();
+    }
+
+    /* add the HMAC-SHA2 tests to the suite */
+    if (   (NULL == CU_add_test(pSuite, "HMAC-SHA256 Test Vectors", hmac_sha256_testvecs))
+        || (NULL == CU_add_test(pSuite, "HMAC-SHA512 Test Vectors", hmac_sha512_testvecs))
+        || (NULL == CU_add_test(pSuite, "HMAC-SHA256 counter kernel", hmac_sha256_counter_test))
+        || (NULL == CU_add_test(pSuite, "HMAC-SHA512 counter kernel", hmac_sha512_counter_test))
+        || (NULL == CU_add_test(pSuite, "HMAC-SHA256/512 incremental update", hmac_sha2_stream_test))
+        || (NULL == CU_add_test(pSuite, "HMAC on every SHA256 backend", hmac_sha256_backend_test))) {
+      return CU_get_error();
+    }
+
+    return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_hmac_sha2_suite(void) {
+  return CUE_SUCCESS;
+}
+
+int clean_hmac_sha2_suite(void) {
+  return CUE_SUCCESS;
+}
+
+/* the key is keyByte repeated, or "Jefe" when keyByte is zero */
+static size_t hmac_sha2_vector_key(uint8_t *key, const hmac_sha2_vector *vector) {
+  if (vector->keyByte == 0) {
+    memcpy(key, "Jefe", 4);
+  } else {
+    memset(key, vector->keyByte, vector->keyLength);
+  }
+
+  return vector->keyLength;
+}
+
+void hmac_sha256_testvecs(void) {
+  uint8_t key[131];
+  uint8_t result[HMAC_SHA256_MAC_BYTES];
+  char hexresult[2 * HMAC_SHA256_MAC_BYTES + 1];
+  size_t keyLength;
+  size_t iterator;
+  size_t offset;
+
+  for (iterator = 0; iterator < sizeof(hmac_sha2_vectors)/sizeof(hmac_sha2_vectors[0]); iterator++) {
+    keyLength = hmac_sha2_vector_key(key, &hmac_sha2_vectors[iterator]);
+
+    HMAC_SHA_256(result, key, keyLength,
+                 (const uint8_t *)hmac_sha2_vectors[iterator].data,
+                 strlen(hmac_sha2_vectors[iterator].data));
+
+    for (offset = 0; offset < HMAC_SHA256_MAC_BYTES; offset++) {
+      sprintf((hexresult + (2 * offset)), "%02x", result[offset]);
+    }
+
+    CU_ASSERT_STRING_EQUAL(hexresult, hmac_sha2_vectors[iterator].expect256);
+  }
+}
+
+void hmac_sha512_testvecs(void) {
+  uint8_t key[131];
+  uint8_t result[HMAC_SHA512_MAC_BYTES];
+  char hexresult[2 * HMAC_SHA512_MAC_BYTES + 1];
+  size_t keyLength;
+  size_t iterator;
+  size_t offset;
+
+  for (iterator = 0; iterator < sizeof(hmac_sha2_vectors)/sizeof(hmac_sha2_vectors[0]); iterator++) {
+    keyLength = hmac_sha2_vector_key(key, &hmac_sha2_vectors[iterator]);
+
+    HMAC_SHA_512(result, key, keyLength,
+                 (const uint8_t *)hmac_sha2_vectors[iterator].data,
+                 strlen(hmac_sha2_vectors[iterator].data));
+
+    for (offset = 0; offset < HMAC_SHA512_MAC_BYTES; offset++) {
+      sprintf((hexresult + (2 * offset)), "%02x", result[offset]);
+    }
+
+    CU_ASSERT_STRING_EQUAL(hexresult, hmac_sha2_vectors[iterator].expect512);
+  }
+}
+
+/* the fixed length counter kernels must agree with the generic HMAC */
+void hmac_sha256_counter_test(void) {
+  const char key[] = "12345678901234567890123456789012";
+  const uint64_t counters[] = { 0, 1, 9, 0x0123456789abcdefULL, UINT64_MAX };
+  hmac_sha256_key keyCtx;
+  uint8_t message[8];
+  uint8_t expect[HMAC_SHA256_MAC_BYTES];
+  uint32_t digest[HMAC_SHA256_MAC_WORDS];
+  size_t iterator;
+  size_t offset;
+
+  hmac_sha256_init_key(&keyCtx, (uint8_t *)key, strlen(key));
+
+  for (iterator = 0; iterator < sizeof(counters)/sizeof(counters[0]); iterator++) {
+    for (offset = 0; offset < 8; offset++) {
+      message[offset] = (uint8_t)(counters[iterator] >> (56 - 8 * offset));
+    }
+
+    HMAC_SHA_256(expect, (uint8_t *)key, strlen(key), message, sizeof(message));
+    hmac_sha256_counter(digest, &keyCtx, counters[iterator]);
+
+    for (offset = 0; offset < HMAC_SHA256_MAC_BYTES; offset++) {
+      CU_ASSERT_EQUAL((uint8_t)(digest[offset / 4] >> (24 - 8 * (offset % 4))),
+                      expect[offset]);
+    }
+  }
+}
+
+void hmac_sha512_counter_test(void) {
+  const char key[] = "1234567890123456789012345678901234567890123456789012345678901234";
+  const uint64_t counters[] = { 0, 1, 9, 0x0123456789abcdefULL, UINT64_MAX };
+  hmac_sha512_key keyCtx;
+  uint8_t message[8];
+  uint8_t expect[HMAC_SHA512_MAC_BYTES];
+  uint64_t digest[HMAC_SHA512_MAC_WORDS];
+  size_t iterator;
+  size_t offset;
+
+  hmac_sha512_init_key(&keyCtx, (uint8_t *)key, strlen(key));
+
+  for (iterator = 0; iterator < sizeof(counters)/sizeof(counters[0]); iterator++) {
+    for (offset = 0; offset < 8; offset++) {
+      message[offset] = (uint8_t)(counters[iterator] >> (56 - 8 * offset));
+    }
+
+    HMAC_SHA_512(expect, (uint8_t *)key, strlen(key), message, sizeof(message));
+    hmac_sha512_counter(digest, &keyCtx, counters[iterator]);
+
+    for (offset = 0; offset < HMAC_SHA512_MAC_BYTES; offset++) {
+      CU_ASSERT_EQUAL((uint8_t)(digest[offset / 8] >> (56 - 8 * (offset % 8))),
+                      expect[offset]);
+    }
+  }
+}
+
+/* any split of the message into chunks must give the one-shot HMAC */
+void hmac_sha2_stream_test(void) {
+  const char key[] = "Jefe";
+  uint8_t message[300];
+  uint8_t expect[HMAC_SHA512_MAC_BYTES];
+  uint8_t result[HMAC_SHA512_MAC_BYTES];
+  hmac_sha256_key key256;
+  hmac_sha512_key key512;
+  hmac_sha256_ctx ctx256;
+  hmac_sha512_ctx ctx512;
+  size_t chunk;
+  size_t offset;
+  size_t piece;
+  size_t length;
+
+  for (offset = 0; offset < sizeof(message); offset++) {
+    message[offset] = (uint8_t)(offset * 7);
+  }
+
+  hmac_sha256_init_key(&key256, (uint8_t *)key, strlen(key));
+  hmac_sha512_init_key(&key512, (uint8_t *)key, strlen(key));
+
+  for (length = 0; length <= sizeof(message); length += 55) {
+    for (chunk = 1; chunk <= 260; chunk += 7) {
+      HMAC_SHA_256(expect, (uint8_t *)key, strlen(key), message, length);
+      hmac_sha256_begin(&ctx256, &key256);
+      for (offset = 0; offset < length; offset += piece) {
+        piece = length - offset < chunk ? length - offset : chunk;
+        hmac_sha256_update(&ctx256, message + offset, piece);
+      }
+      hmac_sha256_final(&ctx256, result);
+      CU_ASSERT(memcmp(result, expect, HMAC_SHA256_MAC_BYTES) == 0);
+
+      HMAC_SHA_512(expect, (uint8_t *)key, strlen(key), message, length);
+      hmac_sha512_begin(&ctx512, &key512);
+      for (offset = 0; offset < length; offset += piece) {
+        piece = length - offset < chunk ? length - offset : chunk;
+        hmac_sha512_update(&ctx512, message + offset, piece);
+      }
+      hmac_sha512_final(&ctx512, result);
+      CU_ASSERT(memcmp(result, expect, HMAC_SHA512_MAC_BYTES) == 0);
+    }
+  }
+}
+
+/* rerun the SHA256 vectors on each compression backend this CPU supports */
+void hmac_sha256_backend_test(void) {
+  SHA256_BACKEND original = sha256_backend_current();
+  int backend;
+
+  for (backend = 0; backend < SHA256_BACKEND_COUNT; backend++) {
+    if (sha256_backend_select((SHA256_BACKEND)backend) != 0) {
+      continue;
+    }
+
+    printf("\n    backend: %s ", sha256_backend_name((SHA256_BACKEND)backend));
+    hmac_sha256_testvecs();
+    hmac_sha256_counter_test();
+    hmac_sha2_stream_test();
+  }
+
+  sha256_backend_select(original);
+}
+
+#endif /* HMAC_SHA2_test_ */
@@ -24,6 +24,7 @@
 
 /* local includes */
 #include "../libotp.h"
+#include "../hmac_sha1_mb.h"
 
 /* external includes */
 #include <CUnit/Basic.h>
@@ -32,6 +33,7 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -39,6 +41,15 @@
 int init_hotp_suite(void);
 int clean_hotp_suite(void);
 void hotp_testvec1(void);
+void hotp_ctx_testvec1(void);
+void hotp_validate_ctx_test(void);
+void hotp_many_test(void);
+void hotp_range_test(void);
+void hotp_matrix_test(void);
+void hotp_truncate_many_test(void);
+void hotp_format_test(void);
+void hotp_window_test(void);
+void hotp_resync_test(void);
 
 /* global variable containing the HOTP secret */
 char hotp_reference_secret[] = "12345678901234567890";
@@ -54,7 +65,16 @@ CU_ErrorCode addHOTPTestSuite( CU_pSuite pSuite )
   }
 
   /* add the HMAC-SHA1 tests to the suite */
-  if ( NULL == CU_add_test(pSuite, "hotp Test Vector 1", hotp_testvec1) ) {
+  if (   (NULL == CU_add_test(pSuite, "hotp Test Vector 1", hotp_testvec1))
+      || (NULL == CU_add_test(pSuite, "hotp_ctx Test Vector 1", hotp_ctx_testvec1))
+      || (NULL == CU_add_test(pSuite, "hotp_validate_ctx", hotp_validate_ctx_test))
+      || (NULL == CU_add_test(pSuite, "hotp_many", hotp_many_test))
+      || (NULL == CU_add_test(pSuite, "hotp_range_ctx", hotp_range_test))
+      || (NULL == CU_add_test(pSuite, "hotp_matrix_ctx", hotp_matrix_test))
+      || (NULL == CU_add_test(pSuite, "otp_truncate_many", hotp_truncate_many_test))
+      || (NULL == CU_add_test(pSuite, "otp_format_codes", hotp_format_test))
+      || (NULL == CU_add_test(pSuite, "hotp window search", hotp_window_test))
+      || (NULL == CU_add_test(pSuite, "hotp resync", hotp_resync_test)) ) {
     return CU_get_error();
   }
 
@@ -101,5 +121,328 @@ void hotp_testvec1(void)
   }
 }
 
+void hotp_ctx_testvec1(void)
+{
+  otp_key key;
+  uint64_t iterator;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+
+  for (iterator = 0; iterator < sizeof(hotp_reference_results)/sizeof(uint32_t); iterator++) {
+    if (! (CU_ASSERT_EQUAL(hotp_ctx(&key, iterator),hotp_reference_results[iterator])))
+    {
+      printf("counter value: %" PRIu64 "\n",iterator);
+      printf("hotp_ctx() return value: %" PRIu32 "\n", hotp_ctx(&key, iterator));
+
+      printf( "hotp reference value: %" PRIu32 "\n",
+              hotp_reference_results[iterator]);
+    }
+  }
+
+  otp_key_clear(&key);
+}
+
+void hotp_validate_ctx_test(void)
+{
+  otp_key key;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+
+  /* RFC 4226 appendix D six digit values */
+  CU_ASSERT_EQUAL(hotp_validate_ctx(&key, 0, 755224, 6), OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_validate_ctx(&key, 9, 520489, 6), OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_validate_ctx(&key, 1, 755224, 6), OTP_VALIDATE_FAILURE);
+
+  otp_key_clear(&key);
+}
+
+/* every lane width must agree with the scalar path, including the tails */
+void hotp_many_test(void)
+{
+  const size_t laneLimits[] = { HMAC_SHA1_MB_MAX_LANES, 8, 4, 1 };
+  otp_key keys[3];
+  hotp_request requests[37];
+  uint32_t codes[37];
+  size_t limit;
+  size_t iterator;
+
+  otp_key_init(&keys[0], (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+  otp_key_init(&keys[1], (uint8_t *) "Jefe", 4);
+  otp_key_init(&keys[2], (uint8_t *) hotp_reference_secret, 7);
+
+  for (iterator = 0; iterator < 37; iterator++) {
+    requests[iterator].key = &keys[iterator % 3];
+    requests[iterator].counter = iterator * 0x100000001ULL;
+  }
+
+  for (limit = 0; limit < sizeof(laneLimits)/sizeof(laneLimits[0]); limit++) {
+    hmac_sha1_mb_limit_lanes(laneLimits[limit]);
+    memset(codes, 0, sizeof(codes));
+    hotp_many(requests, codes, 37);
+
+    for (iterator = 0; iterator < 37; iterator++) {
+      CU_ASSERT_EQUAL(codes[iterator],
+                      hotp_ctx(requests[iterator].key, requests[iterator].counter));
+    }
+  }
+
+  hmac_sha1_mb_limit_lanes(HMAC_SHA1_MB_MAX_LANES);
+  otp_key_clear(&keys[0]);
+  otp_key_clear(&keys[1]);
+  otp_key_clear(&keys[2]);
+}
+
+void hotp_range_test(void)
+{
+  otp_key key;
+  uint32_t codes[150];
+  size_t iterator;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+
+  /* RFC 4226 appendix D, then past a chunk and into a short tail */
+  hotp_range_ctx(&key, 0, 150, 6, codes);
+  for (iterator = 0; iterator < 10; iterator++) {
+    CU_ASSERT_EQUAL(codes[iterator], hotp_reference_results[iterator] % 1000000);
+  }
+  for (iterator = 0; iterator < 150; iterator++) {
+    CU_ASSERT_EQUAL(codes[iterator], hotp_ctx(&key, iterator) % 1000000);
+  }
+
+  hotp_range_ctx(&key, 1ULL << 40, 3, 10, codes);
+  CU_ASSERT_EQUAL(codes[2], hotp_ctx(&key, (1ULL << 40) + 2));
+
+  totp_range_ctx(&key, 59, 30, 4, 8, codes);
+  CU_ASSERT_EQUAL(codes[0], 94287082);
+  CU_ASSERT_EQUAL(codes[3], hotp_ctx(&key, 4) % 100000000);
+
+  otp_key_clear(&key);
+}
+
+/* tiles must cover partial key groups and step runs, mixing algorithms */
+void hotp_matrix_test(void)
+{
+  otp_key keys[21];
+  const otp_key *keyPointers[21];
+  uint32_t *codes = malloc(21 * 300 * sizeof(*codes));
+  size_t key;
+  size_t step;
+
+  CU_ASSERT_PTR_NOT_NULL(codes);
+  if (codes == NULL) {
+    return;
+  }
+
+  for (key = 0; key < 21; key++) {
+    otp_key_init_algorithm(&keys[key], key % 7 == 6 ? OTP_SHA256 : OTP_SHA1,
+                           (uint8_t *) hotp_reference_secret, key + 1);
+    keyPointers[key] = &keys[key];
+  }
+
+  hotp_matrix_ctx(keyPointers, 21, 1000, 300, 6, codes);
+  for (key = 0; key < 21; key++) {
+    for (step = 0; step < 300; step++) {
+      CU_ASSERT_EQUAL(codes[key * 300 + step],
+                      hotp_ctx(&keys[key], 1000 + step) % 1000000);
+    }
+  }
+
+  /* a single row is a range */
+  hotp_matrix_ctx(keyPointers + 19, 1, 5, 7, 7, codes);
+  hotp_range_ctx(&keys[19], 5, 7, 7, codes + 7);
+  CU_ASSERT_EQUAL(memcmp(codes, codes + 7, 7 * sizeof(*codes)), 0);
+
+  for (key = 0; key < 21; key++) {
+    otp_key_clear(&keys[key]);
+  }
+  free(codes);
+}
+
+/* every digit count, including the scalar tail after whole groups */
+void hotp_truncate_many_test(void)
+{
+  const uint32_t edges[] = { 0, 9, 999999, 1000000, 999999999, 1000000000,
+                             2147483647, 0xffffffff };
+  otp_key key;
+  const hmac_sha1_key *keys[37];
+  uint64_t counters[37];
+  uint32_t digests[37][HMAC_SHA1_MAC_WORDS];
+  uint32_t codes[37];
+  uint32_t modulus = 1;
+  unsigned int digits;
+  size_t iterator;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+  for (iterator = 0; iterator < 37; iterator++) {
+    keys[iterator] = &key.hmac.sha1;
+    counters[iterator] = iterator * 7919;
+  }
+  hmac_sha1_counter_mb(digests, keys, counters, 37);
+
+  for (digits = 0; digits <= 12; digits++) {
+    otp_truncate_many(digests, 37, digits, codes);
+    for (iterator = 0; iterator < 37; iterator++) {
+      CU_ASSERT_EQUAL(codes[iterator],
+                      otp_truncate_digits(hotp_ctx(&key, counters[iterator]),
+                                          digits));
+    }
+
+    for (iterator = 0; iterator < sizeof(edges) / sizeof(edges[0]); iterator++) {
+      CU_ASSERT_EQUAL(otp_truncate_digits(edges[iterator] & 0x7fffffff, digits),
+                      digits < 10 ? (edges[iterator] & 0x7fffffff) % modulus
+                                  : (edges[iterator] & 0x7fffffff));
+    }
+    modulus *= digits < 10 ? 10 : 1;
+  }
+
+  otp_key_clear(&key);
+}
+
+void hotp_format_test(void)
+{
+  const uint32_t codes[] = { 0, 755224, 1284755224, 2147483647, 42 };
+  char text[64];
+  char expected[64];
+  unsigned int digits;
+  size_t length;
+  size_t iterator;
+
+  for (digits = 1; digits <= 10; digits++) {
+    length = 0;
+    for (iterator = 0; iterator < 5; iterator++) {
+      length += snprintf(expected + length, sizeof(expected) - length,
+                         "%0*" PRIu32 "\n", (int)digits,
+                         otp_truncate_digits(codes[iterator], digits));
+    }
+    CU_ASSERT_EQUAL(otp_format_codes(codes, 5, digits, '\n', text), length);
+    CU_ASSERT_EQUAL(memcmp(text, expected, length), 0);
+  }
+
+  /* without a separator the codes are packed */
+  memset(text, '#', sizeof(text));
+  CU_ASSERT_EQUAL(otp_format_codes(codes, 3, 6, '\0', text), 18);
+  CU_ASSERT_EQUAL(memcmp(text, "000000755224755224#", 19), 0);
+}
+
+void hotp_window_test(void)
+{
+  hotp_state state;
+  otp_key key;
+  int64_t offset = 0;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+
+  /* counter 3 is two steps behind 5, inside a window of five */
+  CU_ASSERT_EQUAL(hotp_find_window_ctx(&key, 5, 969429, 6, 5, &offset),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(offset, -2);
+
+  /* an even window reaches one further forward than back */
+  CU_ASSERT_EQUAL(hotp_find_window_ctx(&key, 5, 399871, 6, 6, &offset),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(offset, 3);
+  CU_ASSERT_EQUAL(hotp_find_window_ctx(&key, 5, 338314, 6, 6, &offset),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(offset, -1);
+  CU_ASSERT_EQUAL(hotp_validate_windows_ctx(&key, 5, 969429, 6, 3),
+                  OTP_VALIDATE_FAILURE);
+
+  /* the window is clipped at counter zero */
+  CU_ASSERT_EQUAL(hotp_find_window_ctx(&key, 1, 755224, 6, 201, &offset),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(offset, -1);
+  CU_ASSERT_EQUAL(hotp_find_window_ctx(&key, 0, 520489, 6, 201, &offset),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(offset, 9);
+  CU_ASSERT_EQUAL(hotp_validate_windows_ctx(&key, 0, 123456, 6, 0),
+                  OTP_VALIDATE_FAILURE);
+
+  /* the state based wrapper searches the same way */
+  state.secret = (uint8_t *) hotp_reference_secret;
+  state.secretLength = strlen(hotp_reference_secret);
+  state.counter = 7;
+  CU_ASSERT_EQUAL(hotp_validate_windows(&state, 287922, 6, 3),
+                  OTP_VALIDATE_SUCCESS);
+
+  otp_key_clear(&key);
+}
+
+/* lowest counter from start on that produced guesses, the slow way */
+static uint64_t hotp_resync_expected(const otp_key *key, uint64_t start,
+                                     const uint32_t *guesses, size_t count)
+{
+  uint64_t counter;
+
+  for (counter = start; ; counter++) {
+    if (hotp_ctx(key, counter) % 1000000 == guesses[0]
+        && (count == 1 || hotp_ctx(key, counter + 1) % 1000000 == guesses[1])) {
+      return counter;
+    }
+  }
+}
+
+void hotp_resync_test(void)
+{
+  otp_key key;
+  uint32_t guesses[2];
+  uint64_t next = 0;
+  uint64_t expected;
+  uint64_t start;
+  size_t count;
+
+  otp_key_init(&key, (uint8_t *) hotp_reference_secret,
+               strlen(hotp_reference_secret));
+  guesses[0] = hotp_ctx(&key, 5000) % 1000000;
+  guesses[1] = hotp_ctx(&key, 5001) % 1000000;
+
+  /* starting around the chunk boundaries before the token's counter */
+  for (count = 1; count <= 2; count++) {
+    for (start = 5000 - 130; start <= 5000; start++) {
+      expected = hotp_resync_expected(&key, start, guesses, count);
+      CU_ASSERT_EQUAL(hotp_resync_ctx(&key, start, 10000, guesses, count, 6,
+                                      &next), OTP_VALIDATE_SUCCESS);
+      CU_ASSERT_EQUAL(next, expected + count);
+    }
+  }
+
+  /* the range ends at the first code, the second may lie past it */
+  expected = hotp_resync_expected(&key, 0, guesses, 2);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, 0, expected + 1, guesses, 2, 6, &next),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(next, expected + 2);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, 0, expected, guesses, 2, 6, &next),
+                  OTP_VALIDATE_FAILURE);
+
+  /* the very last counter can be found, alone or as a second code */
+  guesses[0] = hotp_ctx(&key, UINT64_MAX - 1) % 1000000;
+  guesses[1] = hotp_ctx(&key, UINT64_MAX) % 1000000;
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, UINT64_MAX - 100, UINT64_MAX,
+                                  &guesses[1], 1, 6, &next),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(next, 0);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, UINT64_MAX, 1, &guesses[1], 1, 6,
+                                  &next), OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, UINT64_MAX - 100, 1000, guesses, 2,
+                                  6, &next), OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, UINT64_MAX, 1, guesses, 2, 6, &next),
+                  OTP_VALIDATE_FAILURE);
+  /* a range of every counter, clamped without overflowing */
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, 0, UINT64_MAX, guesses, 1, 6, &next),
+                  OTP_VALIDATE_SUCCESS);
+
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, 0, 100, guesses, 0, 6, &next),
+                  OTP_VALIDATE_FAILURE);
+  CU_ASSERT_EQUAL(hotp_resync_ctx(&key, 0, 100, guesses, 3, 6, &next),
+                  OTP_VALIDATE_FAILURE);
+
+  otp_key_clear(&key);
+}
+
 #endif /* HOTP_TEST_ */
 
@@ -0,0 +1,181 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef HPP_TEST_
+#define HPP_TEST_
+
+/* local includes */
+#include "../libotp.hpp"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <cstring>
+#include <utility>
+
+/* C++ wrapper test function definitions */
+void hpp_hotp_codes_test(void);
+void hpp_totp_rfc6238_test(void);
+void hpp_window_test(void);
+void hpp_key_move_test(void);
+
+static const uint8_t hpp_seed[] = "12345678901234567890";
+
+CU_ErrorCode addHPPTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("C++ wrapper", NULL, NULL);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "hotp codes", hpp_hotp_codes_test))
+      || (NULL == CU_add_test(pSuite, "totp RFC 6238 vectors", hpp_totp_rfc6238_test))
+      || (NULL == CU_add_test(pSuite, "windows match the C search", hpp_window_test))
+      || (NULL == CU_add_test(pSuite, "keys wiped on move", hpp_key_move_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+void hpp_hotp_codes_test(void) {
+  static const uint32_t expect[] = {
+    755224, 287082, 359152, 969429, 338314,
+    254676, 287922, 162583, 399871, 520489
+  };
+  otp::key<> key(hpp_seed, 20);
+  uint64_t counter;
+
+  for (counter = 0; counter < 10; counter++) {
+    CU_ASSERT_EQUAL((otp::hotp_validator<6>::code(key, counter)),
+                    expect[counter]);
+    CU_ASSERT((otp::hotp_validator<6>::validate(key, counter,
+                                                expect[counter])));
+    CU_ASSERT_EQUAL((otp::hotp_validator<10>::code(key, counter)),
+                    hotp_ctx(key.get(), counter));
+  }
+}
+
+/* one algorithm's row of the RFC 6238 appendix B table */
+template <otp::algorithm Algo>
+static void hpp_totp_vectors(const char *seed, const uint32_t *expect) {
+  static const time_t times[] = {
+    59, 1111111109, 1111111111, 1234567890, 2000000000, 20000000000LL
+  };
+  otp::key<Algo> key((const uint8_t *)seed, strlen(seed));
+  int64_t offset = 0;
+  size_t iterator;
+
+  for (iterator = 0; iterator < 6; iterator++) {
+    CU_ASSERT_EQUAL((otp::totp_validator<8, 30, 1, Algo>::code(key,
+                                                               times[iterator])),
+                    expect[iterator]);
+    CU_ASSERT((otp::totp_validator<8, 30, 5, Algo>::validate(
+        key, times[iterator] + 60, expect[iterator], &offset)));
+    CU_ASSERT_EQUAL(offset, -2);
+    CU_ASSERT(!(otp::totp_validator<8, 30, 3, Algo>::validate(
+        key, times[iterator] + 60, expect[iterator])));
+  }
+}
+
+void hpp_totp_rfc6238_test(void) {
+  static const uint32_t expect[][6] = {
+    { 94287082, 7081804, 14050471, 89005924, 69279037, 65353130 },
+    { 46119246, 68084774, 67062674, 91819424, 90698825, 77737706 },
+    { 90693936, 25091201, 99943326, 93441116, 38618901, 47863826 }
+  };
+
+  hpp_totp_vectors<otp::algorithm::sha1>("12345678901234567890", expect[0]);
+  hpp_totp_vectors<otp::algorithm::sha256>(
+      "12345678901234567890123456789012", expect[1]);
+  hpp_totp_vectors<otp::algorithm::sha512>(
+      "1234567890123456789012345678901234567890123456789012345678901234",
+      expect[2]);
+}
+
+/* every guess from around the window, including near counter zero, gets
+ * the same answer and offset from the template as from the C search */
+template <unsigned int Window, otp::algorithm Algo>
+static void hpp_compare_window(const otp::key<Algo> &key) {
+  uint64_t counter;
+  int64_t guessOffset;
+  int64_t offset;
+  int64_t expectOffset;
+
+  for (counter = 0; counter < 12; counter++) {
+    for (guessOffset = -(int64_t)Window; guessOffset <= (int64_t)Window;
+         guessOffset++) {
+      uint32_t guess;
+      bool matched;
+
+      if ((int64_t)counter + guessOffset < 0) {
+        continue;
+      }
+      guess = hotp_ctx(key.get(), counter + guessOffset) % 1000000;
+      offset = expectOffset = 99;
+      matched = otp::hotp_validator<6, Window, Algo>::validate(key, counter,
+                                                               guess, &offset);
+
+      CU_ASSERT_EQUAL(matched,
+                      hotp_find_window_ctx(key.get(), counter, guess, 6, Window,
+                                           &expectOffset)
+                      == OTP_VALIDATE_SUCCESS);
+      if (matched) {
+        CU_ASSERT_EQUAL(offset, expectOffset);
+      }
+    }
+  }
+}
+
+void hpp_window_test(void) {
+  otp::key<otp::algorithm::sha1> sha1(hpp_seed, 20);
+  otp::key<otp::algorithm::sha256> sha256(hpp_seed, 20);
+  otp::key<otp::algorithm::sha512> sha512(hpp_seed, 20);
+
+  hpp_compare_window<1>(sha1);
+  hpp_compare_window<3>(sha1);
+  hpp_compare_window<4>(sha1);
+  hpp_compare_window<17>(sha1);
+  hpp_compare_window<64>(sha1);
+  hpp_compare_window<3>(sha256);
+  hpp_compare_window<8>(sha256);
+  hpp_compare_window<3>(sha512);
+  hpp_compare_window<8>(sha512);
+}
+
+void hpp_key_move_test(void) {
+  static const otp_key zero = otp_key();
+  otp::key<> first(hpp_seed, 20);
+  otp::key<> second(std::move(first));
+  otp::key<> third((const uint8_t *)"another secret", 14);
+
+  CU_ASSERT_EQUAL(memcmp(first.get(), &zero, sizeof(zero)), 0);
+  CU_ASSERT_EQUAL((otp::hotp_validator<6>::code(second, 0)), 755224);
+
+  third = std::move(second);
+  CU_ASSERT_EQUAL(memcmp(second.get(), &zero, sizeof(zero)), 0);
+  CU_ASSERT_EQUAL((otp::hotp_validator<6>::code(third, 1)), 287082);
+}
+
+#endif /* HPP_TEST_ */
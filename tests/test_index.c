@@ -0,0 +1,219 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+
+#ifndef INDEX_TEST_
+#define INDEX_TEST_
+
+/* local includes */
+#include "../otp_index.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INDEX_TEST_USERS 3000
+
+/* index test function definitions */
+int init_index_suite(void);
+int clean_index_suite(void);
+void index_lookup_test(void);
+void index_collision_test(void);
+void index_background_test(void);
+
+otp_key *index_keys;
+uint64_t *index_user_ids;
+
+CU_ErrorCode addIndexTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Code to user index", init_index_suite,
+                        clean_index_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "lookup", index_lookup_test))
+      || (NULL == CU_add_test(pSuite, "collisions", index_collision_test))
+      || (NULL == CU_add_test(pSuite, "background rebuild", index_background_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_index_suite(void) {
+  uint8_t secret[20];
+  size_t user;
+
+  index_keys = malloc(INDEX_TEST_USERS * sizeof(otp_key));
+  index_user_ids = malloc(INDEX_TEST_USERS * sizeof(uint64_t));
+  if (index_keys == NULL || index_user_ids == NULL) {
+    return -1;
+  }
+
+  for (user = 0; user < INDEX_TEST_USERS; user++) {
+    memset(secret, 0, sizeof(secret));
+    memcpy(secret, &user, sizeof(user));
+    otp_key_init(&index_keys[user], secret, sizeof(secret));
+    index_user_ids[user] = 1000 + user;
+  }
+
+  return CUE_SUCCESS;
+}
+
+int clean_index_suite(void) {
+  free(index_keys);
+  free(index_user_ids);
+  return CUE_SUCCESS;
+}
+
+/* brute force count of users with code at step + offset, |offset| <= radius */
+static size_t index_expected_matches(time_t time, uint32_t code,
+                                     unsigned int radius) {
+  uint64_t step = time / 30;
+  int64_t offset;
+  size_t user;
+  size_t matches = 0;
+
+  for (offset = -(int64_t)radius; offset <= (int64_t)radius; offset++) {
+    for (user = 0; user < INDEX_TEST_USERS; user++) {
+      if (hotp_ctx(&index_keys[user], step + offset) % 1000000 == code) {
+        matches++;
+      }
+    }
+  }
+
+  return matches;
+}
+
+void index_lookup_test(void) {
+  otp_executor *executor = otp_executor_create(2, 0);
+  otp_index *index = otp_index_create(index_user_ids, index_keys,
+                                      INDEX_TEST_USERS, 30, 6, 1, executor);
+  otp_index_match matches[8];
+  time_t time = 1500000000;
+  size_t user;
+  size_t found;
+  size_t match;
+  int seen;
+
+  CU_ASSERT_PTR_NOT_NULL(index);
+  if (index == NULL) {
+    otp_executor_destroy(executor);
+    return;
+  }
+
+  /* the step of each user's own code, a step behind and ahead */
+  for (user = 0; user < INDEX_TEST_USERS; user += 37) {
+    int64_t offset = (int64_t)(user % 3) - 1;
+    uint32_t code = totp_ctx(&index_keys[user], time + 30 * offset, 30) % 1000000;
+
+    found = otp_index_lookup(index, time, code, matches, 8);
+    CU_ASSERT_EQUAL(found, index_expected_matches(time, code, 1));
+
+    seen = 0;
+    for (match = 0; match < found && match < 8; match++) {
+      seen |= matches[match].userId == 1000 + user
+              && matches[match].offset == offset;
+    }
+    CU_ASSERT_TRUE(seen);
+  }
+
+  /* later steps rebuild the tables that fell out of range */
+  for (time = 1500000000; time < 1500000000 + 30 * 5; time += 30) {
+    uint32_t code = totp_ctx(&index_keys[42], time, 30) % 1000000;
+
+    found = otp_index_lookup(index, time, code, matches, 8);
+    CU_ASSERT_TRUE(found >= 1);
+    CU_ASSERT_EQUAL(matches[0].userId, 1042);
+    CU_ASSERT_EQUAL(matches[0].offset, 0);
+  }
+
+  CU_ASSERT_EQUAL(otp_index_lookup(index, time, 1000000, matches, 8), 0);
+
+  otp_index_destroy(index);
+  otp_executor_destroy(executor);
+}
+
+/* two users sharing a secret always collide */
+void index_collision_test(void) {
+  otp_key keys[3];
+  uint64_t userIds[3] = { 7, 8, 9 };
+  otp_index_match matches[1];
+  otp_index *index;
+  uint32_t code;
+
+  keys[0] = index_keys[1];
+  keys[1] = index_keys[2];
+  keys[2] = index_keys[1];
+
+  index = otp_index_create(userIds, keys, 3, 30, 6, 0, NULL);
+  CU_ASSERT_PTR_NOT_NULL(index);
+  if (index == NULL) {
+    return;
+  }
+
+  code = totp_ctx(&keys[0], 59, 30) % 1000000;
+  CU_ASSERT_EQUAL(otp_index_lookup(index, 59, code, matches, 1),
+                  code == totp_ctx(&keys[1], 59, 30) % 1000000 ? 3 : 2);
+  CU_ASSERT_TRUE(matches[0].userId == 7 || matches[0].userId == 9);
+
+  CU_ASSERT_PTR_NULL(otp_index_create(userIds, keys, 3, 0, 6, 0, NULL));
+  CU_ASSERT_PTR_NULL(otp_index_create(userIds, keys, 3, 30, 6,
+                                      OTP_INDEX_MAX_RADIUS + 1, NULL));
+
+  otp_index_destroy(index);
+}
+
+/* the rebuild thread keeps the current step ready against the real clock */
+void index_background_test(void) {
+  otp_index *index = otp_index_create(index_user_ids, index_keys,
+                                      INDEX_TEST_USERS, 30, 6, 0, NULL);
+  otp_index_match matches[4];
+  time_t now;
+  uint32_t code;
+
+  CU_ASSERT_PTR_NOT_NULL(index);
+  if (index == NULL) {
+    return;
+  }
+
+  CU_ASSERT_EQUAL(otp_index_start(index), 0);
+  CU_ASSERT_EQUAL(otp_index_start(index), -1);
+
+  now = time(NULL);
+  code = totp_ctx(&index_keys[99], now, 30) % 1000000;
+  CU_ASSERT_TRUE(otp_index_lookup(index, now, code, matches, 4) >= 1);
+
+  otp_index_stop(index);
+  otp_index_stop(index);
+  otp_index_destroy(index);
+}
+
+#endif /* INDEX_TEST_ */
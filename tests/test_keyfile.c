@@ -0,0 +1,265 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef KEYFILE_TEST_
+#define KEYFILE_TEST_
+
+/* local includes */
+#include "../otp_keyfile.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* keyfile test function definitions */
+int init_keyfile_suite(void);
+int clean_keyfile_suite(void);
+void keyfile_roundtrip_test(void);
+void keyfile_reject_test(void);
+void keyfile_replace_test(void);
+void keyfile_algorithm_test(void);
+
+char keyfile_test_path[] = "/tmp/libotp-keyfile-XXXXXX";
+
+CU_ErrorCode addKeyfileTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Memory mapped key file", init_keyfile_suite,
+                        clean_keyfile_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "write, map and find", keyfile_roundtrip_test))
+      || (NULL == CU_add_test(pSuite, "reject bad files", keyfile_reject_test))
+      || (NULL == CU_add_test(pSuite, "replace a mapped file", keyfile_replace_test))
+      || (NULL == CU_add_test(pSuite, "record algorithms", keyfile_algorithm_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_keyfile_suite(void) {
+  int fd = mkstemp(keyfile_test_path);
+
+  if (fd < 0) {
+    return -1;
+  }
+  close(fd);
+  return CUE_SUCCESS;
+}
+
+int clean_keyfile_suite(void) {
+  unlink(keyfile_test_path);
+  return CUE_SUCCESS;
+}
+
+void keyfile_roundtrip_test(void) {
+  otp_keyfile_record records[100];
+  const otp_keyfile_record *record;
+  otp_keyfile *keyfile;
+  uint8_t secret[20];
+  otp_key key;
+  size_t iterator;
+
+  /* IDs deliberately out of order */
+  memset(records, 0, sizeof(records));
+  for (iterator = 0; iterator < 100; iterator++) {
+    memset(secret, (int)iterator, sizeof(secret));
+    records[iterator].userId = (iterator * 37) % 100 + 1000;
+    records[iterator].counter = iterator;
+    records[iterator].digits = 6;
+    records[iterator].period = 30;
+    otp_key_init(&records[iterator].key, secret, sizeof(secret));
+  }
+
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 100), 0);
+
+  keyfile = otp_keyfile_open(keyfile_test_path);
+  CU_ASSERT_PTR_NOT_NULL(keyfile);
+  if (keyfile == NULL) {
+    return;
+  }
+  CU_ASSERT_EQUAL(otp_keyfile_count(keyfile), 100);
+
+  for (iterator = 0; iterator < 100; iterator++) {
+    record = otp_keyfile_find(keyfile, 1000 + iterator);
+    CU_ASSERT_PTR_NOT_NULL(record);
+    if (record == NULL) {
+      continue;
+    }
+
+    /* the mapped key hashes the same as a freshly derived one */
+    memset(secret, (int)record->counter, sizeof(secret));
+    otp_key_init(&key, secret, sizeof(secret));
+    CU_ASSERT_EQUAL(hotp_ctx(&record->key, 42), hotp_ctx(&key, 42));
+    CU_ASSERT_EQUAL((uintptr_t)record % 64, 0);
+  }
+
+  CU_ASSERT_PTR_NULL(otp_keyfile_find(keyfile, 999));
+  CU_ASSERT_PTR_NULL(otp_keyfile_find(keyfile, 1100));
+  CU_ASSERT_PTR_NULL(otp_keyfile_record_at(keyfile, 100));
+  CU_ASSERT_EQUAL(otp_keyfile_record_at(keyfile, 0)->userId, 1000);
+
+  otp_keyfile_close(keyfile);
+}
+
+void keyfile_reject_test(void) {
+  otp_keyfile_record records[2];
+  FILE *file;
+
+  /* duplicate IDs can't be written */
+  memset(records, 0, sizeof(records));
+  records[0].userId = 5;
+  records[1].userId = 5;
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 2), -1);
+
+  /* a truncated file is refused */
+  records[1].userId = 6;
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 2), 0);
+  CU_ASSERT_EQUAL(truncate(keyfile_test_path, 200), 0);
+  CU_ASSERT_PTR_NULL(otp_keyfile_open(keyfile_test_path));
+
+  /* and so is a file without the magic */
+  file = fopen(keyfile_test_path, "wb");
+  CU_ASSERT_PTR_NOT_NULL(file);
+  if (file != NULL) {
+    fprintf(file, "%64s", "not a key file");
+    fclose(file);
+  }
+  CU_ASSERT_PTR_NULL(otp_keyfile_open(keyfile_test_path));
+}
+
+/* a rewrite replaces the file whole, readers of the old one keep it */
+void keyfile_replace_test(void) {
+  otp_keyfile_record records[3];
+  otp_keyfile *before;
+  otp_keyfile *after;
+  char temporary[sizeof(keyfile_test_path) + 4];
+
+  memset(records, 0, sizeof(records));
+  records[0].userId = 1;
+  records[0].counter = 10;
+  records[1].userId = 2;
+  records[1].counter = 20;
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 2), 0);
+
+  before = otp_keyfile_open(keyfile_test_path);
+  CU_ASSERT_PTR_NOT_NULL(before);
+  if (before == NULL) {
+    return;
+  }
+
+  records[0].counter = 11;
+  records[2].userId = 3;
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 3), 0);
+
+  CU_ASSERT_EQUAL(otp_keyfile_count(before), 2);
+  CU_ASSERT_EQUAL(otp_keyfile_find(before, 1)->counter, 10);
+  CU_ASSERT_EQUAL(otp_keyfile_find(before, 2)->counter, 20);
+  otp_keyfile_close(before);
+
+  after = otp_keyfile_open(keyfile_test_path);
+  CU_ASSERT_PTR_NOT_NULL(after);
+  if (after != NULL) {
+    CU_ASSERT_EQUAL(otp_keyfile_count(after), 3);
+    CU_ASSERT_EQUAL(otp_keyfile_find(after, 1)->counter, 11);
+    otp_keyfile_close(after);
+  }
+
+  snprintf(temporary, sizeof(temporary), "%s.tmp", keyfile_test_path);
+  CU_ASSERT_NOT_EQUAL(access(temporary, F_OK), 0);
+}
+
+/* overwrite the algorithm of the first record on disk */
+static void keyfile_set_algorithm(uint32_t algorithm) {
+  otp_keyfile_header header;
+  int fd = open(keyfile_test_path, O_RDWR);
+
+  CU_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+  CU_ASSERT_EQUAL(pread(fd, &header, sizeof(header), 0), sizeof(header));
+  CU_ASSERT_EQUAL(pwrite(fd, &algorithm, sizeof(algorithm),
+                         header.recordsOffset
+                         + offsetof(otp_keyfile_record, key.algorithm)),
+                  sizeof(algorithm));
+  close(fd);
+}
+
+/* the header lists the algorithms in use and every record must be one */
+void keyfile_algorithm_test(void) {
+  otp_keyfile_record records[2];
+  otp_keyfile_header header;
+  otp_keyfile *keyfile;
+  otp_key key;
+  FILE *file;
+
+  memset(records, 0, sizeof(records));
+  records[0].userId = 1;
+  records[1].userId = 2;
+  otp_key_init_algorithm(&records[0].key, OTP_SHA256,
+                         (uint8_t *)"12345678901234567890", 20);
+  otp_key_init(&records[1].key, (uint8_t *)"12345678901234567890", 20);
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 2), 0);
+
+  file = fopen(keyfile_test_path, "rb");
+  CU_ASSERT_PTR_NOT_NULL(file);
+  if (file != NULL) {
+    CU_ASSERT_EQUAL(fread(&header, sizeof(header), 1, file), 1);
+    CU_ASSERT_EQUAL(header.algorithm, OTP_KEYFILE_ALGORITHM_SHA1
+                                      | OTP_KEYFILE_ALGORITHM_SHA256);
+    fclose(file);
+  }
+
+  keyfile = otp_keyfile_open(keyfile_test_path);
+  CU_ASSERT_PTR_NOT_NULL(keyfile);
+  if (keyfile != NULL) {
+    otp_key_init_algorithm(&key, OTP_SHA256,
+                           (uint8_t *)"12345678901234567890", 20);
+    CU_ASSERT_EQUAL(hotp_ctx(&otp_keyfile_find(keyfile, 1)->key, 7),
+                    hotp_ctx(&key, 7));
+    otp_keyfile_close(keyfile);
+  }
+
+  /* algorithms the header doesn't list, or that don't exist, are refused */
+  keyfile_set_algorithm(OTP_SHA512);
+  CU_ASSERT_PTR_NULL(otp_keyfile_open(keyfile_test_path));
+  keyfile_set_algorithm(9);
+  CU_ASSERT_PTR_NULL(otp_keyfile_open(keyfile_test_path));
+
+  records[0].key.algorithm = (OTP_ALGORITHM)9;
+  CU_ASSERT_EQUAL(otp_keyfile_write(keyfile_test_path, records, 2), -1);
+}
+
+#endif /* KEYFILE_TEST_ */
@@ -0,0 +1,186 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef METRICS_TEST_
+#define METRICS_TEST_
+
+/* local includes */
+#include "../otp_metrics.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/* metrics test function definitions */
+int init_metrics_suite(void);
+int clean_metrics_suite(void);
+void metrics_counts_test(void);
+void metrics_threads_test(void);
+void metrics_format_test(void);
+
+CU_ErrorCode addMetricsTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Metrics counters", init_metrics_suite,
+                        clean_metrics_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "counts and offsets", metrics_counts_test))
+      || (NULL == CU_add_test(pSuite, "exited threads still count", metrics_threads_test))
+      || (NULL == CU_add_test(pSuite, "JSON export", metrics_format_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_metrics_suite(void) {
+  return CUE_SUCCESS;
+}
+
+int clean_metrics_suite(void) {
+  return CUE_SUCCESS;
+}
+
+static const char metrics_secret[] = "12345678901234567890";
+
+/* RFC 4226 counter 1 is 287082, seen from counter 2 it is at offset -1 */
+void metrics_counts_test(void) {
+  otp_metrics_snapshot snapshot;
+  otp_key key;
+  uint64_t latencies = 0;
+  size_t bucket;
+
+  if (!otp_metrics_enabled()) {
+    otp_metrics_read(&snapshot);
+    CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_VALIDATIONS], 0);
+    return;
+  }
+
+  otp_key_init(&key, (uint8_t *)metrics_secret, strlen(metrics_secret));
+  otp_metrics_reset();
+
+  CU_ASSERT_EQUAL(hotp_validate_windows_ctx(&key, 2, 287082, 6, 3),
+                  OTP_VALIDATE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_validate_windows_ctx(&key, 2, 1, 6, 3),
+                  OTP_VALIDATE_FAILURE);
+  CU_ASSERT_EQUAL(hotp_validate_ctx(&key, 1, 287082, 6), OTP_VALIDATE_SUCCESS);
+
+  otp_metrics_read(&snapshot);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_VALIDATIONS], 3);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_SUCCESSES], 2);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_FAILURES], 1);
+  /* nearest first: 2, 3 then 1 for the match, all three for the miss */
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_HASHES], 3 + 3 + 1);
+  CU_ASSERT_EQUAL(snapshot.matchOffsets[OTP_METRICS_OFFSET_LIMIT - 1], 1);
+  CU_ASSERT_EQUAL(snapshot.matchOffsets[OTP_METRICS_OFFSET_LIMIT], 1);
+
+  for (bucket = 0; bucket < OTP_METRICS_LATENCY_BUCKETS; bucket++) {
+    latencies += snapshot.latency[bucket];
+  }
+  CU_ASSERT_EQUAL(latencies, 3);
+
+  otp_metrics_reset();
+  otp_metrics_read(&snapshot);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_VALIDATIONS], 0);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_HASHES], 0);
+
+  otp_key_clear(&key);
+}
+
+static void *metrics_thread(void *arg) {
+  const otp_key *key = arg;
+  uint64_t counter;
+
+  for (counter = 0; counter < 100; counter++) {
+    hotp_validate_ctx(key, counter, 0, 6);
+  }
+
+  return NULL;
+}
+
+void metrics_threads_test(void) {
+  otp_metrics_snapshot snapshot;
+  pthread_t threads[4];
+  otp_key key;
+  size_t index;
+
+  if (!otp_metrics_enabled()) {
+    return;
+  }
+
+  otp_key_init(&key, (uint8_t *)metrics_secret, strlen(metrics_secret));
+  otp_metrics_reset();
+
+  /* two rounds, the second reusing the slots the first left behind */
+  for (index = 0; index < 8; index++) {
+    CU_ASSERT_EQUAL(pthread_create(&threads[index % 4], NULL, metrics_thread,
+                                   &key), 0);
+    if (index % 4 == 3) {
+      pthread_join(threads[0], NULL);
+      pthread_join(threads[1], NULL);
+      pthread_join(threads[2], NULL);
+      pthread_join(threads[3], NULL);
+    }
+  }
+
+  otp_metrics_read(&snapshot);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_VALIDATIONS], 800);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_HASHES], 800);
+  CU_ASSERT_EQUAL(snapshot.counters[OTP_METRIC_SUCCESSES]
+                  + snapshot.counters[OTP_METRIC_FAILURES], 800);
+
+  otp_key_clear(&key);
+}
+
+void metrics_format_test(void) {
+  otp_metrics_snapshot snapshot;
+  char small[16];
+  char text[512];
+  int length;
+
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.counters[OTP_METRIC_HASHES] = 7;
+  snapshot.matchOffsets[OTP_METRICS_OFFSET_LIMIT - 2] = 3;
+  snapshot.matchOffsets[OTP_METRICS_OFFSET_LIMIT + 1] = 4;
+  snapshot.latency[10] = 1;
+
+  length = otp_metrics_format(text, sizeof(text), &snapshot);
+  CU_ASSERT_EQUAL((size_t)length, strlen(text));
+  CU_ASSERT_STRING_EQUAL(text,
+                         "{\"hashes\": 7, \"validations\": 0, \"successes\": 0, "
+                         "\"failures\": 0, \"match_offsets\": {\"-2\": 3, "
+                         "\"1\": 4}, \"latency_p50_ns\": 1023, "
+                         "\"latency_p99_ns\": 1023, \"latency_p999_ns\": 1023}");
+
+  /* truncated output still reports the full length */
+  CU_ASSERT_EQUAL(otp_metrics_format(small, sizeof(small), &snapshot), length);
+  CU_ASSERT_EQUAL(strlen(small), sizeof(small) - 1);
+}
+
+#endif /* METRICS_TEST_ */
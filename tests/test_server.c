@@ -0,0 +1,426 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef SERVER_TEST_
+#define SERVER_TEST_
+
+/* local includes */
+#include "../otp_server.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* server test function definitions */
+int init_server_suite(void);
+int clean_server_suite(void);
+void server_hotp_round_trip_test(void);
+void server_shared_state_test(void);
+void server_stats_test(void);
+void server_socket_path_test(void);
+void server_batch_wait_test(void);
+void server_user_settings_test(void);
+
+otp_store *server_test_store;
+otp_server *test_server;
+pthread_t server_thread;
+char server_test_path[64];
+
+CU_ErrorCode addServerTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Validation server", init_server_suite,
+                        clean_server_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "hotp round trip", server_hotp_round_trip_test))
+      || (NULL == CU_add_test(pSuite, "state shared between clients", server_shared_state_test))
+      || (NULL == CU_add_test(pSuite, "latency and batch stats", server_stats_test))
+      || (NULL == CU_add_test(pSuite, "socket path takeover", server_socket_path_test))
+      || (NULL == CU_add_test(pSuite, "sleep while a batch is open", server_batch_wait_test))
+      || (NULL == CU_add_test(pSuite, "per user settings", server_user_settings_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+static void *run_test_server(void *argument) {
+  otp_server_run(argument);
+  return NULL;
+}
+
+/* The suite boilerplate functions */
+int init_server_suite(void) {
+  otp_server_config config;
+  otp_key key;
+
+  server_test_store = otp_store_create(16, 1);
+  if (server_test_store == NULL) {
+    return 1;
+  }
+  otp_key_init(&key, (uint8_t *)"12345678901234567890", 20);
+  otp_store_add(server_test_store, 1, &key, 0);
+  otp_store_add(server_test_store, 2, &key, 0);
+  otp_store_add(server_test_store, 3, &key, 0);
+  otp_store_add_user(server_test_store, 4, &key, 0, 6, 0);
+  otp_store_add_user(server_test_store, 5, &key, 0, 8, 30);
+  otp_store_add_user(server_test_store, 6, &key, 0, 8, 30);
+  otp_key_clear(&key);
+
+  /* a long delay so that pipelined requests share a batch */
+  memset(&config, 0, sizeof(config));
+  config.maxBatch = 8;
+  config.batchDelay = 2000000;
+  snprintf(server_test_path, sizeof(server_test_path),
+           "/tmp/libotptest-%d.sock", (int)getpid());
+  test_server = otp_server_create(server_test_store, server_test_path,
+                                  &config);
+  if (test_server == NULL) {
+    return 1;
+  }
+
+  return pthread_create(&server_thread, NULL, run_test_server, test_server);
+}
+
+int clean_server_suite(void) {
+  otp_server_stop(test_server);
+  pthread_join(server_thread, NULL);
+  otp_server_destroy(test_server);
+  otp_store_destroy(server_test_store);
+  return access(server_test_path, F_OK) == 0;
+}
+
+static int connect_test_server(void) {
+  struct sockaddr_un address;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, server_test_path);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static void server_request(otp_server_request *request, uint8_t type,
+                           uint64_t userId, uint32_t guess, uint32_t tag) {
+  memset(request, 0, sizeof(*request));
+  request->version = OTP_SERVER_VERSION;
+  request->type = type;
+  request->digits = 6;
+  request->userId = userId;
+  request->guess = guess;
+  request->tag = tag;
+}
+
+void server_hotp_round_trip_test(void) {
+  otp_server_request requests[6];
+  otp_server_response responses[6];
+  int fd = connect_test_server();
+  size_t iterator;
+
+  CU_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+
+  server_request(&requests[0], OTP_SERVER_HOTP, 1, 755224, 10);
+  server_request(&requests[1], OTP_SERVER_HOTP, 1, 287082, 11);
+  server_request(&requests[2], OTP_SERVER_HOTP, 1, 755224, 12);
+  server_request(&requests[3], OTP_SERVER_HOTP, 9, 755224, 13);
+  server_request(&requests[4], OTP_SERVER_HOTP, 1, 359152, 14);
+  requests[4].version = 0;
+  server_request(&requests[5], OTP_SERVER_TOTP, 2, 0, 15);
+  requests[5].time = 59;
+  requests[5].digits = 8;
+  requests[5].guess = 94287082;
+
+  /* all in one write, split oddly on the way in */
+  CU_ASSERT_EQUAL(write(fd, requests, 20), 20);
+  CU_ASSERT_EQUAL(write(fd, (uint8_t *)requests + 20, sizeof(requests) - 20),
+                  sizeof(requests) - 20);
+  CU_ASSERT_EQUAL(recv(fd, responses, sizeof(responses), MSG_WAITALL),
+                  sizeof(responses));
+
+  for (iterator = 0; iterator < 6; iterator++) {
+    CU_ASSERT_EQUAL(responses[iterator].tag, 10 + iterator);
+  }
+  CU_ASSERT_EQUAL(responses[0].status, OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(responses[1].status, OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(responses[2].status, OTP_STORE_REPLAY);
+  CU_ASSERT_EQUAL(responses[3].status, OTP_STORE_UNKNOWN_USER);
+  CU_ASSERT_EQUAL(responses[4].status, OTP_SERVER_MALFORMED);
+  CU_ASSERT_EQUAL(responses[5].status, OTP_STORE_SUCCESS);
+
+  close(fd);
+}
+
+/* a code used through one connection is spent for every other */
+void server_shared_state_test(void) {
+  otp_server_request request;
+  otp_server_response response;
+  int first = connect_test_server();
+  int second = connect_test_server();
+
+  CU_ASSERT(first >= 0 && second >= 0);
+  if (first < 0 || second < 0) {
+    return;
+  }
+
+  server_request(&request, OTP_SERVER_HOTP, 3, 755224, 1);
+  CU_ASSERT_EQUAL(write(first, &request, sizeof(request)), sizeof(request));
+  CU_ASSERT_EQUAL(recv(first, &response, sizeof(response), MSG_WAITALL),
+                  sizeof(response));
+  CU_ASSERT_EQUAL(response.status, OTP_STORE_SUCCESS);
+
+  request.tag = 2;
+  CU_ASSERT_EQUAL(write(second, &request, sizeof(request)), sizeof(request));
+  CU_ASSERT_EQUAL(recv(second, &response, sizeof(response), MSG_WAITALL),
+                  sizeof(response));
+  CU_ASSERT_EQUAL(response.tag, 2);
+  CU_ASSERT_NOT_EQUAL(response.status, OTP_STORE_SUCCESS);
+
+  /* a client that stops sending still gets its answers */
+  server_request(&request, OTP_SERVER_HOTP, 3, 287082, 3);
+  CU_ASSERT_EQUAL(write(second, &request, sizeof(request)), sizeof(request));
+  shutdown(second, SHUT_WR);
+  CU_ASSERT_EQUAL(recv(second, &response, sizeof(response), MSG_WAITALL),
+                  sizeof(response));
+  CU_ASSERT_EQUAL(response.status, OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(recv(second, &response, sizeof(response), 0), 0);
+
+  close(first);
+  close(second);
+}
+
+void server_stats_test(void) {
+  otp_server_request request;
+  otp_server_response response;
+  otp_server_stats stats;
+  char json[512];
+  int fd = connect_test_server();
+
+  CU_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+
+  server_request(&request, OTP_SERVER_STATS, 0, 0, 7);
+  CU_ASSERT_EQUAL(write(fd, &request, sizeof(request)), sizeof(request));
+  CU_ASSERT_EQUAL(recv(fd, &response, sizeof(response), MSG_WAITALL),
+                  sizeof(response));
+  CU_ASSERT_EQUAL(response.tag, 7);
+  CU_ASSERT_EQUAL(response.status, OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(recv(fd, &stats, sizeof(stats), MSG_WAITALL), sizeof(stats));
+  close(fd);
+
+  /* the snapshot includes the batch holding the stats request itself */
+  CU_ASSERT_EQUAL(stats.connections, 4);
+  CU_ASSERT_EQUAL(stats.requests, 10);
+  CU_ASSERT_EQUAL(stats.malformed, 1);
+  CU_ASSERT_EQUAL(stats.batches, 5);
+  /* the six pipelined requests went through as one batch */
+  CU_ASSERT_EQUAL(stats.batchSizes[0], 4);
+  CU_ASSERT_EQUAL(stats.batchSizes[2], 1);
+  CU_ASSERT(otp_server_batch_percentile(&stats, 1.0) == 7);
+  CU_ASSERT(otp_server_latency_percentile(&stats, 0.5) > 0);
+
+  otp_server_read_stats(test_server, &stats);
+  CU_ASSERT_EQUAL(stats.requests, 10);
+  CU_ASSERT(otp_server_format(json, sizeof(json), &stats) < (int)sizeof(json));
+  CU_ASSERT_PTR_NOT_NULL(strstr(json, "\"requests\": 10"));
+}
+
+/* only a socket nobody is listening on may be replaced, and only its
+ * owner may connect by default */
+void server_socket_path_test(void) {
+  struct sockaddr_un address;
+  struct stat status;
+  char path[64];
+  otp_server *server;
+  int fd;
+
+  CU_ASSERT_EQUAL(stat(server_test_path, &status), 0);
+  CU_ASSERT(S_ISSOCK(status.st_mode));
+  CU_ASSERT_EQUAL(status.st_mode & 0777, 0600);
+
+  /* the running server's socket is left alone */
+  errno = 0;
+  CU_ASSERT_PTR_NULL(otp_server_create(server_test_store, server_test_path,
+                                       NULL));
+  CU_ASSERT_EQUAL(errno, EADDRINUSE);
+  CU_ASSERT_EQUAL(access(server_test_path, F_OK), 0);
+
+  /* so are files that aren't sockets */
+  snprintf(path, sizeof(path), "/tmp/libotptest-%d.file", (int)getpid());
+  fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  CU_ASSERT(fd >= 0);
+  if (fd >= 0) {
+    close(fd);
+  }
+  errno = 0;
+  CU_ASSERT_PTR_NULL(otp_server_create(server_test_store, path, NULL));
+  CU_ASSERT_EQUAL(errno, EADDRINUSE);
+  CU_ASSERT_EQUAL(access(path, F_OK), 0);
+  unlink(path);
+
+  /* a socket whose server is gone is replaced */
+  snprintf(path, sizeof(path), "/tmp/libotptest-%d.stale", (int)getpid());
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CU_ASSERT(fd >= 0);
+  if (fd >= 0) {
+    CU_ASSERT_EQUAL(bind(fd, (struct sockaddr *)&address, sizeof(address)), 0);
+    close(fd);
+  }
+  server = otp_server_create(server_test_store, path, NULL);
+  CU_ASSERT_PTR_NOT_NULL(server);
+  if (server) {
+    otp_server_destroy(server);
+  }
+  CU_ASSERT_NOT_EQUAL(access(path, F_OK), 0);
+}
+
+static uint64_t server_test_ns(clockid_t clock) {
+  struct timespec now;
+
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/* each lone request waits out the 2ms batch delay, which should be spent
+ * asleep rather than polling */
+void server_batch_wait_test(void) {
+  otp_server_request request;
+  otp_server_response response;
+  uint64_t wall = server_test_ns(CLOCK_MONOTONIC);
+  uint64_t cpu = server_test_ns(CLOCK_PROCESS_CPUTIME_ID);
+  int fd = connect_test_server();
+  int iterator;
+
+  CU_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+
+  for (iterator = 0; iterator < 20; iterator++) {
+    server_request(&request, OTP_SERVER_HOTP, 9, 0, iterator);
+    CU_ASSERT_EQUAL(write(fd, &request, sizeof(request)), sizeof(request));
+    CU_ASSERT_EQUAL(recv(fd, &response, sizeof(response), MSG_WAITALL),
+                    sizeof(response));
+    CU_ASSERT_EQUAL(response.status, OTP_STORE_UNKNOWN_USER);
+  }
+  close(fd);
+
+  wall = server_test_ns(CLOCK_MONOTONIC) - wall;
+  cpu = server_test_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+  CU_ASSERT(wall >= 20 * 2000000u);
+  CU_ASSERT(cpu < wall / 2);
+}
+
+static uint32_t server_exchange(int fd, const otp_server_request *request) {
+  otp_server_response response;
+
+  response.status = OTP_SERVER_MALFORMED;
+  CU_ASSERT_EQUAL(write(fd, request, sizeof(*request)), sizeof(*request));
+  CU_ASSERT_EQUAL(recv(fd, &response, sizeof(response), MSG_WAITALL),
+                  sizeof(response));
+  return response.status;
+}
+
+/* users added with settings are checked with them, not the request's */
+void server_user_settings_test(void) {
+  otp_server_request request;
+  int fd = connect_test_server();
+
+  CU_ASSERT(fd >= 0);
+  if (fd < 0) {
+    return;
+  }
+
+  /* a one digit guess would be right one time in ten */
+  server_request(&request, OTP_SERVER_HOTP, 4, 755224 % 10, 1);
+  request.digits = 1;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+
+  server_request(&request, OTP_SERVER_HOTP, 4, 755224, 2);
+  request.digits = 0;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_SUCCESS);
+
+  /* a hotp user's codes aren't totp codes */
+  server_request(&request, OTP_SERVER_TOTP, 4, 287082, 3);
+  request.time = 30;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+
+  /* the window is capped at the server's 3 */
+  server_request(&request, OTP_SERVER_HOTP, 4, 520489, 4);
+  request.windows = 255;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+  server_request(&request, OTP_SERVER_HOTP, 4, 287082, 5);
+  request.windows = 255;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_SUCCESS);
+
+  /* steps are always counted in the user's period */
+  server_request(&request, OTP_SERVER_TOTP, 5, 94287082, 6);
+  request.digits = 8;
+  request.time = 59;
+  request.period = 60;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+  server_request(&request, OTP_SERVER_HOTP, 5, 94287082, 7);
+  request.digits = 8;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+  server_request(&request, OTP_SERVER_TOTP, 5, 94287082, 8);
+  request.digits = 0;
+  request.time = 59;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_REPLAY);
+
+  /* and step 0 can't be told from no step used, so it is never taken */
+  server_request(&request, OTP_SERVER_TOTP, 6, 84755224, 9);
+  request.digits = 0;
+  request.time = 1;
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(server_exchange(fd, &request), OTP_STORE_FAILURE);
+
+  close(fd);
+}
+
+#endif /* SERVER_TEST_ */
@@ -0,0 +1,414 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef STORE_TEST_
+#define STORE_TEST_
+
+/* local includes */
+#include "../otp_metrics.h"
+#include "../otp_store.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* store test function definitions */
+int init_store_suite(void);
+int clean_store_suite(void);
+void store_add_lookup_test(void);
+void store_hotp_advance_test(void);
+void store_totp_replay_drift_test(void);
+void store_concurrent_test(void);
+void store_validate_many_test(void);
+void store_totp_adaptive_test(void);
+void store_totp_drift_test(void);
+void store_user_settings_test(void);
+
+otp_store *test_store;
+otp_key store_reference_key;
+
+CU_ErrorCode addStoreTestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Counter and replay store", init_store_suite,
+                        clean_store_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "add and lookup", store_add_lookup_test))
+      || (NULL == CU_add_test(pSuite, "hotp validate-and-advance", store_hotp_advance_test))
+      || (NULL == CU_add_test(pSuite, "totp replay and drift", store_totp_replay_drift_test))
+      || (NULL == CU_add_test(pSuite, "concurrent submissions", store_concurrent_test))
+      || (NULL == CU_add_test(pSuite, "batched submissions", store_validate_many_test))
+      || (NULL == CU_add_test(pSuite, "drift adaptive totp windows", store_totp_adaptive_test))
+      || (NULL == CU_add_test(pSuite, "totp drift past the narrow window", store_totp_drift_test))
+      || (NULL == CU_add_test(pSuite, "per user digits and period", store_user_settings_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_store_suite(void) {
+  otp_key_init(&store_reference_key, (uint8_t *)"12345678901234567890", 20);
+  test_store = otp_store_create(1000, 8);
+  return test_store == NULL;
+}
+
+int clean_store_suite(void) {
+  otp_store_destroy(test_store);
+  otp_key_clear(&store_reference_key);
+  return CUE_SUCCESS;
+}
+
+void store_add_lookup_test(void) {
+  uint64_t step = 0;
+  int64_t drift = 1;
+  uint64_t userId;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 1, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 1, &store_reference_key, 0),
+                  OTP_STORE_EXISTS);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 1, &step, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 0);
+  CU_ASSERT_EQUAL(drift, 0);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 2, &step, &drift),
+                  OTP_STORE_UNKNOWN_USER);
+
+  /* fill up well past the first shard's share */
+  for (userId = 100; userId < 900; userId++) {
+    CU_ASSERT_EQUAL(otp_store_add(test_store, userId, &store_reference_key,
+                                  userId), OTP_STORE_SUCCESS);
+  }
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 512, &step, NULL),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 512);
+}
+
+void store_hotp_advance_test(void) {
+  uint64_t step = 0;
+  int64_t drift = 0;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 10, &store_reference_key, 2),
+                  OTP_STORE_SUCCESS);
+
+  /* counter 4 is two presses ahead of the expected 2 */
+  CU_ASSERT_EQUAL(hotp_store_validate(test_store, 10, 338314, 6, 5),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 10, &step, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 5);
+  CU_ASSERT_EQUAL(drift, 2);
+
+  /* the same code again, and an older one, are both refused */
+  CU_ASSERT_NOT_EQUAL(hotp_store_validate(test_store, 10, 338314, 6, 5),
+                      OTP_STORE_SUCCESS);
+  CU_ASSERT_NOT_EQUAL(hotp_store_validate(test_store, 10, 969429, 6, 5),
+                      OTP_STORE_SUCCESS);
+
+  /* the next counter is accepted */
+  CU_ASSERT_EQUAL(hotp_store_validate(test_store, 10, 254676, 6, 5),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(hotp_store_validate(test_store, 11, 254676, 6, 5),
+                  OTP_STORE_UNKNOWN_USER);
+}
+
+void store_totp_replay_drift_test(void) {
+  uint64_t step = 0;
+  int64_t drift = 0;
+  uint32_t code;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 20, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+
+  /* the token runs one step (30s) behind the server */
+  code = totp_ctx(&store_reference_key, 3000 - 30, 30) % 1000000;
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 20, 3000, 30, code, 6, 3),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 20, &step, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 99);
+  CU_ASSERT_EQUAL(drift, -1);
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 20, 3000, 30, code, 6, 3),
+                  OTP_STORE_REPLAY);
+
+  /* with the drift remembered a narrow window still finds the next code */
+  code = totp_ctx(&store_reference_key, 3030 - 30, 30) % 1000000;
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 20, 3030, 30, code, 6, 1),
+                  OTP_STORE_SUCCESS);
+}
+
+typedef struct store_race {
+  atomic_int start;
+  atomic_int successes;
+  uint32_t code;
+} store_race;
+
+static void *store_race_thread(void *argument) {
+  store_race *race = argument;
+
+  while (!atomic_load(&race->start)) {
+  }
+  if (hotp_store_validate(test_store, 30, race->code, 6, 3) == OTP_STORE_SUCCESS) {
+    atomic_fetch_add(&race->successes, 1);
+  }
+
+  return NULL;
+}
+
+/* many submissions of one code for one user - exactly one may win */
+void store_concurrent_test(void) {
+  pthread_t threads[8];
+  store_race race;
+  size_t iterator;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 30, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+
+  atomic_init(&race.start, 0);
+  atomic_init(&race.successes, 0);
+  race.code = 287082;
+
+  for (iterator = 0; iterator < 8; iterator++) {
+    pthread_create(&threads[iterator], NULL, store_race_thread, &race);
+  }
+  atomic_store(&race.start, 1);
+  for (iterator = 0; iterator < 8; iterator++) {
+    pthread_join(threads[iterator], NULL);
+  }
+
+  CU_ASSERT_EQUAL(atomic_load(&race.successes), 1);
+}
+
+/* the batched path gives the same answers as the single calls */
+void store_validate_many_test(void) {
+  otp_store_request requests[108];
+  OTP_STORE_RESULT results[108];
+  uint64_t step = 0;
+  size_t iterator;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 40, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 41, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 42, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+
+  memset(requests, 0, sizeof(requests));
+  for (iterator = 0; iterator < 108; iterator++) {
+    requests[iterator].userId = 40;
+    requests[iterator].guessDigits = 6;
+    requests[iterator].windows = 3;
+  }
+  requests[0].guess = 755224;
+  requests[1].guess = 287082;
+  /* counter 0 again, after the batch already moved past it */
+  requests[2].guess = 755224;
+  requests[3].userId = 999999;
+  requests[4].userId = 41;
+  requests[4].time = 3000;
+  requests[4].windowLength = 30;
+  requests[4].guess = totp_ctx(&store_reference_key, 3000, 30) % 1000000;
+  requests[5].windows = 0;
+  requests[6].guess = 123456;
+  /* too wide for one chunk, done on its own */
+  requests[7].userId = 42;
+  requests[7].windows = 300;
+  requests[7].guess = hotp_ctx(&store_reference_key, 250) % 1000000;
+  /* enough windows to need several chunks */
+  for (iterator = 8; iterator < 108; iterator++) {
+    requests[iterator].userId = 92 + iterator;
+    requests[iterator].guess = hotp_ctx(&store_reference_key,
+                                        93 + iterator) % 1000000;
+  }
+
+  otp_store_validate_many(test_store, requests, results, 108);
+
+  CU_ASSERT_EQUAL(results[0], OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(results[1], OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(results[2], OTP_STORE_REPLAY);
+  CU_ASSERT_EQUAL(results[3], OTP_STORE_UNKNOWN_USER);
+  CU_ASSERT_EQUAL(results[4], OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(results[5], OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(results[6], OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(results[7], OTP_STORE_SUCCESS);
+  for (iterator = 8; iterator < 108; iterator++) {
+    CU_ASSERT_EQUAL(results[iterator], OTP_STORE_SUCCESS);
+  }
+
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 40, &step, NULL),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 2);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 41, &step, NULL),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 100);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 42, &step, NULL),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 251);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 199, &step, NULL),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(step, 201);
+
+  /* and none of it is accepted twice */
+  otp_store_validate_many(test_store, requests, results, 108);
+  for (iterator = 0; iterator < 108; iterator++) {
+    CU_ASSERT_NOT_EQUAL(results[iterator], OTP_STORE_SUCCESS);
+  }
+}
+
+static uint64_t store_hashes(void) {
+  otp_metrics_snapshot snapshot;
+
+  otp_metrics_read(&snapshot);
+  return snapshot.counters[OTP_METRIC_HASHES];
+}
+
+static OTP_STORE_RESULT store_totp_step(uint64_t userId, time_t time,
+                                        uint64_t step, unsigned int windows,
+                                        uint64_t *hashes) {
+  uint32_t code = hotp_ctx(&store_reference_key, step) % 1000000;
+  uint64_t before = store_hashes();
+  OTP_STORE_RESULT result = totp_store_validate(test_store, userId, time, 30,
+                                                code, 6, windows);
+
+  *hashes = store_hashes() - before;
+  return result;
+}
+
+/* codes on the predicted step cost one hash, and a device that keeps
+ * hitting it is searched a step either side before the rest */
+void store_totp_adaptive_test(void) {
+  uint64_t hashes = 0;
+  int64_t drift = 0;
+  int metrics = otp_metrics_enabled();
+  uint64_t step;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 50, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+
+  for (step = 100; step < 105; step++) {
+    CU_ASSERT_EQUAL(store_totp_step(50, step * 30, step, 5, &hashes),
+                    OTP_STORE_SUCCESS);
+    CU_ASSERT(!metrics || hashes == 1);
+  }
+
+  /* one step out is found in the narrow window */
+  CU_ASSERT_EQUAL(store_totp_step(50, 105 * 30, 106, 5, &hashes),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT(!metrics || hashes == 3);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 50, NULL, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(drift, 1);
+
+  /* having just drifted it goes straight to the full window */
+  CU_ASSERT_EQUAL(store_totp_step(50, 106 * 30, 109, 5, &hashes),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT(!metrics || hashes == 5);
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 50, NULL, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(drift, 3);
+}
+
+/* a stable device whose clock jumps past the narrow window is still found
+ * in the rest of its window, and followed from there */
+void store_totp_drift_test(void) {
+  uint64_t hashes = 0;
+  int64_t drift = 0;
+  int metrics = otp_metrics_enabled();
+  uint64_t step;
+
+  CU_ASSERT_EQUAL(otp_store_add(test_store, 51, &store_reference_key, 0),
+                  OTP_STORE_SUCCESS);
+
+  for (step = 200; step < 205; step++) {
+    CU_ASSERT_EQUAL(store_totp_step(51, step * 30, step, 9, &hashes),
+                    OTP_STORE_SUCCESS);
+  }
+
+  CU_ASSERT_EQUAL(store_totp_step(51, 205 * 30, 207, 9, &hashes),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT(!metrics || hashes == 9);
+
+  for (step = 206; step < 215; step++) {
+    CU_ASSERT_EQUAL(store_totp_step(51, step * 30, step + 2, 9, &hashes),
+                    OTP_STORE_SUCCESS);
+    CU_ASSERT(!metrics || hashes == 1);
+  }
+  CU_ASSERT_EQUAL(otp_store_lookup(test_store, 51, NULL, &drift),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(drift, 2);
+
+  /* outside the whole window is refused after searching all of it */
+  CU_ASSERT_EQUAL(store_totp_step(51, 215 * 30, 223, 9, &hashes),
+                  OTP_STORE_FAILURE);
+  CU_ASSERT(!metrics || hashes == 9);
+}
+
+/* codes for a user added with settings must be made with them */
+void store_user_settings_test(void) {
+  unsigned int digits = 0;
+  unsigned int period = 0;
+  uint32_t code;
+
+  CU_ASSERT_EQUAL(otp_store_add_user(test_store, 60, &store_reference_key, 0,
+                                     11, 0), OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(otp_store_add_user(test_store, 60, &store_reference_key, 0,
+                                     0, 30), OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(otp_store_add_user(test_store, 60, &store_reference_key, 0,
+                                     6, 0), OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_add_user(test_store, 61, &store_reference_key, 0,
+                                     6, 30), OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(otp_store_settings(test_store, 61, &digits, &period),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(digits, 6);
+  CU_ASSERT_EQUAL(period, 30);
+  CU_ASSERT_EQUAL(otp_store_settings(test_store, 1, &digits, &period),
+                  OTP_STORE_SUCCESS);
+  CU_ASSERT_EQUAL(digits, 0);
+  CU_ASSERT_EQUAL(otp_store_settings(test_store, 62, &digits, &period),
+                  OTP_STORE_UNKNOWN_USER);
+
+  CU_ASSERT_EQUAL(hotp_store_validate(test_store, 60, 755224 % 100, 2, 3),
+                  OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 60, 59, 30, 287082, 6, 3),
+                  OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(hotp_store_validate(test_store, 60, 755224, 6, 3),
+                  OTP_STORE_SUCCESS);
+
+  code = totp_ctx(&store_reference_key, 3000, 30) % 1000000;
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 61, 6000, 60, code, 6, 3),
+                  OTP_STORE_FAILURE);
+  CU_ASSERT_EQUAL(totp_store_validate(test_store, 61, 3000, 30, code, 6, 3),
+                  OTP_STORE_SUCCESS);
+}
+
+#endif /* STORE_TEST_ */
@@ -39,6 +39,9 @@
 int init_totp_suite(void);
 int clean_totp_suite(void);
 void totp_testvec1(void);
+void totp_ctx_testvec1(void);
+void totp_validate_batch_test(void);
+void totp_rfc6238_test(void);
 
 /* global variable containing the TOTP secret */
 char totp_reference_secret[] = "12345678901234567890";
@@ -56,7 +59,10 @@ CU_ErrorCode addTOTPTestSuite( CU_pSuite pSuite )
   }
 
   /* add the HMAC-SHA1 tests to the suite */
-  if ( CUE_SUCCESS == CU_add_test(pSuite, "totp Test Vector 1", totp_testvec1) ) {
+  if (   (CUE_SUCCESS == CU_add_test(pSuite, "totp Test Vector 1", totp_testvec1))
+      || (CUE_SUCCESS == CU_add_test(pSuite, "totp_ctx Test Vector 1", totp_ctx_testvec1))
+      || (CUE_SUCCESS == CU_add_test(pSuite, "totp_validate_batch", totp_validate_batch_test))
+      || (CUE_SUCCESS == CU_add_test(pSuite, "RFC 6238 SHA1/SHA256/SHA512", totp_rfc6238_test)) ) {
     return CU_get_error();
   }
 
@@ -124,5 +130,123 @@ void totp_testvec1(void)
   }
 }
 
+void totp_ctx_testvec1(void)
+{
+  otp_key key;
+  time_t iterator;
+  unsigned int windowLength = 30;
+
+  otp_key_init(&key, (uint8_t *) totp_reference_secret,
+               strlen(totp_reference_secret));
+
+  for (iterator = 0; iterator < sizeof(totp_reference_results)/sizeof(uint32_t); iterator++) {
+    /* every second of the window maps to the same counter */
+    CU_ASSERT_EQUAL(totp_ctx(&key, iterator * windowLength, windowLength),
+                    totp_reference_results[iterator]);
+    CU_ASSERT_EQUAL(totp_ctx(&key, iterator * windowLength + windowLength - 1,
+                             windowLength),
+                    totp_reference_results[iterator]);
+    CU_ASSERT_EQUAL(totp_validate_ctx(&key, iterator * windowLength,
+                                      windowLength,
+                                      totp_reference_results[iterator] % 1000000,
+                                      6),
+                    OTP_VALIDATE_SUCCESS);
+  }
+
+  otp_key_clear(&key);
+}
+
+/* the 8 digit test vectors of RFC 6238 appendix B, one seed per algorithm */
+void totp_rfc6238_test(void)
+{
+  static const char *seeds[] = {
+    "12345678901234567890",
+    "12345678901234567890123456789012",
+    "1234567890123456789012345678901234567890123456789012345678901234"
+  };
+  static const OTP_ALGORITHM algorithms[] = { OTP_SHA1, OTP_SHA256, OTP_SHA512 };
+  static const time_t times[] = {
+    59, 1111111109, 1111111111, 1234567890, 2000000000, 20000000000LL
+  };
+  static const uint32_t expect[][6] = {
+    { 94287082, 7081804, 14050471, 89005924, 69279037, 65353130 },
+    { 46119246, 68084774, 67062674, 91819424, 90698825, 77737706 },
+    { 90693936, 25091201, 99943326, 93441116, 38618901, 47863826 }
+  };
+  otp_key key;
+  int64_t offset;
+  size_t algorithm;
+  size_t iterator;
+
+  for (algorithm = 0; algorithm < 3; algorithm++) {
+    CU_ASSERT_EQUAL(otp_key_init_algorithm(&key, algorithms[algorithm],
+                                           (uint8_t *)seeds[algorithm],
+                                           strlen(seeds[algorithm])), 0);
+
+    for (iterator = 0; iterator < sizeof(times)/sizeof(times[0]); iterator++) {
+      CU_ASSERT_EQUAL(otp_truncate_digits(totp_ctx(&key, times[iterator], 30), 8),
+                      expect[algorithm][iterator]);
+      CU_ASSERT_EQUAL(totp_find_window_ctx(&key, times[iterator] + 60, 30,
+                                           expect[algorithm][iterator], 8, 5,
+                                           &offset),
+                      OTP_VALIDATE_SUCCESS);
+      CU_ASSERT_EQUAL(offset, -2);
+    }
+
+    otp_key_clear(&key);
+  }
+
+  CU_ASSERT_EQUAL(otp_key_init_algorithm(&key, (OTP_ALGORITHM)3,
+                                         (uint8_t *)seeds[0],
+                                         strlen(seeds[0])), -1);
+}
+
+/* 20 requests alternating between two packed secrets, every third one wrong */
+void totp_validate_batch_test(void)
+{
+  uint8_t secrets[40 * 20];
+  size_t secretOffsets[21];
+  time_t times[20];
+  uint32_t guesses[20];
+  uint8_t guessDigits[20];
+  OTP_VALIDATE_RESULT results[20];
+  totp_batch batch;
+  otp_key key;
+  size_t length;
+  size_t iterator;
+
+  secretOffsets[0] = 0;
+  for (iterator = 0; iterator < 20; iterator++) {
+    length = iterator & 1 ? 4 : strlen(totp_reference_secret);
+    memcpy(secrets + secretOffsets[iterator],
+           iterator & 1 ? "Jefe" : totp_reference_secret, length);
+    secretOffsets[iterator + 1] = secretOffsets[iterator] + length;
+
+    otp_key_init(&key, secrets + secretOffsets[iterator], length);
+    times[iterator] = 59 + 1000 * iterator;
+    guessDigits[iterator] = 6 + iterator % 3;
+    guesses[iterator] = totp_ctx(&key, times[iterator], 30);
+    guesses[iterator] %= guessDigits[iterator] == 6 ? 1000000
+                       : guessDigits[iterator] == 7 ? 10000000 : 100000000;
+    if (iterator % 3 == 0) {
+      guesses[iterator] ^= 1;
+    }
+    otp_key_clear(&key);
+  }
+
+  batch.secrets = secrets;
+  batch.secretOffsets = secretOffsets;
+  batch.times = times;
+  batch.guesses = guesses;
+  batch.guessDigits = guessDigits;
+  batch.count = 20;
+  totp_validate_batch(&batch, 30, results);
+
+  for (iterator = 0; iterator < 20; iterator++) {
+    CU_ASSERT_EQUAL(results[iterator], iterator % 3 == 0 ? OTP_VALIDATE_FAILURE
+                                                         : OTP_VALIDATE_SUCCESS);
+  }
+}
+
 #endif /* TOTP_TEST_ */
 
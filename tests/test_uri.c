@@ -0,0 +1,252 @@
+/*
+ * Author: Philip Woolford
+ *
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef URI_TEST_
+#define URI_TEST_
+
+/* local includes */
+#include "../otp_uri.h"
+
+/* external includes */
+#include <CUnit/Basic.h>
+#include <CUnit/CUError.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* uri test function definitions */
+int init_uri_suite(void);
+int clean_uri_suite(void);
+void base32_testvecs(void);
+void base32_long_test(void);
+void base32_reject_test(void);
+void uri_parse_test(void);
+void uri_reject_test(void);
+
+CU_ErrorCode addURITestSuite( CU_pSuite pSuite )
+{
+  pSuite = CU_add_suite("Base32 and otpauth URIs", init_uri_suite,
+                        clean_uri_suite);
+  if (pSuite == NULL) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  if (   (NULL == CU_add_test(pSuite, "Base32 vectors (RFC 4648)", base32_testvecs))
+      || (NULL == CU_add_test(pSuite, "Base32 long input", base32_long_test))
+      || (NULL == CU_add_test(pSuite, "Base32 rejects", base32_reject_test))
+      || (NULL == CU_add_test(pSuite, "otpauth parse", uri_parse_test))
+      || (NULL == CU_add_test(pSuite, "otpauth rejects", uri_reject_test)) ) {
+    return CU_get_error();
+  }
+
+  return CUE_SUCCESS;
+}
+
+/* The suite boilerplate functions */
+int init_uri_suite(void) {
+  return CUE_SUCCESS;
+}
+
+int clean_uri_suite(void) {
+  return CUE_SUCCESS;
+}
+
+static int base32_decode_string(uint8_t *out, size_t *outLength,
+                                const char *text, OTP_BASE32_ALPHABET alphabet) {
+  return otp_base32_decode(out, outLength, text, strlen(text), alphabet);
+}
+
+/* RFC 4648 section 10, padded, unpadded and in lower case */
+void base32_testvecs(void) {
+  static const char *plain[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+  static const char *encoded[2][7] = {
+    { "", "MY======", "MZXQ====", "MZXW6===", "MZXW6YQ=", "MZXW6YTB",
+      "MZXW6YTBOI======" },
+    { "", "CO======", "CPNG====", "CPNMU===", "CPNMUOG=", "CPNMUOJ1",
+      "CPNMUOJ1E8======" }
+  };
+  char text[32];
+  uint8_t out[16];
+  size_t outLength;
+  size_t iterator;
+  size_t offset;
+  size_t length;
+  int alphabet;
+
+  for (alphabet = 0; alphabet < 2; alphabet++) {
+    for (iterator = 0; iterator < 7; iterator++) {
+      outLength = sizeof(out);
+      CU_ASSERT_EQUAL(base32_decode_string(out, &outLength,
+                                           encoded[alphabet][iterator],
+                                           (OTP_BASE32_ALPHABET)alphabet), 0);
+      CU_ASSERT_EQUAL(outLength, strlen(plain[iterator]));
+      CU_ASSERT(memcmp(out, plain[iterator], outLength) == 0);
+
+      /* without padding and in lower case */
+      strcpy(text, encoded[alphabet][iterator]);
+      length = strcspn(text, "=");
+      for (offset = 0; offset < length; offset++) {
+        if (text[offset] >= 'A' && text[offset] <= 'Z') {
+          text[offset] += 'a' - 'A';
+        }
+      }
+      outLength = sizeof(out);
+      CU_ASSERT_EQUAL(otp_base32_decode(out, &outLength, text, length,
+                                        (OTP_BASE32_ALPHABET)alphabet), 0);
+      CU_ASSERT_EQUAL(outLength, strlen(plain[iterator]));
+      CU_ASSERT(memcmp(out, plain[iterator], outLength) == 0);
+    }
+  }
+}
+
+/* round trip random bytes long enough for the block decoder */
+void base32_long_test(void) {
+  static const char *alphabets[2] = {
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567", "0123456789ABCDEFGHIJKLMNOPQRSTUV"
+  };
+  uint8_t plain[200];
+  uint8_t out[200];
+  char text[328];
+  size_t outLength;
+  size_t length;
+  size_t chars;
+  size_t bit;
+  size_t iterator;
+  unsigned int value;
+  int alphabet;
+
+  srand(16);
+  for (iterator = 0; iterator < sizeof(plain); iterator++) {
+    plain[iterator] = (uint8_t)rand();
+  }
+
+  for (alphabet = 0; alphabet < 2; alphabet++) {
+    for (length = 0; length <= sizeof(plain); length += 7) {
+      /* encode without padding */
+      chars = (length * 8 + 4) / 5;
+      for (iterator = 0; iterator < chars; iterator++) {
+        value = 0;
+        for (bit = 5 * iterator; bit < 5 * iterator + 5; bit++) {
+          value = value << 1 | (bit < 8 * length
+                                ? (plain[bit / 8] >> (7 - bit % 8)) & 1 : 0);
+        }
+        text[iterator] = alphabets[alphabet][value];
+      }
+
+      outLength = sizeof(out);
+      CU_ASSERT_EQUAL(otp_base32_decode(out, &outLength, text, chars,
+                                        (OTP_BASE32_ALPHABET)alphabet), 0);
+      CU_ASSERT_EQUAL(outLength, length);
+      CU_ASSERT(memcmp(out, plain, length) == 0);
+    }
+  }
+}
+
+void base32_reject_test(void) {
+  char text[33] = "MZXW6YTBMZXW6YTBMZXW6YTBMZXW6YTB";
+  uint8_t out[32];
+  size_t outLength;
+  size_t position;
+
+  /* a bad character anywhere, inside and after the first block */
+  for (position = 0; position < 32; position++) {
+    text[position] = '1';
+    outLength = sizeof(out);
+    CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, text, OTP_BASE32), -1);
+    text[position] = '\xc1';
+    outLength = sizeof(out);
+    CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, text, OTP_BASE32), -1);
+    text[position] = 'M';
+  }
+
+  outLength = sizeof(out);
+  CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, "MZX", OTP_BASE32), -1);
+  outLength = sizeof(out);
+  CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, "MZ=XW6YQ", OTP_BASE32), -1);
+  outLength = sizeof(out);
+  CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, "W", OTP_BASE32_HEX), -1);
+
+  /* not enough room */
+  outLength = 4;
+  CU_ASSERT_EQUAL(base32_decode_string(out, &outLength, "MZXW6YTB", OTP_BASE32), -1);
+}
+
+/* the RFC 6238 SHA256 seed, 12345678901234567890123456789012 */
+void uri_parse_test(void) {
+  const char *text = "otpauth://totp/ACME%20Co:john@example.com?"
+                     "secret=GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA%3D%3D%3D%3D"
+                     "&issuer=ACME%20Co&algorithm=SHA256&digits=8&period=30&image=x";
+  const char *hotpText = "otpauth://hotp/label?counter=9&secret=gezdgnbvgy3tqojqgezdgnbvgy3tqojq";
+  otp_uri uri;
+  otp_key key;
+
+  CU_ASSERT_EQUAL(otp_uri_parse(&uri, &key, text, strlen(text)), 0);
+  CU_ASSERT_EQUAL(uri.type, OTP_TIME);
+  CU_ASSERT_EQUAL(uri.algorithm, OTP_SHA256);
+  CU_ASSERT_EQUAL(uri.digits, 8);
+  CU_ASSERT_EQUAL(uri.period, 30);
+  CU_ASSERT_EQUAL(uri.labelLength, strlen("ACME%20Co:john@example.com"));
+  CU_ASSERT(strncmp(uri.label, "ACME%20Co:john@example.com", uri.labelLength) == 0);
+  CU_ASSERT_EQUAL(uri.issuerLength, strlen("ACME%20Co"));
+  CU_ASSERT(strncmp(uri.issuer, "ACME%20Co", uri.issuerLength) == 0);
+  CU_ASSERT_EQUAL(otp_truncate_digits(totp_ctx(&key, 59, uri.period), uri.digits),
+                  46119246);
+  otp_key_clear(&key);
+
+  /* defaults, and the RFC 4226 value for counter 9 */
+  CU_ASSERT_EQUAL(otp_uri_parse(&uri, &key, hotpText, strlen(hotpText)), 0);
+  CU_ASSERT_EQUAL(uri.type, OTP_HASH);
+  CU_ASSERT_EQUAL(uri.algorithm, OTP_SHA1);
+  CU_ASSERT_EQUAL(uri.digits, 6);
+  CU_ASSERT_EQUAL(uri.counter, 9);
+  CU_ASSERT_PTR_NULL(uri.issuer);
+  CU_ASSERT_EQUAL(otp_truncate_digits(hotp_ctx(&key, uri.counter), 6), 520489);
+  otp_key_clear(&key);
+}
+
+void uri_reject_test(void) {
+  static const char *texts[] = {
+    "otpauth://totp/label",
+    "otpauth://totp/label?secret=",
+    "otpauth://totp/label?secret=GEZ1",
+    "otpauth://xotp/label?secret=GEZDGNBV",
+    "otpauth:/totp/label?secret=GEZDGNBV",
+    "otpauth://totp?secret=GEZDGNBV",
+    "otpauth://totp/label?secret=GEZDGNBV&algorithm=MD5",
+    "otpauth://totp/label?secret=GEZDGNBV&digits=11",
+    "otpauth://totp/label?secret=GEZDGNBV&digits=six",
+    "otpauth://totp/label?secret=GEZDGNBV&period=0",
+    "otpauth://hotp/label?secret=GEZDGNBV&counter=18446744073709551616",
+    "otpauth://totp/label?secret=GEZDGNBV%3"
+  };
+  otp_uri uri;
+  otp_key key;
+  size_t iterator;
+
+  for (iterator = 0; iterator < sizeof(texts)/sizeof(texts[0]); iterator++) {
+    CU_ASSERT_EQUAL(otp_uri_parse(&uri, &key, texts[iterator],
+                                  strlen(texts[iterator])), -1);
+  }
+}
+
+#endif /* URI_TEST_ */